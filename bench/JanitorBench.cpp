@@ -0,0 +1,545 @@
+// janitor_bench: reproducible benchmarks for the janitor's hot paths. Every fixture is generated from a fixed
+// seed inside a scratch folder, and the results are written as JSON so runs can be compared across releases.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "ConfigParser.hpp"
+#include "FileMover.hpp"
+#include "Logger.hpp"
+#include "PlatformFs.hpp"
+#include "RuleCache.hpp"
+
+using json = nlohmann::ordered_json;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr std::uint32_t kSeed = 20240917;
+// Micro-benchmarks repeat their measurement and report the median.
+constexpr int kRepetitions = 5;
+// Names cycled through by the per-call benchmarks.
+constexpr std::size_t kNamePoolSize = 4096;
+constexpr std::size_t kResolveOpsPerRun = 1000000;
+constexpr std::size_t kNormalizeOpsPerRun = 2000000;
+// Moves timed per collision chain depth.
+constexpr std::size_t kCollisionMoves = 200;
+
+struct Options {
+    std::filesystem::path output = "janitor_bench.json";
+    std::filesystem::path workDir;
+    std::filesystem::path crossDeviceDir;
+    std::vector<std::size_t> folderSizes{1000, 100000, 1000000};
+    std::vector<double> hitRatios{0.9, 0.5};
+    std::vector<std::size_t> collisionDepths{10, 1000, 10000};
+    std::vector<std::size_t> configRuleCounts{10, 100, 1000};
+    std::size_t copyFiles = 8;
+    std::size_t copyFileMiB = 32;
+    std::vector<std::string> only;
+    bool keep = false;
+};
+
+// Keep the janitor's per-file info lines out of the timings; warnings and errors still show.
+class QuietLog {
+public:
+    QuietLog() { Logger::setLevel(Logger::Level::Warning); }
+    ~QuietLog() { Logger::setLevel(Logger::Level::Info); }
+
+    QuietLog(const QuietLog&) = delete;
+    QuietLog& operator=(const QuietLog&) = delete;
+};
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values.empty() ? 0.0 : values[values.size() / 2];
+}
+
+bool writeFile(const std::filesystem::path& path, std::string_view contents) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+    return static_cast<bool>(out);
+}
+
+// A rule set shaped like a typical Downloads configuration: extension rules, multi-part suffixes, a glob and a regex.
+std::vector<Rule> benchRules(const std::filesystem::path& sortedRoot) {
+    auto rule = [&sortedRoot](std::vector<std::string> extensions, std::vector<std::string> patterns, std::vector<std::string> regexes,
+                              const char* folder) {
+        Rule result;
+        result.extensions = std::move(extensions);
+        result.patterns = std::move(patterns);
+        result.nameRegexes = std::move(regexes);
+        result.destination = (sortedRoot / folder).string();
+        return result;
+    };
+
+    return {
+        rule({}, {}, {"invoice-\\d{4}-\\d+\\.pdf"}, "Invoices"),
+        rule({}, {"Screenshot*"}, {}, "Screenshots"),
+        rule({".jpg", ".jpeg", ".png", ".gif", ".webp"}, {}, {}, "Images"),
+        rule({".pdf", ".docx", ".txt", ".md"}, {}, {}, "Documents"),
+        rule({".zip", ".7z", ".rar", ".tar.gz", ".tar.xz"}, {}, {}, "Archives"),
+        rule({".mp3", ".flac", ".wav"}, {}, {}, "Audio"),
+        rule({".mp4", ".mkv", ".mov"}, {}, {}, "Videos"),
+        rule({".exe", ".msi", ".deb"}, {}, {}, "Installers"),
+    };
+}
+
+// Deterministic file names where roughly hitRatio of them match benchRules().
+std::vector<std::string> makeNames(std::size_t count, double hitRatio, std::uint32_t seed) {
+    static const char* const kHits[] = {".jpg", ".PNG", ".pdf", ".txt", ".zip", ".tar.gz", ".mp3", ".mkv", ".exe", ".docx"};
+    static const char* const kMisses[] = {".dat", ".bin", ".csv", ".log", ".json", ".xyz", ".tar.bz2", ""};
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+
+    std::vector<std::string> names;
+    names.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        const std::string index = std::to_string(i);
+        if (coin(generator) >= hitRatio) {
+            names.push_back("file-" + index + kMisses[generator() % std::size(kMisses)]);
+            continue;
+        }
+        switch (generator() % 12) {
+        case 0:
+            names.push_back("Screenshot " + index + ".png");
+            break;
+        case 1:
+            names.push_back("invoice-2024-" + index + ".pdf");
+            break;
+        default:
+            names.push_back("download-" + index + kHits[generator() % std::size(kHits)]);
+            break;
+        }
+    }
+    return names;
+}
+
+std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream stream(text);
+    for (std::string item; std::getline(stream, item, ',');) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+class Bench {
+public:
+    explicit Bench(Options options) : m_options(std::move(options)) {}
+
+    bool enabled(const std::string& name) const {
+        return m_options.only.empty() || std::find(m_options.only.begin(), m_options.only.end(), name) != m_options.only.end();
+    }
+
+    void record(const std::string& name, json params, json metrics) {
+        std::cerr << name << ' ' << params.dump() << " -> " << metrics.dump() << std::endl;
+        m_results.push_back({{"name", name}, {"params", std::move(params)}, {"metrics", std::move(metrics)}});
+    }
+
+    // Fresh empty scratch folder for one benchmark.
+    std::filesystem::path scratch(const std::string& name) {
+        const auto path = m_options.workDir / name;
+        std::error_code ec;
+        std::filesystem::remove_all(path, ec);
+        std::filesystem::create_directories(path, ec);
+        return path;
+    }
+
+    void discard(const std::filesystem::path& path) {
+        std::error_code ec;
+        std::filesystem::remove_all(path, ec);
+    }
+
+    void organizeOnce() {
+        for (std::size_t count : m_options.folderSizes) {
+            for (double hitRatio : m_options.hitRatios) {
+                const auto root = scratch("organize");
+                const auto watch = root / "watch";
+                std::filesystem::create_directories(watch);
+                const auto names = makeNames(count, hitRatio, kSeed);
+                for (const auto& name : names) {
+                    writeFile(watch / name, "x");
+                }
+
+                FileMover mover({WatchFolder{watch, false, benchRules(root / "sorted")}});
+                double seconds = 0;
+                {
+                    QuietLog quiet;
+                    const auto start = Clock::now();
+                    mover.organizeOnce();
+                    seconds = secondsSince(start);
+                }
+
+                // Files without a matching rule are left behind.
+                std::size_t leftInPlace = 0;
+                std::error_code ec;
+                for (std::filesystem::directory_iterator it(watch, ec), end; !ec && it != end; it.increment(ec)) {
+                    ++leftInPlace;
+                }
+
+                record("organize_once", {{"files", count}, {"hit_ratio", hitRatio}},
+                       {{"seconds", seconds},
+                        {"files_moved", count - leftInPlace},
+                        {"files_per_second", seconds > 0 ? static_cast<double>(count) / seconds : 0.0},
+                        {"ns_per_file", seconds * 1e9 / static_cast<double>(count)}});
+                discard(root);
+            }
+        }
+    }
+
+    void resolveDestination() {
+        const auto root = scratch("resolve");
+        const auto watch = root / "watch";
+        FileMover mover({WatchFolder{watch, false, benchRules(root / "sorted")}});
+        const auto names = makeNames(kNamePoolSize, 0.75, kSeed + 1);
+        std::vector<std::filesystem::path> paths;
+        for (const auto& name : names) {
+            paths.push_back(watch / name);
+        }
+
+        std::vector<double> runs;
+        std::size_t matched = 0;
+        for (int run = 0; run < kRepetitions; ++run) {
+            matched = 0;
+            const auto start = Clock::now();
+            for (std::size_t i = 0; i < kResolveOpsPerRun; ++i) {
+                matched += mover.destinationFor(paths[i % paths.size()]) != nullptr;
+            }
+            runs.push_back(secondsSince(start) * 1e9 / kResolveOpsPerRun);
+        }
+        record("resolve_destination", {{"names", paths.size()}, {"ops", kResolveOpsPerRun}, {"repetitions", kRepetitions}},
+               {{"ns_per_op", median(runs)}, {"match_ratio", static_cast<double>(matched) / kResolveOpsPerRun}});
+        discard(root);
+    }
+
+    void normalizeExtension() {
+        const std::vector<std::string> inputs{".pdf", "PDF", " .Tar.GZ ", "jpeg", ".MKV", "docx", " .7z", ".webp"};
+        std::vector<double> runs;
+        std::size_t sink = 0;
+        for (int run = 0; run < kRepetitions; ++run) {
+            const auto start = Clock::now();
+            for (std::size_t i = 0; i < kNormalizeOpsPerRun; ++i) {
+                sink += FileMover::normalizeExtension(inputs[i % inputs.size()]).size();
+            }
+            runs.push_back(secondsSince(start) * 1e9 / kNormalizeOpsPerRun);
+        }
+        record("normalize_extension", {{"ops", kNormalizeOpsPerRun}, {"repetitions", kRepetitions}},
+               {{"ns_per_op", median(runs)}, {"checksum", sink}});
+    }
+
+    void collisions() {
+        for (std::size_t depth : m_options.collisionDepths) {
+            const auto root = scratch("collisions");
+            const auto watch = root / "watch";
+            const auto documents = root / "sorted" / "Documents";
+            std::filesystem::create_directories(watch);
+            std::filesystem::create_directories(documents);
+
+            // report.pdf, report_1.pdf ... report_(depth-1).pdf are already taken.
+            writeFile(documents / "report.pdf", "x");
+            for (std::size_t i = 1; i < depth; ++i) {
+                writeFile(documents / ("report_" + std::to_string(i) + ".pdf"), "x");
+            }
+
+            FileMover mover({WatchFolder{watch, false, benchRules(root / "sorted")}});
+            const auto source = watch / "report.pdf";
+            std::vector<double> moves;
+            {
+                QuietLog quiet;
+                for (std::size_t i = 0; i < kCollisionMoves; ++i) {
+                    writeFile(source, "x");
+                    const auto start = Clock::now();
+                    mover.organizePaths({source});
+                    moves.push_back(secondsSince(start) * 1e6);
+                }
+            }
+
+            // The first move loads the directory into the name index; the rest should not depend on the depth.
+            const double first = moves.front();
+            moves.erase(moves.begin());
+            record("collision_chain", {{"existing_names", depth}, {"moves", kCollisionMoves}},
+                   {{"first_move_us", first}, {"median_move_us", median(moves)}});
+            discard(root);
+        }
+    }
+
+    void crossDevice() {
+        json params{{"files", m_options.copyFiles}, {"file_mib", m_options.copyFileMiB}};
+        auto crossDir = m_options.crossDeviceDir;
+#ifdef __linux__
+        if (crossDir.empty()) {
+            crossDir = "/dev/shm";
+        }
+#endif
+        if (crossDir.empty()) {
+            record("cross_device_copy", std::move(params), {{"skipped", "pass --cross-device-dir on another volume"}});
+            return;
+        }
+
+        const auto root = scratch("cross-device");
+        const auto remoteVolume = platform::volumeId(crossDir);
+        if (!remoteVolume || remoteVolume == platform::volumeId(root)) {
+            record("cross_device_copy", std::move(params), {{"skipped", "`" + crossDir.string() + "` is on the same volume as the work dir"}});
+            discard(root);
+            return;
+        }
+        params["target"] = crossDir.string();
+
+        const auto watch = root / "watch";
+        const auto remote = crossDir / ("janitor_bench-" + std::to_string(kSeed));
+        std::filesystem::create_directories(watch);
+
+        // Incompressible contents so no layer can shortcut the copy.
+        std::mt19937_64 generator(kSeed);
+        std::string contents(m_options.copyFileMiB * 1024 * 1024, '\0');
+        for (std::size_t i = 0; i + sizeof(std::uint64_t) <= contents.size(); i += sizeof(std::uint64_t)) {
+            const std::uint64_t word = generator();
+            std::memcpy(contents.data() + i, &word, sizeof(word));
+        }
+        for (std::size_t i = 0; i < m_options.copyFiles; ++i) {
+            writeFile(watch / ("disk-" + std::to_string(i) + ".iso"), contents);
+        }
+
+        Rule rule;
+        rule.extensions = {".iso"};
+        rule.destination = (remote / "Isos").string();
+        FileMover mover({WatchFolder{watch, false, {rule}}});
+        double seconds = 0;
+        bool succeeded = false;
+        {
+            QuietLog quiet;
+            const auto start = Clock::now();
+            succeeded = mover.organizeOnce();
+            seconds = secondsSince(start);
+        }
+
+        const double mebibytes = static_cast<double>(m_options.copyFiles * m_options.copyFileMiB);
+        record("cross_device_copy", std::move(params),
+               {{"succeeded", succeeded}, {"seconds", seconds}, {"mib_per_second", seconds > 0 ? mebibytes / seconds : 0.0}});
+        discard(remote);
+        discard(root);
+    }
+
+    void configLoad() {
+        for (std::size_t ruleCount : m_options.configRuleCounts) {
+            const auto root = scratch("config");
+            std::filesystem::create_directories(root / "config");
+            std::filesystem::create_directories(root / "watch");
+
+            json rules = json::array();
+            for (std::size_t i = 0; i < ruleCount; ++i) {
+                const std::string id = std::to_string(i);
+                rules.push_back({{"extensions", json::array({".e" + id})},
+                                 {"patterns", json::array({"p" + id + "_*"})},
+                                 {"name_regex", json::array({"r" + id + "\\d+"})},
+                                 {"destination", "{{base}}/D" + std::to_string(i % 20)}});
+            }
+            const json config{{"watch_folder", (root / "watch").string()},
+                              {"placeholders", {{"base", (root / "sorted").string()}}},
+                              {"use_default_rules", false},
+                              {"custom_rules", std::move(rules)}};
+            const auto rulesPath = ConfigParser::rulesPathFor(root.string());
+            writeFile(rulesPath, config.dump(2));
+
+            // Load the configuration and compile it into a mover, as startup does.
+            auto startOnce = [&root](bool storeCache) {
+                QuietLog quiet;
+                const auto start = Clock::now();
+                ConfigParser parser;
+                parser.load(root.string());
+                FileMover mover(parser.getWatchFolders(), 1, parser.compiledRules());
+                const double seconds = secondsSince(start);
+                if (storeCache) {
+                    parser.storeCache(mover.serializeRules());
+                }
+                return seconds;
+            };
+
+            std::vector<double> cold;
+            std::vector<double> warm;
+            for (int run = 0; run < kRepetitions; ++run) {
+                std::error_code ec;
+                std::filesystem::remove(RuleCache::pathFor(rulesPath), ec);
+                cold.push_back(startOnce(run + 1 == kRepetitions) * 1e3);
+            }
+            for (int run = 0; run < kRepetitions; ++run) {
+                warm.push_back(startOnce(false) * 1e3);
+            }
+
+            std::error_code ec;
+            record("config_load", {{"rules", ruleCount}, {"rules_json_bytes", std::filesystem::file_size(rulesPath, ec)}},
+                   {{"cold_ms", median(cold)}, {"cached_ms", median(warm)}});
+            discard(root);
+        }
+    }
+
+    bool writeResults() const {
+        const std::time_t now = std::time(nullptr);
+        std::tm utc{};
+#ifdef _WIN32
+        gmtime_s(&utc, &now);
+#else
+        gmtime_r(&now, &utc);
+#endif
+        std::ostringstream timestamp;
+        timestamp << std::put_time(&utc, "%Y-%m-%dT%H:%M:%SZ");
+
+        const json report{{"benchmark", "janitor_bench"},
+                          {"version", DOWNLOADS_JANITOR_VERSION},
+                          {"timestamp", timestamp.str()},
+                          {"seed", kSeed},
+                          {"hardware_threads", std::thread::hardware_concurrency()},
+                          {"results", m_results}};
+        std::ofstream out(m_options.output);
+        out << report.dump(2) << std::endl;
+        if (!out) {
+            std::cerr << "Failed to write results to `" << m_options.output.string() << "`." << std::endl;
+            return false;
+        }
+        std::cerr << "Results written to `" << m_options.output.string() << "`." << std::endl;
+        return true;
+    }
+
+private:
+    Options m_options;
+    json m_results = json::array();
+};
+
+void printUsage() {
+    std::cerr << "Usage: janitor_bench [options]\n"
+                 "  --output FILE             where to write the JSON results (default janitor_bench.json)\n"
+                 "  --work-dir DIR            scratch folder for fixtures (default: a new folder under the temp dir)\n"
+                 "  --cross-device-dir DIR    folder on another volume for the copy benchmark (Linux default /dev/shm)\n"
+                 "  --sizes N,N,...           folder sizes for organize_once (default 1000,100000,1000000)\n"
+                 "  --hit-ratios R,R,...      share of files that match a rule (default 0.9,0.5)\n"
+                 "  --collision-depths N,...  names already taken in the destination (default 10,1000,10000)\n"
+                 "  --config-rules N,...      rule counts for config_load (default 10,100,1000)\n"
+                 "  --copy-files N            files for cross_device_copy (default 8)\n"
+                 "  --copy-file-mib N         size of each of those files (default 32)\n"
+                 "  --only NAME,...           run only organize, resolve, normalize, collisions, cross_device, config\n"
+                 "  --keep                    leave the work dir in place\n";
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    auto sizes = [](const std::string& text, std::vector<std::size_t>& out) {
+        out.clear();
+        for (const auto& item : splitList(text)) {
+            out.push_back(static_cast<std::size_t>(std::stoull(item)));
+        }
+    };
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--keep") {
+                options.keep = true;
+                continue;
+            }
+            if (arg == "--help" || i + 1 >= argc) {
+                return false;
+            }
+
+            const std::string value = argv[++i];
+            if (arg == "--output") {
+                options.output = value;
+            } else if (arg == "--work-dir") {
+                options.workDir = value;
+            } else if (arg == "--cross-device-dir") {
+                options.crossDeviceDir = value;
+            } else if (arg == "--sizes") {
+                sizes(value, options.folderSizes);
+            } else if (arg == "--hit-ratios") {
+                options.hitRatios.clear();
+                for (const auto& item : splitList(value)) {
+                    options.hitRatios.push_back(std::clamp(std::stod(item), 0.0, 1.0));
+                }
+            } else if (arg == "--collision-depths") {
+                sizes(value, options.collisionDepths);
+            } else if (arg == "--config-rules") {
+                sizes(value, options.configRuleCounts);
+            } else if (arg == "--copy-files") {
+                options.copyFiles = static_cast<std::size_t>(std::stoull(value));
+            } else if (arg == "--copy-file-mib") {
+                options.copyFileMiB = static_cast<std::size_t>(std::stoull(value));
+            } else if (arg == "--only") {
+                options.only = splitList(value);
+            } else {
+                return false;
+            }
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    const bool ownWorkDir = options.workDir.empty();
+    if (ownWorkDir) {
+        options.workDir = std::filesystem::temp_directory_path() /
+                          ("janitor_bench-" + std::to_string(std::chrono::system_clock::now().time_since_epoch().count()));
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(options.workDir, ec);
+    if (ec) {
+        std::cerr << "Cannot create work dir `" << options.workDir.string() << "`: " << ec.message() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const bool keep = options.keep;
+    const auto workDir = options.workDir;
+    Bench bench(std::move(options));
+    const std::vector<std::pair<const char*, std::function<void()>>> suites{
+        {"normalize", [&bench]() { bench.normalizeExtension(); }},
+        {"resolve", [&bench]() { bench.resolveDestination(); }},
+        {"config", [&bench]() { bench.configLoad(); }},
+        {"collisions", [&bench]() { bench.collisions(); }},
+        {"cross_device", [&bench]() { bench.crossDevice(); }},
+        {"organize", [&bench]() { bench.organizeOnce(); }},
+    };
+    for (const auto& [name, run] : suites) {
+        if (bench.enabled(name)) {
+            run();
+        }
+    }
+
+    const bool written = bench.writeResults();
+    // Each benchmark clears up after itself; a work dir the caller named is left in place.
+    if (ownWorkDir && !keep) {
+        std::filesystem::remove_all(workDir, ec);
+    }
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,63 @@
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+// Blocking FIFO between two pipeline stages. A full queue stalls the producer, so a fast stage can't run
+// ahead of a slow one and buffer without limit.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(std::size_t capacity) : m_capacity(capacity) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // Blocks while the queue is full; returns false (dropping item) once the queue is closed.
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_spaceAvailable.wait(lock, [this]() { return m_closed || m_items.size() < m_capacity; });
+        if (m_closed) {
+            return false;
+        }
+        m_items.push_back(std::move(item));
+        m_itemAvailable.notify_one();
+        return true;
+    }
+
+    // Blocks while the queue is empty; nullopt once it is closed and everything pushed before has been popped.
+    std::optional<T> pop() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_itemAvailable.wait(lock, [this]() { return m_closed || !m_items.empty(); });
+        if (m_items.empty()) {
+            return std::nullopt;
+        }
+        T item = std::move(m_items.front());
+        m_items.pop_front();
+        m_spaceAvailable.notify_one();
+        return item;
+    }
+
+    // No more items: wakes every waiter, and pop() drains what is left.
+    void close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_itemAvailable.notify_all();
+        m_spaceAvailable.notify_all();
+    }
+
+private:
+    std::size_t m_capacity;
+    std::mutex m_mutex;
+    std::condition_variable m_itemAvailable;
+    std::condition_variable m_spaceAvailable;
+    std::deque<T> m_items;
+    bool m_closed = false;
+};
+
+#endif
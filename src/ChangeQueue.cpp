@@ -0,0 +1,68 @@
+#include "ChangeQueue.hpp"
+
+ChangeQueue::ChangeQueue(Clock::duration quietPeriod) : m_quietPeriod(quietPeriod) {}
+
+void ChangeQueue::touch(const std::filesystem::path& path, Clock::time_point now) {
+    const Clock::time_point deadline = now + m_quietPeriod;
+    // Repeated notifications for the same file only move its deadline; the old heap entry goes stale.
+    auto [it, inserted] = m_deadlines.try_emplace(path, Pending{deadline, now});
+    if (!inserted) {
+        it->second.deadline = deadline;
+    }
+    m_heap.emplace(deadline, path);
+}
+
+void ChangeQueue::forget(const std::filesystem::path& path) {
+    m_deadlines.erase(path);
+}
+
+std::vector<std::filesystem::path> ChangeQueue::takeReady(Clock::time_point now, std::vector<Clock::time_point>* firstSeen) {
+    std::vector<std::filesystem::path> ready;
+    while (true) {
+        discardStaleHead();
+        if (m_heap.empty() || m_heap.top().first > now) {
+            break;
+        }
+
+        auto it = m_deadlines.find(m_heap.top().second);
+        if (firstSeen != nullptr) {
+            firstSeen->push_back(it->second.firstSeen);
+        }
+        ready.push_back(m_heap.top().second);
+        m_deadlines.erase(it);
+        m_heap.pop();
+    }
+    return ready;
+}
+
+std::optional<ChangeQueue::Clock::time_point> ChangeQueue::nextDeadline() {
+    discardStaleHead();
+    if (m_heap.empty()) {
+        return std::nullopt;
+    }
+    return m_heap.top().first;
+}
+
+void ChangeQueue::clear() {
+    m_deadlines.clear();
+    m_heap = {};
+}
+
+bool ChangeQueue::empty() const {
+    return m_deadlines.empty();
+}
+
+std::size_t ChangeQueue::size() const {
+    return m_deadlines.size();
+}
+
+void ChangeQueue::discardStaleHead() {
+    while (!m_heap.empty()) {
+        const auto& [deadline, path] = m_heap.top();
+        auto it = m_deadlines.find(path);
+        if (it != m_deadlines.end() && it->second.deadline == deadline) {
+            return;
+        }
+        m_heap.pop();
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef CHANGE_QUEUE_HPP
+#define CHANGE_QUEUE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Coalesces change notifications per path and releases each path once it has been quiet for a while.
+class ChangeQueue {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit ChangeQueue(Clock::duration quietPeriod);
+
+    // Record activity for the path, pushing its release time back by the quiet period.
+    void touch(const std::filesystem::path& path, Clock::time_point now);
+    // Drop a pending path, e.g. when it disappears before being released.
+    void forget(const std::filesystem::path& path);
+    // Remove and return every path whose quiet period has elapsed, oldest first. When firstSeen is given it
+    // receives, for each returned path, the time of its first notification since it was last released.
+    std::vector<std::filesystem::path> takeReady(Clock::time_point now, std::vector<Clock::time_point>* firstSeen = nullptr);
+    // Earliest pending release time, or nullopt when nothing is queued.
+    std::optional<Clock::time_point> nextDeadline();
+    // Discard all pending paths (used after a full rescan supersedes them).
+    void clear();
+
+    bool empty() const;
+    std::size_t size() const;
+
+private:
+    struct PathHash {
+        std::size_t operator()(const std::filesystem::path& path) const {
+            return std::filesystem::hash_value(path);
+        }
+    };
+
+    struct Pending {
+        Clock::time_point deadline;
+        Clock::time_point firstSeen;
+    };
+
+    using HeapEntry = std::pair<Clock::time_point, std::filesystem::path>;
+
+    // Pop heap entries that were superseded by a later touch or removed by forget().
+    void discardStaleHead();
+
+    Clock::duration m_quietPeriod;
+    // Authoritative release time per path; heap entries that disagree are stale.
+    std::unordered_map<std::filesystem::path, Pending, PathHash> m_deadlines;
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> m_heap;
+};
+
+#endif
@@ -1,174 +1,924 @@
 #include "ConfigParser.hpp"
 
+#include "ContentSniffer.hpp"
+#include "ExtensionClassifier.hpp"
+#include "Logger.hpp"
+#include "PatternMatcher.hpp"
+#include "RuleCache.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
-#include <iostream>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <string_view>
 #include <system_error>
+#include <utility>
 
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
 
-std::string ConfigParser::getWatchFolder() const {
-    if (m_watch_folder.empty()) {
-        std::cerr << "Watch folder has not been configured yet." << std::endl;
-        return {};
+namespace {
+// Long enough for a browser to write its next chunk, short enough that finished downloads still move promptly.
+constexpr std::chrono::milliseconds kDefaultStabilityPeriod(1000);
+
+// A byte count: a plain integer, or a number with a unit such as `500 MB` or `1GiB`.
+std::optional<std::uint64_t> parseByteSize(const json& value) {
+    if (value.is_number_unsigned()) {
+        return value.get<std::uint64_t>();
+    }
+    if (!value.is_string()) {
+        return std::nullopt;
     }
 
-    // Confirm the folder exists before handing it back to callers.
-    std::error_code ec;
-    if (std::filesystem::exists(m_watch_folder, ec)) {
-        return m_watch_folder;
+    const std::string text = value.get<std::string>();
+    std::size_t digits = 0;
+    while (digits < text.size() && std::isdigit(static_cast<unsigned char>(text[digits])) != 0) {
+        ++digits;
+    }
+    if (digits == 0 || digits > 15) {
+        return std::nullopt;
+    }
+    std::string unit = text.substr(digits);
+    unit.erase(0, unit.find_first_not_of(' '));
+    std::transform(unit.begin(), unit.end(), unit.begin(), [](unsigned char ch) { return static_cast<char>(std::tolower(ch)); });
+
+    constexpr std::array<std::pair<std::string_view, std::uint64_t>, 10> kUnits{{
+        {"", 1}, {"b", 1},
+        {"kb", 1000}, {"mb", 1000 * 1000}, {"gb", 1000 * 1000 * 1000}, {"tb", 1000ull * 1000 * 1000 * 1000},
+        {"kib", 1ull << 10}, {"mib", 1ull << 20}, {"gib", 1ull << 30}, {"tib", 1ull << 40},
+    }};
+    const std::uint64_t count = std::stoull(text.substr(0, digits));
+    for (const auto& [name, scale] : kUnits) {
+        if (unit == name && count <= std::numeric_limits<std::uint64_t>::max() / scale) {
+            return count * scale;
+        }
+    }
+    return std::nullopt;
+}
+
+// One built-in rule: a handful of extensions routed to a subfolder of the watch folder.
+struct DefaultRuleSpec {
+    std::string_view subFolder;
+    std::array<std::string_view, 5> extensions;
+    std::size_t extensionCount;
+};
+
+constexpr std::array<DefaultRuleSpec, 7> kBuiltInDefaultRules{{
+    {"Installers", {".exe", ".msi"}, 2},
+    {"Archives", {".zip", ".rar", ".7z"}, 3},
+    {"Images", {".jpg", ".jpeg", ".png", ".gif", ".webp"}, 5},
+    {"PDFs", {".pdf"}, 1},
+    {"Notes", {".txt", ".md"}, 2},
+    {"Audio", {".mp3", ".wav", ".flac"}, 3},
+    {"Videos", {".mp4", ".mkv", ".mov"}, 3},
+}};
+
+// Hash every built-in extension at compile time (with the classifier's own hash) and reject the table if any
+// entry is not already normalized or the same extension is routed twice.
+constexpr bool builtInDefaultsAreValid() {
+    constexpr std::size_t kMaxEntries = kBuiltInDefaultRules.size() * 5;
+    std::array<std::uint32_t, kMaxEntries> hashes{};
+    std::array<std::string_view, kMaxEntries> seen{};
+    std::size_t count = 0;
+
+    for (const auto& spec : kBuiltInDefaultRules) {
+        if (spec.extensionCount == 0 || spec.extensionCount > spec.extensions.size()) {
+            return false;
+        }
+
+        for (std::size_t i = 0; i < spec.extensionCount; ++i) {
+            const std::string_view extension = spec.extensions[i];
+            if (extension.size() < 2 || extension.front() != '.') {
+                return false;
+            }
+            for (char ch : extension) {
+                if (ch >= 'A' && ch <= 'Z') {
+                    return false;
+                }
+            }
+
+            const std::uint32_t hash = ExtensionClassifier::hash(extension);
+            for (std::size_t j = 0; j < count; ++j) {
+                if (hashes[j] == hash && seen[j] == extension) {
+                    return false;
+                }
+            }
+            hashes[count] = hash;
+            seen[count] = extension;
+            ++count;
+        }
     }
+    return true;
+}
+
+static_assert(builtInDefaultsAreValid(), "built-in default rules must be normalized and route each extension once");
+} // namespace
 
-    if (ec) {
-        std::cerr << "Unable to validate folder `" << m_watch_folder << "`: " << ec.message() << std::endl;
+std::vector<WatchFolder> ConfigParser::getWatchFolders() const {
+    if (m_watch_folders.empty()) {
+        Logger::error() << "Watch folder has not been configured yet.";
         return {};
     }
 
-    std::cerr << "Invalid folder, please fix it and try again." << std::endl;
-    return {};
+    // Confirm each folder exists before handing it back to callers; one missing drop folder shouldn't stop the rest.
+    std::vector<WatchFolder> folders;
+    for (const auto& folder : m_watch_folders) {
+        std::error_code ec;
+        if (std::filesystem::exists(folder.path, ec)) {
+            folders.push_back(folder);
+        } else if (ec) {
+            Logger::error() << "Unable to validate folder `" << folder.path.string() << "`: " << ec.message();
+        } else {
+            Logger::error() << "Invalid folder `" << folder.path.string() << "`, please fix it and try again.";
+        }
+    }
+    return folders;
 }
 
-const std::vector<Rule>& ConfigParser::getRules() const {
-    return m_rules;
+std::size_t ConfigParser::getWorkerThreads() const {
+    return m_worker_threads;
 }
 
-bool ConfigParser::load(const std::string& filePath) {
+std::chrono::milliseconds ConfigParser::getStabilityPeriod() const {
+    return m_stability_period;
+}
+
+bool ConfigParser::getSniffContent() const {
+    return m_sniff_content;
+}
+
+DedupAction ConfigParser::getDedupAction() const {
+    return m_dedup;
+}
+
+const MetricsSettings& ConfigParser::getMetricsSettings() const {
+    return m_metrics;
+}
+
+const IoSettings& ConfigParser::getIoSettings() const {
+    return m_io;
+}
+
+const std::vector<RetentionPolicy>& ConfigParser::getRetentionPolicies() const {
+    return m_retention;
+}
+
+const LogSettings& ConfigParser::getLogSettings() const {
+    return m_logging;
+}
+
+std::filesystem::path ConfigParser::rulesPathFor(const std::string& filePath) {
     // rules.json lives in a config folder beside the executable/config root.
-    std::filesystem::path configDir = std::filesystem::path(filePath) / "config";
-    std::filesystem::path rulesPath = configDir / "rules.json";
+    return std::filesystem::path(filePath) / "config" / "rules.json";
+}
 
-    std::ifstream jsonFile(rulesPath);
-    if (!jsonFile) {
-        std::cerr << "Failed to open configuration file: " << rulesPath << std::endl;
-        return false;
+std::optional<std::chrono::seconds> ConfigParser::parseDuration(std::string_view text) {
+    if (text.size() < 2 || text.size() > 12 ||
+        !std::all_of(text.begin(), text.end() - 1, [](unsigned char ch) { return std::isdigit(ch) != 0; })) {
+        return std::nullopt;
+    }
+    const std::chrono::seconds::rep count = std::stoll(std::string(text.substr(0, text.size() - 1)));
+    switch (text.back()) {
+    case 's':
+        return std::chrono::seconds(count);
+    case 'm':
+        return std::chrono::minutes(count);
+    case 'h':
+        return std::chrono::hours(count);
+    case 'd':
+        return std::chrono::hours(24 * count);
+    case 'w':
+        return std::chrono::hours(24 * 7 * count);
+    default:
+        return std::nullopt;
+    }
+}
+
+bool ConfigParser::load(const std::string& filePath) {
+    m_rules_path = rulesPathFor(filePath);
+    m_loaded_from_cache = false;
+    m_compiled_rules.clear();
+
+    std::string contents;
+    {
+        std::ifstream jsonFile(m_rules_path, std::ios::binary);
+        if (!jsonFile) {
+            Logger::error() << "Failed to open configuration file: " << m_rules_path;
+            return false;
+        }
+        std::ostringstream buffer;
+        buffer << jsonFile.rdbuf();
+        contents = std::move(buffer).str();
+    }
+
+    // An unchanged rules.json was already validated and compiled by an earlier run; take the result from its cache.
+    m_content_hash = RuleCache::hashContents(contents);
+    {
+        RuleCache cache;
+        if (cache.open(RuleCache::pathFor(m_rules_path), m_content_hash) && restoreConfig(cache.configSection())) {
+            m_compiled_rules.assign(cache.compiledSection());
+            m_loaded_from_cache = true;
+            reportLoaded(true);
+            return true;
+        }
     }
 
     json data;
     try {
-        jsonFile >> data;
+        data = json::parse(contents);
     } catch (const json::parse_error& e) {
-        std::cerr << "Failed to parse configuration file: " << e.what() << std::endl;
+        Logger::error() << "Failed to parse configuration file: " << e.what();
         return false;
     }
 
     loadPlaceholders(data);
 
-    try {
-        const std::string rawWatch = data.at("watch_folder").get<std::string>();
-        m_watch_folder = applyPlaceholders(rawWatch);
-    } catch (const json::exception& e) {
-        std::cerr << "Missing or invalid watch_folder: " << e.what() << std::endl;
+    m_worker_threads = 0;
+    if (auto it = data.find("worker_threads"); it != data.end()) {
+        if (!it->is_number_unsigned() || it->get<std::size_t>() == 0) {
+            Logger::error() << "`worker_threads` must be a positive integer.";
+            return false;
+        }
+        m_worker_threads = it->get<std::size_t>();
+    }
+
+    m_stability_period = kDefaultStabilityPeriod;
+    if (auto it = data.find("stability_period_ms"); it != data.end()) {
+        if (!it->is_number_unsigned()) {
+            Logger::error() << "`stability_period_ms` must be a non-negative integer.";
+            return false;
+        }
+        m_stability_period = std::chrono::milliseconds(it->get<std::uint64_t>());
+    }
+
+    m_sniff_content = false;
+    if (auto it = data.find("sniff_content"); it != data.end()) {
+        if (!it->is_boolean()) {
+            Logger::error() << "`sniff_content` must be a boolean value.";
+            return false;
+        }
+        m_sniff_content = it->get<bool>();
+    }
+
+    m_dedup = DedupAction::Off;
+    if (auto it = data.find("dedup"); it != data.end()) {
+        const auto action = it->is_string() ? DuplicateIndex::parseAction(it->get<std::string>()) : std::nullopt;
+        if (!action) {
+            Logger::error() << "`dedup` must be one of `off`, `hardlink`, `delete` or `keep`.";
+            return false;
+        }
+        m_dedup = *action;
+    }
+
+    if (!parseMetrics(data) || !parseLogging(data) || !parseIo(data) || !parseRetention(data)) {
         return false;
     }
 
-    m_rules.clear();
+    // Top-level default for folders that don't say otherwise.
+    bool recursive = false;
+    if (auto it = data.find("recursive"); it != data.end()) {
+        if (!it->is_boolean()) {
+            Logger::error() << "`recursive` must be a boolean value.";
+            return false;
+        }
+        recursive = it->get<bool>();
+    }
+
+    m_watch_folders.clear();
+
+    // The top-level `watch_folder` and rules form the first folder; `watch_folders` adds more, each with its own rules.
+    const auto watchFolderIt = data.find("watch_folder");
+    const auto watchFoldersIt = data.find("watch_folders");
+    if (watchFolderIt != data.end() || watchFoldersIt == data.end()) {
+        if (watchFolderIt == data.end() || !watchFolderIt->is_string()) {
+            Logger::error() << "Missing or invalid watch_folder: expected a folder path string.";
+            return false;
+        }
+
+        WatchFolder folder;
+        folder.path = applyPlaceholders(watchFolderIt->get<std::string>());
+        folder.recursive = recursive;
+        if (!parseRuleSections(data, folder.path, "", folder.rules)) {
+            return false;
+        }
+        m_watch_folders.push_back(std::move(folder));
+    }
+
+    if (watchFoldersIt != data.end()) {
+        if (!watchFoldersIt->is_array() || watchFoldersIt->empty()) {
+            Logger::error() << "`watch_folders` must be a non-empty array of folder objects.";
+            return false;
+        }
 
+        for (std::size_t i = 0; i < watchFoldersIt->size(); ++i) {
+            const auto& entry = (*watchFoldersIt)[i];
+            const std::string prefix = "watch_folders[" + std::to_string(i) + "].";
+            if (!entry.is_object()) {
+                Logger::error() << "Invalid entry `" << prefix.substr(0, prefix.size() - 1) << "`: expected an object.";
+                return false;
+            }
+
+            auto pathIt = entry.find("path");
+            if (pathIt == entry.end() || !pathIt->is_string() || pathIt->get<std::string>().empty()) {
+                Logger::error() << "Missing or invalid `" << prefix << "path`.";
+                return false;
+            }
+
+            WatchFolder folder;
+            folder.path = applyPlaceholders(pathIt->get<std::string>());
+            folder.recursive = recursive;
+            if (auto it = entry.find("recursive"); it != entry.end()) {
+                if (!it->is_boolean()) {
+                    Logger::error() << "`" << prefix << "recursive` must be a boolean value.";
+                    return false;
+                }
+                folder.recursive = it->get<bool>();
+            }
+
+            const auto normalized = folder.path.lexically_normal();
+            const bool duplicate = std::any_of(m_watch_folders.begin(), m_watch_folders.end(), [&normalized](const WatchFolder& other) {
+                return other.path.lexically_normal() == normalized;
+            });
+            if (duplicate) {
+                Logger::error() << "Watch folder `" << folder.path.string() << "` is configured more than once.";
+                return false;
+            }
+
+            if (!parseRuleSections(entry, folder.path, prefix, folder.rules)) {
+                return false;
+            }
+            m_watch_folders.push_back(std::move(folder));
+        }
+    }
+
+    reportLoaded(false);
+    return true;
+}
+
+bool ConfigParser::loadedFromCache() const {
+    return m_loaded_from_cache;
+}
+
+std::string_view ConfigParser::compiledRules() const {
+    return m_compiled_rules;
+}
+
+bool ConfigParser::storeCache(std::string_view compiledRules) const {
+    const auto cachePath = RuleCache::pathFor(m_rules_path);
+    std::error_code ec;
+    if (!RuleCache::store(cachePath, m_content_hash, serializeConfig(), compiledRules, ec)) {
+        Logger::warning() << "Failed to write rule cache `" << cachePath.string() << "`: " << ec.message();
+        return false;
+    }
+    return true;
+}
+
+void ConfigParser::reportLoaded(bool fromCache) const {
+    std::size_t ruleCount = 0;
+    for (const auto& folder : m_watch_folders) {
+        ruleCount += folder.rules.size();
+    }
+    const char* source = fromCache ? " (compiled cache)" : "";
+    if (m_watch_folders.size() == 1) {
+        Logger::info() << "Loaded " << ruleCount << " rule(s) from " << m_rules_path << source;
+    } else {
+        Logger::info() << "Loaded " << ruleCount << " rule(s) for " << m_watch_folders.size() << " watch folders from " << m_rules_path << source;
+    }
+}
+
+std::string ConfigParser::serializeConfig() const {
+    RuleCache::Writer out;
+    auto writeStrings = [&out](const std::vector<std::string>& strings) {
+        out.value<std::uint64_t>(strings.size());
+        for (const auto& text : strings) {
+            out.string(text);
+        }
+    };
+
+    auto writeConditions = [&out](const RuleConditions& conditions) {
+        for (const auto* size : {&conditions.minSize, &conditions.maxSize}) {
+            out.value<std::uint8_t>(size->has_value());
+            out.value<std::uint64_t>(size->value_or(0));
+        }
+        for (const auto* age : {&conditions.olderThan, &conditions.newerThan, &conditions.notAccessedFor}) {
+            out.value<std::uint8_t>(age->has_value());
+            out.value<std::int64_t>(age->value_or(std::chrono::seconds(0)).count());
+        }
+    };
+
+    out.value<std::uint64_t>(m_worker_threads);
+    out.value<std::int64_t>(m_stability_period.count());
+    out.value<std::uint8_t>(m_sniff_content);
+    out.value<std::uint8_t>(static_cast<std::uint8_t>(m_dedup));
+    out.string(m_metrics.file.native());
+    out.string(m_metrics.socket.native());
+    out.value<std::int64_t>(m_metrics.interval.count());
+    out.value<std::uint8_t>(static_cast<std::uint8_t>(m_logging.level));
+    out.value<std::uint8_t>(static_cast<std::uint8_t>(m_logging.format));
+    out.value<std::uint64_t>(m_io.bytesPerSecond);
+    out.value<std::uint64_t>(m_io.burstBytes);
+    out.value<std::uint64_t>(m_io.smallFileBytes);
+    out.value<std::uint8_t>(static_cast<std::uint8_t>(m_io.priority));
+    out.value<std::uint64_t>(m_retention.size());
+    for (const auto& policy : m_retention) {
+        out.string(policy.folder.native());
+        out.value<std::uint8_t>(policy.maxAge.has_value());
+        out.value<std::int64_t>(policy.maxAge.value_or(std::chrono::seconds(0)).count());
+        out.value<std::uint8_t>(policy.maxTotalBytes.has_value());
+        out.value<std::uint64_t>(policy.maxTotalBytes.value_or(0));
+    }
+    out.value<std::uint64_t>(m_watch_folders.size());
+    for (const auto& folder : m_watch_folders) {
+        out.string(folder.path.native());
+        out.value<std::uint8_t>(folder.recursive);
+        out.value<std::uint64_t>(folder.rules.size());
+        for (const auto& rule : folder.rules) {
+            writeStrings(rule.extensions);
+            writeStrings(rule.patterns);
+            writeStrings(rule.nameRegexes);
+            writeStrings(rule.mimeTypes);
+            writeConditions(rule.conditions);
+            out.string(rule.destination);
+        }
+    }
+    return out.data();
+}
+
+bool ConfigParser::restoreConfig(std::string_view section) {
+    RuleCache::Reader in(section);
+    auto readStrings = [&in](std::vector<std::string>& strings) {
+        std::uint64_t count = 0;
+        if (!in.value(count)) {
+            return false;
+        }
+        for (std::uint64_t i = 0; i < count && in.ok(); ++i) {
+            in.string(strings.emplace_back());
+        }
+        return in.ok();
+    };
+
+    auto readConditions = [&in](RuleConditions& conditions) {
+        for (auto* size : {&conditions.minSize, &conditions.maxSize}) {
+            std::uint8_t present = 0;
+            std::uint64_t value = 0;
+            if (in.value(present) && in.value(value) && present != 0) {
+                *size = value;
+            }
+        }
+        for (auto* age : {&conditions.olderThan, &conditions.newerThan, &conditions.notAccessedFor}) {
+            std::uint8_t present = 0;
+            std::int64_t value = 0;
+            if (in.value(present) && in.value(value) && present != 0) {
+                *age = std::chrono::seconds(value);
+            }
+        }
+        return in.ok();
+    };
+
+    std::uint64_t workerThreads = 0;
+    std::int64_t stabilityPeriod = 0;
+    std::uint8_t sniffContent = 0;
+    std::uint8_t dedup = 0;
+    std::filesystem::path::string_type metricsFile;
+    std::filesystem::path::string_type metricsSocket;
+    std::int64_t metricsInterval = 0;
+    std::uint8_t logLevel = 0;
+    std::uint8_t logFormat = 0;
+    IoSettings io;
+    std::uint8_t ioPriority = 0;
+    std::uint64_t policyCount = 0;
+    std::uint64_t folderCount = 0;
+    in.value(workerThreads);
+    in.value(stabilityPeriod);
+    in.value(sniffContent);
+    in.value(dedup);
+    in.string(metricsFile);
+    in.string(metricsSocket);
+    in.value(metricsInterval);
+    in.value(logLevel);
+    in.value(logFormat);
+    in.value(io.bytesPerSecond);
+    in.value(io.burstBytes);
+    in.value(io.smallFileBytes);
+    in.value(ioPriority);
+    in.value(policyCount);
+
+    std::vector<RetentionPolicy> retention;
+    for (std::uint64_t i = 0; i < policyCount && in.ok(); ++i) {
+        RetentionPolicy& policy = retention.emplace_back();
+        std::filesystem::path::string_type folder;
+        std::uint8_t hasMaxAge = 0;
+        std::int64_t maxAge = 0;
+        std::uint8_t hasMaxTotalBytes = 0;
+        std::uint64_t maxTotalBytes = 0;
+        in.string(folder);
+        in.value(hasMaxAge);
+        in.value(maxAge);
+        in.value(hasMaxTotalBytes);
+        in.value(maxTotalBytes);
+        policy.folder = std::move(folder);
+        if (hasMaxAge != 0) {
+            policy.maxAge = std::chrono::seconds(maxAge);
+        }
+        if (hasMaxTotalBytes != 0) {
+            policy.maxTotalBytes = maxTotalBytes;
+        }
+    }
+    in.value(folderCount);
+
+    std::vector<WatchFolder> folders;
+    for (std::uint64_t i = 0; i < folderCount && in.ok(); ++i) {
+        WatchFolder& folder = folders.emplace_back();
+        std::filesystem::path::string_type path;
+        std::uint8_t recursive = 0;
+        std::uint64_t ruleCount = 0;
+        in.string(path);
+        in.value(recursive);
+        in.value(ruleCount);
+        folder.path = std::move(path);
+        folder.recursive = recursive != 0;
+        for (std::uint64_t j = 0; j < ruleCount && in.ok(); ++j) {
+            Rule& rule = folder.rules.emplace_back();
+            if (readStrings(rule.extensions) && readStrings(rule.patterns) && readStrings(rule.nameRegexes) && readStrings(rule.mimeTypes) &&
+                readConditions(rule.conditions)) {
+                in.string(rule.destination);
+            }
+        }
+    }
+
+    if (!in.atEnd() || folders.empty() || dedup > static_cast<std::uint8_t>(DedupAction::Keep) ||
+        logLevel > static_cast<std::uint8_t>(Logger::Level::Error) || logFormat > static_cast<std::uint8_t>(Logger::Format::JsonLines) ||
+        ioPriority > static_cast<std::uint8_t>(IoPriority::Idle)) {
+        return false;
+    }
+
+    m_worker_threads = static_cast<std::size_t>(workerThreads);
+    m_stability_period = std::chrono::milliseconds(stabilityPeriod);
+    m_sniff_content = sniffContent != 0;
+    m_dedup = static_cast<DedupAction>(dedup);
+    m_metrics.file = std::move(metricsFile);
+    m_metrics.socket = std::move(metricsSocket);
+    m_metrics.interval = std::chrono::milliseconds(metricsInterval);
+    m_logging.level = static_cast<Logger::Level>(logLevel);
+    m_logging.format = static_cast<Logger::Format>(logFormat);
+    io.priority = static_cast<IoPriority>(ioPriority);
+    m_io = io;
+    m_retention = std::move(retention);
+    m_watch_folders = std::move(folders);
+    return true;
+}
+
+bool ConfigParser::parseMetrics(const json& data) {
+    m_metrics = MetricsSettings{};
+    auto metricsIt = data.find("metrics");
+    if (metricsIt == data.end()) {
+        return true;
+    }
+    if (!metricsIt->is_object()) {
+        Logger::error() << "`metrics` must be an object.";
+        return false;
+    }
+
+    auto parsePath = [&](const char* key, std::filesystem::path& target) {
+        auto it = metricsIt->find(key);
+        if (it == metricsIt->end()) {
+            return true;
+        }
+        if (!it->is_string() || it->get<std::string>().empty()) {
+            Logger::error() << "`metrics." << key << "` must be a non-empty path string.";
+            return false;
+        }
+        target = applyPlaceholders(it->get<std::string>());
+        return true;
+    };
+    if (!parsePath("file", m_metrics.file) || !parsePath("socket", m_metrics.socket)) {
+        return false;
+    }
+
+    if (auto it = metricsIt->find("interval_ms"); it != metricsIt->end()) {
+        if (!it->is_number_unsigned() || it->get<std::uint64_t>() == 0) {
+            Logger::error() << "`metrics.interval_ms` must be a positive integer.";
+            return false;
+        }
+        m_metrics.interval = std::chrono::milliseconds(it->get<std::uint64_t>());
+    }
+    return true;
+}
+
+bool ConfigParser::parseLogging(const json& data) {
+    m_logging = LogSettings{};
+    auto loggingIt = data.find("logging");
+    if (loggingIt == data.end()) {
+        return true;
+    }
+    if (!loggingIt->is_object()) {
+        Logger::error() << "`logging` must be an object.";
+        return false;
+    }
+
+    if (auto it = loggingIt->find("level"); it != loggingIt->end()) {
+        const auto level = it->is_string() ? Logger::parseLevel(it->get<std::string>()) : std::nullopt;
+        if (!level) {
+            Logger::error() << "`logging.level` must be one of `debug`, `info`, `warning` or `error`.";
+            return false;
+        }
+        m_logging.level = *level;
+    }
+
+    if (auto it = loggingIt->find("format"); it != loggingIt->end()) {
+        const auto format = it->is_string() ? Logger::parseFormat(it->get<std::string>()) : std::nullopt;
+        if (!format) {
+            Logger::error() << "`logging.format` must be `text` or `json`.";
+            return false;
+        }
+        m_logging.format = *format;
+    }
+    return true;
+}
+
+bool ConfigParser::parseIo(const json& data) {
+    m_io = IoSettings{};
+    auto ioIt = data.find("io");
+    if (ioIt == data.end()) {
+        return true;
+    }
+    if (!ioIt->is_object()) {
+        Logger::error() << "`io` must be an object.";
+        return false;
+    }
+
+    auto parseBytes = [&](const char* key, std::uint64_t& target) {
+        auto it = ioIt->find(key);
+        if (it == ioIt->end()) {
+            return true;
+        }
+        if (!it->is_number_unsigned()) {
+            Logger::error() << "`io." << key << "` must be a non-negative integer.";
+            return false;
+        }
+        target = it->get<std::uint64_t>();
+        return true;
+    };
+    if (!parseBytes("bytes_per_second", m_io.bytesPerSecond) || !parseBytes("burst_bytes", m_io.burstBytes) ||
+        !parseBytes("small_file_bytes", m_io.smallFileBytes)) {
+        return false;
+    }
+
+    if (auto it = ioIt->find("priority"); it != ioIt->end()) {
+        const auto priority = it->is_string() ? IoScheduler::parsePriority(it->get<std::string>()) : std::nullopt;
+        if (!priority) {
+            Logger::error() << "`io.priority` must be one of `normal`, `low` or `idle`.";
+            return false;
+        }
+        m_io.priority = *priority;
+    }
+    return true;
+}
+
+bool ConfigParser::parseRetention(const json& data) {
+    m_retention.clear();
+    auto retentionIt = data.find("retention");
+    if (retentionIt == data.end()) {
+        return true;
+    }
+    if (!retentionIt->is_array()) {
+        Logger::error() << "`retention` must be an array of folder objects.";
+        return false;
+    }
+
+    for (std::size_t i = 0; i < retentionIt->size(); ++i) {
+        const auto& entry = (*retentionIt)[i];
+        const std::string prefix = "retention[" + std::to_string(i) + "].";
+        if (!entry.is_object()) {
+            Logger::error() << "Invalid entry `" << prefix.substr(0, prefix.size() - 1) << "`: expected an object.";
+            return false;
+        }
+
+        auto pathIt = entry.find("path");
+        if (pathIt == entry.end() || !pathIt->is_string() || pathIt->get<std::string>().empty()) {
+            Logger::error() << "Missing or invalid `" << prefix << "path`.";
+            return false;
+        }
+        RetentionPolicy policy;
+        policy.folder = applyPlaceholders(pathIt->get<std::string>());
+
+        if (auto it = entry.find("max_age"); it != entry.end()) {
+            policy.maxAge = it->is_string() ? parseDuration(it->get<std::string>()) : std::nullopt;
+            if (!policy.maxAge || policy.maxAge->count() == 0) {
+                Logger::error() << "`" << prefix << "max_age` must be a positive duration, e.g. `30d` or `2w`.";
+                return false;
+            }
+        }
+        if (auto it = entry.find("max_total_size"); it != entry.end()) {
+            policy.maxTotalBytes = parseByteSize(*it);
+            if (!policy.maxTotalBytes) {
+                Logger::error() << "`" << prefix << "max_total_size` must be a byte count, e.g. `500 MB` or `20 GiB`.";
+                return false;
+            }
+        }
+        if (!policy.maxAge && !policy.maxTotalBytes) {
+            Logger::error() << "`" << prefix.substr(0, prefix.size() - 1) << "` needs `max_age`, `max_total_size` or both.";
+            return false;
+        }
+
+        const auto normalized = policy.folder.lexically_normal();
+        const bool duplicate = std::any_of(m_retention.begin(), m_retention.end(), [&normalized](const RetentionPolicy& other) {
+            return other.folder.lexically_normal() == normalized;
+        });
+        if (duplicate) {
+            Logger::error() << "Retention for `" << policy.folder.string() << "` is configured more than once.";
+            return false;
+        }
+        m_retention.push_back(std::move(policy));
+    }
+    return true;
+}
+
+bool ConfigParser::parseRuleSections(const json& section, const std::filesystem::path& watchFolder, const std::string& prefix,
+                                     std::vector<Rule>& rules) {
     bool useDefaultRules = false;
-    if (auto it = data.find("use_default_rules"); it != data.end()) {
+    if (auto it = section.find("use_default_rules"); it != section.end()) {
         if (!it->is_boolean()) {
-            std::cerr << "`use_default_rules` must be a boolean value." << std::endl;
+            Logger::error() << "`" << prefix << "use_default_rules` must be a boolean value.";
             return false;
         }
         useDefaultRules = it->get<bool>();
     }
 
-    const bool hasDefaultRulesSection = data.contains("default_rules");
-    const bool hasCustomRulesSection = data.contains("custom_rules");
-    const bool hasLegacyRulesSection = data.contains("rules");
+    const bool hasDefaultRulesSection = section.contains("default_rules");
+    const bool hasCustomRulesSection = section.contains("custom_rules");
+    const bool hasLegacyRulesSection = section.contains("rules");
 
     try {
         if (useDefaultRules) {
             if (hasDefaultRulesSection) {
-                const std::size_t before = m_rules.size();
-                if (!parseRuleArray(data.at("default_rules"), "default_rules")) {
+                const std::size_t before = rules.size();
+                if (!parseRuleArray(section.at("default_rules"), prefix + "default_rules", rules)) {
                     return false;
                 }
-                if (m_rules.size() == before) {
-                    std::cout << "`default_rules` is empty; no default rules applied from file." << std::endl;
+                if (rules.size() == before) {
+                    Logger::info() << "`" << prefix << "default_rules` is empty; no default rules applied from file.";
                 }
             } else {
                 // Fall back to a curated set so new users get sensible behavior out of the box.
-                const auto defaults = builtInDefaultRules(std::filesystem::path(m_watch_folder));
-                m_rules.insert(m_rules.end(), defaults.begin(), defaults.end());
-                std::cout << "Using built-in default rules (" << defaults.size() << " rule(s))." << std::endl;
+                const auto defaults = builtInDefaultRules(watchFolder);
+                rules.insert(rules.end(), defaults.begin(), defaults.end());
+                Logger::info() << "Using built-in default rules (" << defaults.size() << " rule(s)) for `" << watchFolder.string() << "`.";
             }
         }
 
         if (hasCustomRulesSection) {
-            if (!parseRuleArray(data.at("custom_rules"), "custom_rules")) {
+            if (!parseRuleArray(section.at("custom_rules"), prefix + "custom_rules", rules)) {
                 return false;
             }
         } else if (!useDefaultRules && hasLegacyRulesSection) {
-            std::cerr << "The configuration uses the legacy `rules` section; please migrate to `custom_rules` when convenient."
-                      << std::endl;
-            if (!parseRuleArray(data.at("rules"), "rules")) {
+            Logger::warning() << "The configuration uses the legacy `" << prefix << "rules` section; please migrate to `custom_rules` when convenient.";
+            if (!parseRuleArray(section.at("rules"), prefix + "rules", rules)) {
                 return false;
             }
         } else if (!useDefaultRules && !hasLegacyRulesSection) {
-            std::cerr << "No rules configured. Enable `use_default_rules` or add entries to `custom_rules`." << std::endl;
+            Logger::warning() << "No rules configured for `" << watchFolder.string() << "`. Enable `use_default_rules` or add entries to `custom_rules`.";
         }
     } catch (const json::exception& e) {
-        std::cerr << "Invalid rules configuration: " << e.what() << std::endl;
+        Logger::error() << "Invalid rules configuration: " << e.what();
         return false;
     }
 
-    std::cout << "Loaded " << m_rules.size() << " rule(s) from " << rulesPath << std::endl;
     return true;
 }
 
-bool ConfigParser::parseRuleArray(const json& rulesArray, const std::string& sectionName) {
+bool ConfigParser::parseRuleArray(const json& rulesArray, const std::string& sectionName, std::vector<Rule>& rules) {
     if (!rulesArray.is_array()) {
-        std::cerr << "Invalid configuration: `" << sectionName << "` must be an array." << std::endl;
+        Logger::error() << "Invalid configuration: `" << sectionName << "` must be an array.";
         return false;
     }
 
     for (const auto& ruleJson : rulesArray) {
         if (!ruleJson.is_object()) {
-            std::cerr << "Invalid rule entry in `" << sectionName << "`: expected an object." << std::endl;
+            Logger::error() << "Invalid rule entry in `" << sectionName << "`: expected an object.";
             return false;
         }
 
         Rule rule;
 
-        auto extensionsIt = ruleJson.find("extensions");
-        if (extensionsIt == ruleJson.end()) {
-            std::cerr << "Invalid rule in `" << sectionName << "`: missing `extensions` field." << std::endl;
+        // Each matcher list is optional on its own, but a rule needs at least one way to match.
+        auto readStrings = [&](const char* key, const char* itemName, std::vector<std::string>& out) {
+            auto it = ruleJson.find(key);
+            if (it == ruleJson.end()) {
+                return true;
+            }
+
+            if (!it->is_array()) {
+                Logger::error() << "Invalid rule in `" << sectionName << "`: `" << key << "` must be an array.";
+                return false;
+            }
+
+            for (const auto& item : *it) {
+                if (!item.is_string() || item.get<std::string>().empty()) {
+                    Logger::error() << "Invalid rule in `" << sectionName << "`: each " << itemName << " must be a non-empty string.";
+                    return false;
+                }
+                out.push_back(item.get<std::string>());
+            }
+            return true;
+        };
+
+        if (!readStrings("extensions", "extension", rule.extensions) ||
+            !readStrings("patterns", "pattern", rule.patterns) ||
+            !readStrings("name_regex", "regex", rule.nameRegexes) ||
+            !readStrings("mime_types", "MIME type", rule.mimeTypes)) {
             return false;
         }
 
-        if (!extensionsIt->is_array()) {
-            std::cerr << "Invalid rule in `" << sectionName << "`: `extensions` must be an array." << std::endl;
+        auto readSize = [&](const char* key, std::optional<std::uint64_t>& out) {
+            auto it = ruleJson.find(key);
+            if (it == ruleJson.end()) {
+                return true;
+            }
+            out = parseByteSize(*it);
+            if (!out) {
+                Logger::error() << "Invalid rule in `" << sectionName << "`: `" << key
+                                << "` must be a byte count, e.g. `1048576`, `500 MB` or `1 GiB`.";
+                return false;
+            }
+            return true;
+        };
+        auto readAge = [&](const char* key, std::optional<std::chrono::seconds>& out) {
+            auto it = ruleJson.find(key);
+            if (it == ruleJson.end()) {
+                return true;
+            }
+            out = it->is_string() ? parseDuration(it->get<std::string>()) : std::nullopt;
+            if (!out) {
+                Logger::error() << "Invalid rule in `" << sectionName << "`: `" << key << "` must be a duration, e.g. `12h`, `30d` or `2w`.";
+                return false;
+            }
+            return true;
+        };
+
+        RuleConditions& conditions = rule.conditions;
+        if (!readSize("min_size", conditions.minSize) || !readSize("max_size", conditions.maxSize) ||
+            !readAge("older_than", conditions.olderThan) || !readAge("newer_than", conditions.newerThan) ||
+            !readAge("not_accessed_for", conditions.notAccessedFor)) {
+            return false;
+        }
+        if (conditions.minSize && conditions.maxSize && *conditions.minSize > *conditions.maxSize) {
+            Logger::error() << "Invalid rule in `" << sectionName << "`: `min_size` is larger than `max_size`.";
             return false;
         }
 
-        for (const auto& ext : *extensionsIt) {
-            if (!ext.is_string()) {
-                std::cerr << "Invalid rule in `" << sectionName << "`: each extension must be a string." << std::endl;
+        // A rule with conditions may leave out the matchers to apply to every file that meets them.
+        if (rule.extensions.empty() && rule.patterns.empty() && rule.nameRegexes.empty() && rule.mimeTypes.empty() &&
+            conditions.empty()) {
+            Logger::error() << "Invalid rule in `" << sectionName
+                            << "`: at least one of `extensions`, `patterns`, `name_regex`, `mime_types` or a size or age condition is required.";
+            return false;
+        }
+
+        for (const auto& pattern : rule.patterns) {
+            std::string error;
+            if (!PatternMatcher::validateGlob(pattern, error)) {
+                Logger::error() << "Invalid rule in `" << sectionName << "`: pattern `" << pattern << "`: " << error << ".";
                 return false;
             }
-            rule.extensions.push_back(ext.get<std::string>());
         }
 
-        if (rule.extensions.empty()) {
-            std::cerr << "Invalid rule in `" << sectionName << "`: at least one extension is required." << std::endl;
-            return false;
+        for (const auto& regex : rule.nameRegexes) {
+            std::string error;
+            if (!PatternMatcher::validateRegex(regex, error)) {
+                Logger::error() << "Invalid rule in `" << sectionName << "`: name_regex `" << regex << "`: " << error << ".";
+                return false;
+            }
+        }
+
+        for (const auto& mimeType : rule.mimeTypes) {
+            std::string error;
+            if (!ContentSniffer::validateMimePattern(mimeType, error)) {
+                Logger::error() << "Invalid rule in `" << sectionName << "`: MIME type `" << mimeType << "`: " << error << ".";
+                return false;
+            }
         }
 
         auto destinationIt = ruleJson.find("destination");
         if (destinationIt == ruleJson.end() || !destinationIt->is_string()) {
-            std::cerr << "Invalid rule in `" << sectionName << "`: missing or invalid `destination`." << std::endl;
+            Logger::error() << "Invalid rule in `" << sectionName << "`: missing or invalid `destination`.";
             return false;
         }
 
         rule.destination = applyPlaceholders(destinationIt->get<std::string>());
         if (rule.destination.empty()) {
-            std::cerr << "Invalid rule in `" << sectionName << "`: destination cannot be empty." << std::endl;
+            Logger::error() << "Invalid rule in `" << sectionName << "`: destination cannot be empty.";
             return false;
         }
 
-        m_rules.push_back(std::move(rule));
+        rules.push_back(std::move(rule));
     }
 
     return true;
@@ -177,22 +927,24 @@ bool ConfigParser::parseRuleArray(const json& rulesArray, const std::string& sec
 std::vector<Rule> ConfigParser::builtInDefaultRules(const std::filesystem::path& watchFolder) const {
     const std::filesystem::path base = watchFolder.empty() ? std::filesystem::path{} : watchFolder;
     // Helper to either use the watch folder as a base or keep relative subfolders.
-    auto makeDestination = [&](const std::string& subFolder) -> std::string {
+    auto makeDestination = [&](std::string_view subFolder) -> std::string {
         if (base.empty()) {
-            return subFolder;
+            return std::string(subFolder);
         }
         return (base / subFolder).string();
     };
 
-    return {
-        {{".exe", ".msi"}, makeDestination("Installers")},
-        {{".zip", ".rar", ".7z"}, makeDestination("Archives")},
-        {{".jpg", ".jpeg", ".png", ".gif", ".webp"}, makeDestination("Images")},
-        {{".pdf"}, makeDestination("PDFs")},
-        {{".txt", ".md"}, makeDestination("Notes")},
-        {{".mp3", ".wav", ".flac"}, makeDestination("Audio")},
-        {{".mp4", ".mkv", ".mov"}, makeDestination("Videos")}
-    };
+    std::vector<Rule> rules;
+    rules.reserve(kBuiltInDefaultRules.size());
+    for (const auto& spec : kBuiltInDefaultRules) {
+        Rule rule;
+        for (std::size_t i = 0; i < spec.extensionCount; ++i) {
+            rule.extensions.emplace_back(spec.extensions[i]);
+        }
+        rule.destination = makeDestination(spec.subFolder);
+        rules.push_back(std::move(rule));
+    }
+    return rules;
 }
 
 void ConfigParser::loadPlaceholders(const json& data) {
@@ -201,7 +953,7 @@ void ConfigParser::loadPlaceholders(const json& data) {
     // Support both legacy `user` token and the newer `placeholders` map.
     auto addPlaceholder = [this](const std::string& key, const json& value) {
         if (!value.is_string()) {
-            std::cerr << "Placeholder `" << key << "` must be a string." << std::endl;
+            Logger::error() << "Placeholder `" << key << "` must be a string.";
             return;
         }
         m_placeholders[key] = value.get<std::string>();
@@ -213,7 +965,7 @@ void ConfigParser::loadPlaceholders(const json& data) {
 
     if (auto placeholdersIt = data.find("placeholders"); placeholdersIt != data.end()) {
         if (!placeholdersIt->is_object()) {
-            std::cerr << "`placeholders` must be an object of key/value strings." << std::endl;
+            Logger::error() << "`placeholders` must be an object of key/value strings.";
         } else {
             for (auto it = placeholdersIt->begin(); it != placeholdersIt->end(); ++it) {
                 addPlaceholder(it.key(), it.value());
@@ -223,19 +975,33 @@ void ConfigParser::loadPlaceholders(const json& data) {
 }
 
 std::string ConfigParser::applyPlaceholders(const std::string& value) const {
-    std::string result = value;
-    for (const auto& [key, replacement] : m_placeholders) {
-        const std::string token = "{{" + key + "}}";
-        std::size_t pos = 0;
-        // Replace all occurrences instead of just the first to allow repeated tokens.
-        while ((pos = result.find(token, pos)) != std::string::npos) {
-            result.replace(pos, token.size(), replacement);
-            pos += replacement.size();
+    std::string result;
+    result.reserve(value.size());
+    bool unresolved = false;
+    std::size_t pos = 0;
+    // Copy the text between tokens and look each token up once; replacements are not rescanned.
+    while (pos < value.size()) {
+        const std::size_t open = value.find("{{", pos);
+        const std::size_t close = open == std::string::npos ? std::string::npos : value.find("}}", open + 2);
+        if (close == std::string::npos) {
+            unresolved = unresolved || open != std::string::npos;
+            result.append(value, pos, std::string::npos);
+            break;
+        }
+
+        result.append(value, pos, open - pos);
+        auto it = m_placeholders.find(value.substr(open + 2, close - open - 2));
+        if (it != m_placeholders.end()) {
+            result += it->second;
+        } else {
+            result.append(value, open, close + 2 - open);
+            unresolved = true;
         }
+        pos = close + 2;
     }
 
-    if (result.find("{{") != std::string::npos) {
-        std::cerr << "Warning: unresolved placeholder detected in value `" << result << "`." << std::endl;
+    if (unresolved) {
+        Logger::warning() << "Unresolved placeholder detected in value `" << result << "`.";
     }
 
     return result;
@@ -1,42 +1,153 @@
 #ifndef CONFIG_PARSER_HPP
 #define CONFIG_PARSER_HPP
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 #include <nlohmann/json_fwd.hpp>
 
-// Rule ties a list of extensions to the destination directory that should receive them.
+#include "DuplicateIndex.hpp"
+#include "IoScheduler.hpp"
+#include "Logger.hpp"
+#include "RetentionIndex.hpp"
+
+// RuleConditions is the metadata a file must have for its rule to apply; bounds left unset don't constrain it.
+struct RuleConditions {
+    // Size in bytes (`min_size`, `max_size`), both inclusive.
+    std::optional<std::uint64_t> minSize;
+    std::optional<std::uint64_t> maxSize;
+    // Time since the file was last modified (`older_than`, `newer_than`) or last read (`not_accessed_for`).
+    std::optional<std::chrono::seconds> olderThan;
+    std::optional<std::chrono::seconds> newerThan;
+    std::optional<std::chrono::seconds> notAccessedFor;
+
+    bool empty() const { return !minSize && !maxSize && !olderThan && !newerThan && !notAccessedFor; }
+    // Whether the verdict can change without the file's folder changing: as time passes, or as the file grows.
+    bool dependsOnMetadata() const { return !empty(); }
+};
+
+// Rule ties file name and content matchers to the destination directory that should receive matching files.
 struct Rule {
+    // Extensions with the leading dot; multi-part ones such as `.tar.gz` match the whole suffix.
     std::vector<std::string> extensions;
+    // Globs over the whole file name, e.g. `Screenshot*` or `invoice-*.pdf`.
+    std::vector<std::string> patterns;
+    // Regexes that must match the whole file name.
+    std::vector<std::string> nameRegexes;
+    // MIME types recognized from the file's contents, e.g. `application/pdf` or `image/*`.
+    std::vector<std::string> mimeTypes;
+    RuleConditions conditions;
+    // May contain `{yyyy}`, `{mm}` and `{dd}`, filled in from the file's modification time.
     std::string destination;
 };
 
-// Parses the rules.json file and exposes the resolved watch folder and rules.
+// WatchFolder pairs a folder to organize with the rules that apply to the files arriving in it.
+struct WatchFolder {
+    std::filesystem::path path;
+    // Organize files in subfolders too (`recursive`).
+    bool recursive = false;
+    std::vector<Rule> rules;
+};
+
+// MetricsSettings says where metrics are published (`metrics`); with neither path set they stay in memory.
+struct MetricsSettings {
+    // Rewritten with the current metrics every interval.
+    std::filesystem::path file;
+    // Unix socket answering each connection with the current metrics.
+    std::filesystem::path socket;
+    std::chrono::milliseconds interval{10000};
+
+    bool enabled() const { return !file.empty() || !socket.empty(); }
+};
+
+// LogSettings picks how much the janitor logs and in what shape (`logging`).
+struct LogSettings {
+    Logger::Level level = Logger::Level::Info;
+    Logger::Format format = Logger::Format::Text;
+};
+
+// Parses the rules.json file and exposes the resolved watch folders and their rules.
 class ConfigParser {
 public:
-    // Read-only access to the loaded rule set.
-    const std::vector<Rule>& getRules() const;
-    // Load configuration from disk; returns false on I/O or validation errors.
+    // Where load() looks for rules.json under the given config root.
+    static std::filesystem::path rulesPathFor(const std::string& filePath);
+    // Parse a duration such as `90s`, `30m`, `12h`, `7d` or `2w`.
+    static std::optional<std::chrono::seconds> parseDuration(std::string_view text);
+    // Load configuration from disk; returns false on I/O or validation errors. When config/rules.cache was
+    // written for exactly this rules.json, the settings and compiled rules come from it and no JSON is parsed.
     bool load(const std::string& filePath);
-    // Returns the validated watch folder path, or empty string when invalid.
-    std::string getWatchFolder() const;
+    // Whether load() was served by rules.cache.
+    bool loadedFromCache() const;
+    // The compiled rules stored in rules.cache (FileMover's format), or empty when load() parsed the JSON.
+    std::string_view compiledRules() const;
+    // Write rules.cache for the loaded rules.json with the given compiled rules; logs and returns false on failure.
+    bool storeCache(std::string_view compiledRules) const;
+    // The configured watch folders that exist, in definition order; folders that don't are reported and left out.
+    std::vector<WatchFolder> getWatchFolders() const;
+    // Number of move worker threads requested by `worker_threads`; 0 lets the mover pick.
+    std::size_t getWorkerThreads() const;
+    // How long a file's size and modification time must stay unchanged before it is moved (`stability_period_ms`).
+    std::chrono::milliseconds getStabilityPeriod() const;
+    // Whether `sniff_content` asks for files to be classified by their contents as well as their names.
+    bool getSniffContent() const;
+    // What `dedup` asks to be done with files whose contents are already in their destination.
+    DedupAction getDedupAction() const;
+    // Where `metrics` asks for metrics to be published.
+    const MetricsSettings& getMetricsSettings() const;
+    // How `logging` asks for log lines to be filtered and written.
+    const LogSettings& getLogSettings() const;
+    // How `io` asks for cross-volume copies to be paced.
+    const IoSettings& getIoSettings() const;
+    // The destination folders `retention` bounds, and how.
+    const std::vector<RetentionPolicy>& getRetentionPolicies() const;
 
 private:
+    // Settings and watch folders as stored in rules.cache.
+    std::string serializeConfig() const;
+    bool restoreConfig(std::string_view section);
+    // Log how many rules were loaded and from where.
+    void reportLoaded(bool fromCache) const;
     // Collect placeholder tokens (built-in and user-defined) for later substitution.
     void loadPlaceholders(const nlohmann::json& data);
-    // Replace placeholder tokens in strings, logging warnings for unresolved entries.
+    // Replace `{{key}}` tokens in one pass over the string, logging a warning for unresolved ones.
     std::string applyPlaceholders(const std::string& value) const;
+    // Parse the optional `metrics` object.
+    bool parseMetrics(const nlohmann::json& data);
+    // Parse the optional `logging` object.
+    bool parseLogging(const nlohmann::json& data);
+    // Parse the optional `io` object.
+    bool parseIo(const nlohmann::json& data);
+    // Parse the optional `retention` array.
+    bool parseRetention(const nlohmann::json& data);
+    // Parse `use_default_rules`, `default_rules`, `custom_rules` and legacy `rules` from one config object.
+    bool parseRuleSections(const nlohmann::json& section, const std::filesystem::path& watchFolder, const std::string& prefix,
+                           std::vector<Rule>& rules);
     // Parse and validate a JSON array of rule objects.
-    bool parseRuleArray(const nlohmann::json& rulesArray, const std::string& sectionName);
+    bool parseRuleArray(const nlohmann::json& rulesArray, const std::string& sectionName, std::vector<Rule>& rules);
     // Generate a built-in set of rules when requested by the configuration.
     std::vector<Rule> builtInDefaultRules(const std::filesystem::path& watchFolder) const;
 
-    std::string m_watch_folder;
-    std::vector<Rule> m_rules;
+    std::vector<WatchFolder> m_watch_folders;
+    std::size_t m_worker_threads = 0;
+    bool m_sniff_content = false;
+    DedupAction m_dedup = DedupAction::Off;
+    MetricsSettings m_metrics;
+    LogSettings m_logging;
+    IoSettings m_io;
+    std::vector<RetentionPolicy> m_retention;
+    std::chrono::milliseconds m_stability_period;
     std::unordered_map<std::string, std::string> m_placeholders;
+    std::filesystem::path m_rules_path;
+    std::uint64_t m_content_hash = 0;
+    bool m_loaded_from_cache = false;
+    std::string m_compiled_rules;
 };
 
 #endif
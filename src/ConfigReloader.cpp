@@ -0,0 +1,239 @@
+#include "ConfigReloader.hpp"
+
+#include "ConfigParser.hpp"
+#include "Logger.hpp"
+
+#include <chrono>
+#include <string>
+#include <system_error>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <cerrno>
+#include <cstdint>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+// Editors often save in several steps (truncate, write, rename); wait for them to settle before parsing.
+constexpr auto kSettleDelay = std::chrono::milliseconds(300);
+
+#if defined(__linux__)
+std::string lastErrorMessage() {
+    return std::error_code(errno, std::generic_category()).message();
+}
+#endif
+} // namespace
+
+ConfigReloader::ConfigReloader(std::filesystem::path configRoot, FileMover& mover)
+    : m_configRoot(std::move(configRoot)), m_rulesPath(ConfigParser::rulesPathFor(m_configRoot.string())), m_mover(mover) {
+    // The rules already in use came from the file as it is now.
+    std::error_code ec;
+    const auto writeTime = std::filesystem::last_write_time(m_rulesPath, ec);
+    if (!ec) {
+        m_loadedWriteTime = writeTime;
+    }
+}
+
+ConfigReloader::~ConfigReloader() {
+    stop();
+}
+
+#ifdef _WIN32
+bool ConfigReloader::start() {
+    m_stopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (m_stopEvent == nullptr) {
+        Logger::warning() << "Failed to create the config reload stop event; rules.json changes need a restart.";
+        return false;
+    }
+
+    // Watch the folder rather than the file: saving through a temporary and a rename replaces the file itself.
+    m_changeHandle = FindFirstChangeNotificationW(m_rulesPath.parent_path().wstring().c_str(), FALSE,
+                                                  FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+    if (m_changeHandle == INVALID_HANDLE_VALUE) {
+        m_changeHandle = nullptr;
+        Logger::warning() << "Failed to watch `" << m_rulesPath.parent_path().string() << "` (error " << GetLastError()
+                          << "); rules.json changes need a restart.";
+        closeAll();
+        return false;
+    }
+
+    m_thread = std::thread([this]() { run(); });
+    return true;
+}
+
+void ConfigReloader::stop() {
+    if (m_thread.joinable()) {
+        SetEvent(m_stopEvent);
+        m_thread.join();
+    }
+    closeAll();
+}
+
+void ConfigReloader::run() {
+    HANDLE handles[] = {m_stopEvent, m_changeHandle};
+    bool settling = false;
+    while (true) {
+        const DWORD timeout = settling ? static_cast<DWORD>(kSettleDelay.count()) : INFINITE;
+        const DWORD waitStatus = WaitForMultipleObjects(2, handles, FALSE, timeout);
+        if (waitStatus == WAIT_OBJECT_0 + 1) {
+            settling = true;
+            if (!FindNextChangeNotification(m_changeHandle)) {
+                Logger::warning() << "Lost the watch on `" << m_rulesPath.parent_path().string() << "`; rules.json changes need a restart.";
+                return;
+            }
+        } else if (waitStatus == WAIT_TIMEOUT) {
+            settling = false;
+            reload();
+        } else {
+            return;
+        }
+    }
+}
+
+void ConfigReloader::closeAll() {
+    if (m_changeHandle != nullptr) {
+        FindCloseChangeNotification(m_changeHandle);
+        m_changeHandle = nullptr;
+    }
+    if (m_stopEvent != nullptr) {
+        CloseHandle(m_stopEvent);
+        m_stopEvent = nullptr;
+    }
+}
+#elif defined(__linux__)
+bool ConfigReloader::start() {
+    m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    m_stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_inotifyFd < 0 || m_stopFd < 0) {
+        Logger::warning() << "Failed to set up config reloading: " << lastErrorMessage() << "; rules.json changes need a restart.";
+        closeAll();
+        return false;
+    }
+
+    // Watch the folder rather than the file: saving through a temporary and a rename replaces the file itself.
+    const auto configDir = m_rulesPath.parent_path();
+    if (inotify_add_watch(m_inotifyFd, configDir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) < 0) {
+        Logger::warning() << "Failed to watch `" << configDir.string() << "`: " << lastErrorMessage() << "; rules.json changes need a restart.";
+        closeAll();
+        return false;
+    }
+
+    m_thread = std::thread([this]() { run(); });
+    return true;
+}
+
+void ConfigReloader::stop() {
+    if (m_thread.joinable()) {
+        const std::uint64_t one = 1;
+        [[maybe_unused]] const ssize_t written = ::write(m_stopFd, &one, sizeof(one));
+        m_thread.join();
+    }
+    closeAll();
+}
+
+void ConfigReloader::run() {
+    const auto fileName = m_rulesPath.filename().native();
+    alignas(inotify_event) char buffer[4096];
+    bool settling = false;
+    while (true) {
+        pollfd fds[2] = {{m_stopFd, POLLIN, 0}, {m_inotifyFd, POLLIN, 0}};
+        const int ready = ::poll(fds, 2, settling ? static_cast<int>(kSettleDelay.count()) : -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Logger::warning() << "Config reloading stopped: " << lastErrorMessage();
+            return;
+        }
+
+        if (ready == 0) {
+            settling = false;
+            reload();
+            continue;
+        }
+
+        if (fds[0].revents != 0) {
+            return;
+        }
+
+        ssize_t length;
+        while ((length = ::read(m_inotifyFd, buffer, sizeof(buffer))) > 0) {
+            for (const char* cursor = buffer; cursor < buffer + length;) {
+                const auto* event = reinterpret_cast<const inotify_event*>(cursor);
+                cursor += sizeof(inotify_event) + event->len;
+                if (event->mask & IN_IGNORED) {
+                    Logger::warning() << "The config folder was removed; rules.json changes need a restart.";
+                    return;
+                }
+                if (event->len != 0 && fileName == event->name) {
+                    settling = true;
+                }
+            }
+        }
+    }
+}
+
+void ConfigReloader::closeAll() {
+    for (int* fd : {&m_stopFd, &m_inotifyFd}) {
+        if (*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+}
+#else
+bool ConfigReloader::start() {
+    Logger::warning() << "Config reloading is not supported on this platform; rules.json changes need a restart.";
+    return false;
+}
+
+void ConfigReloader::stop() {}
+
+void ConfigReloader::run() {}
+
+void ConfigReloader::closeAll() {}
+#endif
+
+bool ConfigReloader::reload() {
+    std::error_code ec;
+    const auto writeTime = std::filesystem::last_write_time(m_rulesPath, ec);
+    if (!ec && m_loadedWriteTime && writeTime == *m_loadedWriteTime) {
+        return true;
+    }
+
+    Logger::info() << "`" << m_rulesPath.string() << "` changed; reloading rules...";
+    ConfigParser parser;
+    if (!parser.load(m_configRoot.string())) {
+        Logger::warning() << "Keeping the rules already in use; fix rules.json and save it again.";
+        return false;
+    }
+
+    const auto watchFolders = parser.getWatchFolders();
+    if (watchFolders.empty()) {
+        Logger::warning() << "Reloaded configuration has no usable watch folder; keeping the rules already in use.";
+        return false;
+    }
+
+    // Only mark the file as loaded once it has been, so a broken save followed by a fix is always picked up.
+    if (!ec) {
+        m_loadedWriteTime = writeTime;
+    }
+    m_mover.reloadRules(watchFolders);
+    m_mover.setContentSniffing(parser.getSniffContent());
+    m_mover.setDedupAction(parser.getDedupAction());
+    m_mover.setIoSettings(parser.getIoSettings());
+    m_mover.setRetentionPolicies(parser.getRetentionPolicies());
+    Logger::setLevel(parser.getLogSettings().level);
+    Logger::setFormat(parser.getLogSettings().format);
+    if (!parser.loadedFromCache()) {
+        parser.storeCache(m_mover.serializeRules());
+    }
+    Logger::info() << "Rules reloaded.";
+    return true;
+}
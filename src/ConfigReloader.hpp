@@ -0,0 +1,50 @@
+#ifndef CONFIG_RELOADER_HPP
+#define CONFIG_RELOADER_HPP
+
+#include "FileMover.hpp"
+
+#include <filesystem>
+#include <optional>
+#include <thread>
+
+// Watches config/rules.json and, on its own thread, re-parses and recompiles it shortly after it changes, then
+// publishes the new rules to the mover. Moves never wait on a reload, and a file that fails to load leaves the
+// rules already in use untouched.
+class ConfigReloader {
+public:
+    // configRoot is the folder ConfigParser::load() was given.
+    ConfigReloader(std::filesystem::path configRoot, FileMover& mover);
+    // Stops the reload thread.
+    ~ConfigReloader();
+
+    ConfigReloader(const ConfigReloader&) = delete;
+    ConfigReloader& operator=(const ConfigReloader&) = delete;
+
+    // Start watching the config folder; returns false (after logging) when it can't be watched.
+    bool start();
+    // Stop watching and wait for a reload in progress to finish.
+    void stop();
+
+private:
+    // Wait for changes until stop() is called.
+    void run();
+    // Load, compile and publish the current file; returns false when the previous rules were kept.
+    bool reload();
+    void closeAll();
+
+    std::filesystem::path m_configRoot;
+    std::filesystem::path m_rulesPath;
+    FileMover& m_mover;
+    // Last modification time loaded, so notifications for other files in the folder don't cause reloads.
+    std::optional<std::filesystem::file_time_type> m_loadedWriteTime;
+#ifdef _WIN32
+    void* m_changeHandle = nullptr;
+    void* m_stopEvent = nullptr;
+#else
+    int m_inotifyFd = -1;
+    int m_stopFd = -1;
+#endif
+    std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include "ContentHash.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+namespace {
+constexpr std::uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+constexpr std::uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr std::uint64_t kPrime3 = 0x165667B19E3779F9ull;
+constexpr std::uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+constexpr std::uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+// Large sequential reads; files are hashed one at a time per worker.
+constexpr std::size_t kReadBufferSize = 1024 * 1024;
+
+constexpr std::uint64_t rotateLeft(std::uint64_t value, int bits) noexcept {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Little-endian loads; every platform the janitor builds for is little-endian.
+std::uint64_t read64(const unsigned char* bytes) noexcept {
+    std::uint64_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+std::uint32_t read32(const unsigned char* bytes) noexcept {
+    std::uint32_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+constexpr std::uint64_t mixRound(std::uint64_t lane, std::uint64_t input) noexcept {
+    return rotateLeft(lane + input * kPrime2, 31) * kPrime1;
+}
+
+constexpr std::uint64_t mergeRound(std::uint64_t hash, std::uint64_t lane) noexcept {
+    return (hash ^ mixRound(0, lane)) * kPrime1 + kPrime4;
+}
+
+// Consume every whole stripe in [bytes, bytes + length) and return how many bytes that was.
+std::size_t consumeStripes(std::uint64_t (&lanes)[4], const unsigned char* bytes, std::size_t length) noexcept {
+    std::uint64_t lane0 = lanes[0];
+    std::uint64_t lane1 = lanes[1];
+    std::uint64_t lane2 = lanes[2];
+    std::uint64_t lane3 = lanes[3];
+    std::size_t offset = 0;
+    for (; offset + 32 <= length; offset += 32) {
+        lane0 = mixRound(lane0, read64(bytes + offset));
+        lane1 = mixRound(lane1, read64(bytes + offset + 8));
+        lane2 = mixRound(lane2, read64(bytes + offset + 16));
+        lane3 = mixRound(lane3, read64(bytes + offset + 24));
+    }
+    lanes[0] = lane0;
+    lanes[1] = lane1;
+    lanes[2] = lane2;
+    lanes[3] = lane3;
+    return offset;
+}
+} // namespace
+
+ContentHash::ContentHash(std::uint64_t seed) noexcept
+    : m_lanes{seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1}, m_seed(seed), m_pending{} {}
+
+void ContentHash::update(const void* data, std::size_t length) noexcept {
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    m_totalLength += length;
+
+    if (m_pendingLength > 0) {
+        const std::size_t take = std::min(length, kStripeLength - m_pendingLength);
+        std::memcpy(m_pending + m_pendingLength, bytes, take);
+        m_pendingLength += take;
+        bytes += take;
+        length -= take;
+        if (m_pendingLength < kStripeLength) {
+            return;
+        }
+        consumeStripes(m_lanes, m_pending, kStripeLength);
+        m_pendingLength = 0;
+    }
+
+    const std::size_t consumed = consumeStripes(m_lanes, bytes, length);
+    m_pendingLength = length - consumed;
+    std::memcpy(m_pending, bytes + consumed, m_pendingLength);
+}
+
+std::uint64_t ContentHash::digest() const noexcept {
+    std::uint64_t hash;
+    if (m_totalLength >= kStripeLength) {
+        hash = rotateLeft(m_lanes[0], 1) + rotateLeft(m_lanes[1], 7) + rotateLeft(m_lanes[2], 12) + rotateLeft(m_lanes[3], 18);
+        for (const std::uint64_t lane : m_lanes) {
+            hash = mergeRound(hash, lane);
+        }
+    } else {
+        hash = m_seed + kPrime5;
+    }
+    hash += m_totalLength;
+
+    std::size_t offset = 0;
+    for (; offset + 8 <= m_pendingLength; offset += 8) {
+        hash = rotateLeft(hash ^ mixRound(0, read64(m_pending + offset)), 27) * kPrime1 + kPrime4;
+    }
+    if (offset + 4 <= m_pendingLength) {
+        hash = rotateLeft(hash ^ (static_cast<std::uint64_t>(read32(m_pending + offset)) * kPrime1), 23) * kPrime2 + kPrime3;
+        offset += 4;
+    }
+    for (; offset < m_pendingLength; ++offset) {
+        hash = rotateLeft(hash ^ (m_pending[offset] * kPrime5), 11) * kPrime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+std::optional<std::uint64_t> ContentHash::ofFile(const std::filesystem::path& file) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+        return std::nullopt;
+    }
+
+    ContentHash hash;
+    const auto buffer = std::make_unique<char[]>(kReadBufferSize);
+    while (in) {
+        in.read(buffer.get(), static_cast<std::streamsize>(kReadBufferSize));
+        hash.update(buffer.get(), static_cast<std::size_t>(in.gcount()));
+    }
+    if (in.bad()) {
+        return std::nullopt;
+    }
+    return hash.digest();
+}
+
+bool ContentHash::sameContents(const std::filesystem::path& first, const std::filesystem::path& second) {
+    std::ifstream firstIn(first, std::ios::binary);
+    std::ifstream secondIn(second, std::ios::binary);
+    if (!firstIn || !secondIn) {
+        return false;
+    }
+
+    const auto firstBuffer = std::make_unique<char[]>(kReadBufferSize);
+    const auto secondBuffer = std::make_unique<char[]>(kReadBufferSize);
+    while (firstIn && secondIn) {
+        firstIn.read(firstBuffer.get(), static_cast<std::streamsize>(kReadBufferSize));
+        secondIn.read(secondBuffer.get(), static_cast<std::streamsize>(kReadBufferSize));
+        const auto length = firstIn.gcount();
+        if (length != secondIn.gcount() || std::memcmp(firstBuffer.get(), secondBuffer.get(), static_cast<std::size_t>(length)) != 0) {
+            return false;
+        }
+    }
+    // Both must have ended together and cleanly.
+    return !firstIn.bad() && !secondIn.bad() && firstIn.eof() && secondIn.eof();
+}
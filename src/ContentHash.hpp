@@ -0,0 +1,35 @@
+#ifndef CONTENT_HASH_HPP
+#define CONTENT_HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+// Streaming XXH64 over file contents. Its four independent 64-bit lanes keep a core's multipliers busy
+// (and vectorize where the target has 64-bit lane multiplies), so hashing runs at memory speed rather than
+// being the bottleneck of reading a file. Not cryptographic: equal digests mark candidates, not proof.
+class ContentHash {
+public:
+    explicit ContentHash(std::uint64_t seed = 0) noexcept;
+
+    void update(const void* data, std::size_t length) noexcept;
+    std::uint64_t digest() const noexcept;
+
+    // Digest of the whole file, read sequentially through one buffer; nullopt when it can't be read.
+    static std::optional<std::uint64_t> ofFile(const std::filesystem::path& file);
+    // Whether both files can be read and hold the same bytes.
+    static bool sameContents(const std::filesystem::path& first, const std::filesystem::path& second);
+
+private:
+    static constexpr std::size_t kStripeLength = 32;
+
+    std::uint64_t m_lanes[4];
+    std::uint64_t m_seed;
+    std::uint64_t m_totalLength = 0;
+    // Bytes of a stripe not yet complete.
+    unsigned char m_pending[kStripeLength];
+    std::size_t m_pendingLength = 0;
+};
+
+#endif
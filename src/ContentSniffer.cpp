@@ -0,0 +1,460 @@
+#include "ContentSniffer.hpp"
+
+#include "ExtensionClassifier.hpp"
+
+#include <array>
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std::string_view_literals;
+
+namespace {
+// Bounded so a long-running watcher doesn't accumulate one entry per file it has ever seen.
+constexpr std::size_t kMaxCachedVerdicts = 16384;
+// Bytes of the head packed into the two words every signature is compared against.
+constexpr std::size_t kWordBytes = 16;
+
+struct TypeSpec {
+    std::string_view mimeType;
+    // Space separated, canonical one first.
+    std::string_view extensions;
+};
+
+constexpr std::array<TypeSpec, 39> kTypes{{
+    {"application/pdf", ".pdf .ai"},
+    {"image/png", ".png .apng"},
+    {"image/jpeg", ".jpg .jpeg .jpe .jfif"},
+    {"image/gif", ".gif"},
+    {"image/webp", ".webp"},
+    {"image/bmp", ".bmp .dib"},
+    {"image/tiff", ".tif .tiff .dng .cr2 .nef .arw"},
+    {"image/x-icon", ".ico"},
+    {"image/vnd.adobe.photoshop", ".psd"},
+    {"image/heic", ".heic .heif"},
+    {"image/avif", ".avif"},
+    {"audio/wav", ".wav"},
+    {"audio/mpeg", ".mp3"},
+    {"audio/flac", ".flac"},
+    {"audio/ogg", ".ogg .oga .opus .ogv .spx"},
+    {"audio/mp4", ".m4a .m4b .m4p"},
+    {"video/x-msvideo", ".avi"},
+    {"video/quicktime", ".mov .qt"},
+    {"video/mp4", ".mp4 .m4v .m4a .mov .3gp .3g2"},
+    {"video/x-matroska", ".mkv .webm .mka .mk3d"},
+    {"application/zip", ".zip .docx .xlsx .pptx .odt .ods .odp .epub .jar .apk .whl .nupkg .xpi .vsix .appx .msix .ipa .cbz .3mf"},
+    {"application/gzip", ".gz .tgz"},
+    {"application/x-bzip2", ".bz2 .tbz2 .tbz"},
+    {"application/x-xz", ".xz .txz"},
+    {"application/zstd", ".zst .tzst"},
+    {"application/x-7z-compressed", ".7z"},
+    {"application/vnd.rar", ".rar"},
+    {"application/x-tar", ".tar"},
+    {"application/vnd.ms-cab-compressed", ".cab"},
+    {"application/x-ole-storage", ".doc .xls .ppt .msi .msg .vsd .pub"},
+    {"application/vnd.debian.binary-package", ".deb"},
+    {"application/x-rpm", ".rpm"},
+    {"application/vnd.sqlite3", ".sqlite .sqlite3 .db"},
+    {"application/wasm", ".wasm"},
+    {"application/x-elf", ".so .o .elf .bin .run"},
+    {"application/vnd.microsoft.portable-executable", ".exe .dll .sys .scr .efi .cpl .ocx"},
+    {"font/woff", ".woff .woff2"},
+    {"font/otf", ".otf"},
+    {"application/rtf", ".rtf"},
+}};
+
+// One magic number: up to two byte runs at fixed offsets. Listed most specific first, since the lowest
+// matching entry wins (an MP4 brand before the bare `ftyp` box, for example).
+struct SignatureSpec {
+    std::string_view mimeType;
+    std::size_t offset;
+    std::string_view bytes;
+    std::size_t secondOffset = 0;
+    std::string_view secondBytes = {};
+};
+
+constexpr std::array<SignatureSpec, 46> kSignatures{{
+    {"application/pdf", 0, "%PDF-"sv},
+    {"image/png", 0, "\x89PNG\r\n\x1A\n"sv},
+    {"image/jpeg", 0, "\xFF\xD8\xFF"sv},
+    {"image/gif", 0, "GIF87a"sv},
+    {"image/gif", 0, "GIF89a"sv},
+    {"image/webp", 0, "RIFF"sv, 8, "WEBP"sv},
+    {"audio/wav", 0, "RIFF"sv, 8, "WAVE"sv},
+    {"video/x-msvideo", 0, "RIFF"sv, 8, "AVI "sv},
+    {"image/bmp", 0, "BM"sv, 6, "\0\0\0\0"sv},
+    {"image/tiff", 0, "II*\0"sv},
+    {"image/tiff", 0, "MM\0*"sv},
+    {"image/x-icon", 0, "\0\0\1\0"sv},
+    {"image/vnd.adobe.photoshop", 0, "8BPS"sv},
+    {"image/heic", 4, "ftypheic"sv},
+    {"image/heic", 4, "ftypheix"sv},
+    // Generic HEIF image and image-sequence brands, as written by many cameras and phones.
+    {"image/heic", 4, "ftypmif1"sv},
+    {"image/heic", 4, "ftypmsf1"sv},
+    {"image/avif", 4, "ftypavif"sv},
+    {"image/avif", 4, "ftypavis"sv},
+    {"video/quicktime", 4, "ftypqt  "sv},
+    {"audio/mp4", 4, "ftypM4A "sv},
+    {"video/mp4", 4, "ftyp"sv},
+    {"audio/mpeg", 0, "ID3"sv},
+    {"audio/flac", 0, "fLaC"sv},
+    {"audio/ogg", 0, "OggS"sv},
+    {"video/x-matroska", 0, "\x1A\x45\xDF\xA3"sv},
+    {"application/zip", 0, "PK\3\4"sv},
+    {"application/zip", 0, "PK\5\6"sv},
+    {"application/gzip", 0, "\x1F\x8B\x08"sv},
+    {"application/x-bzip2", 0, "BZh"sv},
+    {"application/x-xz", 0, "\xFD" "7zXZ\0"sv},
+    {"application/zstd", 0, "\x28\xB5\x2F\xFD"sv},
+    {"application/x-7z-compressed", 0, "7z\xBC\xAF\x27\x1C"sv},
+    {"application/vnd.rar", 0, "Rar!\x1A\x07"sv},
+    {"application/x-tar", 257, "ustar"sv},
+    {"application/vnd.ms-cab-compressed", 0, "MSCF\0\0\0\0"sv},
+    {"application/x-ole-storage", 0, "\xD0\xCF\x11\xE0\xA1\xB1\x1A\xE1"sv},
+    {"application/vnd.debian.binary-package", 0, "!<arch>\ndebian"sv},
+    {"application/x-rpm", 0, "\xED\xAB\xEE\xDB"sv},
+    {"application/vnd.sqlite3", 0, "SQLite format 3\0"sv},
+    {"application/wasm", 0, "\0asm"sv},
+    {"application/x-elf", 0, "\x7F" "ELF"sv},
+    {"application/vnd.microsoft.portable-executable", 0, "MZ"sv},
+    {"font/woff", 0, "wOFF"sv},
+    {"font/woff", 0, "wOF2"sv},
+    {"font/otf", 0, "OTTO"sv},
+}};
+
+constexpr std::size_t kSignatureCount = kSignatures.size();
+static_assert(kSignatureCount <= 64, "identify() tracks matches in a 64-bit mask");
+
+constexpr std::uint16_t typeIndex(std::string_view mimeType) {
+    for (std::size_t i = 0; i < kTypes.size(); ++i) {
+        if (kTypes[i].mimeType == mimeType) {
+            return static_cast<std::uint16_t>(i);
+        }
+    }
+    return ContentSniffer::kUnknown;
+}
+
+// Signatures compiled into parallel arrays of masks and expected values over the first kWordBytes bytes,
+// so identify() is a branch-free loop the compiler can vectorize. A run past those bytes (only tar's
+// `ustar`) is kept as a separate far check.
+struct SignatureTable {
+    std::array<std::uint64_t, kSignatureCount> mask0{};
+    std::array<std::uint64_t, kSignatureCount> value0{};
+    std::array<std::uint64_t, kSignatureCount> mask1{};
+    std::array<std::uint64_t, kSignatureCount> value1{};
+    std::array<std::uint16_t, kSignatureCount> minLength{};
+    std::array<std::uint16_t, kSignatureCount> farOffset{};
+    std::array<std::uint64_t, kSignatureCount> farMask{};
+    std::array<std::uint64_t, kSignatureCount> farValue{};
+    std::array<std::uint16_t, kSignatureCount> type{};
+    std::uint64_t hasFar = 0;
+    bool valid = true;
+};
+
+constexpr SignatureTable compileSignatures() {
+    SignatureTable table;
+    for (std::size_t i = 0; i < kSignatureCount; ++i) {
+        const SignatureSpec& spec = kSignatures[i];
+        table.type[i] = typeIndex(spec.mimeType);
+        if (table.type[i] == ContentSniffer::kUnknown || spec.bytes.empty()) {
+            table.valid = false;
+        }
+
+        const std::size_t offsets[2] = {spec.offset, spec.secondOffset};
+        const std::string_view runs[2] = {spec.bytes, spec.secondBytes};
+        for (std::size_t run = 0; run < 2; ++run) {
+            const std::size_t offset = offsets[run];
+            const std::string_view bytes = runs[run];
+            if (bytes.empty()) {
+                continue;
+            }
+
+            const std::size_t end = offset + bytes.size();
+            if (end > ContentSniffer::kHeadLength) {
+                table.valid = false;
+                continue;
+            }
+            if (end > table.minLength[i]) {
+                table.minLength[i] = static_cast<std::uint16_t>(end);
+            }
+
+            if (end <= kWordBytes) {
+                for (std::size_t b = 0; b < bytes.size(); ++b) {
+                    const std::size_t position = offset + b;
+                    const std::uint64_t byte = static_cast<unsigned char>(bytes[b]);
+                    const std::size_t shift = (position % 8) * 8;
+                    if (position < 8) {
+                        table.mask0[i] |= std::uint64_t{0xFF} << shift;
+                        table.value0[i] |= byte << shift;
+                    } else {
+                        table.mask1[i] |= std::uint64_t{0xFF} << shift;
+                        table.value1[i] |= byte << shift;
+                    }
+                }
+            } else if (offset >= kWordBytes && bytes.size() <= 8 && (table.hasFar & (std::uint64_t{1} << i)) == 0) {
+                table.hasFar |= std::uint64_t{1} << i;
+                table.farOffset[i] = static_cast<std::uint16_t>(offset);
+                for (std::size_t b = 0; b < bytes.size(); ++b) {
+                    const std::size_t shift = b * 8;
+                    table.farMask[i] |= std::uint64_t{0xFF} << shift;
+                    table.farValue[i] |= static_cast<std::uint64_t>(static_cast<unsigned char>(bytes[b])) << shift;
+                }
+            } else {
+                // A run straddling the packed words, or a second far run, isn't supported.
+                table.valid = false;
+            }
+        }
+    }
+    return table;
+}
+
+constexpr SignatureTable kTable = compileSignatures();
+static_assert(kTable.valid, "every signature must name a known type and fit the supported layout");
+
+// Little-endian packing done by hand so the masks above mean the same thing on every host.
+std::uint64_t loadWord(const unsigned char* bytes, std::size_t available) noexcept {
+    std::uint64_t word = 0;
+    for (std::size_t i = 0; i < 8 && i < available; ++i) {
+        word |= static_cast<std::uint64_t>(bytes[i]) << (i * 8);
+    }
+    return word;
+}
+
+bool equalsIgnoringCase(std::string_view left, std::string_view right) noexcept {
+    if (left.size() != right.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < left.size(); ++i) {
+        if (ExtensionClassifier::foldAscii(left[i]) != ExtensionClassifier::foldAscii(right[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#if defined(__linux__) && defined(O_NOATIME)
+// Sniffing shouldn't make every download look recently read; only allowed for files we own.
+constexpr int kNoAccessTime = O_NOATIME;
+#else
+constexpr int kNoAccessTime = 0;
+#endif
+} // namespace
+
+std::uint16_t ContentSniffer::identify(const unsigned char* head, std::size_t length) noexcept {
+    const std::uint64_t word0 = loadWord(head, length);
+    const std::uint64_t word1 = length > 8 ? loadWord(head + 8, length - 8) : 0;
+
+    std::uint64_t hits = 0;
+    for (std::size_t i = 0; i < kSignatureCount; ++i) {
+        const bool hit = ((word0 & kTable.mask0[i]) == kTable.value0[i]) & ((word1 & kTable.mask1[i]) == kTable.value1[i]) &
+                         (length >= kTable.minLength[i]);
+        hits |= static_cast<std::uint64_t>(hit) << i;
+    }
+
+    // The rare far runs are only checked for signatures that already matched everything else.
+    for (std::uint64_t pending = hits & kTable.hasFar; pending != 0; pending &= pending - 1) {
+        std::size_t i = 0;
+        while ((pending & (std::uint64_t{1} << i)) == 0) {
+            ++i;
+        }
+        const std::size_t offset = kTable.farOffset[i];
+        if ((loadWord(head + offset, length - offset) & kTable.farMask[i]) != kTable.farValue[i]) {
+            hits &= ~(std::uint64_t{1} << i);
+        }
+    }
+
+    if (hits == 0) {
+        return kUnknown;
+    }
+
+    std::size_t first = 0;
+    while ((hits & (std::uint64_t{1} << first)) == 0) {
+        ++first;
+    }
+    return kTable.type[first];
+}
+
+std::uint16_t ContentSniffer::sniff(const std::filesystem::path& file) {
+    unsigned char head[kHeadLength];
+    std::size_t length = 0;
+    Key key;
+
+#ifdef _WIN32
+    HANDLE handle = CreateFileW(file.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return kUnknown;
+    }
+
+    BY_HANDLE_FILE_INFORMATION info{};
+    if (!GetFileInformationByHandle(handle, &info)) {
+        CloseHandle(handle);
+        return kUnknown;
+    }
+
+    key.device = info.dwVolumeSerialNumber;
+    key.fileId = (static_cast<std::uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+    key.size = (static_cast<std::uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+    key.modified = static_cast<std::int64_t>((static_cast<std::uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) |
+                                             info.ftLastWriteTime.dwLowDateTime);
+
+    std::uint16_t type = kUnknown;
+    if (lookup(key, type)) {
+        CloseHandle(handle);
+        m_cacheHits.fetch_add(1, std::memory_order_relaxed);
+        return type;
+    }
+
+    // An explicit offset makes this a positioned read that ignores and leaves alone the handle's file pointer.
+    OVERLAPPED position{};
+    DWORD bytesRead = 0;
+    const BOOL readOk = ReadFile(handle, head, static_cast<DWORD>(kHeadLength), &bytesRead, &position);
+    CloseHandle(handle);
+    if (!readOk && GetLastError() != ERROR_HANDLE_EOF) {
+        return kUnknown;
+    }
+    length = bytesRead;
+#else
+    // A stat answers rescans of unchanged files without opening them at all.
+    auto makeKey = [](const struct stat& info) {
+        Key made;
+        made.device = static_cast<std::uint64_t>(info.st_dev);
+        made.fileId = static_cast<std::uint64_t>(info.st_ino);
+        made.size = static_cast<std::uint64_t>(info.st_size);
+        made.modified = static_cast<std::int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+        return made;
+    };
+
+    struct stat info {};
+    if (::stat(file.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+        return kUnknown;
+    }
+
+    std::uint16_t type = kUnknown;
+    if (lookup(makeKey(info), type)) {
+        m_cacheHits.fetch_add(1, std::memory_order_relaxed);
+        return type;
+    }
+
+    // O_NONBLOCK keeps a FIFO swapped in after the stat from blocking the caller.
+    constexpr int kFlags = O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK;
+    int fd = ::open(file.c_str(), kFlags | kNoAccessTime);
+    if (fd < 0 && errno == EPERM && kNoAccessTime != 0) {
+        fd = ::open(file.c_str(), kFlags);
+    }
+    if (fd < 0) {
+        return kUnknown;
+    }
+
+    // Key the verdict on what was actually read, in case the file changed since the stat.
+    if (::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        ::close(fd);
+        return kUnknown;
+    }
+    key = makeKey(info);
+
+    ssize_t bytesRead = 0;
+    do {
+        bytesRead = ::pread(fd, head, kHeadLength, 0);
+    } while (bytesRead < 0 && errno == EINTR);
+    ::close(fd);
+    if (bytesRead < 0) {
+        return kUnknown;
+    }
+    length = static_cast<std::size_t>(bytesRead);
+#endif
+
+    type = identify(head, length);
+    remember(key, type);
+    return type;
+}
+
+std::size_t ContentSniffer::typeCount() noexcept {
+    return kTypes.size();
+}
+
+std::string_view ContentSniffer::mimeType(std::uint16_t type) noexcept {
+    return type < kTypes.size() ? kTypes[type].mimeType : std::string_view{};
+}
+
+std::string_view ContentSniffer::canonicalExtension(std::uint16_t type) noexcept {
+    if (type >= kTypes.size()) {
+        return {};
+    }
+    const std::string_view extensions = kTypes[type].extensions;
+    return extensions.substr(0, extensions.find(' '));
+}
+
+bool ContentSniffer::mimeMatches(std::string_view pattern, std::uint16_t type) noexcept {
+    const std::string_view mime = mimeType(type);
+    if (mime.empty()) {
+        return false;
+    }
+
+    if (pattern.size() >= 2 && pattern.substr(pattern.size() - 2) == "/*") {
+        const std::size_t slash = mime.find('/');
+        return equalsIgnoringCase(pattern.substr(0, pattern.size() - 1), mime.substr(0, slash + 1));
+    }
+    return equalsIgnoringCase(pattern, mime);
+}
+
+bool ContentSniffer::validateMimePattern(std::string_view pattern, std::string& error) {
+    const std::size_t slash = pattern.find('/');
+    if (slash == std::string_view::npos || slash == 0 || slash + 1 == pattern.size() || pattern.find('/', slash + 1) != std::string_view::npos) {
+        error = "expected `type/subtype` or `type/*`";
+        return false;
+    }
+
+    const std::string_view subtype = pattern.substr(slash + 1);
+    if (pattern.substr(0, slash).find('*') != std::string_view::npos || (subtype != "*" && subtype.find('*') != std::string_view::npos)) {
+        error = "`*` is only allowed as the whole subtype";
+        return false;
+    }
+
+    for (char ch : pattern) {
+        if (static_cast<unsigned char>(ch) <= ' ' || static_cast<unsigned char>(ch) >= 0x7F) {
+            error = "MIME types may not contain spaces or non-ASCII characters";
+            return false;
+        }
+    }
+    return true;
+}
+
+std::uint64_t ContentSniffer::cacheHits() const {
+    return m_cacheHits.load(std::memory_order_relaxed);
+}
+
+std::size_t ContentSniffer::KeyHash::operator()(const Key& key) const noexcept {
+    std::uint64_t value = key.fileId * 0x9E3779B97F4A7C15ull;
+    value ^= key.device + 0x9E3779B97F4A7C15ull + (value << 6) + (value >> 2);
+    value ^= key.size + 0x9E3779B97F4A7C15ull + (value << 6) + (value >> 2);
+    value ^= static_cast<std::uint64_t>(key.modified) + 0x9E3779B97F4A7C15ull + (value << 6) + (value >> 2);
+    return static_cast<std::size_t>(value);
+}
+
+bool ContentSniffer::lookup(const Key& key, std::uint16_t& type) const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    auto it = m_verdicts.find(key);
+    if (it == m_verdicts.end()) {
+        return false;
+    }
+    type = it->second;
+    return true;
+}
+
+void ContentSniffer::remember(const Key& key, std::uint16_t type) {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    if (m_verdicts.size() >= kMaxCachedVerdicts) {
+        m_verdicts.clear();
+    }
+    m_verdicts[key] = type;
+}
@@ -0,0 +1,65 @@
+#ifndef CONTENT_SNIFFER_HPP
+#define CONTENT_SNIFFER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Identifies a file's type from its leading bytes ("magic numbers") so extensionless or mislabeled downloads
+// can still be routed. Only the first kHeadLength bytes are read, with one positioned read, and the verdict
+// is cached by file identity, size and modification time so rescans of an unchanged file never reread it.
+class ContentSniffer {
+public:
+    static constexpr std::uint16_t kUnknown = UINT16_MAX;
+    // Enough for every signature in the table, including the tar header at offset 257.
+    static constexpr std::size_t kHeadLength = 512;
+
+    // Content type of the file, or kUnknown when it cannot be read or matches no signature.
+    std::uint16_t sniff(const std::filesystem::path& file);
+    // Match leading bytes against every known signature in one pass; the most specific match wins.
+    static std::uint16_t identify(const unsigned char* head, std::size_t length) noexcept;
+
+    // Number of distinct type ids identify() can return.
+    static std::size_t typeCount() noexcept;
+    static std::string_view mimeType(std::uint16_t type) noexcept;
+    // The extension files of this type usually carry, e.g. ".jpg" for image/jpeg.
+    static std::string_view canonicalExtension(std::uint16_t type) noexcept;
+    // Whether a configured `mime_types` entry such as "image/png" or "image/*" covers the type.
+    static bool mimeMatches(std::string_view pattern, std::uint16_t type) noexcept;
+    // Syntax check used while loading the configuration: "type/subtype" or "type/*".
+    static bool validateMimePattern(std::string_view pattern, std::string& error);
+
+    // Number of sniff() calls answered from the cache without reading the file.
+    std::uint64_t cacheHits() const;
+
+private:
+    // Identifies one version of one file: a rename keeps it, any write changes the size or modification time.
+    struct Key {
+        std::uint64_t device = 0;
+        std::uint64_t fileId = 0;
+        std::uint64_t size = 0;
+        std::int64_t modified = 0;
+
+        bool operator==(const Key& other) const noexcept {
+            return device == other.device && fileId == other.fileId && size == other.size && modified == other.modified;
+        }
+    };
+
+    struct KeyHash {
+        std::size_t operator()(const Key& key) const noexcept;
+    };
+
+    bool lookup(const Key& key, std::uint16_t& type) const;
+    void remember(const Key& key, std::uint16_t type);
+
+    mutable std::shared_mutex m_mutex;
+    std::unordered_map<Key, std::uint16_t, KeyHash> m_verdicts;
+    std::atomic<std::uint64_t> m_cacheHits{0};
+};
+
+#endif
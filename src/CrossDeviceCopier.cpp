@@ -0,0 +1,255 @@
+#include "CrossDeviceCopier.hpp"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/sendfile.h>
+#endif
+#endif
+
+namespace {
+// Hidden prefix so a half-finished copy is never mistaken for a real file by users or rules.
+constexpr char kTemporaryPrefix[] = ".djtmp-";
+
+std::atomic<std::uint64_t> g_temporaryCounter{0};
+
+std::filesystem::path makeTemporaryPath(const std::filesystem::path& destinationDir) {
+#ifdef _WIN32
+    const auto processId = static_cast<std::uint64_t>(GetCurrentProcessId());
+#else
+    const auto processId = static_cast<std::uint64_t>(getpid());
+#endif
+    const std::string name = kTemporaryPrefix + std::to_string(processId) + "-" +
+                             std::to_string(g_temporaryCounter.fetch_add(1, std::memory_order_relaxed)) + ".part";
+    return destinationDir / name;
+}
+
+#ifndef _WIN32
+// Large chunks keep syscall overhead negligible for multi-GB files.
+constexpr std::size_t kKernelCopyChunk = 256 * 1024 * 1024;
+constexpr std::size_t kUserCopyBuffer = 1024 * 1024;
+// Throttled copies report back this often, so pacing stays smooth at any budget worth setting.
+constexpr std::size_t kThrottledCopyChunk = 1024 * 1024;
+
+std::error_code lastError() {
+    return std::error_code(errno, std::generic_category());
+}
+
+// True for errors that only mean "this copy mechanism isn't available here, try the next one".
+bool isUnsupported(int error) {
+    return error == EXDEV || error == EINVAL || error == ENOSYS || error == EOPNOTSUPP || error == ENOTTY ||
+           error == EBADF || error == EPERM;
+}
+
+// Copy in-> out with the fastest mechanism the kernel accepts; returns false with ec set on real errors.
+bool copyContents(int in, int out, std::uintmax_t size, const CrossDeviceCopier::Throttle& throttle, std::uintmax_t& copied,
+                  const char*& method, std::error_code& ec) {
+    copied = 0;
+#ifdef __linux__
+    // Reflinks share extents, so the "copy" is instant when both files live on the same CoW filesystem.
+    if (ioctl(out, FICLONE, in) == 0) {
+        copied = size;
+        method = "reflink";
+        return true;
+    }
+
+    const std::size_t kernelChunk = throttle ? kThrottledCopyChunk : kKernelCopyChunk;
+    bool kernelCopyUsable = true;
+    while (kernelCopyUsable) {
+        const ssize_t chunk = copy_file_range(in, nullptr, out, nullptr, kernelChunk, 0);
+        if (chunk > 0) {
+            copied += static_cast<std::uintmax_t>(chunk);
+            if (throttle) {
+                throttle(static_cast<std::uintmax_t>(chunk));
+            }
+            continue;
+        }
+        if (chunk == 0) {
+            method = "copy_file_range";
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (copied != 0 || !isUnsupported(errno)) {
+            ec = lastError();
+            return false;
+        }
+        kernelCopyUsable = false;
+    }
+
+    kernelCopyUsable = true;
+    while (kernelCopyUsable) {
+        const ssize_t chunk = sendfile(out, in, nullptr, kernelChunk);
+        if (chunk > 0) {
+            copied += static_cast<std::uintmax_t>(chunk);
+            if (throttle) {
+                throttle(static_cast<std::uintmax_t>(chunk));
+            }
+            continue;
+        }
+        if (chunk == 0) {
+            method = "sendfile";
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (copied != 0 || !isUnsupported(errno)) {
+            ec = lastError();
+            return false;
+        }
+        kernelCopyUsable = false;
+    }
+#else
+    (void)size;
+#endif
+
+    std::vector<char> buffer(kUserCopyBuffer);
+    while (true) {
+        const ssize_t readBytes = read(in, buffer.data(), buffer.size());
+        if (readBytes == 0) {
+            method = "read/write";
+            return true;
+        }
+        if (readBytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ec = lastError();
+            return false;
+        }
+
+        for (ssize_t written = 0; written < readBytes;) {
+            const ssize_t step = write(out, buffer.data() + written, static_cast<std::size_t>(readBytes - written));
+            if (step < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ec = lastError();
+                return false;
+            }
+            written += step;
+        }
+        copied += static_cast<std::uintmax_t>(readBytes);
+        if (throttle) {
+            throttle(static_cast<std::uintmax_t>(readBytes));
+        }
+    }
+}
+#endif
+} // namespace
+
+bool CrossDeviceCopier::copyToTemporary(const std::filesystem::path& source, const std::filesystem::path& destinationDir,
+                                        Result& result, std::error_code& ec, const Throttle& throttle) {
+    ec.clear();
+    result = Result{};
+    const auto temporaryPath = makeTemporaryPath(destinationDir);
+
+#ifdef _WIN32
+    // CopyFileExW keeps attributes and timestamps; FAIL_IF_EXISTS guards against a stale temp of the same name.
+    // The progress routine runs on this thread after each chunk CopyFileExW writes, so a throttle can pace it there.
+    struct Progress {
+        const Throttle* throttle;
+        std::uintmax_t reported = 0;
+    } progress{&throttle};
+    LPPROGRESS_ROUTINE onProgress = [](LARGE_INTEGER, LARGE_INTEGER transferred, LARGE_INTEGER, LARGE_INTEGER, DWORD, DWORD, HANDLE,
+                                       HANDLE, LPVOID data) -> DWORD {
+        auto& state = *static_cast<Progress*>(data);
+        const auto total = static_cast<std::uintmax_t>(transferred.QuadPart);
+        if (total > state.reported) {
+            (*state.throttle)(total - state.reported);
+            state.reported = total;
+        }
+        return PROGRESS_CONTINUE;
+    };
+    if (!CopyFileExW(source.wstring().c_str(), temporaryPath.wstring().c_str(), throttle ? onProgress : nullptr, &progress, nullptr,
+                     COPY_FILE_FAIL_IF_EXISTS)) {
+        ec = std::error_code(static_cast<int>(GetLastError()), std::system_category());
+        return false;
+    }
+
+    HANDLE handle = CreateFileW(temporaryPath.wstring().c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE || !FlushFileBuffers(handle)) {
+        ec = std::error_code(static_cast<int>(GetLastError()), std::system_category());
+        if (handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(handle);
+        }
+        DeleteFileW(temporaryPath.wstring().c_str());
+        return false;
+    }
+    CloseHandle(handle);
+
+    std::error_code sizeErr;
+    result.bytesCopied = std::filesystem::file_size(temporaryPath, sizeErr);
+    result.method = "CopyFileEx";
+#else
+    const int in = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        ec = lastError();
+        return false;
+    }
+
+    struct stat info {};
+    if (fstat(in, &info) != 0) {
+        ec = lastError();
+        ::close(in);
+        return false;
+    }
+
+#ifdef __linux__
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    // O_EXCL plus a process-unique name means we never write into a file someone else owns.
+    const int out = ::open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (out < 0) {
+        ec = lastError();
+        ::close(in);
+        return false;
+    }
+
+    const timespec times[2] = {info.st_atim, info.st_mtim};
+    bool ok = copyContents(in, out, static_cast<std::uintmax_t>(info.st_size), throttle, result.bytesCopied, result.method, ec);
+    if (ok && fchmod(out, info.st_mode & 07777) != 0) {
+        ec = lastError();
+        ok = false;
+    }
+    if (ok && futimens(out, times) != 0) {
+        ec = lastError();
+        ok = false;
+    }
+    if (ok && fsync(out) != 0) {
+        ec = lastError();
+        ok = false;
+    }
+
+    if (::close(out) != 0 && ok) {
+        ec = lastError();
+        ok = false;
+    }
+    ::close(in);
+
+    if (!ok) {
+        ::unlink(temporaryPath.c_str());
+        return false;
+    }
+#endif
+
+    result.temporaryPath = temporaryPath;
+    return true;
+}
@@ -0,0 +1,31 @@
+#ifndef CROSS_DEVICE_COPIER_HPP
+#define CROSS_DEVICE_COPIER_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <system_error>
+
+// Copies a file onto another volume without ever exposing a partially written file under its final name.
+// The data lands in a hidden temporary file inside the destination directory, which the caller renames
+// into place once copyToTemporary() has made it durable.
+class CrossDeviceCopier {
+public:
+    // Called with the size of each piece of data as it is written, e.g. to pace the copy; may block.
+    using Throttle = std::function<void(std::uintmax_t bytes)>;
+
+    struct Result {
+        std::filesystem::path temporaryPath;
+        std::uintmax_t bytesCopied = 0;
+        // Which kernel path moved the bytes (e.g. "reflink", "copy_file_range"), for logging.
+        const char* method = "";
+    };
+
+    // Copy source into a fresh temporary file in destinationDir, carrying over permissions and modification
+    // time, then fsync it. On failure nothing is left behind and ec describes the error. With a throttle, data
+    // is written in pieces of at most 1 MiB, each reported to it; reflinks write no data and report nothing.
+    static bool copyToTemporary(const std::filesystem::path& source, const std::filesystem::path& destinationDir,
+                                Result& result, std::error_code& ec, const Throttle& throttle = nullptr);
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "DestinationNameIndex.hpp"
+
+#include "DirectoryScanner.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <system_error>
+
+#ifdef _WIN32
+#include <cwctype>
+#endif
+
+namespace {
+// Joins stem and extension in suffix-counter keys; it can never appear inside a file name.
+constexpr std::filesystem::path::value_type kKeySeparator = '/';
+}
+
+std::filesystem::path DestinationNameIndex::reserve(const std::filesystem::path& directory, const std::filesystem::path& fileName) {
+    auto names = entryFor(directory);
+    std::lock_guard<std::mutex> lock(names->mutex);
+    if (!names->loaded) {
+        load(directory, *names);
+    }
+
+    if (names->taken.insert(keyFor(fileName)).second) {
+        return fileName;
+    }
+
+    const auto stem = fileName.stem().native();
+    const auto extension = fileName.extension().native();
+    auto& next = names->nextSuffix[keyFor(stem + kKeySeparator + extension)];
+    next = std::max<std::uint64_t>(next, 1);
+
+    // The counter is already past every suffix seen, so this only loops if a name was taken some other way.
+    while (true) {
+        std::filesystem::path candidate = stem;
+        candidate += "_" + std::to_string(next++);
+        candidate += extension;
+        if (names->taken.insert(keyFor(candidate)).second) {
+            return candidate;
+        }
+    }
+}
+
+void DestinationNameIndex::release(const std::filesystem::path& directory, const std::filesystem::path& fileName) {
+    auto names = entryFor(directory);
+    std::lock_guard<std::mutex> lock(names->mutex);
+    names->taken.erase(keyFor(fileName));
+
+    // Hand the same suffix out again if it was the latest one, so an aborted attempt leaves no gap.
+    Key counterKey;
+    std::uint64_t suffix = 0;
+    if (parseSuffix(fileName, counterKey, suffix)) {
+        auto it = names->nextSuffix.find(counterKey);
+        if (it != names->nextSuffix.end() && it->second == suffix + 1) {
+            it->second = suffix;
+        }
+    }
+}
+
+void DestinationNameIndex::invalidate(const std::filesystem::path& directory) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_directories.erase(directory.native());
+}
+
+std::shared_ptr<DestinationNameIndex::DirectoryNames> DestinationNameIndex::entryFor(const std::filesystem::path& directory) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& entry = m_directories[directory.native()];
+    if (!entry) {
+        entry = std::make_shared<DirectoryNames>();
+    }
+    return entry;
+}
+
+DestinationNameIndex::Key DestinationNameIndex::keyFor(const std::filesystem::path& name) {
+    Key key = name.native();
+#ifdef _WIN32
+    std::transform(key.begin(), key.end(), key.begin(), [](wchar_t ch) {
+        return static_cast<wchar_t>(std::towlower(ch));
+    });
+#endif
+    return key;
+}
+
+void DestinationNameIndex::load(const std::filesystem::path& directory, DirectoryNames& names) {
+    // A missing directory simply starts empty; the caller creates it before moving anything in.
+    std::error_code ec;
+    DirectoryScanner scanner;
+    scanner.list(directory, [&names](DirectoryScanner::NameView name, DirectoryScanner::EntryType) {
+        recordName(names, name);
+    }, ec);
+    names.loaded = true;
+}
+
+void DestinationNameIndex::recordName(DirectoryNames& names, const std::filesystem::path& fileName) {
+    names.taken.insert(keyFor(fileName));
+
+    Key counterKey;
+    std::uint64_t suffix = 0;
+    if (parseSuffix(fileName, counterKey, suffix)) {
+        auto& next = names.nextSuffix[counterKey];
+        next = std::max(next, suffix + 1);
+    }
+}
+
+bool DestinationNameIndex::parseSuffix(const std::filesystem::path& fileName, Key& counterKey, std::uint64_t& suffix) {
+    const auto stem = fileName.stem().native();
+    const auto underscore = stem.find_last_of('_');
+    if (underscore == Key::npos || underscore + 1 == stem.size()) {
+        return false;
+    }
+
+    suffix = 0;
+    for (std::size_t i = underscore + 1; i < stem.size(); ++i) {
+        if (stem[i] < '0' || stem[i] > '9' || suffix > (UINT64_MAX - 9) / 10) {
+            return false;
+        }
+        suffix = suffix * 10 + static_cast<std::uint64_t>(stem[i] - '0');
+    }
+
+    counterKey = keyFor(stem.substr(0, underscore) + kKeySeparator + fileName.extension().native());
+    return true;
+}
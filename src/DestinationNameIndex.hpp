@@ -0,0 +1,47 @@
+#ifndef DESTINATION_NAME_INDEX_HPP
+#define DESTINATION_NAME_INDEX_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+// In-memory index of the file names present in each destination directory. It hands out
+// collision-free names directly instead of probing `stem_1`, `stem_2`, ... with one stat each.
+class DestinationNameIndex {
+public:
+    // Reserve a name for fileName inside directory: the name itself when free, otherwise `stem_N.ext` with
+    // N one past the highest suffix seen for that stem. The directory is listed once, on first use.
+    std::filesystem::path reserve(const std::filesystem::path& directory, const std::filesystem::path& fileName);
+    // Give back a reservation whose move failed for a reason other than the name being taken.
+    void release(const std::filesystem::path& directory, const std::filesystem::path& fileName);
+    // Drop everything known about the directory so the next reservation lists it again.
+    void invalidate(const std::filesystem::path& directory);
+
+private:
+    using Key = std::filesystem::path::string_type;
+
+    struct DirectoryNames {
+        std::mutex mutex;
+        bool loaded = false;
+        std::unordered_set<Key> taken;
+        // Next suffix to hand out per `stem` + separator + `extension`.
+        std::unordered_map<Key, std::uint64_t> nextSuffix;
+    };
+
+    std::shared_ptr<DirectoryNames> entryFor(const std::filesystem::path& directory);
+    // Lookup key for a name; folds case on Windows where names differing only in case collide.
+    static Key keyFor(const std::filesystem::path& name);
+    static void load(const std::filesystem::path& directory, DirectoryNames& names);
+    // Record a taken name and bump the suffix counter if it looks like `stem_N.ext`.
+    static void recordName(DirectoryNames& names, const std::filesystem::path& fileName);
+    // Split `stem_N.ext` into its suffix-counter key and N; false when the name has no numeric suffix.
+    static bool parseSuffix(const std::filesystem::path& fileName, Key& counterKey, std::uint64_t& suffix);
+
+    std::mutex m_mutex;
+    std::unordered_map<Key, std::shared_ptr<DirectoryNames>> m_directories;
+};
+
+#endif
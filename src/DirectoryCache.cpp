@@ -0,0 +1,46 @@
+#include "DirectoryCache.hpp"
+
+#include <mutex>
+
+void DirectoryCache::reset(const std::vector<std::filesystem::path>& destinations) {
+    std::unordered_set<std::filesystem::path::string_type> known;
+    for (const auto& destination : destinations) {
+        // Only record what is already there; folders for rules that never fire are not created up front.
+        std::error_code ec;
+        if (std::filesystem::is_directory(destination, ec) && !ec) {
+            known.insert(destination.native());
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    m_known = std::move(known);
+}
+
+bool DirectoryCache::ensure(const std::filesystem::path& directory, std::error_code& ec) {
+    ec.clear();
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        if (m_known.count(directory.native()) != 0) {
+            m_savedChecks.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    std::filesystem::create_directories(directory, ec);
+    if (ec) {
+        return false;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    m_known.insert(directory.native());
+    return true;
+}
+
+void DirectoryCache::invalidate(const std::filesystem::path& directory) {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    m_known.erase(directory.native());
+}
+
+std::uint64_t DirectoryCache::savedChecks() const {
+    return m_savedChecks.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,31 @@
+#ifndef DIRECTORY_CACHE_HPP
+#define DIRECTORY_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <shared_mutex>
+#include <system_error>
+#include <unordered_set>
+#include <vector>
+
+// Remembers which destination directories are known to exist so create_directories runs once per
+// directory instead of once per moved file.
+class DirectoryCache {
+public:
+    // Forget everything and record which of the given destinations already exist (one stat each).
+    void reset(const std::vector<std::filesystem::path>& destinations);
+    // Make sure the directory exists, creating it on first use; returns false and sets ec on failure.
+    bool ensure(const std::filesystem::path& directory, std::error_code& ec);
+    // Drop the directory from the cache, e.g. after a move fails with ENOENT or a watcher saw it removed.
+    void invalidate(const std::filesystem::path& directory);
+    // Number of create_directories calls (each at least one stat) answered from the cache instead.
+    std::uint64_t savedChecks() const;
+
+private:
+    mutable std::shared_mutex m_mutex;
+    std::unordered_set<std::filesystem::path::string_type> m_known;
+    std::atomic<std::uint64_t> m_savedChecks{0};
+};
+
+#endif
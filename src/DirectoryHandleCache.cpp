@@ -0,0 +1,81 @@
+#include "DirectoryHandleCache.hpp"
+
+#include "PlatformFs.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+// Recursive sweeps touch one source directory per subfolder; past this many open handles start over.
+constexpr std::size_t kMaxHandles = 256;
+} // namespace
+
+DirectoryHandleCache::Handle::~Handle() {
+#ifndef _WIN32
+    ::close(fd);
+#endif
+}
+
+bool DirectoryHandleCache::renameNoReplace(const std::filesystem::path& fromDir, const std::filesystem::path& fromName,
+                                           const std::filesystem::path& toDir, const std::filesystem::path& toName,
+                                           std::error_code& ec) {
+#ifndef _WIN32
+    const auto from = handleFor(fromDir);
+    const auto to = from ? handleFor(toDir) : nullptr;
+    if (from && to) {
+        if (platform::renameNoReplaceAt(from->fd, fromName, to->fd, toName, ec) || ec != std::errc::no_such_file_or_directory) {
+            return !ec;
+        }
+        // A directory deleted and recreated since it was opened leaves a handle to the dead one; go by path
+        // this once, which also reports a genuinely missing file or directory the way callers expect.
+        invalidate(fromDir);
+        invalidate(toDir);
+    }
+#endif
+    return platform::renameNoReplace(fromDir / fromName, toDir / toName, ec);
+}
+
+void DirectoryHandleCache::invalidate(const std::filesystem::path& directory) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_handles.erase(directory.native());
+}
+
+void DirectoryHandleCache::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_handles.clear();
+}
+
+std::shared_ptr<const DirectoryHandleCache::Handle> DirectoryHandleCache::handleFor(const std::filesystem::path& directory) {
+#ifdef _WIN32
+    (void)directory;
+    return nullptr;
+#else
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto it = m_handles.find(directory.native());
+        if (it != m_handles.end()) {
+            return it->second;
+        }
+    }
+
+    // O_PATH is all the *at() calls need: no read access to the directory, no open file description to speak of.
+#ifdef O_PATH
+    const int fd = ::open(directory.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+#else
+    const int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+#endif
+    if (fd < 0) {
+        return nullptr;
+    }
+    auto handle = std::make_shared<const Handle>(fd);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_handles.size() >= kMaxHandles) {
+        m_handles.clear();
+    }
+    // Another worker may have opened it meanwhile; either handle works, keep the one already shared.
+    return m_handles.emplace(directory.native(), std::move(handle)).first->second;
+#endif
+}
@@ -0,0 +1,41 @@
+#ifndef DIRECTORY_HANDLE_CACHE_HPP
+#define DIRECTORY_HANDLE_CACHE_HPP
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <unordered_map>
+
+// Open descriptors for the directories files are moved out of and into, so a move renames one name relative to
+// another (renameat2) instead of having the kernel walk both full paths again for every file. Handles are shared
+// with the moves using them and closed only once the last of those finishes. Without *at() calls (Windows)
+// moves simply go by path.
+class DirectoryHandleCache {
+public:
+    // Rename fromDir/fromName to toDir/toName, failing with errc::file_exists instead of replacing the target.
+    bool renameNoReplace(const std::filesystem::path& fromDir, const std::filesystem::path& fromName,
+                         const std::filesystem::path& toDir, const std::filesystem::path& toName, std::error_code& ec);
+    // Close the directory's handle, e.g. after a watcher saw it removed or renamed; the next move reopens it.
+    void invalidate(const std::filesystem::path& directory);
+    void clear();
+
+private:
+    struct Handle {
+        explicit Handle(int descriptor) : fd(descriptor) {}
+        ~Handle();
+
+        Handle(const Handle&) = delete;
+        Handle& operator=(const Handle&) = delete;
+
+        const int fd;
+    };
+
+    // The cached handle for directory, opening it on first use; nullptr when it can't be opened.
+    std::shared_ptr<const Handle> handleFor(const std::filesystem::path& directory);
+
+    std::mutex m_mutex;
+    std::unordered_map<std::filesystem::path::string_type, std::shared_ptr<const Handle>> m_handles;
+};
+
+#endif
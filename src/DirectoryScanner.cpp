@@ -0,0 +1,162 @@
+#include "DirectoryScanner.hpp"
+
+#ifdef __linux__
+#include <cerrno>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef __linux__
+// Large enough for several thousand entries per getdents64 call.
+constexpr std::size_t kBufferSize = 256 * 1024;
+
+// The file type of name inside dirFd, following a symlink when follow is set.
+bool modeAt(int dirFd, const char* name, bool follow, unsigned& mode) {
+    const int flags = follow ? 0 : AT_SYMLINK_NOFOLLOW;
+#ifdef STATX_TYPE
+    // Asking for the type alone lets filesystems that can skip fetching the rest of the inode do so.
+    struct statx info {};
+    if (::statx(dirFd, name, flags | AT_STATX_DONT_SYNC, STATX_TYPE, &info) != 0) {
+        return false;
+    }
+    mode = info.stx_mode;
+#else
+    struct stat info {};
+    if (::fstatat(dirFd, name, &info, flags) != 0) {
+        return false;
+    }
+    mode = info.st_mode;
+#endif
+    return true;
+}
+
+DirectoryScanner::EntryType entryType(int dirFd, const char* name, unsigned char type) {
+    using EntryType = DirectoryScanner::EntryType;
+    switch (type) {
+    case DT_REG:
+        return EntryType::File;
+    case DT_DIR:
+        return EntryType::Directory;
+    case DT_LNK:
+    case DT_UNKNOWN:
+        break;
+    default:
+        return EntryType::Other;
+    }
+
+    // Only links and filesystems that leave d_type empty (some network and FUSE ones) cost a stat.
+    bool followed = type == DT_LNK;
+    unsigned mode = 0;
+    if (!modeAt(dirFd, name, followed, mode)) {
+        return EntryType::Other;
+    }
+    if (!followed && S_ISLNK(mode)) {
+        followed = true;
+        if (!modeAt(dirFd, name, true, mode)) {
+            return EntryType::Other;
+        }
+    }
+    if (S_ISREG(mode)) {
+        return EntryType::File;
+    }
+    return S_ISDIR(mode) && !followed ? EntryType::Directory : EntryType::Other;
+}
+#endif
+} // namespace
+
+bool DirectoryScanner::list(const std::filesystem::path& directory, const Visitor& visit, std::error_code& ec) {
+    ec.clear();
+#ifdef __linux__
+    const int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        ec = std::error_code(errno, std::generic_category());
+        return false;
+    }
+
+    m_buffer.resize(kBufferSize);
+    while (true) {
+        const long filled = ::syscall(SYS_getdents64, fd, m_buffer.data(), m_buffer.size());
+        if (filled < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ec = std::error_code(errno, std::generic_category());
+            break;
+        }
+        if (filled == 0) {
+            break;
+        }
+
+        // glibc's dirent64 has the kernel's linux_dirent64 layout.
+        for (long offset = 0; offset < filled;) {
+            const auto* entry = reinterpret_cast<const struct dirent64*>(m_buffer.data() + offset);
+            offset += entry->d_reclen;
+
+            const std::string_view name(entry->d_name);
+            if (name == "." || name == "..") {
+                continue;
+            }
+            visit(name, entryType(fd, entry->d_name, entry->d_type));
+        }
+    }
+
+    ::close(fd);
+    return !ec;
+#else
+    for (std::filesystem::directory_iterator iter(directory, ec), end; !ec && iter != end; iter.increment(ec)) {
+        // Entry types come from the directory listing itself on Windows, so none of these stats the file.
+        std::error_code typeErr;
+        EntryType type = EntryType::Other;
+        if (iter->is_symlink(typeErr)) {
+            type = iter->is_regular_file(typeErr) ? EntryType::File : EntryType::Other;
+        } else if (iter->is_regular_file(typeErr)) {
+            type = EntryType::File;
+        } else if (iter->is_directory(typeErr)) {
+            type = EntryType::Directory;
+        }
+        visit(iter->path().filename().native(), type);
+    }
+    return !ec;
+#endif
+}
+
+bool DirectoryScanner::walk(const std::filesystem::path& directory, const std::function<bool(const std::filesystem::path&)>& descend,
+                            const std::function<void(const std::filesystem::path&)>& visitFile, std::error_code& ec) {
+    ec.clear();
+    // Depth first; subdirectories are queued while their parent is listed and opened once the listing is done.
+    std::vector<std::filesystem::path> pending{directory};
+    bool isRoot = true;
+    while (!pending.empty()) {
+        const auto current = std::move(pending.back());
+        pending.pop_back();
+
+        std::error_code listErr;
+        list(current, [&](NameView name, EntryType type) {
+            if (type == EntryType::Other) {
+                return;
+            }
+            auto path = current / name;
+            if (type == EntryType::File) {
+                visitFile(path);
+            } else if (descend(path)) {
+                pending.push_back(std::move(path));
+            }
+        }, listErr);
+
+        if (listErr && isRoot) {
+            ec = listErr;
+            return false;
+        }
+        isRoot = false;
+        if (listErr && !ec && listErr != std::errc::permission_denied && listErr != std::errc::no_such_file_or_directory &&
+            listErr != std::errc::not_a_directory) {
+            ec = listErr;
+        }
+    }
+    return !ec;
+}
@@ -0,0 +1,40 @@
+#ifndef DIRECTORY_SCANNER_HPP
+#define DIRECTORY_SCANNER_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+// Directory listing for sweeps over large trees. On Linux entries are read with getdents64 into one large,
+// reused buffer and typed from d_type, so a listing costs a handful of system calls however many entries it
+// has, and an entry is only stat'ed (relative to the open directory) when the filesystem leaves its type
+// unknown or it is a symlink. Elsewhere it falls back to std::filesystem. Not thread-safe; use one per thread.
+class DirectoryScanner {
+public:
+    using NameView = std::basic_string_view<std::filesystem::path::value_type>;
+
+    // Symlinks are reported as File when they point at a regular file and as Other otherwise, so walks
+    // never follow them into directories.
+    enum class EntryType : std::uint8_t { File, Directory, Other };
+
+    // Receives each entry's name (valid only during the call) and type; `.` and `..` are left out.
+    using Visitor = std::function<void(NameView name, EntryType type)>;
+
+    // List directory's entries. Returns false and sets ec when it can't be opened or read. visit must not use
+    // this scanner, whose buffer still holds the rest of the listing.
+    bool list(const std::filesystem::path& directory, const Visitor& visit, std::error_code& ec);
+
+    // List directory and every subdirectory below it for which descend returns true, calling visitFile with each
+    // regular file's path. Subdirectories that vanish or deny access mid-walk are skipped. Returns false and sets
+    // ec when directory can't be listed, or after the walk when some other subdirectory couldn't be.
+    bool walk(const std::filesystem::path& directory, const std::function<bool(const std::filesystem::path&)>& descend,
+              const std::function<void(const std::filesystem::path&)>& visitFile, std::error_code& ec);
+
+private:
+    std::vector<char> m_buffer;
+};
+
+#endif
@@ -0,0 +1,254 @@
+#include "DuplicateIndex.hpp"
+
+#include "ContentHash.hpp"
+#include "DirectoryScanner.hpp"
+#include "Logger.hpp"
+
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace {
+std::string entryLine(const std::filesystem::path& directory, const std::filesystem::path& name, const platform::FileIdentity& identity,
+                      std::uint64_t hash) {
+    json entry;
+    entry["dir"] = directory.u8string();
+    entry["name"] = name.u8string();
+    entry["device"] = identity.device;
+    entry["file"] = identity.fileId;
+    entry["size"] = identity.size;
+    entry["mtime"] = identity.modified;
+    entry["hash"] = hash;
+    return entry.dump(-1, ' ', false, json::error_handler_t::replace) + '\n';
+}
+} // namespace
+
+DuplicateIndex::DuplicateIndex(std::filesystem::path path) : m_path(std::move(path)) {}
+
+std::filesystem::path DuplicateIndex::pathFor(const std::filesystem::path& rulesPath) {
+    return rulesPath.parent_path() / "dedup.index";
+}
+
+std::optional<DedupAction> DuplicateIndex::parseAction(std::string_view name) {
+    if (name == "off") {
+        return DedupAction::Off;
+    }
+    if (name == "hardlink") {
+        return DedupAction::Hardlink;
+    }
+    if (name == "delete") {
+        return DedupAction::Delete;
+    }
+    if (name == "keep") {
+        return DedupAction::Keep;
+    }
+    return std::nullopt;
+}
+
+bool DuplicateIndex::open() {
+    {
+        std::ifstream in(m_path, std::ios::binary);
+        std::string line;
+        while (std::getline(in, line)) {
+            // A torn last line from a crash is simply skipped.
+            const json record = json::parse(line, nullptr, false);
+            if (!record.is_object() || !record.value("dir", json()).is_string() || !record.value("name", json()).is_string()) {
+                continue;
+            }
+            Entry entry;
+            entry.name = std::filesystem::u8path(record["name"].get<std::string>()).native();
+            entry.identity.device = record.value("device", std::uint64_t{0});
+            entry.identity.fileId = record.value("file", std::uint64_t{0});
+            entry.identity.size = record.value("size", std::uint64_t{0});
+            entry.identity.modified = record.value("mtime", std::int64_t{0});
+            entry.hash = record.value("hash", std::uint64_t{0});
+            const auto directory = std::filesystem::u8path(record["dir"].get<std::string>()).native();
+            m_stored[directory][entry.name] = std::move(entry);
+        }
+    }
+
+    // Keep only hashes that still describe their file, and write them back without the superseded lines.
+    auto temporary = m_path;
+    temporary += ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        for (auto directory = m_stored.begin(); directory != m_stored.end();) {
+            auto& names = directory->second;
+            for (auto it = names.begin(); it != names.end();) {
+                const std::filesystem::path path = std::filesystem::path(directory->first) / it->first;
+                if (platform::fileIdentity(path) != it->second.identity) {
+                    it = names.erase(it);
+                    continue;
+                }
+                out << entryLine(directory->first, it->first, it->second.identity, *it->second.hash);
+                ++it;
+            }
+            directory = names.empty() ? m_stored.erase(directory) : std::next(directory);
+        }
+        out.close();
+        if (!out) {
+            Logger::warning() << "Unable to write duplicate index `" << temporary.string() << "`; content hashes will not be kept.";
+            std::error_code cleanupErr;
+            std::filesystem::remove(temporary, cleanupErr);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temporary, m_path, ec);
+    if (ec) {
+        Logger::warning() << "Unable to replace duplicate index `" << m_path.string() << "`: " << ec.message();
+        std::filesystem::remove(temporary, ec);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_fileMutex);
+    m_out.open(m_path, std::ios::binary | std::ios::app);
+    return m_out.is_open();
+}
+
+std::optional<std::filesystem::path> DuplicateIndex::findDuplicate(const std::filesystem::path& file, const std::filesystem::path& directory) {
+    // Empty files are all alike, and not worth a link or a removal.
+    const auto identity = platform::fileIdentity(file);
+    if (!identity || identity->size == 0) {
+        return std::nullopt;
+    }
+
+    auto files = filesFor(directory);
+    std::vector<Entry> candidates;
+    {
+        std::lock_guard<std::mutex> lock(files->mutex);
+        if (!files->loaded) {
+            load(directory, *files);
+        }
+        const auto [first, last] = files->bySize.equal_range(identity->size);
+        for (auto it = first; it != last; ++it) {
+            candidates.push_back(it->second);
+        }
+    }
+    if (candidates.empty()) {
+        return std::nullopt;
+    }
+
+    // Hashing happens outside the lock, so moves into the same directory aren't held up behind a large file.
+    const auto hash = ContentHash::ofFile(file);
+    if (!hash) {
+        return std::nullopt;
+    }
+
+    for (auto& candidate : candidates) {
+        const auto path = directory / candidate.name;
+        const auto current = platform::fileIdentity(path);
+        if (current != candidate.identity) {
+            // Changed or gone since it was listed: re-file it under its current size, unhashed.
+            std::lock_guard<std::mutex> lock(files->mutex);
+            const auto [first, last] = files->bySize.equal_range(candidate.identity.size);
+            for (auto it = first; it != last; ++it) {
+                if (it->second.name == candidate.name) {
+                    files->bySize.erase(it);
+                    break;
+                }
+            }
+            if (!current) {
+                continue;
+            }
+            candidate.identity = *current;
+            candidate.hash.reset();
+            files->bySize.emplace(current->size, candidate);
+            if (current->size != identity->size) {
+                continue;
+            }
+        }
+
+        if (!candidate.hash) {
+            candidate.hash = ContentHash::ofFile(path);
+            if (!candidate.hash) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(files->mutex);
+            const auto [first, last] = files->bySize.equal_range(candidate.identity.size);
+            for (auto it = first; it != last; ++it) {
+                if (it->second.name == candidate.name && it->second.identity == candidate.identity) {
+                    it->second.hash = candidate.hash;
+                }
+            }
+            store(directory, candidate);
+        }
+
+        // XXH64 is not collision-resistant, and acting on a duplicate removes a file, so the bytes decide.
+        if (*candidate.hash == *hash && ContentHash::sameContents(file, path)) {
+            return path;
+        }
+    }
+    return std::nullopt;
+}
+
+void DuplicateIndex::added(const std::filesystem::path& directory, const std::filesystem::path& fileName) {
+    auto files = filesFor(directory);
+    std::lock_guard<std::mutex> lock(files->mutex);
+    // An unlisted directory picks the file up when it is first listed.
+    if (!files->loaded) {
+        return;
+    }
+    if (const auto identity = platform::fileIdentity(directory / fileName)) {
+        files->bySize.emplace(identity->size, Entry{fileName.native(), *identity, std::nullopt});
+    }
+}
+
+void DuplicateIndex::invalidate(const std::filesystem::path& directory) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_directories.erase(directory.native());
+}
+
+std::shared_ptr<DuplicateIndex::DirectoryFiles> DuplicateIndex::filesFor(const std::filesystem::path& directory) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& entry = m_directories[directory.native()];
+    if (!entry) {
+        entry = std::make_shared<DirectoryFiles>();
+    }
+    return entry;
+}
+
+void DuplicateIndex::load(const std::filesystem::path& directory, DirectoryFiles& files) {
+    std::unordered_map<Key, Entry> stored;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_stored.find(directory.native());
+        if (it != m_stored.end()) {
+            stored = std::move(it->second);
+            m_stored.erase(it);
+        }
+    }
+
+    // A missing directory simply starts empty; the caller creates it before moving anything in.
+    std::error_code ec;
+    DirectoryScanner scanner;
+    scanner.list(directory, [&](DirectoryScanner::NameView name, DirectoryScanner::EntryType type) {
+        if (type != DirectoryScanner::EntryType::File) {
+            return;
+        }
+        Entry entry{Key(name), {}, std::nullopt};
+        const auto identity = platform::fileIdentity(directory / name);
+        if (!identity) {
+            return;
+        }
+        entry.identity = *identity;
+        if (auto known = stored.find(entry.name); known != stored.end() && known->second.identity == entry.identity) {
+            entry.hash = known->second.hash;
+        }
+        files.bySize.emplace(entry.identity.size, std::move(entry));
+    }, ec);
+    files.loaded = true;
+}
+
+void DuplicateIndex::store(const std::filesystem::path& directory, const Entry& entry) {
+    std::lock_guard<std::mutex> lock(m_fileMutex);
+    if (m_out.is_open()) {
+        m_out << entryLine(directory, std::filesystem::path(entry.name), entry.identity, *entry.hash);
+        m_out.flush();
+    }
+}
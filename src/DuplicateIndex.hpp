@@ -0,0 +1,88 @@
+#ifndef DUPLICATE_INDEX_HPP
+#define DUPLICATE_INDEX_HPP
+
+#include "PlatformFs.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// What to do with a download whose exact contents already sit in its destination (`dedup`).
+enum class DedupAction : std::uint8_t {
+    // Move it like any other file; a name collision gets a `_N` suffix.
+    Off,
+    // Give it its usual destination name, but as a hard link to the existing copy, and remove the download.
+    Hardlink,
+    // Remove the download; the destination already has it.
+    Delete,
+    // Leave the download where it is.
+    Keep
+};
+
+// Finds files in a destination directory with the same contents as a file about to be moved there. Sizes are
+// compared first, from one listing of the directory. Only files whose size matches get hashed (XXH64, on the
+// calling move worker), and a hash match is confirmed byte by byte before anything is called a duplicate.
+// Hashes are kept per file, keyed by its identity (file id, size and modification time), and persisted as JSON
+// lines, so later runs never rehash a file that hasn't changed.
+class DuplicateIndex {
+public:
+    explicit DuplicateIndex(std::filesystem::path path);
+
+    DuplicateIndex(const DuplicateIndex&) = delete;
+    DuplicateIndex& operator=(const DuplicateIndex&) = delete;
+
+    // dedup.index, next to rules.json.
+    static std::filesystem::path pathFor(const std::filesystem::path& rulesPath);
+    // Parse `off`, `hardlink`, `delete` or `keep`.
+    static std::optional<DedupAction> parseAction(std::string_view name);
+
+    // Load the hashes earlier runs stored, dropping those of files that changed or went away, then start
+    // appending. Returns false (after logging) when the index can't be written; hashes then last one run.
+    bool open();
+
+    // A file in directory with exactly the contents of file, or nullopt when there is none.
+    std::optional<std::filesystem::path> findDuplicate(const std::filesystem::path& file, const std::filesystem::path& directory);
+    // Record that directory gained fileName, e.g. by a move into it.
+    void added(const std::filesystem::path& directory, const std::filesystem::path& fileName);
+    // Forget the directory's listing, e.g. after it was removed; it is listed again on next use.
+    void invalidate(const std::filesystem::path& directory);
+
+private:
+    using Key = std::filesystem::path::string_type;
+
+    struct Entry {
+        Key name;
+        platform::FileIdentity identity;
+        std::optional<std::uint64_t> hash;
+    };
+
+    struct DirectoryFiles {
+        std::mutex mutex;
+        bool loaded = false;
+        std::unordered_multimap<std::uint64_t, Entry> bySize;
+    };
+
+    std::shared_ptr<DirectoryFiles> filesFor(const std::filesystem::path& directory);
+    // List the directory and identify each file, reusing stored hashes where the identity still matches.
+    void load(const std::filesystem::path& directory, DirectoryFiles& files);
+    // Remember entry's hash for later runs.
+    void store(const std::filesystem::path& directory, const Entry& entry);
+
+    std::filesystem::path m_path;
+
+    std::mutex m_mutex;
+    std::unordered_map<Key, std::shared_ptr<DirectoryFiles>> m_directories;
+    // Hashes loaded from disk, per directory and then per file name, until that directory is first listed.
+    std::unordered_map<Key, std::unordered_map<Key, Entry>> m_stored;
+
+    std::mutex m_fileMutex;
+    std::ofstream m_out;
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "ExtensionClassifier.hpp"
+
+namespace {
+constexpr std::size_t kMinimumSlots = 16;
+
+constexpr bool isSeparator(ExtensionClassifier::CharT ch) {
+#ifdef _WIN32
+    return ch == L'/' || ch == L'\\';
+#else
+    return ch == '/';
+#endif
+}
+}
+
+void ExtensionClassifier::rebuild(const std::vector<Entry>& entries) {
+    // Keep the table at most half full so probe chains stay short.
+    std::size_t capacity = kMinimumSlots;
+    while (capacity < entries.size() * 2) {
+        capacity *= 2;
+    }
+
+    m_slots.assign(capacity, Slot{});
+    m_mask = capacity - 1;
+    m_size = 0;
+    m_keys.clear();
+
+    for (const auto& [extension, destinationId] : entries) {
+        if (extension.empty() || extension.size() > kMaxExtensionLength || destinationId == kNoMatch) {
+            continue;
+        }
+
+        const StringView key(extension);
+        const std::uint32_t keyHash = hash(key);
+        std::size_t index = keyHash & m_mask;
+        bool duplicate = false;
+        while (m_slots[index].destinationId != kNoMatch) {
+            if (m_slots[index].hash == keyHash && keyEquals(m_slots[index], key)) {
+                duplicate = true;
+                break;
+            }
+            index = (index + 1) & m_mask;
+        }
+
+        // First defined wins, matching the documented rule precedence.
+        if (duplicate) {
+            continue;
+        }
+
+        Slot& slot = m_slots[index];
+        slot.hash = keyHash;
+        slot.keyOffset = static_cast<std::uint32_t>(m_keys.size());
+        slot.length = static_cast<std::uint8_t>(key.size());
+        slot.destinationId = destinationId;
+        for (CharT ch : key) {
+            m_keys.push_back(static_cast<CharT>(foldAscii(ch)));
+        }
+        ++m_size;
+    }
+}
+
+std::uint16_t ExtensionClassifier::classify(StringView fileName) const noexcept {
+    if (m_size == 0) {
+        return kNoMatch;
+    }
+
+    // Walk back from the end to the last dot of the final component; hitting a separator first means no extension.
+    std::size_t dot = StringView::npos;
+    for (std::size_t i = fileName.size(); i > 0; --i) {
+        const CharT ch = fileName[i - 1];
+        if (ch == '.') {
+            dot = i - 1;
+            break;
+        }
+        if (isSeparator(ch)) {
+            return kNoMatch;
+        }
+    }
+
+    // A leading dot marks a hidden file (".bashrc"), not an extension.
+    if (dot == StringView::npos || dot == 0 || isSeparator(fileName[dot - 1])) {
+        return kNoMatch;
+    }
+
+    const StringView extension = fileName.substr(dot);
+    if (extension.size() > kMaxExtensionLength) {
+        return kNoMatch;
+    }
+
+    const std::uint32_t keyHash = hash(extension);
+    for (std::size_t index = keyHash & m_mask; m_slots[index].destinationId != kNoMatch; index = (index + 1) & m_mask) {
+        const Slot& slot = m_slots[index];
+        if (slot.hash == keyHash && keyEquals(slot, extension)) {
+            return slot.destinationId;
+        }
+    }
+    return kNoMatch;
+}
+
+std::size_t ExtensionClassifier::size() const noexcept {
+    return m_size;
+}
+
+void ExtensionClassifier::serialize(RuleCache::Writer& out) const {
+    out.array(m_slots);
+    out.value<std::uint64_t>(m_size);
+    out.string(m_keys);
+}
+
+bool ExtensionClassifier::restore(RuleCache::Reader& in) {
+    std::vector<Slot> slots;
+    std::uint64_t size = 0;
+    StringType keys;
+    if (!in.array(slots) || !in.value(size) || !in.string(keys)) {
+        return false;
+    }
+
+    // A power-of-two table with at least one free slot, so probing always terminates, and keys within bounds.
+    if (slots.size() < kMinimumSlots || (slots.size() & (slots.size() - 1)) != 0) {
+        return false;
+    }
+    std::size_t used = 0;
+    for (const Slot& slot : slots) {
+        if (slot.destinationId == kNoMatch) {
+            continue;
+        }
+        if (slot.length == 0 || slot.length > kMaxExtensionLength || slot.keyOffset > keys.size() ||
+            slot.length > keys.size() - slot.keyOffset) {
+            return false;
+        }
+        ++used;
+    }
+    if (used != size || used >= slots.size()) {
+        return false;
+    }
+
+    m_slots = std::move(slots);
+    m_mask = m_slots.size() - 1;
+    m_size = used;
+    m_keys = std::move(keys);
+    return true;
+}
+
+bool ExtensionClassifier::keyEquals(const Slot& slot, StringView extension) const noexcept {
+    if (slot.length != extension.size()) {
+        return false;
+    }
+
+    const CharT* key = m_keys.data() + slot.keyOffset;
+    for (std::size_t i = 0; i < extension.size(); ++i) {
+        if (foldAscii(key[i]) != foldAscii(extension[i])) {
+            return false;
+        }
+    }
+    return true;
+}
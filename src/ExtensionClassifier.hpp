@@ -0,0 +1,73 @@
+#ifndef EXTENSION_CLASSIFIER_HPP
+#define EXTENSION_CLASSIFIER_HPP
+
+#include "RuleCache.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Case-insensitive extension -> id lookup that never allocates while classifying.
+// Extensions live in one flat open-addressed table mapping to small integer IDs (FileMover uses rule ids),
+// so a lookup is a backwards scan for the dot, one hash and usually one probe.
+class ExtensionClassifier {
+public:
+    using CharT = std::filesystem::path::value_type;
+    using StringType = std::filesystem::path::string_type;
+    using StringView = std::basic_string_view<CharT>;
+    // (normalized extension including the dot, id)
+    using Entry = std::pair<StringType, std::uint16_t>;
+
+    static constexpr std::uint16_t kNoMatch = UINT16_MAX;
+    // Longer "extensions" are almost certainly just dotted names; refusing them keeps the table compact.
+    static constexpr std::size_t kMaxExtensionLength = 32;
+
+    // Replace the table. Entries must already be normalized; when an extension repeats, the first entry wins.
+    void rebuild(const std::vector<Entry>& entries);
+    // Id for the extension of the last component of fileName (bare name or full path), or kNoMatch.
+    std::uint16_t classify(StringView fileName) const noexcept;
+    std::size_t size() const noexcept;
+    // Copy the built table to or from a rule cache; restore() rejects a table that could not have been built.
+    void serialize(RuleCache::Writer& out) const;
+    bool restore(RuleCache::Reader& in);
+
+    // FNV-1a over ASCII-lowercased code units; constexpr so built-in tables can be hashed at compile time.
+    template <typename Char>
+    static constexpr std::uint32_t hash(std::basic_string_view<Char> text) noexcept {
+        std::uint32_t value = 2166136261u;
+        for (Char ch : text) {
+            value ^= static_cast<std::uint32_t>(foldAscii(ch));
+            value *= 16777619u;
+        }
+        return value;
+    }
+
+    template <typename Char>
+    static constexpr std::uint32_t foldAscii(Char ch) noexcept {
+        using Unsigned = std::make_unsigned_t<Char>;
+        const auto unit = static_cast<std::uint32_t>(static_cast<Unsigned>(ch));
+        return unit >= 'A' && unit <= 'Z' ? unit + ('a' - 'A') : unit;
+    }
+
+private:
+    struct Slot {
+        std::uint32_t hash = 0;
+        std::uint32_t keyOffset = 0;
+        std::uint16_t destinationId = kNoMatch;
+        std::uint8_t length = 0;
+    };
+
+    bool keyEquals(const Slot& slot, StringView extension) const noexcept;
+
+    std::vector<Slot> m_slots;
+    std::size_t m_mask = 0;
+    std::size_t m_size = 0;
+    // Every key back to back, so the table itself holds no pointers or per-key allocations.
+    StringType m_keys;
+};
+
+#endif
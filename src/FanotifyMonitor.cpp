@@ -0,0 +1,211 @@
+#include "FanotifyMonitor.hpp"
+
+#include "PlatformFs.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/fanotify.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+// Completed writes and arrivals are what the janitor acts on; directory moves also invalidate cached paths.
+constexpr std::uint64_t kEventMask = FAN_CLOSE_WRITE | FAN_MOVED_TO | FAN_MOVED_FROM | FAN_ONDIR;
+constexpr std::size_t kEventBufferSize = 64 * 1024;
+// A filesystem mark sees every directory on the volume, so keep the resolved-path cache bounded.
+constexpr std::size_t kMaxCachedDirectories = 65536;
+
+// Called through syscall() so the build doesn't depend on the libc shipping <sys/fanotify.h>.
+int fanotifyInit(unsigned int flags, unsigned int eventFlags) {
+    return static_cast<int>(::syscall(SYS_fanotify_init, flags, eventFlags));
+}
+
+int fanotifyMark(int fd, unsigned int flags, std::uint64_t mask, int dirFd, const char* path) {
+    return static_cast<int>(::syscall(SYS_fanotify_mark, fd, flags, mask, dirFd, path));
+}
+
+std::uint64_t fsidKey(const int (&value)[2]) {
+    return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(value[0])) << 32) | static_cast<std::uint32_t>(value[1]);
+}
+
+std::error_code lastError() {
+    return std::error_code(errno, std::generic_category());
+}
+} // namespace
+
+FanotifyMonitor::~FanotifyMonitor() {
+    for (const auto& [fsid, fd] : m_mountFds) {
+        ::close(fd);
+    }
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+bool FanotifyMonitor::open(std::error_code& ec) {
+    ec.clear();
+    m_fd = fanotifyInit(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY | O_CLOEXEC | O_LARGEFILE);
+    if (m_fd < 0) {
+        ec = lastError();
+        return false;
+    }
+    return true;
+}
+
+bool FanotifyMonitor::addRoot(const std::filesystem::path& root, std::error_code& ec) {
+    ec.clear();
+    // Not O_PATH: both fanotify_mark and open_by_handle_at refuse path-only descriptors.
+    const int anchor = ::open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (anchor < 0) {
+        ec = lastError();
+        return false;
+    }
+
+    struct statfs info {};
+    if (::fstatfs(anchor, &info) != 0) {
+        ec = lastError();
+        ::close(anchor);
+        return false;
+    }
+
+    if (fanotifyMark(m_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, kEventMask, anchor, nullptr) != 0) {
+        ec = lastError();
+        ::close(anchor);
+        return false;
+    }
+
+    int fsidValue[2];
+    std::memcpy(fsidValue, &info.f_fsid, sizeof(fsidValue));
+    const std::uint64_t fsid = fsidKey(fsidValue);
+    const bool known = std::any_of(m_mountFds.begin(), m_mountFds.end(), [fsid](const auto& entry) { return entry.first == fsid; });
+    if (known) {
+        ::close(anchor);
+    } else {
+        m_mountFds.emplace_back(fsid, anchor);
+    }
+
+    // Resolved handles come back as canonical paths, so compare against the canonical root.
+    std::error_code canonicalErr;
+    const auto canonicalRoot = std::filesystem::canonical(root, canonicalErr);
+    m_roots.push_back(canonicalErr ? root.lexically_normal() : canonicalRoot);
+    return true;
+}
+
+int FanotifyMonitor::fd() const {
+    return m_fd;
+}
+
+bool FanotifyMonitor::drain(std::vector<Event>& events, bool& overflowed) {
+    alignas(fanotify_event_metadata) char buffer[kEventBufferSize];
+    while (true) {
+        const ssize_t length = ::read(m_fd, buffer, sizeof(buffer));
+        if (length < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN;
+        }
+
+        bool directoryMoved = false;
+        for (const char* cursor = buffer; cursor + sizeof(fanotify_event_metadata) <= buffer + length;) {
+            const auto* metadata = reinterpret_cast<const fanotify_event_metadata*>(cursor);
+            if (metadata->event_len < sizeof(fanotify_event_metadata) || cursor + metadata->event_len > buffer + length) {
+                break;
+            }
+            const char* end = cursor + metadata->event_len;
+            const char* record = cursor + metadata->metadata_len;
+            cursor = end;
+
+            if (metadata->vers != FANOTIFY_METADATA_VERSION) {
+                continue;
+            }
+            if (metadata->mask & FAN_Q_OVERFLOW) {
+                overflowed = true;
+                continue;
+            }
+
+            const bool isDirectory = (metadata->mask & FAN_ONDIR) != 0;
+            if (isDirectory && (metadata->mask & (FAN_MOVED_FROM | FAN_MOVED_TO))) {
+                directoryMoved = true;
+            }
+            // A file leaving a directory is nothing to act on; directory moves only matter for the cache.
+            if (!(metadata->mask & (FAN_CLOSE_WRITE | FAN_MOVED_TO))) {
+                continue;
+            }
+
+            while (record + sizeof(fanotify_event_info_header) <= end) {
+                const auto* header = reinterpret_cast<const fanotify_event_info_header*>(record);
+                if (header->len == 0 || record + header->len > end) {
+                    break;
+                }
+
+                if (header->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+                    const auto* fid = reinterpret_cast<const fanotify_event_info_fid*>(record);
+                    const auto* handle = reinterpret_cast<const file_handle*>(fid->handle);
+                    const char* name = reinterpret_cast<const char*>(handle->f_handle + handle->handle_bytes);
+
+                    int fsidValue[2];
+                    std::memcpy(fsidValue, &fid->fsid, sizeof(fsidValue));
+                    const auto directory = resolveDirectory(fsidKey(fsidValue), handle);
+                    if (!directory.empty() && std::strcmp(name, ".") != 0) {
+                        auto path = directory / name;
+                        if (isBelowRoot(path)) {
+                            events.push_back(Event{std::move(path), isDirectory});
+                        }
+                    }
+                    break;
+                }
+                record += header->len;
+            }
+        }
+
+        if (directoryMoved) {
+            // Every cached path under the moved directory is now stale; re-resolving is cheap by comparison.
+            m_directoryPaths.clear();
+        }
+    }
+}
+
+std::filesystem::path FanotifyMonitor::resolveDirectory(std::uint64_t fsid, const void* handle) {
+    const auto* fileHandle = static_cast<const file_handle*>(handle);
+    std::string key(reinterpret_cast<const char*>(&fsid), sizeof(fsid));
+    key.append(reinterpret_cast<const char*>(fileHandle), sizeof(file_handle) + fileHandle->handle_bytes);
+
+    if (auto it = m_directoryPaths.find(key); it != m_directoryPaths.end()) {
+        return it->second;
+    }
+
+    auto mount = std::find_if(m_mountFds.begin(), m_mountFds.end(), [fsid](const auto& entry) { return entry.first == fsid; });
+    if (mount == m_mountFds.end()) {
+        return {};
+    }
+
+    // open_by_handle_at wants a mutable, suitably aligned handle, so hand it a copy.
+    std::vector<std::uint64_t> storage((sizeof(file_handle) + fileHandle->handle_bytes + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t));
+    std::memcpy(storage.data(), fileHandle, sizeof(file_handle) + fileHandle->handle_bytes);
+    const int directoryFd = ::open_by_handle_at(mount->second, reinterpret_cast<file_handle*>(storage.data()), O_PATH | O_CLOEXEC);
+    if (directoryFd < 0) {
+        return {};
+    }
+
+    std::error_code ec;
+    auto path = std::filesystem::read_symlink("/proc/self/fd/" + std::to_string(directoryFd), ec);
+    ::close(directoryFd);
+    if (ec) {
+        return {};
+    }
+
+    if (m_directoryPaths.size() >= kMaxCachedDirectories) {
+        m_directoryPaths.clear();
+    }
+    m_directoryPaths.emplace(std::move(key), path);
+    return path;
+}
+
+bool FanotifyMonitor::isBelowRoot(const std::filesystem::path& path) const {
+    return std::any_of(m_roots.begin(), m_roots.end(), [&path](const auto& root) { return platform::isSameOrBelow(path, root); });
+}
@@ -0,0 +1,53 @@
+#ifndef FANOTIFY_MONITOR_HPP
+#define FANOTIFY_MONITOR_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Reports completed writes and arrivals anywhere below a set of root folders through fanotify filesystem
+// marks, so a tree with hundreds of thousands of directories needs no per-directory watches. Events carry a
+// directory file handle plus a name, which are resolved back to paths with open_by_handle_at and cached.
+// Needs Linux 5.9+ and CAP_SYS_ADMIN/CAP_DAC_READ_SEARCH; open() or addRoot() fail cleanly otherwise.
+class FanotifyMonitor {
+public:
+    struct Event {
+        std::filesystem::path path;
+        // A directory moved into the tree; the files inside it raised no events of their own.
+        bool directory = false;
+    };
+
+    FanotifyMonitor() = default;
+    ~FanotifyMonitor();
+
+    FanotifyMonitor(const FanotifyMonitor&) = delete;
+    FanotifyMonitor& operator=(const FanotifyMonitor&) = delete;
+
+    // Create the fanotify group; returns false with ec set when the kernel or our privileges don't allow it.
+    bool open(std::error_code& ec);
+    // Mark the filesystem holding root and report events below root from now on.
+    bool addRoot(const std::filesystem::path& root, std::error_code& ec);
+    // Descriptor to poll for readability.
+    int fd() const;
+    // Read every pending event, appending those below a root; overflowed is set when the kernel dropped events.
+    // Returns false when the descriptor can no longer be read.
+    bool drain(std::vector<Event>& events, bool& overflowed);
+
+private:
+    // Path of the directory identified by a handle from an event, or empty when it can't be resolved.
+    std::filesystem::path resolveDirectory(std::uint64_t fsid, const void* handle);
+    bool isBelowRoot(const std::filesystem::path& path) const;
+
+    int m_fd = -1;
+    std::vector<std::filesystem::path> m_roots;
+    // Filesystem id -> an open descriptor on that filesystem, which open_by_handle_at needs as an anchor.
+    std::vector<std::pair<std::uint64_t, int>> m_mountFds;
+    // Raw directory handle -> path; flushed whenever a directory is renamed, since that changes its path.
+    std::unordered_map<std::string, std::filesystem::path> m_directoryPaths;
+};
+
+#endif
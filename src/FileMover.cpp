@@ -1,117 +1,1011 @@
 #include "FileMover.hpp"
 
+#include "CrossDeviceCopier.hpp"
+#include "DirectoryScanner.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "PlatformFs.hpp"
+#include "RuleCache.hpp"
+#include "StabilityTracker.hpp"
+
 #include <algorithm>
 #include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
 #include <filesystem>
-#include <iostream>
+#include <iterator>
+#include <string_view>
 #include <system_error>
+#include <thread>
+#include <utility>
 
 namespace {
-// Limit how many unique filenames we'll try when resolving collisions.
+// Limit how many names we'll try when other writers keep taking the ones the name index hands out.
 constexpr std::size_t kMaxCollisionAttempts = 50;
+// Upper bound for the automatic worker count; moves are I/O bound, so more threads rarely help.
+constexpr std::size_t kMaxDefaultWorkerThreads = 8;
+// Bounds the memory spent remembering reported files; past it they are simply reported once more.
+constexpr std::size_t kMaxReported = 65536;
+// Files per chunk handed from a sweep's listing thread to classification, and chunks allowed in between.
+constexpr std::size_t kScanChunkFiles = 512;
+constexpr std::size_t kMaxQueuedChunks = 16;
+// Filled in per file in dated destinations.
+constexpr std::string_view kDateTokens[] = {"{yyyy}", "{mm}", "{dd}"};
+
+std::size_t defaultWorkerThreads() {
+    const std::size_t hardwareThreads = std::thread::hardware_concurrency();
+    return std::clamp<std::size_t>(hardwareThreads, 4, kMaxDefaultWorkerThreads);
+}
 }
 
-FileMover::FileMover(std::filesystem::path watchFolder, std::vector<Rule> rules)
-    : m_watchFolder(std::move(watchFolder)), m_rules(std::move(rules)) {
-    rebuildLookup();
+FileMover::FileMover(std::vector<WatchFolder> watchFolders, std::size_t workerThreads, std::string_view compiledRules) {
+    updateWatchFolders(std::move(watchFolders), compiledRules);
+    m_pool = std::make_unique<MoveWorkerPool>(workerThreads == 0 ? defaultWorkerThreads() : workerThreads);
 }
 
-void FileMover::updateRules(std::vector<Rule> rules) {
-    m_rules = std::move(rules);
-    rebuildLookup();
+void FileMover::updateWatchFolders(std::vector<WatchFolder> watchFolders, std::string_view compiledRules) {
+    std::vector<RuleSet> ruleSets(watchFolders.size());
+    for (std::size_t i = 0; i < watchFolders.size(); ++i) {
+        ruleSets[i].watchFolder = std::move(watchFolders[i].path);
+        ruleSets[i].recursive = watchFolders[i].recursive;
+        ruleSets[i].rules = std::move(watchFolders[i].rules);
+    }
+    publish(compileSnapshot(std::move(ruleSets), compiledRules));
 }
 
-void FileMover::setWatchFolder(std::filesystem::path watchFolder) {
-    m_watchFolder = std::move(watchFolder);
+void FileMover::reloadRules(const std::vector<WatchFolder>& watchFolders) {
+    const auto current = snapshot();
+    std::vector<RuleSet> ruleSets;
+    ruleSets.reserve(current->ruleSets.size());
+    std::vector<bool> matched(watchFolders.size(), false);
+    for (const auto& existing : current->ruleSets) {
+        RuleSet ruleSet;
+        ruleSet.watchFolder = existing.watchFolder;
+        ruleSet.recursive = existing.recursive;
+
+        const auto normalized = existing.watchFolder.lexically_normal();
+        auto reloaded = std::find_if(watchFolders.begin(), watchFolders.end(), [&normalized](const WatchFolder& folder) {
+            return folder.path.lexically_normal() == normalized;
+        });
+        if (reloaded == watchFolders.end()) {
+            Logger::info() << "Watch folder `" << existing.watchFolder.string() << "` is no longer configured; it keeps its rules until a restart.";
+            ruleSet.rules = existing.rules;
+        } else {
+            matched[static_cast<std::size_t>(reloaded - watchFolders.begin())] = true;
+            if (reloaded->recursive != existing.recursive) {
+                Logger::info() << "Changing `recursive` for `" << existing.watchFolder.string() << "` takes effect after a restart.";
+            }
+            ruleSet.rules = reloaded->rules;
+        }
+        ruleSets.push_back(std::move(ruleSet));
+    }
+
+    for (std::size_t i = 0; i < watchFolders.size(); ++i) {
+        if (!matched[i]) {
+            Logger::info() << "New watch folder `" << watchFolders[i].path.string() << "` will be watched after a restart.";
+        }
+    }
+
+    // Compiling happens here, on the caller's thread; classification keeps using the old snapshot meanwhile.
+    publish(compileSnapshot(std::move(ruleSets)));
+}
+
+void FileMover::publish(std::shared_ptr<const RuleSnapshot> snapshot) {
+    std::lock_guard<std::mutex> lock(m_publishMutex);
+    // Re-seed the directory cache here too, so the stat per destination stays off the classification path.
+    m_directoryCache.reset(snapshot->destinations);
+    m_directoryHandles.clear();
+    std::atomic_store(&m_snapshot, std::move(snapshot));
+
+    std::lock_guard<std::mutex> reportedLock(m_reportedMutex);
+    m_reported.clear();
+}
+
+std::shared_ptr<const FileMover::RuleSnapshot> FileMover::snapshot() const {
+    return std::atomic_load(&m_snapshot);
+}
+
+void FileMover::setContentSniffing(bool enabled) {
+    if (m_sniffContent.exchange(enabled) != enabled) {
+        std::lock_guard<std::mutex> lock(m_reportedMutex);
+        m_reported.clear();
+    }
+}
+
+void FileMover::setJournal(MoveJournal* journal) {
+    m_journal = journal;
+}
+
+void FileMover::setIoSettings(const IoSettings& settings) {
+    m_io.configure(settings);
+}
+
+void FileMover::setDedupAction(DedupAction action) {
+    m_dedupAction.store(action, std::memory_order_relaxed);
+}
+
+void FileMover::setDuplicateIndex(DuplicateIndex* index) {
+    m_duplicates = index;
+}
+
+void FileMover::setRetentionIndex(RetentionIndex* index) {
+    m_retention = index;
+}
+
+void FileMover::setRetentionPolicies(std::vector<RetentionPolicy> policies) {
+    if (m_retention != nullptr) {
+        m_retention->configure(std::move(policies));
+    }
+}
+
+void FileMover::setCheckpoint(SweepCheckpoint* checkpoint) {
+    m_checkpoint = checkpoint;
+}
+
+void FileMover::setDryRun(PlanSink sink) {
+    m_planSink = std::move(sink);
+}
+
+void FileMover::setPlacedObserver(PlacedObserver observer) {
+    m_placedObserver = std::move(observer);
+}
+
+std::shared_ptr<const std::filesystem::path> FileMover::destinationFor(const std::filesystem::path& file) {
+    const auto rules = snapshot();
+    const RuleSet* ruleSet = ruleSetFor(*rules, file);
+    FileStat stat;
+    std::filesystem::path expanded;
+    std::size_t rule = 0;
+    const auto* destination = ruleSet ? resolveDestinationFor(*rules, *ruleSet, file, stat, expanded, rule) : nullptr;
+    if (destination == &expanded) {
+        return std::make_shared<const std::filesystem::path>(std::move(expanded));
+    }
+    // Share ownership with the snapshot instead of copying the path.
+    return destination ? std::shared_ptr<const std::filesystem::path>(rules, destination) : nullptr;
+}
+
+bool FileMover::isInsideDestination(const std::filesystem::path& path) const {
+    return isInsideDestination(*snapshot(), path);
+}
+
+bool FileMover::isInsideDestination(const RuleSnapshot& snapshot, const std::filesystem::path& path) {
+    std::error_code ec;
+    const auto normalized = std::filesystem::absolute(path, ec).lexically_normal();
+    if (ec) {
+        return false;
+    }
+    return std::any_of(snapshot.destinationRoots.begin(), snapshot.destinationRoots.end(), [&normalized](const auto& destination) {
+        return platform::isSameOrBelow(normalized, destination);
+    });
+}
+
+std::vector<std::filesystem::path> FileMover::destinationDirectories() const {
+    const auto rules = snapshot();
+    std::vector<std::filesystem::path> directories;
+    for (std::size_t i = 0; i < rules->destinations.size(); ++i) {
+        // Dated destinations are only known per file; what lies above the date is a directory like any other.
+        directories.push_back(rules->datedDestinations[i] ? undatedPart(rules->destinations[i]) : rules->destinations[i]);
+    }
+    return directories;
+}
+
+void FileMover::forgetDirectory(const std::filesystem::path& directory) {
+    m_directoryCache.invalidate(directory);
+    m_directoryHandles.invalidate(directory);
+    m_nameIndex.invalidate(directory);
+    if (m_duplicates != nullptr) {
+        m_duplicates->invalidate(directory);
+    }
+    if (m_retention != nullptr) {
+        m_retention->removedBelow(directory);
+    }
+}
+
+void FileMover::forgetFile(const std::filesystem::path& file) {
+    if (m_retention != nullptr) {
+        m_retention->removed(file);
+    }
+}
+
+std::uint64_t FileMover::directoryChecksSaved() const {
+    return m_directoryCache.savedChecks();
 }
 
 bool FileMover::organizeOnce() {
-    if (m_watchFolder.empty()) {
-        std::cerr << "Cannot organize files: watch folder has not been set." << std::endl;
+    const auto rules = snapshot();
+    if (rules->ruleSets.empty()) {
+        Logger::error() << "Cannot organize files: watch folder has not been set.";
         return false;
     }
 
+    if (m_checkpoint != nullptr && !m_checkpoint->begin(rulesFingerprint(*rules))) {
+        m_checkpoint = nullptr;
+    }
+    // A file may come to match a size or age condition (or stop matching one) while its directory stays untouched.
+    SweepCheckpoint* checkpoint = rules->dependsOnMetadata ? nullptr : m_checkpoint;
+
+    // One batch across every folder, so the pool works on all of them at once.
+    bool allSucceeded = true;
+    auto batch = std::make_shared<MoveBatch>();
+    for (const auto& ruleSet : rules->ruleSets) {
+        if (!organizeFolder(*rules, ruleSet, checkpoint, batch)) {
+            allSucceeded = false;
+        }
+    }
+
+    return waitForBatch(*batch) && allSucceeded;
+}
+
+bool FileMover::organizeFolder(const RuleSnapshot& snapshot, const RuleSet& ruleSet, SweepCheckpoint* checkpoint,
+                               const std::shared_ptr<MoveBatch>& batch) {
+    const auto& watchFolder = ruleSet.watchFolder;
+
     // Validate the target directory before trying to iterate over it.
     std::error_code ec;
-    if (!std::filesystem::exists(m_watchFolder, ec) || ec) {
-        std::cerr << "Watch folder `" << m_watchFolder.string() << "` is not accessible: " << (ec ? ec.message() : "path does not exist") << std::endl;
+    if (!std::filesystem::exists(watchFolder, ec) || ec) {
+        Logger::error() << "Watch folder `" << watchFolder.string() << "` is not accessible: " << (ec ? ec.message() : "path does not exist");
         return false;
     }
 
-    if (!std::filesystem::is_directory(m_watchFolder, ec) || ec) {
-        std::cerr << "Watch folder `" << m_watchFolder.string() << "` is not a directory." << std::endl;
+    if (!std::filesystem::is_directory(watchFolder, ec) || ec) {
+        Logger::error() << "Watch folder `" << watchFolder.string() << "` is not a directory.";
         return false;
     }
 
+    // Files are classified as they are found, so this includes their classify time as well.
+    StageTimer timer(Metrics::Stage::Enumerate);
+    // Three stages: this thread classifies what the scanning thread lists and hands the moves to the pool. The
+    // chunk queue and the pool's shard queues are bounded, so each stage waits for the next rather than buffer.
+    BoundedQueue<ScanChunk> chunks(kMaxQueuedChunks);
+    std::error_code scanErr;
+    std::thread lister([&]() {
+        scanFolder(snapshot, ruleSet, checkpoint, chunks, scanErr);
+        chunks.close();
+    });
+
     bool allSucceeded = true;
-    std::filesystem::directory_iterator iter(m_watchFolder, ec);
-    if (ec) {
-        std::cerr << "Unable to enumerate `" << m_watchFolder.string() << "`: " << ec.message() << std::endl;
+    // Whether anything in the directory being classified was moved or failed, which keeps it out of the checkpoint.
+    bool directoryTouched = false;
+    while (auto chunk = chunks.pop()) {
+        for (const auto& file : chunk->files) {
+            bool queued = false;
+            if (!dispatchFile(file, batch, std::nullopt, &queued)) {
+                allSucceeded = false;
+                directoryTouched = true;
+            }
+            directoryTouched = directoryTouched || queued;
+        }
+        if (!chunk->last) {
+            continue;
+        }
+        // Nothing moved and nothing arrived while it was listed: its files all stay put until it changes.
+        if (checkpoint != nullptr && !directoryTouched && chunk->timeBefore && chunk->timeBefore == chunk->timeAfter) {
+            checkpoint->complete(chunk->directory, *chunk->timeBefore);
+        }
+        directoryTouched = false;
+    }
+    lister.join();
+
+    if (scanErr) {
+        Logger::error() << "Unable to enumerate `" << watchFolder.string() << "`: " << scanErr.message();
         return false;
     }
+    return allSucceeded;
+}
+
+void FileMover::scanFolder(const RuleSnapshot& snapshot, const RuleSet& ruleSet, SweepCheckpoint* checkpoint, BoundedQueue<ScanChunk>& chunks,
+                           std::error_code& ec) {
+    ec.clear();
+    DirectoryScanner scanner;
+    std::vector<std::filesystem::path> pending{ruleSet.watchFolder};
+    bool isRoot = true;
+    while (!pending.empty()) {
+        ScanChunk chunk;
+        chunk.directory = std::move(pending.back());
+        pending.pop_back();
 
-    for (const auto& entry : iter) {
-        ec.clear();
-        if (!entry.is_regular_file(ec) || ec) {
+        // A settled directory is still listed for its subfolders, but none of its files are passed on.
+        if (checkpoint != nullptr) {
+            chunk.timeBefore = SweepCheckpoint::modificationTime(chunk.directory);
+        }
+        const bool settled = chunk.timeBefore && checkpoint->unchanged(chunk.directory, *chunk.timeBefore);
+
+        std::error_code listErr;
+        scanner.list(chunk.directory, [&](DirectoryScanner::NameView name, DirectoryScanner::EntryType type) {
+            if (type == DirectoryScanner::EntryType::File && !settled) {
+                chunk.files.push_back(chunk.directory / name);
+                if (chunk.files.size() == kScanChunkFiles) {
+                    ScanChunk full;
+                    full.directory = chunk.directory;
+                    full.files.swap(chunk.files);
+                    chunks.push(std::move(full));
+                }
+            } else if (type == DirectoryScanner::EntryType::Directory && ruleSet.recursive) {
+                // Destinations often live inside the watch folder; descending into them would re-sort sorted files.
+                // Nested watch folders are organized by their own rules.
+                auto path = chunk.directory / name;
+                if (!isInsideDestination(snapshot, path) && ruleSetFor(snapshot, path) == &ruleSet) {
+                    pending.push_back(std::move(path));
+                }
+            }
+        }, listErr);
+
+        if (listErr) {
+            chunk.timeBefore.reset();
+            if (isRoot) {
+                ec = listErr;
+                return;
+            }
+            if (!ec && listErr != std::errc::permission_denied && listErr != std::errc::no_such_file_or_directory &&
+                listErr != std::errc::not_a_directory) {
+                ec = listErr;
+            }
+        }
+        isRoot = false;
+
+        if (settled) {
             continue;
         }
+        if (chunk.timeBefore) {
+            chunk.timeAfter = SweepCheckpoint::modificationTime(chunk.directory);
+        }
+        chunk.last = true;
+        chunks.push(std::move(chunk));
+    }
+}
+
+std::uint64_t FileMover::rulesFingerprint(const RuleSnapshot& snapshot) const {
+    RuleCache::Writer out;
+    out.value<std::uint8_t>(m_sniffContent.load(std::memory_order_relaxed));
+    for (const auto& ruleSet : snapshot.ruleSets) {
+        out.string(ruleSet.watchFolder.native());
+        out.value<std::uint8_t>(ruleSet.recursive);
+        out.value<std::uint64_t>(ruleSet.rules.size());
+        for (const auto& rule : ruleSet.rules) {
+            for (const auto* values : {&rule.extensions, &rule.patterns, &rule.nameRegexes, &rule.mimeTypes}) {
+                out.value<std::uint64_t>(values->size());
+                for (const auto& value : *values) {
+                    out.string(value);
+                }
+            }
+            const auto& conditions = rule.conditions;
+            for (const auto* size : {&conditions.minSize, &conditions.maxSize}) {
+                out.value<std::uint8_t>(size->has_value());
+                out.value<std::uint64_t>(size->value_or(0));
+            }
+            for (const auto* age : {&conditions.olderThan, &conditions.newerThan, &conditions.notAccessedFor}) {
+                out.value<std::uint8_t>(age->has_value());
+                out.value<std::int64_t>(age->value_or(std::chrono::seconds(0)).count());
+            }
+            out.string(rule.destination);
+        }
+    }
+    return RuleCache::hashContents(out.data());
+}
 
-        const auto& filePath = entry.path();
-        const auto destinationDir = resolveDestinationFor(filePath);
-        if (destinationDir.empty()) {
-            std::cout << "No matching rule for `" << filePath.filename().string() << "`, leaving in place." << std::endl;
+bool FileMover::organizePaths(const std::vector<std::filesystem::path>& paths) {
+    bool allSucceeded = true;
+    auto batch = std::make_shared<MoveBatch>();
+    for (const auto& filePath : paths) {
+        // Deltas can be stale by the time they are processed; skip anything that is gone or not a file.
+        FileStat stat;
+        if (!stat.fetch(filePath, FileStat::Size)) {
             continue;
         }
 
-        // Ensure the destination exists before attempting the move.
-        std::error_code mkdirErr;
-        std::filesystem::create_directories(destinationDir, mkdirErr);
-        if (mkdirErr) {
-            std::cerr << "Failed to create destination directory `" << destinationDir.string() << "`: " << mkdirErr.message() << std::endl;
+        if (!dispatchFile(filePath, batch, std::nullopt, nullptr, stat)) {
             allSucceeded = false;
+        }
+    }
+
+    return waitForBatch(*batch) && allSucceeded;
+}
+
+void FileMover::submitPaths(const std::vector<std::filesystem::path>& paths, const std::vector<std::chrono::steady_clock::time_point>& arrivals,
+                            const std::vector<FileStat>& stats) {
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        // A file the stability check just examined is known to be a regular file; anything else is checked here.
+        FileStat stat = i < stats.size() ? stats[i] : FileStat{};
+        if (!stat.has(FileStat::Size) && !stat.fetch(paths[i], FileStat::Size)) {
             continue;
         }
 
-        if (!moveFile(filePath, destinationDir)) {
-            allSucceeded = false;
+        dispatchFile(paths[i], nullptr, i < arrivals.size() ? std::optional(arrivals[i]) : std::nullopt, nullptr, stat);
+    }
+}
+
+bool FileMover::dispatchFile(const std::filesystem::path& filePath, const std::shared_ptr<MoveBatch>& batch,
+                             std::optional<std::chrono::steady_clock::time_point> arrivedAt, bool* queued, FileStat stat) {
+    if (StabilityTracker::isInProgressDownload(filePath)) {
+        Logger::Line line(firstReport(filePath) ? Logger::Level::Info : Logger::Level::Debug);
+        line << "Skipping in-progress download `" << filePath.filename().string() << "`.";
+        return true;
+    }
+
+    // Pin the rules for the whole classification; a reload publishing meanwhile doesn't affect this file.
+    StageTimer classifyTimer(Metrics::Stage::Classify);
+    const auto rules = snapshot();
+    const RuleSet* ruleSet = ruleSetFor(*rules, filePath);
+    std::filesystem::path expanded;
+    std::size_t rule = 0;
+    const auto* destination = ruleSet ? resolveDestinationFor(*rules, *ruleSet, filePath, stat, expanded, rule) : nullptr;
+    classifyTimer.stop();
+    Metrics::add(Metrics::Counter::FilesClassified);
+    if (destination == nullptr) {
+        Metrics::add(Metrics::Counter::FilesUnmatched);
+        reportUnmatched(filePath);
+        return true;
+    }
+    auto destinationDir = *destination;
+    if (filePath.parent_path() == destinationDir) {
+        // Already where its rule wants it, e.g. the watch folder doubles as a destination.
+        return true;
+    }
+
+    if (queued != nullptr) {
+        *queued = true;
+    }
+    if (m_planSink) {
+        m_planSink(filePath, stat.fetch(filePath, FileStat::Size) ? stat.size() : 0, destinationDir, cachedVolumeId(destinationDir), rule);
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_inFlightMutex);
+        if (!m_inFlight.insert(filePath.native()).second) {
+            return true;
         }
     }
+    Metrics::adjust(Metrics::Gauge::MovesInFlight, 1);
 
-    return allSucceeded;
+    // The name is reserved here, in submit order: moves into one directory run on different workers (renames
+    // and copies go to different lanes), so the first file queued must be the one that keeps its name.
+    auto reservedName = m_nameIndex.reserve(destinationDir, filePath.filename());
+
+    // Same-volume moves are plain renames; anything else may turn into a long copy and goes to a copy lane,
+    // with small files on their own so they never queue behind a large one. Renames shard by destination
+    // directory and copies by destination device, which keeps one device's writes on one worker.
+    const auto sourceVolume = cachedVolumeId(filePath.parent_path());
+    const auto destinationVolume = cachedVolumeId(destinationDir);
+    const bool sameVolume = sourceVolume && destinationVolume && *sourceVolume == *destinationVolume;
+    auto lane = MoveWorkerPool::Lane::Rename;
+    if (!sameVolume) {
+        lane = stat.fetch(filePath, FileStat::Size) && m_io.isSmall(stat.size()) ? MoveWorkerPool::Lane::SmallCopy : MoveWorkerPool::Lane::Copy;
+    }
+    const std::size_t shardKey = sameVolume || !destinationVolume ? std::filesystem::hash_value(destinationDir)
+                                                                  : static_cast<std::size_t>(*destinationVolume);
+
+    if (batch) {
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        ++batch->pending;
+    }
+
+    const auto queuedAt = Metrics::Clock::now();
+    m_pool->submit(lane, shardKey, [this, filePath, destinationDir = std::move(destinationDir), reservedName = std::move(reservedName), batch,
+                                    arrivedAt, queuedAt, stat, rule]() mutable {
+        Metrics::record(Metrics::Stage::QueueWait, Metrics::Clock::now() - queuedAt);
+        // The size has to be known before the move, while the file is still where stat can find it.
+        if (m_placedObserver) {
+            stat.fetch(filePath, FileStat::Size);
+        }
+        const bool moved = placeFile(filePath, destinationDir, stat, std::move(reservedName));
+        Metrics::add(moved ? Metrics::Counter::FilesMoved : Metrics::Counter::MoveFailures);
+        if (moved && m_placedObserver) {
+            m_placedObserver(destinationDir, stat.has(FileStat::Size) ? stat.size() : 0, rule);
+        }
+        if (moved && arrivedAt) {
+            Metrics::record(Metrics::Stage::ArrivalToPlaced, std::chrono::steady_clock::now() - *arrivedAt);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_inFlightMutex);
+            m_inFlight.erase(filePath.native());
+        }
+        Metrics::adjust(Metrics::Gauge::MovesInFlight, -1);
+
+        if (batch) {
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            batch->allSucceeded = batch->allSucceeded && moved;
+            if (--batch->pending == 0) {
+                batch->finished.notify_all();
+            }
+        }
+    });
+    return true;
+}
+
+bool FileMover::firstReport(const std::filesystem::path& filePath) {
+    std::lock_guard<std::mutex> lock(m_reportedMutex);
+    if (m_reported.size() >= kMaxReported) {
+        m_reported.clear();
+    }
+    return m_reported.insert(filePath.native()).second;
+}
+
+void FileMover::reportUnmatched(const std::filesystem::path& filePath) {
+    Logger::Line line(firstReport(filePath) ? Logger::Level::Info : Logger::Level::Debug);
+    line << "No matching rule for `" << filePath.filename().string() << "`, leaving in place.";
+}
+
+bool FileMover::waitForBatch(MoveBatch& batch) {
+    std::unique_lock<std::mutex> lock(batch.mutex);
+    batch.finished.wait(lock, [&batch]() { return batch.pending == 0; });
+    return batch.allSucceeded;
+}
+
+bool FileMover::placeFile(const std::filesystem::path& filePath, const std::filesystem::path& destinationDir, FileStat& stat,
+                          std::filesystem::path reservedName) {
+    // Ensure the destination exists before attempting the move; the cache makes this free after the first file.
+    std::error_code mkdirErr;
+    StageTimer mkdirTimer(Metrics::Stage::Mkdir);
+    const bool destinationReady = m_directoryCache.ensure(destinationDir, mkdirErr);
+    mkdirTimer.stop();
+    if (!destinationReady) {
+        m_nameIndex.release(destinationDir, reservedName);
+        Logger::error() << "Failed to create destination directory `" << destinationDir.string() << "`: " << mkdirErr.message();
+        return false;
+    }
+
+    // Checked before the move, so a duplicate headed for another volume is never copied at all.
+    const DedupAction dedupAction = m_dedupAction.load(std::memory_order_relaxed);
+    if (m_duplicates != nullptr && dedupAction != DedupAction::Off) {
+        StageTimer dedupTimer(Metrics::Stage::Dedup);
+        const auto duplicate = m_duplicates->findDuplicate(filePath, destinationDir);
+        dedupTimer.stop();
+        if (duplicate) {
+            Metrics::add(Metrics::Counter::DuplicatesFound);
+            return settleDuplicate(filePath, destinationDir, *duplicate, dedupAction, stat, std::move(reservedName));
+        }
+    }
+
+    std::error_code moveErr;
+    if (moveFile(filePath, destinationDir, stat, moveErr, std::move(reservedName))) {
+        return true;
+    }
+
+    // ENOENT with the source still present means the cached destination was deleted behind our back.
+    std::error_code existsErr;
+    if (moveErr != std::errc::no_such_file_or_directory || !std::filesystem::exists(filePath, existsErr)) {
+        return false;
+    }
+
+    forgetDirectory(destinationDir);
+    if (!m_directoryCache.ensure(destinationDir, mkdirErr)) {
+        Logger::error() << "Failed to recreate destination directory `" << destinationDir.string() << "`: " << mkdirErr.message();
+        return false;
+    }
+
+    Logger::info() << "Recreated missing destination `" << destinationDir.string() << "`; retrying move.";
+    return moveFile(filePath, destinationDir, stat, moveErr);
 }
 
-void FileMover::rebuildLookup() {
-    // Recreate the mapping so normalizing extensions only happens once per rule.
-    m_extensionToDestination.clear();
-    for (const auto& rule : m_rules) {
+std::optional<std::uint64_t> FileMover::cachedVolumeId(const std::filesystem::path& directory) {
+    std::lock_guard<std::mutex> lock(m_volumeMutex);
+    auto it = m_volumeIds.find(directory.native());
+    if (it == m_volumeIds.end()) {
+        it = m_volumeIds.emplace(directory.native(), platform::volumeId(directory)).first;
+    }
+    return it->second;
+}
+
+std::shared_ptr<const FileMover::RuleSnapshot> FileMover::compileSnapshot(std::vector<RuleSet> ruleSets, std::string_view compiledRules) {
+    // Index the folders compiledRules covers; each entry is the folder path followed by its matchers.
+    std::vector<std::pair<std::filesystem::path::string_type, std::string_view>> compiled;
+    RuleCache::Reader in(compiledRules);
+    std::uint64_t compiledCount = 0;
+    if (!compiledRules.empty() && in.value(compiledCount)) {
+        for (std::uint64_t i = 0; i < compiledCount && in.ok(); ++i) {
+            auto& entry = compiled.emplace_back();
+            in.string(entry.first);
+            in.view(entry.second);
+        }
+        if (!in.atEnd()) {
+            compiled.clear();
+        }
+    }
+
+    // Normalize and compile every matcher once here so classifying a file never has to.
+    auto snapshot = std::make_shared<RuleSnapshot>();
+    snapshot->ruleSets = std::move(ruleSets);
+    for (auto& ruleSet : snapshot->ruleSets) {
+        const auto entry = std::find_if(compiled.begin(), compiled.end(), [&ruleSet](const auto& candidate) {
+            return candidate.first == ruleSet.watchFolder.native();
+        });
+        if (entry == compiled.end() || !restoreRuleSet(ruleSet, entry->second, snapshot->destinations)) {
+            compileRuleSet(ruleSet, snapshot->destinations);
+        }
+        compileConditions(ruleSet);
+        for (const auto& rule : ruleSet.rules) {
+            snapshot->dependsOnMetadata = snapshot->dependsOnMetadata || rule.conditions.dependsOnMetadata();
+        }
+
+        ruleSet.roots.assign(1, ruleSet.watchFolder);
+        std::error_code ec;
+        const auto absolute = std::filesystem::absolute(ruleSet.watchFolder, ec).lexically_normal();
+        if (!ec && absolute != ruleSet.roots.back()) {
+            ruleSet.roots.push_back(absolute);
+        }
+        const auto canonical = std::filesystem::weakly_canonical(ruleSet.watchFolder, ec);
+        if (!ec && std::find(ruleSet.roots.begin(), ruleSet.roots.end(), canonical) == ruleSet.roots.end()) {
+            ruleSet.roots.push_back(canonical);
+        }
+    }
+
+    // Keep the resolved form too: fanotify reports canonical paths even when a destination is named through a symlink.
+    // A destination that is itself a watch folder is left out: its files are still to be organized, not already sorted.
+    const auto isWatchFolder = [&snapshot](const std::filesystem::path& folder) {
+        return std::any_of(snapshot->ruleSets.begin(), snapshot->ruleSets.end(), [&folder](const RuleSet& ruleSet) {
+            return std::find(ruleSet.roots.begin(), ruleSet.roots.end(), folder) != ruleSet.roots.end();
+        });
+    };
+    for (const auto& dated : snapshot->destinations) {
+        snapshot->datedDestinations.push_back(isDated(dated));
+        const auto destination = snapshot->datedDestinations.back() ? undatedPart(dated) : dated;
+        std::error_code ec;
+        const auto absolute = std::filesystem::absolute(destination, ec);
+        const auto normalized = (ec ? destination : absolute).lexically_normal();
+        const auto canonical = std::filesystem::weakly_canonical(destination, ec);
+        if (isWatchFolder(normalized) || (!ec && isWatchFolder(canonical))) {
+            continue;
+        }
+        snapshot->destinationRoots.push_back(normalized);
+        if (!ec && canonical != normalized) {
+            snapshot->destinationRoots.push_back(canonical);
+        }
+    }
+    return snapshot;
+}
+
+void FileMover::compileRuleSet(RuleSet& ruleSet, std::vector<std::filesystem::path>& destinations) {
+    ruleSet.ruleDestinations.clear();
+    ruleSet.patterns.clear();
+    ruleSet.mimeRules.assign(ContentSniffer::typeCount(), ExtensionClassifier::kNoMatch);
+    ruleSet.hasMimeRules = false;
+    std::vector<ExtensionClassifier::Entry> entries;
+    for (const auto& rule : ruleSet.rules) {
         std::filesystem::path destination(rule.destination);
         if (destination.empty()) {
             continue;
         }
 
+        // Rule ids follow definition order, so "lowest id wins" is "first defined wins" in both matchers.
+        if (ruleSet.ruleDestinations.size() >= ExtensionClassifier::kNoMatch) {
+            Logger::warning() << "Too many rules; ignoring rule for `" << rule.destination << "`.";
+            continue;
+        }
+        const auto ruleId = static_cast<std::uint16_t>(ruleSet.ruleDestinations.size());
+
+        ruleSet.ruleDestinations.push_back(internDestination(destinations, destination));
+        // Rules with conditions keep their id (and so their precedence) but are matched by compileConditions().
+        if (!rule.conditions.empty()) {
+            continue;
+        }
+
         for (const auto& ext : rule.extensions) {
             std::string normalized = normalizeExtension(ext);
             if (normalized.empty()) {
                 continue;
             }
 
-            m_extensionToDestination.emplace(std::move(normalized), destination);
+            // Multi-part extensions can't be found by looking at the last dot alone.
+            if (normalized.find('.', 1) != std::string::npos) {
+                ruleSet.patterns.addSuffix(normalized, ruleId);
+            } else {
+                entries.emplace_back(std::filesystem::u8path(normalized).native(), ruleId);
+            }
+        }
+
+        std::string error;
+        for (const auto& pattern : rule.patterns) {
+            if (!ruleSet.patterns.addGlob(pattern, ruleId, error)) {
+                Logger::warning() << "Ignoring invalid pattern `" << pattern << "`: " << error;
+            }
+        }
+        for (const auto& regex : rule.nameRegexes) {
+            if (!ruleSet.patterns.addRegex(regex, ruleId, error)) {
+                Logger::warning() << "Ignoring invalid name_regex `" << regex << "`: " << error;
+            }
+        }
+
+        for (const auto& mimeType : rule.mimeTypes) {
+            bool recognized = false;
+            for (std::uint16_t type = 0; type < ruleSet.mimeRules.size(); ++type) {
+                if (ContentSniffer::mimeMatches(mimeType, type)) {
+                    ruleSet.mimeRules[type] = std::min(ruleSet.mimeRules[type], ruleId);
+                    recognized = true;
+                }
+            }
+            if (!recognized) {
+                Logger::warning() << "MIME type `" << mimeType << "` is not one the content sniffer recognizes; it will never match.";
+            }
+            ruleSet.hasMimeRules = true;
         }
     }
+
+    ruleSet.classifier.rebuild(entries);
+    ruleSet.patterns.compile();
+
+    // A file whose contents contradict its name is routed as if it carried its type's canonical extension.
+    ruleSet.contentRules.resize(ruleSet.mimeRules.size());
+    for (std::uint16_t type = 0; type < ruleSet.mimeRules.size(); ++type) {
+        const auto standIn = std::filesystem::u8path("file" + std::string(ContentSniffer::canonicalExtension(type)));
+        ruleSet.contentRules[type] = std::min(ruleSet.mimeRules[type], ruleSet.classifier.classify(standIn.native()));
+    }
 }
 
-std::filesystem::path FileMover::resolveDestinationFor(const std::filesystem::path& file) const {
-    std::string extension = file.has_extension() ? normalizeExtension(file.extension().string()) : std::string{};
-    if (extension.empty()) {
-        return {};
+bool FileMover::restoreRuleSet(RuleSet& ruleSet, std::string_view compiled, std::vector<std::filesystem::path>& destinations) {
+    RuleCache::Reader in(compiled);
+    std::uint64_t ruleCount = 0;
+    if (!in.value(ruleCount) || ruleCount >= ExtensionClassifier::kNoMatch) {
+        return false;
+    }
+    std::vector<std::filesystem::path> ruleDestinations;
+    for (std::uint64_t i = 0; i < ruleCount && in.ok(); ++i) {
+        std::filesystem::path::string_type destination;
+        in.string(destination);
+        ruleDestinations.emplace_back(std::move(destination));
     }
 
-    auto it = m_extensionToDestination.find(extension);
-    if (it == m_extensionToDestination.end()) {
-        return {};
+    std::uint8_t hasMimeRules = 0;
+    if (!ruleSet.classifier.restore(in) || !ruleSet.patterns.restore(in) || !in.array(ruleSet.mimeRules) ||
+        !in.array(ruleSet.contentRules) || !in.value(hasMimeRules) || !in.atEnd() ||
+        ruleSet.mimeRules.size() != ContentSniffer::typeCount() || ruleSet.contentRules.size() != ruleSet.mimeRules.size()) {
+        return false;
+    }
+    auto outOfRange = [&ruleDestinations](std::uint16_t ruleId) {
+        return ruleId != ExtensionClassifier::kNoMatch && ruleId >= ruleDestinations.size();
+    };
+    if (std::any_of(ruleSet.mimeRules.begin(), ruleSet.mimeRules.end(), outOfRange) ||
+        std::any_of(ruleSet.contentRules.begin(), ruleSet.contentRules.end(), outOfRange)) {
+        return false;
     }
 
-    return it->second;
+    ruleSet.hasMimeRules = hasMimeRules != 0;
+    ruleSet.ruleDestinations.clear();
+    for (const auto& destination : ruleDestinations) {
+        ruleSet.ruleDestinations.push_back(internDestination(destinations, destination));
+    }
+    return true;
+}
+
+std::string FileMover::serializeRules() const {
+    const auto rules = snapshot();
+    RuleCache::Writer out;
+    std::uint64_t count = 0;
+    RuleCache::Writer entries;
+    for (const auto& ruleSet : rules->ruleSets) {
+        RuleCache::Writer entry;
+        entry.value<std::uint64_t>(ruleSet.ruleDestinations.size());
+        for (std::uint16_t destination : ruleSet.ruleDestinations) {
+            entry.string(rules->destinations[destination].native());
+        }
+        ruleSet.classifier.serialize(entry);
+        // A matcher that fell back to its NFA is left out, so that folder simply compiles next time.
+        if (!ruleSet.patterns.serialize(entry)) {
+            continue;
+        }
+        entry.array(ruleSet.mimeRules);
+        entry.array(ruleSet.contentRules);
+        entry.value<std::uint8_t>(ruleSet.hasMimeRules);
+
+        entries.string(ruleSet.watchFolder.native());
+        entries.string(entry.data());
+        ++count;
+    }
+    out.value(count);
+    return out.data() + entries.data();
+}
+
+void FileMover::compileConditions(RuleSet& ruleSet) {
+    ruleSet.conditionalRules.clear();
+    std::uint16_t ruleId = 0;
+    for (const auto& rule : ruleSet.rules) {
+        // Same numbering as compileRuleSet().
+        if (rule.destination.empty()) {
+            continue;
+        }
+        if (ruleId >= ExtensionClassifier::kNoMatch) {
+            break;
+        }
+        const auto id = ruleId++;
+        if (rule.conditions.empty()) {
+            continue;
+        }
+
+        auto& conditional = ruleSet.conditionalRules.emplace_back();
+        conditional.ruleId = id;
+        conditional.conditions = rule.conditions;
+        const auto& conditions = rule.conditions;
+        conditional.fields = static_cast<FileStat::Fields>((conditions.minSize || conditions.maxSize ? FileStat::Size : 0) |
+                                                           (conditions.olderThan || conditions.newerThan ? FileStat::Modified : 0) |
+                                                           (conditions.notAccessedFor ? FileStat::Accessed : 0));
+
+        for (const auto& ext : rule.extensions) {
+            const std::string normalized = normalizeExtension(ext);
+            if (!normalized.empty()) {
+                conditional.names.addSuffix(normalized, id);
+            }
+        }
+        std::string error;
+        for (const auto& pattern : rule.patterns) {
+            if (!conditional.names.addGlob(pattern, id, error)) {
+                Logger::warning() << "Ignoring invalid pattern `" << pattern << "`: " << error;
+            }
+        }
+        for (const auto& regex : rule.nameRegexes) {
+            if (!conditional.names.addRegex(regex, id, error)) {
+                Logger::warning() << "Ignoring invalid name_regex `" << regex << "`: " << error;
+            }
+        }
+        conditional.names.compile();
+
+        conditional.mimeTypes.assign(ContentSniffer::typeCount(), 0);
+        for (const auto& mimeType : rule.mimeTypes) {
+            for (std::uint16_t type = 0; type < conditional.mimeTypes.size(); ++type) {
+                conditional.mimeTypes[type] = conditional.mimeTypes[type] || ContentSniffer::mimeMatches(mimeType, type);
+            }
+            ruleSet.hasMimeRules = true;
+        }
+        conditional.anyName = rule.extensions.empty() && rule.patterns.empty() && rule.nameRegexes.empty() && rule.mimeTypes.empty();
+    }
+}
+
+bool FileMover::conditionsHold(const ConditionalRule& rule, const std::filesystem::path& file, FileStat& stat) {
+    if (!stat.fetch(file, rule.fields)) {
+        return false;
+    }
+    const auto& conditions = rule.conditions;
+    if ((conditions.minSize && stat.size() < *conditions.minSize) || (conditions.maxSize && stat.size() > *conditions.maxSize)) {
+        return false;
+    }
+    const auto now = std::chrono::system_clock::now();
+    if (conditions.olderThan && now - stat.modified() < *conditions.olderThan) {
+        return false;
+    }
+    if (conditions.newerThan && now - stat.modified() >= *conditions.newerThan) {
+        return false;
+    }
+    return !conditions.notAccessedFor || now - stat.accessed() >= *conditions.notAccessedFor;
+}
+
+bool FileMover::isDated(const std::filesystem::path& destination) {
+    const std::string text = destination.u8string();
+    return std::any_of(std::begin(kDateTokens), std::end(kDateTokens), [&text](std::string_view token) {
+        return text.find(token) != std::string::npos;
+    });
+}
+
+std::filesystem::path FileMover::undatedPart(const std::filesystem::path& destination) {
+    std::filesystem::path undated;
+    for (const auto& component : destination) {
+        if (isDated(component)) {
+            break;
+        }
+        undated /= component;
+    }
+    return undated;
+}
+
+std::filesystem::path FileMover::expandDate(const std::filesystem::path& destination, FileStat::Time time) {
+    const std::time_t seconds = std::chrono::system_clock::to_time_t(time);
+    std::tm local{};
+#ifdef _WIN32
+    localtime_s(&local, &seconds);
+#else
+    localtime_r(&seconds, &local);
+#endif
+    // Sized for any int, so the formatting can never be cut short.
+    char year[12];
+    char month[12];
+    char day[12];
+    std::snprintf(year, sizeof(year), "%04d", local.tm_year + 1900);
+    std::snprintf(month, sizeof(month), "%02d", local.tm_mon + 1);
+    std::snprintf(day, sizeof(day), "%02d", local.tm_mday);
+    const std::string_view values[] = {year, month, day};
+
+    std::string text = destination.u8string();
+    for (std::size_t i = 0; i < std::size(kDateTokens); ++i) {
+        for (auto at = text.find(kDateTokens[i]); at != std::string::npos; at = text.find(kDateTokens[i], at + values[i].size())) {
+            text.replace(at, kDateTokens[i].size(), values[i]);
+        }
+    }
+    return std::filesystem::u8path(text);
+}
+
+std::uint16_t FileMover::internDestination(std::vector<std::filesystem::path>& destinations, const std::filesystem::path& destination) {
+    // Intern each distinct destination so rules sharing one, in any folder, only store its index.
+    auto existing = std::find(destinations.begin(), destinations.end(), destination);
+    if (existing == destinations.end()) {
+        destinations.push_back(destination);
+        return static_cast<std::uint16_t>(destinations.size() - 1);
+    }
+    return static_cast<std::uint16_t>(existing - destinations.begin());
+}
+
+const FileMover::RuleSet* FileMover::ruleSetFor(const RuleSnapshot& snapshot, const std::filesystem::path& path) {
+    if (snapshot.ruleSets.size() == 1) {
+        return &snapshot.ruleSets.front();
+    }
+
+    const RuleSet* best = nullptr;
+    std::size_t bestLength = 0;
+    for (const auto& ruleSet : snapshot.ruleSets) {
+        for (const auto& root : ruleSet.roots) {
+            if (root.native().size() >= bestLength && platform::isSameOrBelow(path, root)) {
+                best = &ruleSet;
+                bestLength = root.native().size();
+            }
+        }
+    }
+    return best;
+}
+
+const std::filesystem::path* FileMover::resolveDestinationFor(const RuleSnapshot& snapshot, const RuleSet& ruleSet, const std::filesystem::path& file,
+                                                              FileStat& stat, std::filesystem::path& expanded, std::size_t& rule) {
+    std::uint16_t ruleId = ruleSet.classifier.classify(file.native());
+    std::uint16_t sniffedType = ContentSniffer::kUnknown;
+    bool routedByContents = false;
+    if (m_sniffContent.load(std::memory_order_relaxed) || ruleSet.hasMimeRules) {
+        sniffedType = m_sniffer.sniff(file);
+        if (sniffedType != ContentSniffer::kUnknown) {
+            // A rule for the file's extension always holds: no list of extensions covers every format built on a
+            // container (zip, OLE, ELF, ISO-BMFF). The contents decide only for names no rule knows.
+            if (ruleId != ExtensionClassifier::kNoMatch) {
+                ruleId = std::min(ruleId, ruleSet.mimeRules[sniffedType]);
+            } else {
+                ruleId = ruleSet.contentRules[sniffedType];
+                routedByContents = ruleId != ExtensionClassifier::kNoMatch;
+            }
+        }
+    }
+
+#ifdef _WIN32
+    const std::string fileName = ruleSet.patterns.empty() && ruleSet.conditionalRules.empty() ? std::string() : file.filename().u8string();
+#else
+    std::string_view fileName = file.native();
+    if (const auto slash = fileName.rfind('/'); slash != std::string_view::npos) {
+        fileName.remove_prefix(slash + 1);
+    }
+#endif
+    if (!ruleSet.patterns.empty()) {
+        // All matchers report rule ids and kNoMatch is the largest id, so the minimum is the winning rule.
+        const std::uint16_t patternRule = ruleSet.patterns.match(fileName);
+        routedByContents = routedByContents && ruleId <= patternRule;
+        ruleId = std::min(ruleId, patternRule);
+    }
+
+    // Only conditional rules defined before the winner can take over, so metadata is fetched only for those
+    // whose names match.
+    for (const auto& conditional : ruleSet.conditionalRules) {
+        if (conditional.ruleId >= ruleId) {
+            break;
+        }
+        const bool named = conditional.anyName || conditional.names.match(fileName) != PatternMatcher::kNoMatch ||
+                           (sniffedType != ContentSniffer::kUnknown && conditional.mimeTypes[sniffedType]);
+        if (named && conditionsHold(conditional, file, stat)) {
+            ruleId = conditional.ruleId;
+            routedByContents = false;
+            break;
+        }
+    }
+
+    if (routedByContents) {
+        Logger::info() << "Contents of `" << file.filename().string() << "` look like " << ContentSniffer::mimeType(sniffedType)
+                       << "; no rule matches its name, so routing by contents.";
+    }
+
+    if (ruleId == ExtensionClassifier::kNoMatch) {
+        return nullptr;
+    }
+    rule = ruleId;
+    const auto destination = ruleSet.ruleDestinations[ruleId];
+    if (!snapshot.datedDestinations[destination]) {
+        return &snapshot.destinations[destination];
+    }
+    if (!stat.fetch(file, FileStat::Modified)) {
+        return nullptr;
+    }
+    expanded = expandDate(snapshot.destinations[destination], stat.modified());
+    return &expanded;
 }
 
 std::string FileMover::normalizeExtension(std::string extension) {
@@ -134,64 +1028,244 @@ std::string FileMover::normalizeExtension(std::string extension) {
     return extension;
 }
 
-bool FileMover::moveFile(const std::filesystem::path& sourcePath, const std::filesystem::path& destinationFolder) const {
-    auto targetPath = destinationFolder / sourcePath.filename();
+bool FileMover::settleDuplicate(const std::filesystem::path& filePath, const std::filesystem::path& destinationDir,
+                                const std::filesystem::path& duplicate, DedupAction action, FileStat& stat,
+                                std::filesystem::path reservedName) {
+    if (action != DedupAction::Hardlink) {
+        m_nameIndex.release(destinationDir, reservedName);
+    }
+    if (action == DedupAction::Keep) {
+        Logger::info() << "Leaving `" << filePath.string() << "` in place: `" << duplicate.string() << "` has the same contents.";
+        return true;
+    }
+
+    if (action == DedupAction::Delete) {
+        std::error_code removeErr;
+        if (!std::filesystem::remove(filePath, removeErr) && removeErr) {
+            Logger::error() << "Failed to remove duplicate `" << filePath.string() << "`: " << removeErr.message();
+            return false;
+        }
+        Logger::info() << "Removed `" << filePath.string() << "`: `" << duplicate.string() << "` has the same contents.";
+        return true;
+    }
+
+    // Hardlink: the file keeps the name it would have been moved under, but shares the existing copy's data.
+    const auto fileName = filePath.filename();
+    for (std::size_t attempt = 0; attempt < kMaxCollisionAttempts; ++attempt) {
+        const auto targetName = claimName(reservedName, destinationDir, fileName);
+        const auto targetPath = destinationDir / targetName;
 
-    // Try the straightforward move first.
-    std::error_code renameErr;
-    std::filesystem::rename(sourcePath, targetPath, renameErr);
-    if (!renameErr) {
-        std::cout << "Moved `" << sourcePath.string() << "` -> `" << targetPath.string() << "`" << std::endl;
+        std::error_code linkErr;
+        std::filesystem::create_hard_link(duplicate, targetPath, linkErr);
+        if (linkErr == std::errc::file_exists) {
+            continue;
+        }
+        if (linkErr) {
+            // E.g. a filesystem without hard links, or the existing copy at its link limit: an ordinary move it is,
+            // under the name just reserved.
+            Logger::warning() << "Unable to link `" << targetPath.string() << "` to `" << duplicate.string() << "` (" << linkErr.message()
+                              << "); moving the file instead.";
+            std::error_code moveErr;
+            return moveFile(filePath, destinationDir, stat, moveErr, targetName);
+        }
+
+        std::error_code removeErr;
+        std::filesystem::remove(filePath, removeErr);
+        if (removeErr) {
+            Logger::error() << "Failed to remove `" << filePath.string() << "` after linking its duplicate: " << removeErr.message();
+            return false;
+        }
+        if (m_journal != nullptr) {
+            m_journal->record(filePath, targetPath);
+        }
+        notePlaced(destinationDir, targetName);
+        Logger::info() << "Linked `" << filePath.string() << "` -> `" << targetPath.string() << "` (same contents as `"
+                       << duplicate.filename().string() << "`)";
         return true;
     }
 
-    std::error_code existsCheckErr;
-    bool targetExists = std::filesystem::exists(targetPath, existsCheckErr);
-    if (renameErr == std::errc::file_exists || (!existsCheckErr && targetExists)) {
-        std::filesystem::path uniquePath;
-        std::error_code existsErr;
-        // Generate suffixed filenames until we find a free spot or exhaust attempts.
-        for (std::size_t attempt = 1; attempt <= kMaxCollisionAttempts; ++attempt) {
-            uniquePath = destinationFolder / (targetPath.stem().string() + "_" + std::to_string(attempt) + targetPath.extension().string());
-            bool uniqueExists = std::filesystem::exists(uniquePath, existsErr);
-            if (existsErr) {
-                std::cerr << "Failed to check for existing file `" << uniquePath.string() << "`: " << existsErr.message() << std::endl;
-                existsErr.clear();
-                break;
-            }
-
-            if (!uniqueExists) {
-                std::error_code retryErr;
-                std::filesystem::rename(sourcePath, uniquePath, retryErr);
-                if (!retryErr) {
-                    std::cout << "Moved `" << sourcePath.string() << "` -> `" << uniquePath.string() << "` (renamed to avoid collision)" << std::endl;
-                    return true;
+    Logger::error() << "Failed to link `" << filePath.string() << "`: every name the index offered in `" << destinationDir.string()
+                    << "` was taken by another writer.";
+    return false;
+}
+
+void FileMover::notePlaced(const std::filesystem::path& destinationDir, const std::filesystem::path& fileName) {
+    if (m_duplicates != nullptr && m_dedupAction.load(std::memory_order_relaxed) != DedupAction::Off) {
+        m_duplicates->added(destinationDir, fileName);
+    }
+    if (m_retention != nullptr) {
+        m_retention->placed(destinationDir / fileName);
+    }
+}
+
+std::filesystem::path FileMover::claimName(std::filesystem::path& reservedName, const std::filesystem::path& directory,
+                                           const std::filesystem::path& fileName) {
+    if (!reservedName.empty()) {
+        return std::exchange(reservedName, {});
+    }
+    return m_nameIndex.reserve(directory, fileName);
+}
+
+bool FileMover::moveFile(const std::filesystem::path& sourcePath, const std::filesystem::path& destinationFolder, FileStat& stat,
+                         std::error_code& ec, std::filesystem::path reservedName) {
+    ec.clear();
+    const auto fileName = sourcePath.filename();
+
+    // The index hands out a free name directly; the no-replace rename makes the final claim atomic, so the
+    // only retries left are names another writer took after the index was loaded.
+    const auto sourceFolder = sourcePath.parent_path();
+    for (std::size_t attempt = 0; attempt < kMaxCollisionAttempts; ++attempt) {
+        const auto targetName = claimName(reservedName, destinationFolder, fileName);
+
+        std::error_code renameErr;
+        StageTimer renameTimer(Metrics::Stage::Rename);
+        const bool renamed = m_directoryHandles.renameNoReplace(sourceFolder, fileName, destinationFolder, targetName, renameErr);
+        renameTimer.stop();
+        if (renamed) {
+            notePlaced(destinationFolder, targetName);
+            // Sweeps with the journal off and info lines filtered never need the full target path.
+            if (m_journal != nullptr || Logger::enabled(Logger::Level::Info)) {
+                const auto targetPath = destinationFolder / targetName;
+                if (m_journal != nullptr) {
+                    m_journal->record(sourcePath, targetPath);
                 }
-                renameErr = retryErr;
+                const char* note = targetName == fileName ? "" : " (renamed to avoid collision)";
+                Logger::info() << "Moved `" << sourcePath.string() << "` -> `" << targetPath.string() << "`" << note;
             }
+            return true;
+        }
+
+        if (renameErr == std::errc::file_exists) {
+            // The name stays reserved in the index since it really is taken now.
+            continue;
+        }
+
+        if (renameErr == std::errc::cross_device_link) {
+            // The copy claims the name this attempt reserved, so a file queued later can't take it meanwhile.
+            return moveAcrossDevices(sourcePath, destinationFolder, stat, ec, targetName);
+        }
+        m_nameIndex.release(destinationFolder, targetName);
+
+        Logger::error() << "Failed to move `" << sourcePath.string() << "`: " << renameErr.message();
+        ec = renameErr;
+        return false;
+    }
+
+    Logger::error() << "Failed to move `" << sourcePath.string() << "`: every name the index offered in `" << destinationFolder.string()
+                    << "` was taken by another writer.";
+    ec = std::make_error_code(std::errc::file_exists);
+    return false;
+}
+
+bool FileMover::moveAcrossDevices(const std::filesystem::path& sourcePath, const std::filesystem::path& destinationFolder, FileStat& stat,
+                                  std::error_code& ec, std::filesystem::path reservedName) {
+    const auto started = std::chrono::steady_clock::now();
+
+    // Large files are copied within the destination device's I/O budget and at the configured priority; small
+    // ones are only charged, so they never wait.
+    const bool small = stat.fetch(sourcePath, FileStat::Size) && m_io.isSmall(stat.size());
+    CrossDeviceCopier::Throttle throttle;
+    if (m_io.throttled()) {
+        if (const auto device = cachedVolumeId(destinationFolder)) {
+            throttle = [this, device = *device, small](std::uintmax_t bytes) { m_io.charge(device, bytes, small); };
         }
     }
 
-    if (renameErr == std::errc::cross_device_link) {
-        auto targetPathCopy = destinationFolder / sourcePath.filename();
-        std::error_code copyErr;
-        // Fall back to copy + delete when moving across volumes or network shares.
-        std::filesystem::copy_file(sourcePath, targetPathCopy, std::filesystem::copy_options::overwrite_existing, copyErr);
-        if (!copyErr) {
+    CrossDeviceCopier::Result copy;
+    StageTimer copyTimer(Metrics::Stage::Copy);
+    bool copied = false;
+    {
+        IoScheduler::PriorityScope priority(small ? IoPriority::Normal : m_io.priority());
+        copied = CrossDeviceCopier::copyToTemporary(sourcePath, destinationFolder, copy, ec, throttle);
+    }
+    copyTimer.stop();
+    if (!copied) {
+        m_nameIndex.release(destinationFolder, reservedName);
+        Logger::error() << "Failed to copy `" << sourcePath.string() << "` into `" << destinationFolder.string() << "`: " << ec.message();
+        return false;
+    }
+
+    // The data is durable under a hidden name; claiming the final name uses the same allocation as a local move.
+    const auto fileName = sourcePath.filename();
+    for (std::size_t attempt = 0; attempt < kMaxCollisionAttempts; ++attempt) {
+        const auto targetName = claimName(reservedName, destinationFolder, fileName);
+        const auto targetPath = destinationFolder / targetName;
+
+        // The intent must be on disk before the copy takes its final name: a crash between that rename and removing
+        // the original would otherwise leave a duplicate nothing knows about.
+        std::uint64_t journalId = 0;
+        if (m_journal != nullptr) {
+            journalId = m_journal->begin(sourcePath, targetPath, copy.temporaryPath);
+            m_journal->sync();
+        }
+
+        std::error_code renameErr;
+        if (platform::renameNoReplace(copy.temporaryPath, targetPath, renameErr)) {
+            std::error_code syncErr;
+            if (!platform::syncDirectory(destinationFolder, syncErr)) {
+                Logger::warning() << "Failed to sync `" << destinationFolder.string() << "`: " << syncErr.message();
+            }
+
+            // Only drop the original once the copy is in place, so a crash at any point leaves a complete file.
             std::error_code removeErr;
             std::filesystem::remove(sourcePath, removeErr);
-            if (!removeErr) {
-                std::cout << "Copied `" << sourcePath.string() << "` -> `" << targetPathCopy.string() << "` (cross-device move)" << std::endl;
-                return true;
+            if (removeErr) {
+                // Take the copy back out, so the next sweep doesn't copy the file again beside it. Should that fail
+                // too, the copy stays and the move is journaled as done, so `undo` still knows about it.
+                std::error_code unplaceErr;
+                std::filesystem::remove(targetPath, unplaceErr);
+                if (unplaceErr) {
+                    Logger::error() << "Failed to remove original file `" << sourcePath.string() << "` after copy (" << removeErr.message()
+                                    << ") or the copy `" << targetPath.string() << "` (" << unplaceErr.message() << "); both remain.";
+                    if (m_journal != nullptr) {
+                        m_journal->commit(journalId);
+                    }
+                    notePlaced(destinationFolder, targetName);
+                } else {
+                    Logger::error() << "Failed to remove original file `" << sourcePath.string() << "` after copy: " << removeErr.message()
+                                    << "; removed the copy.";
+                    if (m_journal != nullptr) {
+                        m_journal->abort(journalId);
+                    }
+                    m_nameIndex.release(destinationFolder, targetName);
+                }
+                ec = removeErr;
+                return false;
             }
-            std::cerr << "Failed to remove original file `" << sourcePath.string() << "` after copy: " << removeErr.message() << std::endl;
-            return false;
+            if (m_journal != nullptr) {
+                m_journal->commit(journalId);
+            }
+            notePlaced(destinationFolder, targetName);
+
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            const double mebibytes = static_cast<double>(copy.bytesCopied) / (1024.0 * 1024.0);
+            Logger::info() << "Copied `" << sourcePath.string() << "` -> `" << targetPath.string() << "` (cross-device move"
+                           << (targetName == fileName ? "" : ", renamed to avoid collision") << ", " << copy.method << ", "
+                           << static_cast<std::uint64_t>(seconds > 0 ? mebibytes / seconds : 0) << " MiB/s)";
+            Metrics::add(Metrics::Counter::FilesCopied);
+            Metrics::add(Metrics::Counter::BytesCopied, copy.bytesCopied);
+            return true;
+        }
+
+        if (m_journal != nullptr) {
+            m_journal->abort(journalId);
+        }
+        if (renameErr == std::errc::file_exists) {
+            continue;
         }
 
-        std::cerr << "Failed to copy `" << sourcePath.string() << "` to `" << targetPathCopy.string() << "`: " << copyErr.message() << std::endl;
+        m_nameIndex.release(destinationFolder, targetName);
+        std::error_code cleanupErr;
+        std::filesystem::remove(copy.temporaryPath, cleanupErr);
+        Logger::error() << "Failed to move copy of `" << sourcePath.string() << "` into place: " << renameErr.message();
+        ec = renameErr;
         return false;
     }
 
-    std::cerr << "Failed to move `" << sourcePath.string() << "`: " << renameErr.message() << std::endl;
+    std::error_code cleanupErr;
+    std::filesystem::remove(copy.temporaryPath, cleanupErr);
+    Logger::error() << "Failed to move `" << sourcePath.string() << "`: every name the index offered in `" << destinationFolder.string()
+                    << "` was taken by another writer.";
+    ec = std::make_error_code(std::errc::file_exists);
     return false;
 }
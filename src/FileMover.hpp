@@ -1,38 +1,288 @@
 #ifndef FILE_MOVER_HPP
 #define FILE_MOVER_HPP
 
+#include "BoundedQueue.hpp"
 #include "ConfigParser.hpp"
+#include "ContentSniffer.hpp"
+#include "DestinationNameIndex.hpp"
+#include "DirectoryCache.hpp"
+#include "DirectoryHandleCache.hpp"
+#include "DuplicateIndex.hpp"
+#include "ExtensionClassifier.hpp"
+#include "FileStat.hpp"
+#include "IoScheduler.hpp"
+#include "MoveJournal.hpp"
+#include "MoveWorkerPool.hpp"
+#include "PatternMatcher.hpp"
+#include "RetentionIndex.hpp"
+#include "SweepCheckpoint.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
-// Moves files from the watch folder into destination folders based on extension rules.
+// Moves files from the watch folders into destination folders based on extension, name-pattern and content rules.
+// Each watch folder has its own rules, but all of them share one MoveWorkerPool and one destination directory
+// cache. Classification happens on the calling thread; the moves themselves run on the pool. The compiled rules
+// are an immutable snapshot that reloads replace atomically, so a reload never blocks or drops a move.
 class FileMover {
 public:
-    FileMover(std::filesystem::path watchFolder, std::vector<Rule> rules);
+    // Receives each move a dry run decides on: the file, its size, its destination directory and that directory's volume,
+    // and the index of the rule that matched it in its watch folder's rules.
+    using PlanSink = std::function<void(const std::filesystem::path& file, std::uint64_t size, const std::filesystem::path& destinationDir,
+                                        std::optional<std::uint64_t> volume, std::size_t rule)>;
+    // Told on a worker thread about each file placed, with its destination directory, size and the index of its rule.
+    using PlacedObserver = std::function<void(const std::filesystem::path& destinationDir, std::uint64_t size, std::size_t rule)>;
 
-    // Scan the watch folder once and move any matching files; returns false if any move fails.
-    bool organizeOnce();
-    // Replace the rule set and rebuild the extension lookup table.
-    void updateRules(std::vector<Rule> rules);
-    // Update the folder being watched; does not rebuild the lookup table.
-    void setWatchFolder(std::filesystem::path watchFolder);
+    // workerThreads == 0 picks a default from the number of hardware threads. compiledRules is what
+    // serializeRules() produced for these same folders (e.g. from rules.cache); folders it covers skip compiling.
+    FileMover(std::vector<WatchFolder> watchFolders, std::size_t workerThreads = 0, std::string_view compiledRules = {});
 
-private:
-    // Regenerate the extension-to-destination cache from the current rules.
-    void rebuildLookup();
-    // Determine where the provided file should be placed; returns empty if no rule matches.
-    std::filesystem::path resolveDestinationFor(const std::filesystem::path& file) const;
+    // Scan every watch folder once and move any matching files; returns false if any move fails. Listing,
+    // classifying and moving run as a pipeline with bounded queues between them, so moves start as soon as the
+    // first files are found and memory stays flat however large the backlog.
+    bool organizeOnce();
+    // Classify and move only the given files (e.g. watcher deltas); returns false if any move fails.
+    bool organizePaths(const std::vector<std::filesystem::path>& paths);
+    // Queue the given files for moving and return without waiting; failures are logged by the workers.
+    // arrivals, when given, holds the time each file was first noticed and feeds the arrival-to-placed metric.
+    // stats, when given, holds what is already known of each file's metadata, so it isn't fetched again.
+    void submitPaths(const std::vector<std::filesystem::path>& paths, const std::vector<std::chrono::steady_clock::time_point>& arrivals = {},
+                     const std::vector<FileStat>& stats = {});
+    // Replace the watch folders and their rules and rebuild the lookup tables, reusing compiledRules where it fits.
+    void updateWatchFolders(std::vector<WatchFolder> watchFolders, std::string_view compiledRules = {});
+    // The current compiled matchers of every folder, in the form the constructor accepts.
+    std::string serializeRules() const;
+    // Compile freshly loaded rules for the folders already being organized and publish them. Classifications
+    // already under way finish with the rules they started with. Folders added or removed, or whose `recursive`
+    // setting changed, keep their current setup until a restart, since their watches can't change underneath the
+    // watcher.
+    void reloadRules(const std::vector<WatchFolder>& watchFolders);
+    // Also classify files by their leading bytes, so extensionless and mislabeled files are routed by what they
+    // really are. Rules with `mime_types` turn this on regardless.
+    void setContentSniffing(bool enabled);
+    // Budget and prioritize the disk bandwidth of cross-volume copies; applies to copies started afterwards.
+    void setIoSettings(const IoSettings& settings);
+    // Record every move in journal, which must outlive the mover; nullptr (the default) records nothing.
+    void setJournal(MoveJournal* journal);
+    // What to do with files whose contents are already in their destination; off (the default) moves them anyway.
+    // Needs setDuplicateIndex(), which must outlive the mover, to take effect.
+    void setDedupAction(DedupAction action);
+    void setDuplicateIndex(DuplicateIndex* index);
+    // Record every placed file in index, which must outlive the mover; nullptr (the default) records nothing.
+    void setRetentionIndex(RetentionIndex* index);
+    // Hand the policies to the retention index, if there is one.
+    void setRetentionPolicies(std::vector<RetentionPolicy> policies);
+    // Let organizeOnce() skip directories checkpoint says are settled and record the ones it settles. The
+    // checkpoint must outlive the mover; nullptr (the default) classifies every file on every sweep.
+    void setCheckpoint(SweepCheckpoint* checkpoint);
+    // Classify as usual but hand each move to sink, on the classifying thread, instead of making it. Set before
+    // any file is organized; an empty sink (the default) moves files.
+    void setDryRun(PlanSink sink);
+    // Set before any file is organized; an empty observer (the default) isn't called.
+    void setPlacedObserver(PlacedObserver observer);
+    // Where the current rules would send file, or nullptr when none matches. Nothing is moved, and the file is
+    // only read when content sniffing applies (or examined when a rule has conditions or a dated destination).
+    // The result stays valid across later reloads.
+    std::shared_ptr<const std::filesystem::path> destinationFor(const std::filesystem::path& file);
     // Normalize extensions (trim whitespace, enforce dot prefix, lower-case).
     static std::string normalizeExtension(std::string extension);
-    // Perform the actual filesystem move, handling collisions and cross-device copies.
-    bool moveFile(const std::filesystem::path& sourcePath, const std::filesystem::path& destinationFolder) const;
+    // Whether path is a destination directory or lies inside one, so recursive scans and watches leave it alone.
+    bool isInsideDestination(const std::filesystem::path& path) const;
+    // Distinct destination directories named by the rules of every watch folder.
+    std::vector<std::filesystem::path> destinationDirectories() const;
+    // Called when a watcher sees a destination directory disappear so it is recreated on next use.
+    void forgetDirectory(const std::filesystem::path& directory);
+    // Called when a watcher sees a file deleted or moved out of a destination directory.
+    void forgetFile(const std::filesystem::path& file);
+    // How many per-file destination directory checks the directory cache has skipped so far.
+    std::uint64_t directoryChecksSaved() const;
+
+private:
+    // Completion tracking for the moves queued by one organize call.
+    struct MoveBatch {
+        std::mutex mutex;
+        std::condition_variable finished;
+        std::size_t pending = 0;
+        bool allSucceeded = true;
+    };
+
+    // A rule with size or age conditions. These stay out of the shared matchers, which can only report the first
+    // rule a name matches, and are checked one by one instead: name first, then the metadata its conditions need.
+    struct ConditionalRule {
+        std::uint16_t ruleId = 0;
+        RuleConditions conditions;
+        // The metadata the conditions read.
+        FileStat::Fields fields = 0;
+        // Extensions (as suffixes), globs and regexes.
+        PatternMatcher names;
+        // Per content type, whether `mime_types` names it.
+        std::vector<std::uint8_t> mimeTypes;
+        // No matchers at all: every file meeting the conditions qualifies.
+        bool anyName = false;
+    };
+
+    // Compiled matchers for one watch folder's rules. Rule ids are per folder and follow definition order.
+    struct RuleSet {
+        std::filesystem::path watchFolder;
+        // The folder as configured, absolute and normalized, and resolved; watchers report paths in any of these forms.
+        std::vector<std::filesystem::path> roots;
+        bool recursive = false;
+        std::vector<Rule> rules;
+        // Index into the snapshot's destinations for each rule id the matchers report.
+        std::vector<std::uint16_t> ruleDestinations;
+        ExtensionClassifier classifier;
+        PatternMatcher patterns;
+        // Per content type: the first rule naming it in `mime_types`, and that or the rule for its canonical extension.
+        std::vector<std::uint16_t> mimeRules;
+        std::vector<std::uint16_t> contentRules;
+        bool hasMimeRules = false;
+        // In rule id order.
+        std::vector<ConditionalRule> conditionalRules;
+    };
+
+    // Files found in one directory, on their way from the listing thread to classification.
+    struct ScanChunk {
+        std::filesystem::path directory;
+        std::vector<std::filesystem::path> files;
+        // Set on the directory's last chunk.
+        bool last = false;
+        // On the last chunk, when a checkpoint is kept: the directory's modification time before and after listing.
+        std::optional<std::int64_t> timeBefore;
+        std::optional<std::int64_t> timeAfter;
+    };
+
+    // Everything classification reads, compiled together and never modified once published.
+    struct RuleSnapshot {
+        std::vector<RuleSet> ruleSets;
+        // Distinct destinations across every watch folder's rules.
+        std::vector<std::filesystem::path> destinations;
+        // Absolute, normalized form of destinations for isInsideDestination(); for dated ones, the part before the date.
+        // Destinations that are watch folders themselves are not listed.
+        std::vector<std::filesystem::path> destinationRoots;
+        // Per destination, whether it contains date tokens to fill in per file.
+        std::vector<std::uint8_t> datedDestinations;
+        // Whether some rule's verdict depends on a file's size or age, so no directory ever stays settled.
+        bool dependsOnMetadata = false;
+    };
+
+    // Compile every folder's matchers and the shared destination list, restoring folders found in compiledRules.
+    static std::shared_ptr<const RuleSnapshot> compileSnapshot(std::vector<RuleSet> ruleSets, std::string_view compiledRules = {});
+    // Compile one folder's rules, interning its destinations into destinations.
+    static void compileRuleSet(RuleSet& ruleSet, std::vector<std::filesystem::path>& destinations);
+    // Load one folder's matchers from serializeRules() output; false (leaving destinations alone) when it doesn't fit.
+    static bool restoreRuleSet(RuleSet& ruleSet, std::string_view compiled, std::vector<std::filesystem::path>& destinations);
+    // Build the folder's conditional rules from its rules; they are cheap to compile and never cached.
+    static void compileConditions(RuleSet& ruleSet);
+    // Whether file meets the rule's conditions, fetching into stat only the metadata they read.
+    static bool conditionsHold(const ConditionalRule& rule, const std::filesystem::path& file, FileStat& stat);
+    // Whether destination contains `{yyyy}`, `{mm}` or `{dd}`.
+    static bool isDated(const std::filesystem::path& destination);
+    // The destination with its date tokens filled in from time, in local time.
+    static std::filesystem::path expandDate(const std::filesystem::path& destination, FileStat::Time time);
+    // The part of a dated destination above its first date token.
+    static std::filesystem::path undatedPart(const std::filesystem::path& destination);
+    // Index of destination in destinations, adding it when it is new.
+    static std::uint16_t internDestination(std::vector<std::filesystem::path>& destinations, const std::filesystem::path& destination);
+    // Make the snapshot current for every classification that starts from now on.
+    void publish(std::shared_ptr<const RuleSnapshot> snapshot);
+    // The current snapshot; holding it keeps its rules alive however many reloads happen meanwhile.
+    std::shared_ptr<const RuleSnapshot> snapshot() const;
+    // Scan one watch folder, queueing its moves under batch; returns false if it can't be read. Directories
+    // checkpoint (when not nullptr) says are settled are skipped, and those found settled are recorded.
+    bool organizeFolder(const RuleSnapshot& snapshot, const RuleSet& ruleSet, SweepCheckpoint* checkpoint,
+                        const std::shared_ptr<MoveBatch>& batch);
+    // List the folder (and its subfolders when recursive) into chunks; runs on its own thread. Sets ec as
+    // DirectoryScanner::walk() would.
+    void scanFolder(const RuleSnapshot& snapshot, const RuleSet& ruleSet, SweepCheckpoint* checkpoint, BoundedQueue<ScanChunk>& chunks,
+                    std::error_code& ec);
+    // Identifies the rules (and content sniffing setting) a checkpoint was recorded under.
+    std::uint64_t rulesFingerprint(const RuleSnapshot& snapshot) const;
+    static bool isInsideDestination(const RuleSnapshot& snapshot, const std::filesystem::path& path);
+    // The rules for the watch folder holding path (the innermost one when folders nest), or nullptr.
+    static const RuleSet* ruleSetFor(const RuleSnapshot& snapshot, const std::filesystem::path& path);
+    // Whether the file is being reported for the first time; rescans report it again only at debug level.
+    bool firstReport(const std::filesystem::path& filePath);
+    // Log that no rule matched the file: at info level the first time, at debug level after that.
+    void reportUnmatched(const std::filesystem::path& filePath);
+    // Classify a single regular file and queue its move when a rule matches; returns false only on failure.
+    // queued, when given, is set when the file has a move queued or already under way. stat is what is known of
+    // the file's metadata so far; it is filled in as needed and handed on to the move.
+    bool dispatchFile(const std::filesystem::path& filePath, const std::shared_ptr<MoveBatch>& batch,
+                      std::optional<std::chrono::steady_clock::time_point> arrivedAt = std::nullopt, bool* queued = nullptr,
+                      FileStat stat = {});
+    // Block until every move queued under the batch has finished; returns false if any failed.
+    static bool waitForBatch(MoveBatch& batch);
+    // Create the destination and move the file under reservedName, the name reserved for it when it was queued;
+    // runs on a worker thread.
+    bool placeFile(const std::filesystem::path& filePath, const std::filesystem::path& destinationDir, FileStat& stat,
+                   std::filesystem::path reservedName);
+    // Volume holding the directory, cached because the watch folder and destinations rarely change.
+    std::optional<std::uint64_t> cachedVolumeId(const std::filesystem::path& directory);
+    // Determine where the provided file should be placed; returns nullptr if no rule matches. A dated destination
+    // is filled in into expanded, which is then what's returned, and rule is set to the index of the winning rule.
+    // Only allocates when content sniffing has to read the file or a destination is dated.
+    const std::filesystem::path* resolveDestinationFor(const RuleSnapshot& snapshot, const RuleSet& ruleSet, const std::filesystem::path& file,
+                                                       FileStat& stat, std::filesystem::path& expanded, std::size_t& rule);
+    // Apply the dedup action to a file whose contents duplicate, already in destinationDir.
+    bool settleDuplicate(const std::filesystem::path& filePath, const std::filesystem::path& destinationDir,
+                         const std::filesystem::path& duplicate, DedupAction action, FileStat& stat, std::filesystem::path reservedName);
+    // Tell the duplicate and retention indexes about a file just placed in destinationDir.
+    void notePlaced(const std::filesystem::path& destinationDir, const std::filesystem::path& fileName);
+    // The name reserved up front the first time, a fresh reservation after that (another writer took the name).
+    std::filesystem::path claimName(std::filesystem::path& reservedName, const std::filesystem::path& directory,
+                                    const std::filesystem::path& fileName);
+    // Perform the actual filesystem move, handling collisions and cross-device copies; ec holds the last error on failure.
+    // The first attempt uses reservedName when one is given.
+    bool moveFile(const std::filesystem::path& sourcePath, const std::filesystem::path& destinationFolder, FileStat& stat, std::error_code& ec,
+                  std::filesystem::path reservedName = {});
+    // Copy to a durable temporary in the destination, rename it into place, then remove the source.
+    bool moveAcrossDevices(const std::filesystem::path& sourcePath, const std::filesystem::path& destinationFolder, FileStat& stat,
+                           std::error_code& ec, std::filesystem::path reservedName = {});
+
+    // Only ever accessed through std::atomic_load/std::atomic_store, so readers never wait for a reload.
+    std::shared_ptr<const RuleSnapshot> m_snapshot;
+    // Serializes publishers; readers don't take it.
+    std::mutex m_publishMutex;
+    ContentSniffer m_sniffer;
+    std::atomic<bool> m_sniffContent{false};
+    MoveJournal* m_journal = nullptr;
+    SweepCheckpoint* m_checkpoint = nullptr;
+    DuplicateIndex* m_duplicates = nullptr;
+    RetentionIndex* m_retention = nullptr;
+    std::atomic<DedupAction> m_dedupAction{DedupAction::Off};
+    PlanSink m_planSink;
+    PlacedObserver m_placedObserver;
+    IoScheduler m_io;
+    DirectoryCache m_directoryCache;
+    DirectoryHandleCache m_directoryHandles;
+    DestinationNameIndex m_nameIndex;
+
+    std::mutex m_volumeMutex;
+    std::unordered_map<std::filesystem::path::string_type, std::optional<std::uint64_t>> m_volumeIds;
+    // Sources with a queued or running move, so repeated notifications don't queue the same file twice.
+    std::mutex m_inFlightMutex;
+    std::unordered_set<std::filesystem::path::string_type> m_inFlight;
+    // Files already reported as matching no rule or as still downloading; rescans report them again only at
+    // debug level. Cleared whenever the rules change, since the same file may be worth mentioning under new rules.
+    std::mutex m_reportedMutex;
+    std::unordered_set<std::filesystem::path::string_type> m_reported;
 
-    std::filesystem::path m_watchFolder;
-    std::vector<Rule> m_rules;
-    std::unordered_map<std::string, std::filesystem::path> m_extensionToDestination;
+    // Declared last so it is destroyed first: draining the queues still touches the members above.
+    std::unique_ptr<MoveWorkerPool> m_pool;
 };
 
 #endif
@@ -0,0 +1,87 @@
+#include "FileStat.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+namespace {
+#ifdef _WIN32
+// FILETIME counts 100 ns intervals since 1601-01-01.
+constexpr std::int64_t kFileTimeToUnixEpoch = 116444736000000000;
+
+std::chrono::nanoseconds fromFileTime(const FILETIME& time) {
+    const auto ticks = static_cast<std::int64_t>((static_cast<std::uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime);
+    return std::chrono::nanoseconds((ticks - kFileTimeToUnixEpoch) * 100);
+}
+#elif !defined(STATX_TYPE)
+std::chrono::nanoseconds fromTimespec(const timespec& time) {
+    return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+}
+#endif
+} // namespace
+
+bool FileStat::fetch(const std::filesystem::path& path, Fields fields) {
+    const Fields missing = fields & ~m_known;
+    if (missing == 0) {
+        return true;
+    }
+
+#ifdef _WIN32
+    // One call returns every field; keep them all.
+    WIN32_FILE_ATTRIBUTE_DATA data{};
+    if (!GetFileAttributesExW(path.wstring().c_str(), GetFileExInfoStandard, &data) ||
+        (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+        return false;
+    }
+    m_size = (static_cast<std::uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    m_modified = fromFileTime(data.ftLastWriteTime);
+    m_accessed = fromFileTime(data.ftLastAccessTime);
+    m_born = fromFileTime(data.ftCreationTime);
+    m_known = Size | Modified | Accessed | Born;
+#elif defined(STATX_TYPE)
+    // Asking only for what's missing lets filesystems that can skip fetching the rest (e.g. network ones) do so.
+    unsigned mask = STATX_TYPE;
+    mask |= (missing & Size) != 0 ? STATX_SIZE : 0;
+    mask |= (missing & Modified) != 0 ? STATX_MTIME : 0;
+    mask |= (missing & Accessed) != 0 ? STATX_ATIME : 0;
+    mask |= (missing & Born) != 0 ? STATX_BTIME : 0;
+    struct statx info {};
+    if (::statx(AT_FDCWD, path.c_str(), 0, mask, &info) != 0 || !S_ISREG(info.stx_mode)) {
+        return false;
+    }
+    if ((info.stx_mask & STATX_SIZE) != 0) {
+        m_size = info.stx_size;
+        m_known |= Size;
+    }
+    if ((info.stx_mask & STATX_MTIME) != 0) {
+        m_modified = std::chrono::seconds(info.stx_mtime.tv_sec) + std::chrono::nanoseconds(info.stx_mtime.tv_nsec);
+        m_known |= Modified;
+    }
+    if ((info.stx_mask & STATX_ATIME) != 0) {
+        m_accessed = std::chrono::seconds(info.stx_atime.tv_sec) + std::chrono::nanoseconds(info.stx_atime.tv_nsec);
+        m_known |= Accessed;
+    }
+    if ((info.stx_mask & STATX_BTIME) != 0) {
+        m_born = std::chrono::seconds(info.stx_btime.tv_sec) + std::chrono::nanoseconds(info.stx_btime.tv_nsec);
+        m_known |= Born;
+    }
+#else
+    // No statx: one stat returns every field.
+    struct stat info {};
+    if (::stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+        return false;
+    }
+    m_size = static_cast<std::uint64_t>(info.st_size);
+    m_modified = fromTimespec(info.st_mtim);
+    m_accessed = fromTimespec(info.st_atim);
+    m_known |= Size | Modified | Accessed;
+#endif
+    return has(fields);
+}
+
+bool FileStat::sameSizeAndTime(const FileStat& other) const noexcept {
+    return has(Size | Modified) && other.has(Size | Modified) && m_size == other.m_size && m_modified == other.m_modified;
+}
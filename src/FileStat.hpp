@@ -0,0 +1,50 @@
+#ifndef FILE_STAT_HPP
+#define FILE_STAT_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+
+// What is known of one file's metadata. Fields are fetched on first use, and only those asked for: one statx()
+// per fetch() covering every requested field still missing. A FileStat travels with its file from the stability
+// check through classification to the move, so each field costs at most one metadata call per file however many
+// stages and rules look at it.
+class FileStat {
+public:
+    enum Field : std::uint8_t {
+        Size = 1 << 0,
+        Modified = 1 << 1,
+        Accessed = 1 << 2,
+        // Creation time; not every filesystem records it.
+        Born = 1 << 3,
+    };
+    using Fields = std::uint8_t;
+    using Time = std::chrono::system_clock::time_point;
+
+    // Make sure the fields are known. Returns false when the file can't be examined, isn't a regular file, or
+    // its filesystem doesn't record one of them; fields learned meanwhile are kept.
+    bool fetch(const std::filesystem::path& path, Fields fields);
+    bool has(Fields fields) const noexcept { return (m_known & fields) == fields; }
+
+    std::uint64_t size() const noexcept { return m_size; }
+    Time modified() const noexcept { return toTime(m_modified); }
+    Time accessed() const noexcept { return toTime(m_accessed); }
+    Time born() const noexcept { return toTime(m_born); }
+
+    // Whether both know the size and modification time, and agree on them.
+    bool sameSizeAndTime(const FileStat& other) const noexcept;
+
+private:
+    static Time toTime(std::chrono::nanoseconds sinceEpoch) noexcept {
+        return Time(std::chrono::duration_cast<Time::duration>(sinceEpoch));
+    }
+
+    Fields m_known = 0;
+    std::uint64_t m_size = 0;
+    // Since the Unix epoch.
+    std::chrono::nanoseconds m_modified{0};
+    std::chrono::nanoseconds m_accessed{0};
+    std::chrono::nanoseconds m_born{0};
+};
+
+#endif
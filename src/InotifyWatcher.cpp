@@ -0,0 +1,543 @@
+#include "InotifyWatcher.hpp"
+
+#include "DirectoryScanner.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "PlatformFs.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <string>
+#include <system_error>
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+namespace {
+// Completed writes and files renamed into the folder are the only arrivals worth acting on.
+constexpr std::uint32_t kWatchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+// Recursive watches also need to see subdirectories being created or moved in and out.
+constexpr std::uint32_t kRecursiveWatchMask = kWatchMask | IN_CREATE | IN_MOVED_FROM;
+// Destinations are watched for disappearing, which is all the directory cache needs to know, and for files
+// leaving them, which the retention index needs to know.
+constexpr std::uint32_t kDestinationMask = IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+// When fanotify covers a tree, the root's inotify watch is only there to notice the root going away.
+constexpr std::uint32_t kFanotifyRootMask = IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+// Large enough to pull a burst of events per read without looping.
+constexpr std::size_t kEventBufferSize = 64 * 1024;
+constexpr int kMaxEpollEvents = 8;
+// How often directories that didn't get a watch (inotify limit reached) are rescanned.
+constexpr auto kUnwatchedPollInterval = std::chrono::seconds(30);
+
+std::string lastErrorMessage() {
+    return std::error_code(errno, std::generic_category()).message();
+}
+
+sigset_t shutdownSignalSet() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    return signals;
+}
+} // namespace
+
+InotifyWatcher::InotifyWatcher(FileMover& mover, ChangeQueue::Clock::duration quietPeriod, StabilityTracker::Clock::duration stablePeriod)
+    : m_mover(mover), m_pending(quietPeriod), m_stability(stablePeriod) {}
+
+InotifyWatcher::~InotifyWatcher() {
+    closeAll();
+}
+
+bool InotifyWatcher::blockShutdownSignals() {
+    const sigset_t shutdownSignals = shutdownSignalSet();
+    const int status = pthread_sigmask(SIG_BLOCK, &shutdownSignals, nullptr);
+    if (status != 0) {
+        Logger::error() << "Failed to block shutdown signals: " << std::error_code(status, std::generic_category()).message();
+        return false;
+    }
+    return true;
+}
+
+bool InotifyWatcher::open() {
+    m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotifyFd < 0) {
+        Logger::error() << "Failed to initialize inotify: " << lastErrorMessage();
+        return false;
+    }
+
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollFd < 0) {
+        Logger::error() << "Failed to create epoll instance: " << lastErrorMessage();
+        return false;
+    }
+
+    // Route SIGINT/SIGTERM through a descriptor so the daemon can shut down between batches.
+    if (!blockShutdownSignals()) {
+        return false;
+    }
+
+    const sigset_t shutdownSignals = shutdownSignalSet();
+    m_signalFd = signalfd(-1, &shutdownSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (m_signalFd < 0) {
+        Logger::error() << "Failed to create signal descriptor: " << lastErrorMessage();
+        return false;
+    }
+
+    for (int fd : {m_inotifyFd, m_signalFd}) {
+        epoll_event registration{};
+        registration.events = EPOLLIN;
+        registration.data.fd = fd;
+        if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &registration) != 0) {
+            Logger::error() << "Failed to register descriptor with epoll: " << lastErrorMessage();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool InotifyWatcher::addWatch(const std::filesystem::path& folder, bool recursive) {
+    WatchRoot root{folder, recursive, false};
+
+    // One filesystem mark covers a tree of any size; without the privileges for it, fall back to inotify.
+    if (recursive && !m_fanotifyUnavailable && !m_fanotify) {
+        auto monitor = std::make_unique<FanotifyMonitor>();
+        std::error_code ec;
+        if (monitor->open(ec)) {
+            epoll_event registration{};
+            registration.events = EPOLLIN;
+            registration.data.fd = monitor->fd();
+            if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, monitor->fd(), &registration) == 0) {
+                m_fanotify = std::move(monitor);
+            } else {
+                ec = std::error_code(errno, std::generic_category());
+            }
+        }
+
+        if (!m_fanotify) {
+            Logger::warning() << "fanotify is unavailable (" << ec.message() << "); watching subfolders with one inotify watch each.";
+            m_fanotifyUnavailable = true;
+        }
+    }
+
+    if (recursive && m_fanotify) {
+        std::error_code ec;
+        if (m_fanotify->addRoot(folder, ec)) {
+            root.fanotify = true;
+        } else {
+            Logger::warning() << "fanotify cannot mark `" << folder.string() << "` (" << ec.message() << "); using inotify watches instead.";
+        }
+    }
+
+    if (root.fanotify) {
+        const int wd = inotify_add_watch(m_inotifyFd, folder.c_str(), kFanotifyRootMask | IN_MASK_ADD);
+        if (wd < 0) {
+            Logger::error() << "Failed to watch `" << folder.string() << "`: " << lastErrorMessage();
+            return false;
+        }
+        auto [it, inserted] = m_watchDescriptors.try_emplace(wd, WatchedDirectory{folder, true, false});
+        if (inserted) {
+            m_watchedPaths[folder.native()] = wd;
+        }
+        if (inserted || !it->second.root) {
+            ++m_rootWatchCount;
+        }
+        it->second.root = true;
+    } else {
+        if (!watchDirectory(folder, true, recursive)) {
+            return false;
+        }
+        if (recursive) {
+            watchSubtree(folder, false, ChangeQueue::Clock::now());
+        }
+    }
+
+    m_roots.push_back(root);
+    if (!recursive) {
+        Logger::info() << "Monitoring `" << folder.string() << "` for changes...";
+    } else if (root.fanotify) {
+        Logger::info() << "Monitoring `" << folder.string() << "` and its subfolders for changes (fanotify)...";
+    } else {
+        Logger::info() << "Monitoring `" << folder.string() << "` and its subfolders for changes (" << m_watchedPaths.size()
+                       << " inotify watch(es))...";
+    }
+    return true;
+}
+
+void InotifyWatcher::watchDestinations() {
+    for (const auto& destination : m_mover.destinationDirectories()) {
+        // Folders that don't exist yet are created on first use; a failed move covers them if they vanish later.
+        // IN_MASK_ADD because a destination may be a watch folder itself, whose own mask must survive.
+        const int wd = inotify_add_watch(m_inotifyFd, destination.c_str(), kDestinationMask | IN_MASK_ADD);
+        if (wd >= 0) {
+            m_destinationWatches[wd] = destination;
+        }
+    }
+}
+
+bool InotifyWatcher::run() {
+    epoll_event ready[kMaxEpollEvents];
+    while (true) {
+        const int count = epoll_wait(m_epollFd, ready, kMaxEpollEvents, nextTimeoutMs());
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Logger::error() << "epoll_wait failed: " << lastErrorMessage();
+            return false;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            if (ready[i].data.fd == m_signalFd) {
+                drainSignal();
+                Logger::info() << "Shutdown requested; stopping the watcher.";
+                return true;
+            }
+
+            if (ready[i].data.fd == m_inotifyFd && !drainEvents()) {
+                return false;
+            }
+
+            if (m_fanotify && ready[i].data.fd == m_fanotify->fd() && !drainFanotify()) {
+                return false;
+            }
+        }
+
+        pollUnwatched(ChangeQueue::Clock::now());
+        releaseReadyPaths();
+    }
+}
+
+bool InotifyWatcher::watchDirectory(const std::filesystem::path& directory, bool root, bool recursive) {
+    // IN_MASK_ADD so a directory covered by two watch folders (one nested in the other) keeps the wider mask.
+    const int wd = inotify_add_watch(m_inotifyFd, directory.c_str(), (recursive ? kRecursiveWatchMask : kWatchMask) | IN_MASK_ADD);
+    if (wd < 0) {
+        if (errno == ENOSPC && !root) {
+            // Out of watches: degrade to polling this directory rather than silently missing its files.
+            if (!m_watchLimitReported) {
+                Logger::warning() << "Reached the inotify watch limit (fs.inotify.max_user_watches); folders beyond it are rescanned every "
+                                  << std::chrono::duration_cast<std::chrono::seconds>(kUnwatchedPollInterval).count() << " s instead.";
+                m_watchLimitReported = true;
+            }
+            m_unwatched.insert(directory);
+            if (!m_nextPoll) {
+                m_nextPoll = ChangeQueue::Clock::now() + kUnwatchedPollInterval;
+            }
+            return true;
+        }
+
+        if (root) {
+            Logger::error() << "Failed to watch `" << directory.string() << "`: " << lastErrorMessage();
+        }
+        return false;
+    }
+
+    auto [it, inserted] = m_watchDescriptors.try_emplace(wd, WatchedDirectory{directory, root, recursive});
+    if (!inserted) {
+        // Same inode reached twice (nested watch folders or a bind mount); keep the first path so events stay stable.
+        if (root && !it->second.root) {
+            ++m_rootWatchCount;
+        }
+        it->second.root = it->second.root || root;
+        it->second.recursive = it->second.recursive || recursive;
+        return true;
+    }
+    m_watchedPaths[directory.native()] = wd;
+    if (root) {
+        ++m_rootWatchCount;
+    }
+    return true;
+}
+
+void InotifyWatcher::watchSubtree(const std::filesystem::path& directory, bool queueFiles, ChangeQueue::Clock::time_point now) {
+    // Links to directories are never reported as directories, so they are neither watched nor descended into.
+    auto descend = [this](const std::filesystem::path& subdirectory) {
+        if (m_mover.isInsideDestination(subdirectory)) {
+            return false;
+        }
+        // A nested watch folder may already be watched, but without the events needed to follow subdirectories.
+        const auto known = m_watchedPaths.find(subdirectory.native());
+        const bool followed = known != m_watchedPaths.end() && m_watchDescriptors[known->second].recursive;
+        if (!followed && m_unwatched.count(subdirectory) == 0) {
+            watchDirectory(subdirectory, false, true);
+        }
+        return true;
+    };
+    auto visitFile = [&](const std::filesystem::path& file) {
+        if (queueFiles && !StabilityTracker::isInProgressDownload(file)) {
+            m_pending.touch(file, now);
+        }
+    };
+
+    std::error_code ec;
+    DirectoryScanner scanner;
+    scanner.walk(directory, descend, visitFile, ec);
+}
+
+void InotifyWatcher::unwatchSubtree(const std::filesystem::path& directory) {
+    for (auto it = m_watchedPaths.begin(); it != m_watchedPaths.end();) {
+        auto watched = m_watchDescriptors.find(it->second);
+        const bool isRoot = watched != m_watchDescriptors.end() && watched->second.root;
+        if (!isRoot && platform::isSameOrBelow(std::filesystem::path(it->first), directory)) {
+            inotify_rm_watch(m_inotifyFd, it->second);
+            if (watched != m_watchDescriptors.end()) {
+                m_watchDescriptors.erase(watched);
+            }
+            it = m_watchedPaths.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Paths sort component by component, so everything below directory follows it contiguously.
+    for (auto it = m_unwatched.lower_bound(directory); it != m_unwatched.end() && platform::isSameOrBelow(*it, directory);) {
+        it = m_unwatched.erase(it);
+    }
+}
+
+void InotifyWatcher::pollUnwatched(ChangeQueue::Clock::time_point now) {
+    if (!m_nextPoll || now < *m_nextPoll) {
+        return;
+    }
+
+    m_nextPoll.reset();
+    const std::set<std::filesystem::path> directories = std::move(m_unwatched);
+    m_unwatched.clear();
+
+    DirectoryScanner scanner;
+    for (const auto& directory : directories) {
+        std::error_code ec;
+        if (!std::filesystem::is_directory(directory, ec)) {
+            continue;
+        }
+
+        // Watches may have been freed since; if not, this puts the directory back on the poll list.
+        watchDirectory(directory, false, true);
+
+        scanner.list(directory, [&](DirectoryScanner::NameView name, DirectoryScanner::EntryType type) {
+            const auto path = directory / name;
+            if (type == DirectoryScanner::EntryType::Directory) {
+                const bool known = m_watchedPaths.count(path.native()) != 0 || directories.count(path) != 0 || m_unwatched.count(path) != 0;
+                if (!known && !m_mover.isInsideDestination(path) && watchDirectory(path, false, true)) {
+                    watchSubtree(path, true, now);
+                }
+            } else if (type == DirectoryScanner::EntryType::File && !StabilityTracker::isInProgressDownload(path)) {
+                m_pending.touch(path, now);
+            }
+        }, ec);
+    }
+}
+
+void InotifyWatcher::trackTree(const std::filesystem::path& directory, ChangeQueue::Clock::time_point now) {
+    m_stability.trackFolder(directory, now, true, [this](const std::filesystem::path& subdirectory) {
+        return m_mover.isInsideDestination(subdirectory);
+    });
+}
+
+bool InotifyWatcher::drainEvents() {
+    alignas(inotify_event) char buffer[kEventBufferSize];
+    const auto now = ChangeQueue::Clock::now();
+    bool overflowed = false;
+
+    while (true) {
+        const ssize_t length = read(m_inotifyFd, buffer, sizeof(buffer));
+        if (length < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                break;
+            }
+            Logger::error() << "Failed to read inotify events: " << lastErrorMessage();
+            return false;
+        }
+
+        for (const char* cursor = buffer; cursor < buffer + length;) {
+            const auto* event = reinterpret_cast<const inotify_event*>(cursor);
+            cursor += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflowed = true;
+                continue;
+            }
+
+            if (auto destination = m_destinationWatches.find(event->wd); destination != m_destinationWatches.end()) {
+                if (event->mask & IN_IGNORED) {
+                    m_destinationWatches.erase(destination);
+                } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    Logger::info() << "Destination `" << destination->second.string() << "` was removed; it will be recreated on next use.";
+                    m_mover.forgetDirectory(destination->second);
+                    inotify_rm_watch(m_inotifyFd, event->wd);
+                } else if ((event->mask & (IN_DELETE | IN_MOVED_FROM)) && event->len > 0) {
+                    m_mover.forgetFile(destination->second / event->name);
+                }
+                // A destination that is also watched as a source folder gets its events handled as one too.
+                if (m_watchDescriptors.count(event->wd) == 0) {
+                    continue;
+                }
+            }
+
+            auto it = m_watchDescriptors.find(event->wd);
+            if (it == m_watchDescriptors.end()) {
+                continue;
+            }
+            const WatchedDirectory& watched = it->second;
+
+            // Subdirectories are dropped through their parent's IN_MOVED_FROM or the IN_IGNORED after deletion;
+            // only a root going away is worth reporting.
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                if (watched.root || (event->mask & IN_IGNORED)) {
+                    if (watched.root) {
+                        Logger::error() << "Watch folder `" << watched.path.string() << "` was removed or moved.";
+                        --m_rootWatchCount;
+                    }
+                    if (auto path = m_watchedPaths.find(watched.path.native()); path != m_watchedPaths.end() && path->second == event->wd) {
+                        m_watchedPaths.erase(path);
+                    }
+                    m_watchDescriptors.erase(it);
+                }
+                continue;
+            }
+
+            if (event->len == 0) {
+                continue;
+            }
+
+            auto path = watched.path / event->name;
+            if (event->mask & IN_ISDIR) {
+                if (!watched.recursive) {
+                    continue;
+                }
+                if (event->mask & IN_MOVED_FROM) {
+                    unwatchSubtree(path);
+                } else if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && !m_mover.isInsideDestination(path) &&
+                           watchDirectory(path, false, true)) {
+                    // Anything created before the watch existed raised no events, so pick it up now.
+                    watchSubtree(path, true, now);
+                }
+                continue;
+            }
+
+            // Partial downloads are renamed to their real name when complete, which raises its own event.
+            if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && !StabilityTracker::isInProgressDownload(event->name)) {
+                m_pending.touch(path, now);
+            }
+        }
+    }
+
+    if (m_rootWatchCount == 0) {
+        Logger::error() << "No folders left to watch.";
+        return false;
+    }
+
+    if (overflowed) {
+        Logger::warning() << "inotify event queue overflowed; rescanning the watch folder.";
+        rescanAfterOverflow(now);
+    }
+
+    return true;
+}
+
+bool InotifyWatcher::drainFanotify() {
+    std::vector<FanotifyMonitor::Event> events;
+    bool overflowed = false;
+    if (!m_fanotify->drain(events, overflowed)) {
+        Logger::error() << "Failed to read fanotify events: " << lastErrorMessage();
+        return false;
+    }
+
+    const auto now = ChangeQueue::Clock::now();
+    for (const auto& event : events) {
+        // The mark covers the whole filesystem, including our own moves into destinations below the root.
+        if (m_mover.isInsideDestination(event.path)) {
+            continue;
+        }
+
+        if (event.directory) {
+            trackTree(event.path, now);
+        } else if (!StabilityTracker::isInProgressDownload(event.path)) {
+            m_pending.touch(event.path, now);
+        }
+    }
+
+    if (overflowed) {
+        Logger::warning() << "fanotify event queue overflowed; rescanning the watch folder.";
+        rescanAfterOverflow(now);
+    }
+    return true;
+}
+
+void InotifyWatcher::rescanAfterOverflow(ChangeQueue::Clock::time_point now) {
+    // The kernel dropped events, so rescan; every file still goes through the stability check, since a burst
+    // big enough to overflow the queue is likely to include downloads in progress. Directories created during
+    // the gap never got watches either.
+    m_pending.clear();
+    for (const auto& root : m_roots) {
+        if (root.recursive && !root.fanotify) {
+            watchSubtree(root.path, false, now);
+        }
+
+        if (root.recursive) {
+            trackTree(root.path, now);
+        } else {
+            m_stability.trackFolder(root.path, now);
+        }
+    }
+}
+
+void InotifyWatcher::releaseReadyPaths() {
+    const auto now = ChangeQueue::Clock::now();
+    std::vector<ChangeQueue::Clock::time_point> firstSeen;
+    const auto ready = m_pending.takeReady(now, &firstSeen);
+    for (std::size_t index = 0; index < ready.size(); ++index) {
+        m_stability.track(ready[index], now, firstSeen[index]);
+    }
+
+    // Hand off without waiting so new events keep flowing while the workers move files.
+    std::vector<ChangeQueue::Clock::time_point> arrivals;
+    std::vector<FileStat> stats;
+    const auto stable = m_stability.advance(now, &arrivals, &stats);
+    if (!stable.empty()) {
+        m_mover.submitPaths(stable, arrivals, stats);
+    }
+    Metrics::set(Metrics::Gauge::PendingEvents, static_cast<std::int64_t>(m_pending.size()));
+    Metrics::set(Metrics::Gauge::StabilityTracked, static_cast<std::int64_t>(m_stability.size()));
+}
+
+int InotifyWatcher::nextTimeoutMs() {
+    auto deadline = m_pending.nextDeadline();
+    for (const auto& candidate : {m_stability.nextDeadline(), m_nextPoll}) {
+        if (candidate && (!deadline || *candidate < *deadline)) {
+            deadline = candidate;
+        }
+    }
+    if (!deadline) {
+        return -1;
+    }
+
+    const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(*deadline - ChangeQueue::Clock::now());
+    return remaining.count() > 0 ? static_cast<int>(remaining.count()) : 0;
+}
+
+void InotifyWatcher::drainSignal() {
+    signalfd_siginfo info{};
+    while (read(m_signalFd, &info, sizeof(info)) == static_cast<ssize_t>(sizeof(info))) {
+    }
+}
+
+void InotifyWatcher::closeAll() {
+    // The fanotify descriptor is owned by the monitor, which closes it on destruction.
+    m_fanotify.reset();
+    for (int* fd : {&m_signalFd, &m_epollFd, &m_inotifyFd}) {
+        if (*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef INOTIFY_WATCHER_HPP
+#define INOTIFY_WATCHER_HPP
+
+#include "ChangeQueue.hpp"
+#include "FanotifyMonitor.hpp"
+#include "FileMover.hpp"
+#include "StabilityTracker.hpp"
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+// Linux watcher that turns inotify (and, for recursive trees, fanotify) events into per-file FileMover work
+// from an epoll loop.
+class InotifyWatcher {
+public:
+    // Files are handed to the mover once they have produced no events for quietPeriod and their size and
+    // modification time have then held still for stablePeriod.
+    InotifyWatcher(FileMover& mover, ChangeQueue::Clock::duration quietPeriod, StabilityTracker::Clock::duration stablePeriod);
+    ~InotifyWatcher();
+
+    InotifyWatcher(const InotifyWatcher&) = delete;
+    InotifyWatcher& operator=(const InotifyWatcher&) = delete;
+
+    // Block SIGINT/SIGTERM for the calling thread and every thread it later spawns; call before starting
+    // other threads so the signals are only ever consumed through the watcher's signal descriptor.
+    static bool blockShutdownSignals();
+    // Set up inotify, epoll and the shutdown signal descriptor; returns false on failure.
+    bool open();
+    // Start watching the folder for completed writes and files moved into it. With recursive, its whole
+    // subtree is covered too: through one fanotify filesystem mark when allowed, otherwise with an inotify
+    // watch per directory that follows directories as they appear and disappear.
+    bool addWatch(const std::filesystem::path& folder, bool recursive = false);
+    // Watch the mover's existing destination directories so their removal invalidates its directory cache.
+    void watchDestinations();
+    // Block until SIGINT/SIGTERM (returns true) or an unrecoverable error (returns false).
+    bool run();
+
+private:
+    struct WatchRoot {
+        std::filesystem::path path;
+        bool recursive = false;
+        // Subtree covered by a fanotify filesystem mark rather than per-directory inotify watches.
+        bool fanotify = false;
+    };
+
+    struct WatchedDirectory {
+        std::filesystem::path path;
+        bool root = false;
+        // Follow subdirectories created or moved in below this one.
+        bool recursive = false;
+    };
+
+    // Add one inotify watch. When the inotify watch limit is hit in recursive mode the directory is polled
+    // instead; returns false only when the directory could not be covered at all.
+    bool watchDirectory(const std::filesystem::path& directory, bool root, bool recursive);
+    // Watch every directory below directory, skipping destinations; with queueFiles the files already there
+    // are queued too, since they arrived before the watches existed.
+    void watchSubtree(const std::filesystem::path& directory, bool queueFiles, ChangeQueue::Clock::time_point now);
+    // Drop the watches for directory and everything below it, e.g. when it is moved out of the tree.
+    void unwatchSubtree(const std::filesystem::path& directory);
+    // Retry directories left unwatched by the watch limit and queue any files that appeared in them.
+    void pollUnwatched(ChangeQueue::Clock::time_point now);
+    // Queue every file below directory that isn't inside a destination, e.g. a whole folder moved in.
+    void trackTree(const std::filesystem::path& directory, ChangeQueue::Clock::time_point now);
+    // Read every pending inotify record; returns false when watching can no longer continue.
+    bool drainEvents();
+    // Read every pending fanotify record; returns false when the descriptor fails.
+    bool drainFanotify();
+    // Recover from dropped events by running every watched tree through the stability tracker.
+    void rescanAfterOverflow(ChangeQueue::Clock::time_point now);
+    // Pass quiet paths on to the stability tracker and hand every file it reports stable to the mover.
+    void releaseReadyPaths();
+    // Milliseconds epoll may sleep before the queue, the tracker or the unwatched-directory poll next has work (-1 = none).
+    int nextTimeoutMs();
+    // Consume the pending shutdown signal.
+    void drainSignal();
+    void closeAll();
+
+    FileMover& m_mover;
+    int m_inotifyFd = -1;
+    int m_epollFd = -1;
+    int m_signalFd = -1;
+    std::unordered_map<int, WatchedDirectory> m_watchDescriptors;
+    std::unordered_map<std::filesystem::path::string_type, int> m_watchedPaths;
+    std::unordered_map<int, std::filesystem::path> m_destinationWatches;
+    // Folders passed to addWatch(); rescans after an overflow walk these.
+    std::vector<WatchRoot> m_roots;
+    std::size_t m_rootWatchCount = 0;
+    // Directories that couldn't get an inotify watch because the limit was reached, polled instead.
+    std::set<std::filesystem::path> m_unwatched;
+    std::optional<ChangeQueue::Clock::time_point> m_nextPoll;
+    bool m_watchLimitReported = false;
+    std::unique_ptr<FanotifyMonitor> m_fanotify;
+    bool m_fanotifyUnavailable = false;
+    ChangeQueue m_pending;
+    StabilityTracker m_stability;
+};
+
+#endif
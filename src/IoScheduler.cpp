@@ -0,0 +1,127 @@
+#include "IoScheduler.hpp"
+
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef __linux__
+// From linux/ioprio.h, which not every libc ships.
+constexpr int kIoprioWhoProcess = 1;
+constexpr int kIoprioClassShift = 13;
+constexpr int kIoprioClassBestEffort = 2;
+constexpr int kIoprioClassIdle = 3;
+constexpr int kIoprioLowestLevel = 7;
+
+// With who = 0, both calls act on the calling thread only.
+int currentIoPriority() {
+    return static_cast<int>(::syscall(SYS_ioprio_get, kIoprioWhoProcess, 0));
+}
+
+bool setIoPriority(int value) {
+    return ::syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, value) == 0;
+}
+#endif
+} // namespace
+
+IoScheduler::PriorityScope::PriorityScope(IoPriority priority) {
+    if (priority == IoPriority::Normal) {
+        return;
+    }
+#ifdef _WIN32
+    // Background mode lowers the thread's I/O (and CPU) priority; Windows has no finer split between the two.
+    m_applied = SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN) != 0;
+#elif defined(__linux__)
+    m_previous = currentIoPriority();
+    if (m_previous < 0) {
+        return;
+    }
+    const int value = priority == IoPriority::Idle ? kIoprioClassIdle << kIoprioClassShift
+                                                   : (kIoprioClassBestEffort << kIoprioClassShift) | kIoprioLowestLevel;
+    m_applied = setIoPriority(value);
+#endif
+}
+
+IoScheduler::PriorityScope::~PriorityScope() {
+    if (!m_applied) {
+        return;
+    }
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+#elif defined(__linux__)
+    setIoPriority(m_previous);
+#endif
+}
+
+std::optional<IoPriority> IoScheduler::parsePriority(std::string_view name) {
+    if (name == "normal") {
+        return IoPriority::Normal;
+    }
+    if (name == "low") {
+        return IoPriority::Low;
+    }
+    if (name == "idle") {
+        return IoPriority::Idle;
+    }
+    return std::nullopt;
+}
+
+void IoScheduler::configure(const IoSettings& settings) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_settings = settings;
+    m_buckets.clear();
+}
+
+bool IoScheduler::isSmall(std::uintmax_t size) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return size <= m_settings.smallFileBytes;
+}
+
+bool IoScheduler::throttled() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_settings.bytesPerSecond != 0;
+}
+
+IoPriority IoScheduler::priority() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_settings.priority;
+}
+
+void IoScheduler::charge(std::uint64_t device, std::uintmax_t bytes, bool small) {
+    std::chrono::duration<double> wait{0};
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_settings.bytesPerSecond == 0) {
+            return;
+        }
+        const auto rate = static_cast<double>(m_settings.bytesPerSecond);
+        const auto burst = static_cast<double>(m_settings.burstBytes != 0 ? m_settings.burstBytes : m_settings.bytesPerSecond);
+        const auto now = std::chrono::steady_clock::now();
+
+        // A device starts with a full budget; a bucket can go into debt, which whoever waits next pays off.
+        auto [it, inserted] = m_buckets.try_emplace(device, Bucket{burst, now});
+        Bucket& bucket = it->second;
+        if (!inserted) {
+            const std::chrono::duration<double> idle = now - bucket.refilled;
+            bucket.tokens = std::min(burst, bucket.tokens + idle.count() * rate);
+            bucket.refilled = now;
+        }
+        bucket.tokens -= static_cast<double>(bytes);
+        if (!small && bucket.tokens < 0) {
+            wait = std::chrono::duration<double>(-bucket.tokens / rate);
+        }
+    }
+
+    if (wait.count() > 0) {
+        StageTimer throttleTimer(Metrics::Stage::IoThrottle);
+        std::this_thread::sleep_for(wait);
+    }
+}
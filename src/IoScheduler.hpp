@@ -0,0 +1,78 @@
+#ifndef IO_SCHEDULER_HPP
+#define IO_SCHEDULER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+// I/O priority for copies of large files (`io.priority`).
+enum class IoPriority : std::uint8_t {
+    // Whatever the process runs with.
+    Normal,
+    // The lowest best-effort level: still served, but after everything else of normal priority.
+    Low,
+    // Only served while the disk has nothing else to do.
+    Idle
+};
+
+// IoSettings budgets the disk bandwidth cross-volume copies may take (`io`).
+struct IoSettings {
+    // Bytes per second each destination device accepts from copies; 0 leaves copies unthrottled.
+    std::uint64_t bytesPerSecond = 0;
+    // How much unused budget a device may save up; 0 means one second's worth.
+    std::uint64_t burstBytes = 0;
+    // Files up to this size are copied by their own workers and never wait for budget.
+    std::uint64_t smallFileBytes = 8 * 1024 * 1024;
+    IoPriority priority = IoPriority::Normal;
+};
+
+// Paces cross-volume copies so a huge one doesn't starve everything else sharing the disk. Each destination
+// device has a token bucket refilled at `bytes_per_second`. Copies of large files are charged as they go and
+// wait whenever their device's budget runs out. Small files are charged too, but never wait, so they keep
+// flowing past a large copy. Copies of large files can also run at a lower I/O priority.
+class IoScheduler {
+public:
+    // Applies the priority to the calling thread for the scope's lifetime, then restores the previous one.
+    class PriorityScope {
+    public:
+        explicit PriorityScope(IoPriority priority);
+        ~PriorityScope();
+
+        PriorityScope(const PriorityScope&) = delete;
+        PriorityScope& operator=(const PriorityScope&) = delete;
+
+    private:
+        bool m_applied = false;
+        int m_previous = 0;
+    };
+
+    // Parse `normal`, `low` or `idle`.
+    static std::optional<IoPriority> parsePriority(std::string_view name);
+
+    // Replace the settings; budgets saved up under the old ones are dropped.
+    void configure(const IoSettings& settings);
+
+    // Whether a file of this size takes the small-file lane.
+    bool isSmall(std::uintmax_t size) const;
+    // Whether copies are budgeted at all, i.e. charge() can ever wait.
+    bool throttled() const;
+    IoPriority priority() const;
+
+    // Charge bytes just written to device. Unless small, first waits until the device's budget covers them.
+    void charge(std::uint64_t device, std::uintmax_t bytes, bool small);
+
+private:
+    struct Bucket {
+        double tokens = 0;
+        std::chrono::steady_clock::time_point refilled;
+    };
+
+    mutable std::mutex m_mutex;
+    IoSettings m_settings;
+    std::unordered_map<std::uint64_t, Bucket> m_buckets;
+};
+
+#endif
@@ -0,0 +1,309 @@
+#include "Logger.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <thread>
+
+#include <nlohmann/json.hpp>
+
+namespace {
+using SystemClock = std::chrono::system_clock;
+
+// Power of two so positions map to slots with a mask.
+constexpr std::size_t kRingCapacity = 8192;
+constexpr std::size_t kRingMask = kRingCapacity - 1;
+// Info lines wait up to this long for company, so a burst of them leaves in one write.
+constexpr auto kFlushInterval = std::chrono::milliseconds(100);
+// A ring this full wakes the flusher early rather than let producers run into a full ring.
+constexpr std::size_t kWakeBacklog = kRingCapacity / 4;
+
+struct Record {
+    Logger::Level level = Logger::Level::Info;
+    SystemClock::time_point time;
+    std::string text;
+};
+
+// Bounded MPSC queue after Dmitry Vyukov's: each slot's sequence says whether it is free for the producer that
+// claims its position or holds a record for the consumer.
+struct Slot {
+    std::atomic<std::size_t> sequence{0};
+    Record record;
+};
+
+struct State {
+    State() {
+        for (std::size_t i = 0; i < kRingCapacity; ++i) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    std::array<Slot, kRingCapacity> slots;
+    alignas(64) std::atomic<std::size_t> enqueuePos{0};
+    // Written only by the consumer; producers read it to estimate the backlog.
+    alignas(64) std::atomic<std::size_t> dequeuePos{0};
+
+    std::atomic<Logger::Level> level{Logger::Level::Info};
+    std::atomic<Logger::Format> format{Logger::Format::Text};
+    std::atomic<bool> running{false};
+
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::atomic<bool> flusherWaiting{false};
+    bool stopping = false;
+    std::thread flusher;
+
+    // Serializes synchronous writes, and the final drain in stop() against them.
+    std::mutex writeMutex;
+};
+
+State& state() {
+    // Never destroyed, so threads logging during shutdown can't touch a dead logger.
+    static State* instance = new State();
+    return *instance;
+}
+
+const char* levelName(Logger::Level level) {
+    switch (level) {
+    case Logger::Level::Debug:
+        return "debug";
+    case Logger::Level::Info:
+        return "info";
+    case Logger::Level::Warning:
+        return "warning";
+    case Logger::Level::Error:
+        return "error";
+    }
+    return "info";
+}
+
+std::string formatTimestamp(SystemClock::time_point time) {
+    const std::time_t seconds = SystemClock::to_time_t(time);
+    std::tm utc{};
+#ifdef _WIN32
+    gmtime_s(&utc, &seconds);
+#else
+    gmtime_r(&seconds, &utc);
+#endif
+    char buffer[40];
+    const std::size_t length = std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+    const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count() % 1000;
+    std::snprintf(buffer + length, sizeof(buffer) - length, ".%03dZ", static_cast<int>(millis));
+    return buffer;
+}
+
+// Accumulates formatted lines and writes each run of lines for the same stream with one call.
+class BatchWriter {
+public:
+    explicit BatchWriter(Logger::Format format) : m_format(format) {}
+    ~BatchWriter() { flush(); }
+
+    BatchWriter(const BatchWriter&) = delete;
+    BatchWriter& operator=(const BatchWriter&) = delete;
+
+    void append(const Record& record) {
+        std::FILE* stream = record.level >= Logger::Level::Warning ? stderr : stdout;
+        if (stream != m_stream) {
+            writePending();
+            m_stream = stream;
+        }
+
+        if (m_format == Logger::Format::JsonLines) {
+            nlohmann::ordered_json line;
+            line["time"] = formatTimestamp(record.time);
+            line["level"] = levelName(record.level);
+            line["message"] = record.text;
+            m_buffer += line.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+        } else {
+            m_buffer += record.text;
+        }
+        m_buffer += '\n';
+    }
+
+    void flush() {
+        writePending();
+        std::fflush(stdout);
+        std::fflush(stderr);
+    }
+
+private:
+    void writePending() {
+        if (!m_buffer.empty()) {
+            std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_stream);
+            m_buffer.clear();
+        }
+    }
+
+    Logger::Format m_format;
+    std::FILE* m_stream = stdout;
+    std::string m_buffer;
+};
+
+bool tryEnqueue(State& s, Record& record) {
+    std::size_t pos = s.enqueuePos.load(std::memory_order_relaxed);
+    while (true) {
+        Slot& slot = s.slots[pos & kRingMask];
+        const std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        const auto diff = static_cast<std::ptrdiff_t>(sequence - pos);
+        if (diff == 0) {
+            if (s.enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.record = std::move(record);
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // The slot still holds a record from one lap ago: the ring is full.
+            return false;
+        } else {
+            pos = s.enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// Consumer side; only the flusher, or stop() once the flusher has exited, calls this.
+bool tryDequeue(State& s, Record& record) {
+    const std::size_t pos = s.dequeuePos.load(std::memory_order_relaxed);
+    Slot& slot = s.slots[pos & kRingMask];
+    if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+        return false;
+    }
+    record = std::move(slot.record);
+    slot.sequence.store(pos + kRingCapacity, std::memory_order_release);
+    s.dequeuePos.store(pos + 1, std::memory_order_relaxed);
+    return true;
+}
+
+void drain(State& s) {
+    BatchWriter writer(s.format.load(std::memory_order_relaxed));
+    Record record;
+    while (tryDequeue(s, record)) {
+        writer.append(record);
+    }
+}
+
+void wakeFlusher(State& s) {
+    if (s.flusherWaiting.exchange(false)) {
+        // Taking the mutex guarantees the flusher is inside wait() and sees the notification.
+        std::lock_guard<std::mutex> lock(s.wakeMutex);
+        s.wake.notify_one();
+    }
+}
+
+void runFlusher(State& s) {
+    while (true) {
+        drain(s);
+
+        std::unique_lock<std::mutex> lock(s.wakeMutex);
+        if (s.stopping) {
+            return;
+        }
+        s.flusherWaiting.store(true);
+        const std::size_t pos = s.dequeuePos.load(std::memory_order_relaxed);
+        if (s.slots[pos & kRingMask].sequence.load(std::memory_order_acquire) != pos + 1) {
+            s.wake.wait_for(lock, kFlushInterval);
+        }
+        s.flusherWaiting.store(false);
+    }
+}
+} // namespace
+
+Logger::Line::Line(Level level) : m_level(level) {
+    if (Logger::enabled(level)) {
+        m_stream.emplace();
+    }
+}
+
+Logger::Line::~Line() {
+    if (m_stream) {
+        Logger::write(m_level, m_stream->str());
+    }
+}
+
+bool Logger::enabled(Level level) noexcept {
+    return level >= state().level.load(std::memory_order_relaxed);
+}
+
+void Logger::setLevel(Level level) noexcept {
+    state().level.store(level, std::memory_order_relaxed);
+}
+
+void Logger::setFormat(Format format) noexcept {
+    state().format.store(format, std::memory_order_relaxed);
+}
+
+std::optional<Logger::Level> Logger::parseLevel(std::string_view name) {
+    for (const Level level : {Level::Debug, Level::Info, Level::Warning, Level::Error}) {
+        if (name == levelName(level)) {
+            return level;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<Logger::Format> Logger::parseFormat(std::string_view name) {
+    if (name == "text") {
+        return Format::Text;
+    }
+    if (name == "json") {
+        return Format::JsonLines;
+    }
+    return std::nullopt;
+}
+
+void Logger::start() {
+    State& s = state();
+    if (s.running.load()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(s.wakeMutex);
+        s.stopping = false;
+    }
+    s.running.store(true);
+    s.flusher = std::thread([&s]() { runFlusher(s); });
+}
+
+void Logger::stop() {
+    State& s = state();
+    if (!s.flusher.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(s.wakeMutex);
+        s.stopping = true;
+    }
+    s.wake.notify_one();
+    s.flusher.join();
+
+    // Lines enqueued while the flusher was exiting are still in the ring.
+    std::lock_guard<std::mutex> lock(s.writeMutex);
+    s.running.store(false);
+    drain(s);
+}
+
+void Logger::write(Level level, std::string message) {
+    State& s = state();
+    Record record{level, SystemClock::now(), std::move(message)};
+
+    while (s.running.load(std::memory_order_acquire)) {
+        if (tryEnqueue(s, record)) {
+            const std::size_t backlog = s.enqueuePos.load(std::memory_order_relaxed) - s.dequeuePos.load(std::memory_order_relaxed);
+            if (level >= Level::Warning || backlog >= kWakeBacklog) {
+                wakeFlusher(s);
+            }
+            return;
+        }
+        // Full: make sure the flusher is working on it and wait for room rather than drop the line.
+        wakeFlusher(s);
+        std::this_thread::yield();
+    }
+
+    std::lock_guard<std::mutex> lock(s.writeMutex);
+    BatchWriter writer(s.format.load(std::memory_order_relaxed));
+    writer.append(record);
+}
@@ -0,0 +1,79 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <cstdint>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Leveled logging that keeps output off the hot paths. Lines are formatted by the calling thread, pushed onto a
+// lock-free ring buffer shared by every thread and written out by a background flusher in batches, so a sweep
+// that logs a line per file costs one write per batch instead of a flushed write per line. Until start() (and
+// after stop()) lines are written synchronously, which keeps early startup errors and tools without a flusher
+// working. Debug and info lines go to stdout, warnings and errors to stderr, in the order they were logged.
+class Logger {
+public:
+    enum class Level : std::uint8_t { Debug, Info, Warning, Error };
+    enum class Format : std::uint8_t {
+        // The bare message, as the janitor has always printed it.
+        Text,
+        // One JSON object per line with `time`, `level` and `message`.
+        JsonLines
+    };
+
+    // Collects one line through operator<< and logs it when destroyed; formats nothing below the current level.
+    class Line {
+    public:
+        explicit Line(Level level);
+        ~Line();
+
+        Line(const Line&) = delete;
+        Line& operator=(const Line&) = delete;
+
+        template <typename T>
+        Line& operator<<(const T& value) {
+            if (m_stream) {
+                *m_stream << value;
+            }
+            return *this;
+        }
+
+    private:
+        Level m_level;
+        std::optional<std::ostringstream> m_stream;
+    };
+
+    static Line debug() { return Line(Level::Debug); }
+    static Line info() { return Line(Level::Info); }
+    static Line warning() { return Line(Level::Warning); }
+    static Line error() { return Line(Level::Error); }
+
+    static bool enabled(Level level) noexcept;
+    static void setLevel(Level level) noexcept;
+    static void setFormat(Format format) noexcept;
+    // Parse `debug`, `info`, `warning` or `error`.
+    static std::optional<Level> parseLevel(std::string_view name);
+    // Parse `text` or `json`.
+    static std::optional<Format> parseFormat(std::string_view name);
+
+    // Runs the background flusher for its lifetime.
+    class Scope {
+    public:
+        Scope() { Logger::start(); }
+        ~Scope() { Logger::stop(); }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    // Start the background flusher. Call after signals are blocked so the flusher inherits the mask.
+    static void start();
+    // Write out everything queued and stop the flusher.
+    static void stop();
+
+    static void write(Level level, std::string message);
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace {
+constexpr std::size_t kCounterCount = static_cast<std::size_t>(Metrics::Counter::Count);
+constexpr std::size_t kStageCount = static_cast<std::size_t>(Metrics::Stage::Count);
+constexpr std::size_t kGaugeCount = static_cast<std::size_t>(Metrics::Gauge::Count);
+
+// Values below 16 ns get a bucket each; above that every power of two is split into 16 buckets, up to 2^46 ns
+// (about 19 hours). Anything longer lands in the last bucket.
+constexpr unsigned kSubBucketBits = 4;
+constexpr std::uint64_t kSubBuckets = 1u << kSubBucketBits;
+constexpr std::size_t kBucketGroups = 44;
+constexpr std::size_t kBucketCount = kBucketGroups * kSubBuckets;
+
+constexpr std::array<double, 4> kQuantiles{0.5, 0.9, 0.99, 0.999};
+
+struct Histogram {
+    std::array<std::atomic<std::uint64_t>, kBucketCount> buckets{};
+    std::atomic<std::uint64_t> sumNs{0};
+    std::atomic<std::uint64_t> maxNs{0};
+};
+
+// Written only by its owning thread, read by renderPrometheus(); relaxed loads and stores are enough.
+struct Shard {
+    std::array<std::atomic<std::uint64_t>, kCounterCount> counters{};
+    std::array<Histogram, kStageCount> stages{};
+};
+
+struct Registry {
+    std::mutex mutex;
+    // Shards outlive their threads so counters never go backwards.
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::array<std::atomic<std::int64_t>, kGaugeCount> gauges{};
+};
+
+Registry& registry() {
+    // Never destroyed, so threads still recording during shutdown can't touch a dead registry.
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+Shard& localShard() {
+    thread_local Shard* shard = nullptr;
+    if (shard == nullptr) {
+        auto& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.shards.push_back(std::make_unique<Shard>());
+        shard = reg.shards.back().get();
+    }
+    return *shard;
+}
+
+void bump(std::atomic<std::uint64_t>& value, std::uint64_t amount) noexcept {
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+unsigned highestBit(std::uint64_t value) noexcept {
+    unsigned bit = 0;
+    while (value >>= 1) {
+        ++bit;
+    }
+    return bit;
+}
+
+std::size_t bucketOf(std::uint64_t ns) noexcept {
+    if (ns < kSubBuckets) {
+        return static_cast<std::size_t>(ns);
+    }
+    const unsigned shift = highestBit(ns) - kSubBucketBits;
+    const std::size_t index = (shift + 1) * kSubBuckets + static_cast<std::size_t>((ns >> shift) - kSubBuckets);
+    return std::min(index, kBucketCount - 1);
+}
+
+// Largest value that falls into the bucket, as HDR histograms report quantiles.
+std::uint64_t bucketUpperBound(std::size_t index) noexcept {
+    const std::size_t group = index / kSubBuckets;
+    const std::uint64_t sub = index % kSubBuckets;
+    if (group == 0) {
+        return sub;
+    }
+    const unsigned shift = static_cast<unsigned>(group - 1);
+    return ((kSubBuckets + sub + 1) << shift) - 1;
+}
+
+struct CounterInfo {
+    const char* name;
+    const char* help;
+};
+
+constexpr std::array<CounterInfo, kCounterCount> kCounters{{
+    {"janitor_files_classified_total", "Files run through the rules."},
+    {"janitor_files_unmatched_total", "Files no rule matched, left in place."},
+    {"janitor_files_moved_total", "Files placed in their destination."},
+    {"janitor_files_copied_total", "Files placed by copying them to another volume."},
+    {"janitor_move_failures_total", "Moves that failed."},
+    {"janitor_copied_bytes_total", "Bytes copied to other volumes."},
+    {"janitor_duplicates_total", "Files whose contents were already in their destination."},
+    {"janitor_files_evicted_total", "Files removed from a destination by a retention policy."},
+    {"janitor_evicted_bytes_total", "Bytes freed by retention policies."},
+}};
+
+constexpr std::array<const char*, kStageCount> kStageNames{
+    "enumerate", "classify", "queue_wait", "mkdir", "rename", "copy", "io_throttle", "dedup", "arrival_to_placed",
+};
+
+constexpr std::array<CounterInfo, kGaugeCount> kGauges{{
+    {"janitor_pending_events", "Files waiting for their notifications to go quiet."},
+    {"janitor_stability_tracked_files", "Files waiting for their size and modification time to settle."},
+    {"janitor_move_queue_depth", "Moves queued on the worker pool and not yet started."},
+    {"janitor_moves_in_flight", "Moves queued or running."},
+}};
+} // namespace
+
+void Metrics::add(Counter counter, std::uint64_t amount) noexcept {
+    bump(localShard().counters[static_cast<std::size_t>(counter)], amount);
+}
+
+void Metrics::record(Stage stage, Clock::duration elapsed) noexcept {
+    const auto ns = static_cast<std::uint64_t>(std::max<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), 0));
+    Histogram& histogram = localShard().stages[static_cast<std::size_t>(stage)];
+    bump(histogram.buckets[bucketOf(ns)], 1);
+    bump(histogram.sumNs, ns);
+    if (ns > histogram.maxNs.load(std::memory_order_relaxed)) {
+        histogram.maxNs.store(ns, std::memory_order_relaxed);
+    }
+}
+
+void Metrics::set(Gauge gauge, std::int64_t value) noexcept {
+    registry().gauges[static_cast<std::size_t>(gauge)].store(value, std::memory_order_relaxed);
+}
+
+void Metrics::adjust(Gauge gauge, std::int64_t delta) noexcept {
+    registry().gauges[static_cast<std::size_t>(gauge)].fetch_add(delta, std::memory_order_relaxed);
+}
+
+std::uint64_t Metrics::total(Counter counter) {
+    std::uint64_t sum = 0;
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (const auto& shard : reg.shards) {
+        sum += shard->counters[static_cast<std::size_t>(counter)].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+std::string Metrics::renderPrometheus() {
+    std::array<std::uint64_t, kCounterCount> counters{};
+    std::vector<std::array<std::uint64_t, kBucketCount>> buckets(kStageCount);
+    std::array<std::uint64_t, kStageCount> sums{};
+    std::array<std::uint64_t, kStageCount> maxima{};
+
+    auto& reg = registry();
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (const auto& shard : reg.shards) {
+            for (std::size_t i = 0; i < kCounterCount; ++i) {
+                counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+            }
+            for (std::size_t stage = 0; stage < kStageCount; ++stage) {
+                const Histogram& histogram = shard->stages[stage];
+                for (std::size_t i = 0; i < kBucketCount; ++i) {
+                    buckets[stage][i] += histogram.buckets[i].load(std::memory_order_relaxed);
+                }
+                sums[stage] += histogram.sumNs.load(std::memory_order_relaxed);
+                maxima[stage] = std::max(maxima[stage], histogram.maxNs.load(std::memory_order_relaxed));
+            }
+        }
+    }
+
+    std::ostringstream out;
+    out << std::setprecision(9);
+    auto seconds = [](std::uint64_t ns) { return static_cast<double>(ns) / 1e9; };
+
+    for (std::size_t i = 0; i < kCounterCount; ++i) {
+        out << "# HELP " << kCounters[i].name << ' ' << kCounters[i].help << '\n'
+            << "# TYPE " << kCounters[i].name << " counter\n"
+            << kCounters[i].name << ' ' << counters[i] << '\n';
+    }
+
+    out << "# HELP janitor_stage_duration_seconds Time spent in each stage of handling a file.\n"
+        << "# TYPE janitor_stage_duration_seconds summary\n";
+    for (std::size_t stage = 0; stage < kStageCount; ++stage) {
+        std::uint64_t count = 0;
+        for (std::uint64_t bucket : buckets[stage]) {
+            count += bucket;
+        }
+
+        for (double quantile : kQuantiles) {
+            // Smallest bucket holding at least the requested share of the samples.
+            const auto rank = static_cast<std::uint64_t>(quantile * static_cast<double>(count) + 0.5);
+            std::uint64_t seen = 0;
+            std::uint64_t value = 0;
+            for (std::size_t i = 0; i < kBucketCount && count != 0; ++i) {
+                seen += buckets[stage][i];
+                if (seen >= std::max<std::uint64_t>(rank, 1)) {
+                    value = std::min(bucketUpperBound(i), maxima[stage]);
+                    break;
+                }
+            }
+            out << "janitor_stage_duration_seconds{stage=\"" << kStageNames[stage] << "\",quantile=\"" << quantile << "\"} " << seconds(value)
+                << '\n';
+        }
+        out << "janitor_stage_duration_seconds_sum{stage=\"" << kStageNames[stage] << "\"} " << seconds(sums[stage]) << '\n'
+            << "janitor_stage_duration_seconds_count{stage=\"" << kStageNames[stage] << "\"} " << count << '\n';
+    }
+
+    out << "# HELP janitor_stage_duration_max_seconds Longest time any file has spent in each stage.\n"
+        << "# TYPE janitor_stage_duration_max_seconds gauge\n";
+    for (std::size_t stage = 0; stage < kStageCount; ++stage) {
+        out << "janitor_stage_duration_max_seconds{stage=\"" << kStageNames[stage] << "\"} " << seconds(maxima[stage]) << '\n';
+    }
+
+    for (std::size_t i = 0; i < kGaugeCount; ++i) {
+        out << "# HELP " << kGauges[i].name << ' ' << kGauges[i].help << '\n'
+            << "# TYPE " << kGauges[i].name << " gauge\n"
+            << kGauges[i].name << ' ' << reg.gauges[i].load(std::memory_order_relaxed) << '\n';
+    }
+    return out.str();
+}
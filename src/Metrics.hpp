@@ -0,0 +1,92 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Process-wide instrumentation for the hot paths. Counters and latency histograms are kept per thread, so
+// recording never contends with other threads, and merged only when read. Histograms are HDR-style: 16
+// linear sub-buckets per power of two, which bounds the error of any reported quantile to about 6%.
+class Metrics {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Counter : std::uint8_t {
+        FilesClassified,
+        FilesUnmatched,
+        FilesMoved,
+        FilesCopied,
+        MoveFailures,
+        BytesCopied,
+        DuplicatesFound,
+        FilesEvicted,
+        BytesEvicted,
+        Count
+    };
+
+    // Pipeline stages with a latency histogram each.
+    enum class Stage : std::uint8_t {
+        Enumerate,
+        Classify,
+        // From a move being queued on the worker pool to a worker starting it.
+        QueueWait,
+        Mkdir,
+        Rename,
+        Copy,
+        // Copies waiting for their destination device's I/O budget.
+        IoThrottle,
+        // Looking for a file's contents among its destination's files.
+        Dedup,
+        // From the first notification for a file to the file sitting in its destination.
+        ArrivalToPlaced,
+        Count
+    };
+
+    enum class Gauge : std::uint8_t {
+        // Files waiting for notifications about them to go quiet.
+        PendingEvents,
+        // Files waiting for their size and modification time to settle.
+        StabilityTracked,
+        // Moves queued on the worker pool and not yet started.
+        MoveQueueDepth,
+        // Moves queued or running.
+        MovesInFlight,
+        Count
+    };
+
+    static void add(Counter counter, std::uint64_t amount = 1) noexcept;
+    static void record(Stage stage, Clock::duration elapsed) noexcept;
+    static void set(Gauge gauge, std::int64_t value) noexcept;
+    static void adjust(Gauge gauge, std::int64_t delta) noexcept;
+    // The counter summed over every thread.
+    static std::uint64_t total(Counter counter);
+
+    // Every metric in the Prometheus text exposition format (version 0.0.4).
+    static std::string renderPrometheus();
+};
+
+// Records the time from construction to destruction (or stop()) against a stage.
+class StageTimer {
+public:
+    explicit StageTimer(Metrics::Stage stage) noexcept : m_stage(stage), m_start(Metrics::Clock::now()) {}
+    ~StageTimer() { stop(); }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    void stop() noexcept {
+        if (m_running) {
+            m_running = false;
+            Metrics::record(m_stage, Metrics::Clock::now() - m_start);
+        }
+    }
+
+private:
+    Metrics::Stage m_stage;
+    Metrics::Clock::time_point m_start;
+    bool m_running = true;
+};
+
+#endif
@@ -0,0 +1,267 @@
+#include "MetricsExporter.hpp"
+
+#include "Logger.hpp"
+#include "Metrics.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifndef _WIN32
+// How long a client gets to send its request before it is answered with the bare text.
+constexpr int kRequestWaitMs = 200;
+// A scraper that stops reading must not stall the export thread for long.
+constexpr int kSendTimeoutSeconds = 2;
+
+std::string lastErrorMessage() {
+    return std::error_code(errno, std::generic_category()).message();
+}
+
+bool setCloseOnExec(int fd) {
+    return ::fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+}
+
+bool sendAll(int fd, std::string_view data) {
+#ifdef MSG_NOSIGNAL
+    constexpr int kFlags = MSG_NOSIGNAL;
+#else
+    constexpr int kFlags = 0;
+#endif
+    while (!data.empty()) {
+        const ssize_t sent = ::send(fd, data.data(), data.size(), kFlags);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data.remove_prefix(static_cast<std::size_t>(sent));
+    }
+    return true;
+}
+#endif
+} // namespace
+
+MetricsExporter::MetricsExporter(MetricsSettings settings) : m_settings(std::move(settings)) {}
+
+MetricsExporter::~MetricsExporter() {
+    stop();
+}
+
+void MetricsExporter::writeFile() {
+    auto temporary = m_settings.file;
+    temporary += ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out << Metrics::renderPrometheus();
+        out.close();
+        if (!out) {
+            if (!m_fileErrorReported) {
+                Logger::warning() << "Failed to write metrics to `" << temporary.string() << "`; will keep trying.";
+                m_fileErrorReported = true;
+            }
+            return;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temporary, m_settings.file, ec);
+    if (ec && !m_fileErrorReported) {
+        Logger::warning() << "Failed to replace `" << m_settings.file.string() << "`: " << ec.message() << "; will keep trying.";
+        m_fileErrorReported = true;
+    } else if (!ec) {
+        m_fileErrorReported = false;
+    }
+}
+
+#ifdef _WIN32
+bool MetricsExporter::start() {
+    if (!m_settings.socket.empty()) {
+        Logger::warning() << "`metrics.socket` is not supported on Windows; use `metrics.file` instead.";
+    }
+    if (m_settings.file.empty()) {
+        return false;
+    }
+
+    m_stopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (m_stopEvent == nullptr) {
+        Logger::error() << "Failed to create the metrics stop event; metrics are not exported.";
+        return false;
+    }
+
+    Logger::info() << "Writing metrics to `" << m_settings.file.string() << "` every " << m_settings.interval.count() << " ms.";
+    m_thread = std::thread([this]() { run(); });
+    return true;
+}
+
+void MetricsExporter::stop() {
+    if (m_thread.joinable()) {
+        SetEvent(m_stopEvent);
+        m_thread.join();
+    }
+    closeAll();
+}
+
+void MetricsExporter::run() {
+    do {
+        writeFile();
+    } while (WaitForSingleObject(m_stopEvent, static_cast<DWORD>(m_settings.interval.count())) == WAIT_TIMEOUT);
+}
+
+void MetricsExporter::closeAll() {
+    if (m_stopEvent != nullptr) {
+        CloseHandle(m_stopEvent);
+        m_stopEvent = nullptr;
+    }
+}
+#else
+bool MetricsExporter::start() {
+    if (::pipe(m_stopFds) != 0 || !setCloseOnExec(m_stopFds[0]) || !setCloseOnExec(m_stopFds[1])) {
+        Logger::error() << "Failed to set up metrics export: " << lastErrorMessage();
+        closeAll();
+        return false;
+    }
+
+    if (!m_settings.socket.empty()) {
+        const std::string& path = m_settings.socket.native();
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            Logger::error() << "Metrics socket path `" << path << "` is too long.";
+        } else {
+            std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+            // Replace a socket left behind by an earlier run, but never some other file.
+            struct stat info {};
+            if (::lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+                ::unlink(path.c_str());
+            }
+
+            m_listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (m_listenFd < 0 || !setCloseOnExec(m_listenFd) || ::fcntl(m_listenFd, F_SETFL, O_NONBLOCK) != 0 ||
+                ::bind(m_listenFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || ::listen(m_listenFd, 8) != 0) {
+                Logger::error() << "Failed to listen on metrics socket `" << path << "`: " << lastErrorMessage();
+                if (m_listenFd >= 0) {
+                    ::close(m_listenFd);
+                    m_listenFd = -1;
+                }
+            } else {
+                Logger::info() << "Serving metrics on `" << path << "`.";
+            }
+        }
+    }
+
+    if (!m_settings.file.empty()) {
+        Logger::info() << "Writing metrics to `" << m_settings.file.string() << "` every " << m_settings.interval.count() << " ms.";
+    } else if (m_listenFd < 0) {
+        closeAll();
+        return false;
+    }
+
+    m_thread = std::thread([this]() { run(); });
+    return true;
+}
+
+void MetricsExporter::stop() {
+    if (m_thread.joinable()) {
+        const char wake = 0;
+        [[maybe_unused]] const ssize_t written = ::write(m_stopFds[1], &wake, 1);
+        m_thread.join();
+    }
+    closeAll();
+}
+
+void MetricsExporter::run() {
+    using Clock = std::chrono::steady_clock;
+    auto nextWrite = Clock::now();
+    while (true) {
+        int timeout = -1;
+        if (!m_settings.file.empty()) {
+            const auto now = Clock::now();
+            if (now >= nextWrite) {
+                writeFile();
+                nextWrite = now + m_settings.interval;
+            }
+            timeout = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(nextWrite - now).count());
+        }
+
+        pollfd fds[2] = {{m_stopFds[0], POLLIN, 0}, {m_listenFd, POLLIN, 0}};
+        const int ready = ::poll(fds, m_listenFd >= 0 ? 2 : 1, timeout);
+        if (ready < 0 && errno != EINTR) {
+            Logger::error() << "Metrics export stopped: " << lastErrorMessage();
+            return;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        if (fds[0].revents != 0) {
+            return;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            const int client = ::accept(m_listenFd, nullptr, nullptr);
+            if (client >= 0) {
+                serveClient(client);
+                ::close(client);
+            }
+        }
+    }
+}
+
+void MetricsExporter::serveClient(int client) {
+    const timeval sendTimeout{kSendTimeoutSeconds, 0};
+    ::setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+
+    // Only the request line matters; headers and body are ignored.
+    char request[1024];
+    ssize_t received = 0;
+    pollfd fd{client, POLLIN, 0};
+    if (::poll(&fd, 1, kRequestWaitMs) > 0) {
+        received = ::recv(client, request, sizeof(request), 0);
+    }
+
+    const std::string body = Metrics::renderPrometheus();
+    const std::string_view requestLine(request, received > 0 ? static_cast<std::size_t>(received) : 0);
+    if (requestLine.substr(0, 4) == "GET " || requestLine.substr(0, 5) == "HEAD ") {
+        std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) +
+                               "\r\nConnection: close\r\n\r\n";
+        if (requestLine.substr(0, 4) == "GET ") {
+            response += body;
+        }
+        sendAll(client, response);
+    } else {
+        sendAll(client, body);
+    }
+}
+
+void MetricsExporter::closeAll() {
+    if (m_listenFd >= 0) {
+        ::close(m_listenFd);
+        m_listenFd = -1;
+        ::unlink(m_settings.socket.c_str());
+    }
+    for (int& fd : m_stopFds) {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+}
+#endif
@@ -0,0 +1,48 @@
+#ifndef METRICS_EXPORTER_HPP
+#define METRICS_EXPORTER_HPP
+
+#include "ConfigParser.hpp"
+
+#include <filesystem>
+#include <thread>
+
+// Publishes Metrics::renderPrometheus() on its own thread: by rewriting a file every interval (for the node
+// exporter's textfile collector, say) and/or by answering each connection to a local Unix socket. The socket
+// speaks just enough HTTP for `curl --unix-socket` and scrapers behind a socket proxy; a client that sends no
+// request gets the bare text.
+class MetricsExporter {
+public:
+    explicit MetricsExporter(MetricsSettings settings);
+    // Stops the export thread.
+    ~MetricsExporter();
+
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    // Start exporting to whatever the settings name; returns false (after logging) when none of it could be set up.
+    bool start();
+    void stop();
+
+private:
+    // Export until stop() is called.
+    void run();
+    // Write the metrics through a temporary file and a rename, so readers never see a partial file.
+    void writeFile();
+    void closeAll();
+
+    MetricsSettings m_settings;
+    bool m_fileErrorReported = false;
+#ifdef _WIN32
+    void* m_stopEvent = nullptr;
+#else
+    // Answer one connection on the socket.
+    void serveClient(int client);
+
+    int m_listenFd = -1;
+    // Self-pipe that wakes the export thread for stop().
+    int m_stopFds[2] = {-1, -1};
+#endif
+    std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,512 @@
+#include "MoveJournal.hpp"
+
+#include "CrossDeviceCopier.hpp"
+#include "Logger.hpp"
+#include "PlatformFs.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using json = nlohmann::json;
+
+namespace {
+// Records accumulate this long before an fsync unless a move is waiting on them.
+constexpr auto kCommitInterval = std::chrono::milliseconds(50);
+// Completed moves older than this are dropped when the journal is compacted at startup.
+constexpr auto kRetention = std::chrono::hours(24 * 90);
+
+// One move as reconstructed from its records.
+struct Move {
+    enum class State { Pending, Committed, Aborted, Undone };
+
+    std::uint64_t id = 0;
+    std::int64_t timeMs = 0;
+    std::filesystem::path source;
+    std::filesystem::path target;
+    std::filesystem::path temporary;
+    State state = State::Pending;
+};
+
+std::int64_t toMilliseconds(MoveJournal::SystemClock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+}
+
+std::string pathString(const std::filesystem::path& path) {
+    return path.u8string();
+}
+
+std::filesystem::path pathFrom(const json& record, const char* key) {
+    auto it = record.find(key);
+    return it != record.end() && it->is_string() ? std::filesystem::u8path(it->get<std::string>()) : std::filesystem::path{};
+}
+
+std::string intentRecord(const Move& move, const char* op) {
+    json record{{"op", op}, {"id", move.id}, {"time", move.timeMs}, {"source", pathString(move.source)}, {"target", pathString(move.target)}};
+    // Once the move is complete the temporary name is of no further use.
+    if (!move.temporary.empty() && std::string_view(op) == "begin") {
+        record["temporary"] = pathString(move.temporary);
+    }
+    return record.dump(-1, ' ', false, json::error_handler_t::replace) + '\n';
+}
+
+std::string outcomeRecord(std::uint64_t id, const char* op) {
+    return json{{"op", op}, {"id", id}}.dump() + '\n';
+}
+
+// Every move in the journal, in the order they began. A torn last line from a crash is skipped.
+std::vector<Move> readMoves(const std::filesystem::path& path) {
+    std::vector<Move> moves;
+    std::unordered_map<std::uint64_t, std::size_t> indexById;
+    std::ifstream in(path, std::ios::binary);
+    std::string line;
+    while (std::getline(in, line)) {
+        const json record = json::parse(line, nullptr, false);
+        if (!record.is_object() || !record.contains("op") || !record["op"].is_string() || !record.contains("id") ||
+            !record["id"].is_number_unsigned()) {
+            continue;
+        }
+
+        const auto op = record["op"].get<std::string>();
+        const auto id = record["id"].get<std::uint64_t>();
+        if (op == "begin" || op == "move") {
+            Move move;
+            move.id = id;
+            move.timeMs = record.value("time", std::int64_t{0});
+            move.source = pathFrom(record, "source");
+            move.target = pathFrom(record, "target");
+            move.temporary = pathFrom(record, "temporary");
+            move.state = op == "move" ? Move::State::Committed : Move::State::Pending;
+            indexById[id] = moves.size();
+            moves.push_back(std::move(move));
+            continue;
+        }
+
+        auto it = indexById.find(id);
+        if (it == indexById.end()) {
+            continue;
+        }
+        if (op == "commit") {
+            moves[it->second].state = Move::State::Committed;
+        } else if (op == "abort") {
+            moves[it->second].state = Move::State::Aborted;
+        } else if (op == "undo") {
+            moves[it->second].state = Move::State::Undone;
+        }
+    }
+    return moves;
+}
+
+bool pathExists(const std::filesystem::path& path) {
+    std::error_code ec;
+    return !path.empty() && std::filesystem::exists(path, ec) && !ec;
+}
+
+// Decide what became of a move the process died in the middle of, finishing it where only the last step is missing.
+Move::State recover(const Move& move) {
+    std::error_code ec;
+    if (move.temporary.empty()) {
+        // Renames are atomic: either the file made it or it didn't.
+        return pathExists(move.target) && !pathExists(move.source) ? Move::State::Committed : Move::State::Aborted;
+    }
+
+    if (pathExists(move.temporary)) {
+        // The copy never reached its final name; the original is intact.
+        std::filesystem::remove(move.temporary, ec);
+        Logger::info() << "Removed the unfinished copy of `" << move.source.string() << "` left by an interrupted move.";
+        return Move::State::Aborted;
+    }
+    if (!pathExists(move.target)) {
+        return Move::State::Aborted;
+    }
+    if (!pathExists(move.source)) {
+        return Move::State::Committed;
+    }
+
+    // The copy is in place and durable, only the original wasn't removed yet. Sizes guard against a stranger
+    // having replaced either file meanwhile.
+    const auto sourceSize = std::filesystem::file_size(move.source, ec);
+    std::error_code targetErr;
+    const auto targetSize = std::filesystem::file_size(move.target, targetErr);
+    if (ec || targetErr || sourceSize != targetSize) {
+        Logger::warning() << "Interrupted move of `" << move.source.string() << "` left a copy at `" << move.target.string()
+                          << "` that doesn't match; keeping both.";
+        return Move::State::Aborted;
+    }
+
+    std::filesystem::remove(move.source, ec);
+    if (ec) {
+        Logger::error() << "Failed to finish the interrupted move of `" << move.source.string() << "`: " << ec.message();
+        return Move::State::Aborted;
+    }
+    Logger::info() << "Finished the interrupted move of `" << move.source.string() << "` -> `" << move.target.string() << "`.";
+    return Move::State::Committed;
+}
+
+// Put a moved file back at its original path, copying when the two are on different volumes.
+bool restore(const std::filesystem::path& from, const std::filesystem::path& to, std::error_code& ec) {
+    std::filesystem::create_directories(to.parent_path(), ec);
+    if (ec) {
+        return false;
+    }
+    if (platform::renameNoReplace(from, to, ec)) {
+        return true;
+    }
+    if (ec != std::errc::cross_device_link) {
+        return false;
+    }
+
+    CrossDeviceCopier::Result copy;
+    if (!CrossDeviceCopier::copyToTemporary(from, to.parent_path(), copy, ec)) {
+        return false;
+    }
+    if (!platform::renameNoReplace(copy.temporaryPath, to, ec)) {
+        std::error_code cleanupErr;
+        std::filesystem::remove(copy.temporaryPath, cleanupErr);
+        return false;
+    }
+    std::error_code syncErr;
+    platform::syncDirectory(to.parent_path(), syncErr);
+    std::filesystem::remove(from, ec);
+    return !ec;
+}
+
+#ifdef _WIN32
+using FileHandle = HANDLE;
+const FileHandle kNoFile = INVALID_HANDLE_VALUE;
+
+FileHandle openForAppend(const std::filesystem::path& path, bool truncate) {
+    return CreateFileW(path.wstring().c_str(), truncate ? GENERIC_WRITE : FILE_APPEND_DATA, FILE_SHARE_READ, nullptr,
+                       truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+}
+
+bool writeAll(FileHandle file, std::string_view data) {
+    while (!data.empty()) {
+        DWORD written = 0;
+        const DWORD chunk = static_cast<DWORD>(std::min<std::size_t>(data.size(), 1u << 30));
+        if (!WriteFile(file, data.data(), chunk, &written, nullptr)) {
+            return false;
+        }
+        data.remove_prefix(written);
+    }
+    return true;
+}
+
+bool syncFile(FileHandle file) {
+    return FlushFileBuffers(file) != 0;
+}
+
+void closeFile(FileHandle file) {
+    CloseHandle(file);
+}
+#else
+using FileHandle = int;
+const FileHandle kNoFile = -1;
+
+FileHandle openForAppend(const std::filesystem::path& path, bool truncate) {
+    return ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (truncate ? O_TRUNC : O_APPEND), 0600);
+}
+
+bool writeAll(FileHandle fd, std::string_view data) {
+    while (!data.empty()) {
+        const ssize_t written = ::write(fd, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data.remove_prefix(static_cast<std::size_t>(written));
+    }
+    return true;
+}
+
+bool syncFile(FileHandle fd) {
+    return ::fdatasync(fd) == 0;
+}
+
+void closeFile(FileHandle fd) {
+    ::close(fd);
+}
+#endif
+
+// Replace the journal with just the given records, durably.
+bool rewrite(const std::filesystem::path& path, const std::string& contents) {
+    auto temporary = path;
+    temporary += ".tmp";
+    const FileHandle file = openForAppend(temporary, true);
+    if (file == kNoFile) {
+        return false;
+    }
+    const bool written = writeAll(file, contents) && syncFile(file);
+    closeFile(file);
+
+    std::error_code ec;
+    if (written) {
+        std::filesystem::rename(temporary, path, ec);
+    }
+    if (!written || ec) {
+        std::filesystem::remove(temporary, ec);
+        return false;
+    }
+    platform::syncDirectory(path.parent_path(), ec);
+    return true;
+}
+} // namespace
+
+MoveJournal::MoveJournal(std::filesystem::path path) : m_path(std::move(path)) {}
+
+MoveJournal::~MoveJournal() {
+    close();
+}
+
+std::filesystem::path MoveJournal::pathFor(const std::filesystem::path& rulesPath) {
+    return rulesPath.parent_path() / "moves.journal";
+}
+
+bool MoveJournal::open() {
+    close();
+
+    std::vector<Move> moves = readMoves(m_path);
+    const std::int64_t cutoff = toMilliseconds(SystemClock::now() - kRetention);
+    std::string compacted;
+    std::size_t recovered = 0;
+    for (auto& move : moves) {
+        m_nextId = std::max(m_nextId, move.id + 1);
+        if (move.state == Move::State::Pending) {
+            move.state = recover(move);
+            ++recovered;
+        }
+        if (move.state == Move::State::Committed && move.timeMs >= cutoff) {
+            compacted += intentRecord(move, "move");
+        }
+    }
+    if (recovered != 0) {
+        Logger::info() << "Recovered " << recovered << " interrupted move(s) from `" << m_path.string() << "`.";
+    }
+
+    // Rewriting also drops aborted and undone moves, so the journal only grows with history still worth undoing.
+    if (!moves.empty() && !rewrite(m_path, compacted)) {
+        Logger::warning() << "Failed to compact `" << m_path.string() << "`; appending to it as is.";
+    }
+
+#ifdef _WIN32
+    HANDLE file = openForAppend(m_path, false);
+    if (file == INVALID_HANDLE_VALUE) {
+        Logger::error() << "Failed to open move journal `" << m_path.string() << "`; moves will not be recorded.";
+        return false;
+    }
+    m_file = file;
+#else
+    m_fd = openForAppend(m_path, false);
+    if (m_fd < 0) {
+        Logger::error() << "Failed to open move journal `" << m_path.string() << "`: " << std::error_code(errno, std::generic_category()).message()
+                        << "; moves will not be recorded.";
+        return false;
+    }
+#endif
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = false;
+    m_open = true;
+    m_committer = std::thread([this]() { runCommitter(); });
+    return true;
+}
+
+void MoveJournal::close() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_open) {
+            return;
+        }
+        m_stopping = true;
+    }
+    m_wake.notify_one();
+    m_committer.join();
+
+#ifdef _WIN32
+    CloseHandle(m_file);
+    m_file = nullptr;
+#else
+    ::close(m_fd);
+    m_fd = -1;
+#endif
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_open = false;
+}
+
+std::uint64_t MoveJournal::begin(const std::filesystem::path& source, const std::filesystem::path& target,
+                                 const std::filesystem::path& temporary) {
+    Move move;
+    move.timeMs = toMilliseconds(SystemClock::now());
+    move.source = source;
+    move.target = target;
+    move.temporary = temporary;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_open) {
+            return 0;
+        }
+        move.id = m_nextId++;
+    }
+    append(intentRecord(move, "begin"));
+    return move.id;
+}
+
+void MoveJournal::record(const std::filesystem::path& source, const std::filesystem::path& target) {
+    Move move;
+    move.timeMs = toMilliseconds(SystemClock::now());
+    move.source = source;
+    move.target = target;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_open) {
+            return;
+        }
+        move.id = m_nextId++;
+    }
+    append(intentRecord(move, "move"));
+}
+
+void MoveJournal::commit(std::uint64_t id) {
+    if (id != 0) {
+        append(outcomeRecord(id, "commit"));
+    }
+}
+
+void MoveJournal::abort(std::uint64_t id) {
+    if (id != 0) {
+        append(outcomeRecord(id, "abort"));
+    }
+}
+
+void MoveJournal::sync() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_open) {
+        return;
+    }
+    const std::uint64_t target = m_appendedCount;
+    if (m_durableCount >= target) {
+        return;
+    }
+    ++m_syncWaiters;
+    m_wake.notify_one();
+    m_durable.wait(lock, [this, target]() { return m_durableCount >= target || !m_open; });
+    --m_syncWaiters;
+}
+
+void MoveJournal::append(std::string line) {
+    bool wakeCommitter = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_open) {
+            return;
+        }
+        const bool wasIdle = m_pending.empty();
+        m_pending += line;
+        ++m_appendedCount;
+        // A committer with records in hand is already counting down to its next write.
+        wakeCommitter = wasIdle;
+    }
+    if (wakeCommitter) {
+        m_wake.notify_one();
+    }
+}
+
+void MoveJournal::runCommitter() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_wake.wait(lock, [this]() { return m_stopping || !m_pending.empty(); });
+        if (m_pending.empty()) {
+            return;
+        }
+
+        // Let more records join the batch unless someone is already waiting on it.
+        if (m_syncWaiters == 0 && !m_stopping) {
+            m_wake.wait_for(lock, kCommitInterval, [this]() { return m_stopping || m_syncWaiters != 0; });
+        }
+
+        std::string batch;
+        batch.swap(m_pending);
+        const std::uint64_t batchEnd = m_appendedCount;
+        lock.unlock();
+
+#ifdef _WIN32
+        const bool written = writeAll(static_cast<HANDLE>(m_file), batch) && syncFile(static_cast<HANDLE>(m_file));
+#else
+        const bool written = writeAll(m_fd, batch) && syncFile(m_fd);
+#endif
+
+        lock.lock();
+        if (!written && !m_writeErrorReported) {
+            Logger::error() << "Failed to write move journal `" << m_path.string() << "`; recent moves may not be recoverable.";
+            m_writeErrorReported = true;
+        }
+        // Waiters are released even on failure; the journal is a safety net, not a reason to stop moving files.
+        m_durableCount = batchEnd;
+        m_durable.notify_all();
+    }
+}
+
+bool MoveJournal::undo(SystemClock::time_point since, bool dryRun) {
+    sync();
+
+    const std::int64_t sinceMs = toMilliseconds(since);
+    auto moves = readMoves(m_path);
+    std::reverse(moves.begin(), moves.end());
+
+    bool allRestored = true;
+    std::size_t restored = 0;
+    for (const auto& move : moves) {
+        if (move.state != Move::State::Committed || move.timeMs < sinceMs) {
+            continue;
+        }
+
+        if (!pathExists(move.target)) {
+            Logger::warning() << "`" << move.target.string() << "` is gone; cannot restore `" << move.source.string() << "`.";
+            allRestored = false;
+            continue;
+        }
+        if (pathExists(move.source)) {
+            Logger::warning() << "`" << move.source.string() << "` exists again; leaving `" << move.target.string() << "` where it is.";
+            allRestored = false;
+            continue;
+        }
+
+        if (dryRun) {
+            Logger::info() << "Would restore `" << move.target.string() << "` -> `" << move.source.string() << "`";
+            ++restored;
+            continue;
+        }
+
+        std::error_code ec;
+        if (!restore(move.target, move.source, ec)) {
+            Logger::error() << "Failed to restore `" << move.target.string() << "` -> `" << move.source.string() << "`: " << ec.message();
+            allRestored = false;
+            continue;
+        }
+        append(outcomeRecord(move.id, "undo"));
+        Logger::info() << "Restored `" << move.target.string() << "` -> `" << move.source.string() << "`";
+        ++restored;
+    }
+
+    sync();
+    Logger::info() << (dryRun ? "Would restore " : "Restored ") << restored << " file(s).";
+    return allRestored;
+}
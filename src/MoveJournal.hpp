@@ -0,0 +1,77 @@
+#ifndef MOVE_JOURNAL_HPP
+#define MOVE_JOURNAL_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Append-only write-ahead log of moves, one JSON object per line. Every move is recorded as an intent before
+// it happens and as a commit or abort once it has, so a move cut short by a crash can be finished or rolled
+// back on the next start, and completed moves can be reversed later with `undo`. Records are written by a
+// committer thread that fsyncs whole batches (group commit): moves only wait for durability where a crash
+// would otherwise leave something behind, and then share one fsync with every other move waiting at the time.
+class MoveJournal {
+public:
+    using SystemClock = std::chrono::system_clock;
+
+    explicit MoveJournal(std::filesystem::path path);
+    // Flushes outstanding records and stops the committer.
+    ~MoveJournal();
+
+    MoveJournal(const MoveJournal&) = delete;
+    MoveJournal& operator=(const MoveJournal&) = delete;
+
+    // moves.journal, next to rules.json.
+    static std::filesystem::path pathFor(const std::filesystem::path& rulesPath);
+
+    // Finish or roll back the moves an earlier run left incomplete, drop records past retention, then start
+    // appending. Returns false (after logging) when the journal can't be written; moves then go unrecorded.
+    bool open();
+    void close();
+
+    // Record the intent to move source to target, through temporary for cross-volume copies; returns its id.
+    std::uint64_t begin(const std::filesystem::path& source, const std::filesystem::path& target,
+                        const std::filesystem::path& temporary = {});
+    void commit(std::uint64_t id);
+    // Record a move that already happened atomically (a rename), which needs no intent of its own.
+    void record(const std::filesystem::path& source, const std::filesystem::path& target);
+    void abort(std::uint64_t id);
+    // Block until every record appended so far is on disk.
+    void sync();
+
+    // Move every file the journal moved at or after since back where it came from, newest first. With dryRun
+    // only log what would be restored. Returns false if any file could not be restored.
+    bool undo(SystemClock::time_point since, bool dryRun);
+
+private:
+    void append(std::string line);
+    void runCommitter();
+
+    std::filesystem::path m_path;
+    std::uint64_t m_nextId = 1;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_durable;
+    // Records appended but not yet handed to the committer.
+    std::string m_pending;
+    std::uint64_t m_appendedCount = 0;
+    std::uint64_t m_durableCount = 0;
+    std::size_t m_syncWaiters = 0;
+    bool m_stopping = false;
+    bool m_open = false;
+    bool m_writeErrorReported = false;
+    std::thread m_committer;
+
+#ifdef _WIN32
+    void* m_file = nullptr;
+#else
+    int m_fd = -1;
+#endif
+};
+
+#endif
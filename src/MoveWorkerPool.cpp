@@ -0,0 +1,88 @@
+#include "MoveWorkerPool.hpp"
+
+#include "Metrics.hpp"
+
+#include <algorithm>
+
+namespace {
+// Cap per-shard backlog so a huge scan applies backpressure instead of queueing every file in memory.
+constexpr std::size_t kMaxQueuedJobsPerShard = 4096;
+}
+
+MoveWorkerPool::MoveWorkerPool(std::size_t threadCount) {
+    // One worker per copy lane and two for renames at the least.
+    threadCount = std::max<std::size_t>(threadCount, 4);
+    // Renames are cheap and latency-sensitive, so they get the larger half.
+    const std::size_t renameThreads = (threadCount + 1) / 2;
+    const std::size_t smallCopyThreads = (threadCount - renameThreads) / 2;
+    const std::size_t copyThreads = threadCount - renameThreads - smallCopyThreads;
+
+    auto spawn = [](std::vector<std::unique_ptr<Shard>>& shards, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            auto shard = std::make_unique<Shard>();
+            Shard& ref = *shard;
+            shard->worker = std::thread([&ref]() { runShard(ref); });
+            shards.push_back(std::move(shard));
+        }
+    };
+
+    spawn(m_renameShards, renameThreads);
+    spawn(m_copyShards, copyThreads);
+    spawn(m_smallCopyShards, smallCopyThreads);
+}
+
+MoveWorkerPool::~MoveWorkerPool() {
+    for (auto* shards : {&m_renameShards, &m_copyShards, &m_smallCopyShards}) {
+        for (auto& shard : *shards) {
+            {
+                std::lock_guard<std::mutex> lock(shard->mutex);
+                shard->stopping = true;
+            }
+            shard->workAvailable.notify_one();
+        }
+    }
+
+    for (auto* shards : {&m_renameShards, &m_copyShards, &m_smallCopyShards}) {
+        for (auto& shard : *shards) {
+            if (shard->worker.joinable()) {
+                shard->worker.join();
+            }
+        }
+    }
+}
+
+void MoveWorkerPool::submit(Lane lane, std::size_t shardKey, std::function<void()> job) {
+    auto& shards = lane == Lane::Rename ? m_renameShards : lane == Lane::Copy ? m_copyShards : m_smallCopyShards;
+    Shard& shard = *shards[shardKey % shards.size()];
+
+    {
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        shard.spaceAvailable.wait(lock, [&shard]() { return shard.jobs.size() < kMaxQueuedJobsPerShard; });
+        shard.jobs.push_back(std::move(job));
+    }
+    Metrics::adjust(Metrics::Gauge::MoveQueueDepth, 1);
+    shard.workAvailable.notify_one();
+}
+
+std::size_t MoveWorkerPool::threadCount() const {
+    return m_renameShards.size() + m_copyShards.size() + m_smallCopyShards.size();
+}
+
+void MoveWorkerPool::runShard(Shard& shard) {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            shard.workAvailable.wait(lock, [&shard]() { return shard.stopping || !shard.jobs.empty(); });
+            if (shard.jobs.empty()) {
+                return;
+            }
+            job = std::move(shard.jobs.front());
+            shard.jobs.pop_front();
+        }
+        Metrics::adjust(Metrics::Gauge::MoveQueueDepth, -1);
+        shard.spaceAvailable.notify_one();
+
+        job();
+    }
+}
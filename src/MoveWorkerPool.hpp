@@ -0,0 +1,51 @@
+#ifndef MOVE_WORKER_POOL_HPP
+#define MOVE_WORKER_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of move workers split into lanes so quick same-volume renames never wait behind long cross-volume
+// copies, and copies of small files never wait behind copies of large ones. Each lane is sharded: jobs
+// submitted with the same shard key run on one thread in submission order.
+class MoveWorkerPool {
+public:
+    enum class Lane { Rename, Copy, SmallCopy };
+
+    // threadCount is split between the lanes: half for renames, the rest shared by the two copy lanes. Every
+    // lane gets at least one worker.
+    explicit MoveWorkerPool(std::size_t threadCount);
+    // Finishes every queued job before joining the workers.
+    ~MoveWorkerPool();
+
+    MoveWorkerPool(const MoveWorkerPool&) = delete;
+    MoveWorkerPool& operator=(const MoveWorkerPool&) = delete;
+
+    // Queue a job on the shard chosen by shardKey; blocks while that shard's queue is full.
+    void submit(Lane lane, std::size_t shardKey, std::function<void()> job);
+
+    std::size_t threadCount() const;
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::condition_variable workAvailable;
+        std::condition_variable spaceAvailable;
+        std::deque<std::function<void()>> jobs;
+        bool stopping = false;
+        std::thread worker;
+    };
+
+    static void runShard(Shard& shard);
+
+    std::vector<std::unique_ptr<Shard>> m_renameShards;
+    std::vector<std::unique_ptr<Shard>> m_copyShards;
+    std::vector<std::unique_ptr<Shard>> m_smallCopyShards;
+};
+
+#endif
@@ -0,0 +1,701 @@
+#include "PatternMatcher.hpp"
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+namespace {
+// Bounds that keep a hostile or careless rules.json from compiling into something enormous.
+constexpr int kMaxRepeat = 64;
+constexpr std::size_t kMaxDfaStates = 8192;
+constexpr std::uint32_t kDeadState = 0;
+
+constexpr unsigned char foldAscii(unsigned char ch) {
+    return ch >= 'A' && ch <= 'Z' ? static_cast<unsigned char>(ch + ('a' - 'A')) : ch;
+}
+} // namespace
+
+struct PatternMatcher::Node {
+    enum class Kind { Empty, Bytes, Concat, Alternate, Repeat } kind = Kind::Empty;
+    ByteSet bytes;
+    std::vector<std::unique_ptr<Node>> children;
+    int minRepeat = 0;
+    int maxRepeat = -1; // -1 = unbounded
+};
+
+namespace {
+using Node = PatternMatcher::Node;
+using ByteSet = std::bitset<256>;
+
+std::unique_ptr<Node> makeNode(Node::Kind kind) {
+    auto node = std::make_unique<Node>();
+    node->kind = kind;
+    return node;
+}
+
+// Make the set case-insensitive for ASCII letters.
+void foldSet(ByteSet& set) {
+    for (int ch = 'a'; ch <= 'z'; ++ch) {
+        if (set[ch] || set[ch - ('a' - 'A')]) {
+            set[ch] = true;
+            set[ch - ('a' - 'A')] = true;
+        }
+    }
+}
+
+std::unique_ptr<Node> makeBytes(ByteSet set) {
+    foldSet(set);
+    auto node = makeNode(Node::Kind::Bytes);
+    node->bytes = set;
+    return node;
+}
+
+std::unique_ptr<Node> makeLiteral(unsigned char ch) {
+    ByteSet set;
+    set[ch] = true;
+    return makeBytes(set);
+}
+
+std::unique_ptr<Node> makeAnyByte() {
+    ByteSet set;
+    set.set();
+    return makeBytes(set);
+}
+
+std::unique_ptr<Node> makeRepeat(std::unique_ptr<Node> child, int minRepeat, int maxRepeat) {
+    auto node = makeNode(Node::Kind::Repeat);
+    node->children.push_back(std::move(child));
+    node->minRepeat = minRepeat;
+    node->maxRepeat = maxRepeat;
+    return node;
+}
+
+// Parses a bracket expression starting just after `[`; shared by globs and regexes.
+class ClassParser {
+public:
+    ClassParser(std::string_view text, std::size_t& pos, bool allowEscapes)
+        : m_text(text), m_pos(pos), m_allowEscapes(allowEscapes) {}
+
+    bool parse(ByteSet& out, std::string& error) {
+        bool negate = false;
+        if (m_pos < m_text.size() && (m_text[m_pos] == '^' || (!m_allowEscapes && m_text[m_pos] == '!'))) {
+            negate = true;
+            ++m_pos;
+        }
+
+        ByteSet set;
+        bool first = true;
+        while (true) {
+            if (m_pos >= m_text.size()) {
+                error = "unterminated character class";
+                return false;
+            }
+
+            unsigned char ch = static_cast<unsigned char>(m_text[m_pos]);
+            if (ch == ']' && !first) {
+                ++m_pos;
+                break;
+            }
+            first = false;
+            ++m_pos;
+
+            if (ch == '\\' && m_allowEscapes) {
+                if (m_pos >= m_text.size()) {
+                    error = "dangling escape in character class";
+                    return false;
+                }
+                const char escaped = m_text[m_pos++];
+                ByteSet shorthand;
+                if (shorthandClass(escaped, shorthand)) {
+                    set |= shorthand;
+                    continue;
+                }
+                ch = static_cast<unsigned char>(escaped);
+            }
+
+            // Ranges such as a-z; a trailing `-` is a literal.
+            if (m_pos + 1 < m_text.size() && m_text[m_pos] == '-' && m_text[m_pos + 1] != ']') {
+                const auto last = static_cast<unsigned char>(m_text[m_pos + 1]);
+                m_pos += 2;
+                if (last < ch) {
+                    error = "invalid range in character class";
+                    return false;
+                }
+                for (int value = ch; value <= last; ++value) {
+                    set[static_cast<std::size_t>(value)] = true;
+                }
+                continue;
+            }
+            set[ch] = true;
+        }
+
+        foldSet(set);
+        out = negate ? ~set : set;
+        return true;
+    }
+
+    static bool shorthandClass(char escaped, ByteSet& out) {
+        ByteSet set;
+        switch (escaped) {
+        case 'd':
+        case 'D':
+            for (int ch = '0'; ch <= '9'; ++ch) {
+                set[static_cast<std::size_t>(ch)] = true;
+            }
+            break;
+        case 'w':
+        case 'W':
+            for (int ch = 0; ch < 256; ++ch) {
+                const bool word = (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_';
+                set[static_cast<std::size_t>(ch)] = word;
+            }
+            break;
+        case 's':
+        case 'S':
+            for (char ch : {' ', '\t', '\n', '\r', '\f', '\v'}) {
+                set[static_cast<unsigned char>(ch)] = true;
+            }
+            break;
+        default:
+            return false;
+        }
+
+        out = (escaped >= 'A' && escaped <= 'Z') ? ~set : set;
+        return true;
+    }
+
+private:
+    std::string_view m_text;
+    std::size_t& m_pos;
+    bool m_allowEscapes;
+};
+
+std::unique_ptr<Node> parseGlob(std::string_view glob, std::string& error) {
+    auto root = makeNode(Node::Kind::Concat);
+    std::size_t pos = 0;
+    while (pos < glob.size()) {
+        const auto ch = static_cast<unsigned char>(glob[pos++]);
+        if (ch == '*') {
+            root->children.push_back(makeRepeat(makeAnyByte(), 0, -1));
+        } else if (ch == '?') {
+            root->children.push_back(makeAnyByte());
+        } else if (ch == '[') {
+            ByteSet set;
+            ClassParser parser(glob, pos, false);
+            if (!parser.parse(set, error)) {
+                return nullptr;
+            }
+            auto node = makeNode(Node::Kind::Bytes);
+            node->bytes = set;
+            root->children.push_back(std::move(node));
+        } else {
+            root->children.push_back(makeLiteral(ch));
+        }
+    }
+    return root;
+}
+
+// Recursive-descent parser for the supported regex subset.
+class RegexParser {
+public:
+    RegexParser(std::string_view text, std::string& error) : m_text(text), m_error(error) {}
+
+    std::unique_ptr<Node> parse() {
+        // Patterns always match the whole name, so explicit anchors are accepted and ignored.
+        if (!m_text.empty() && m_text.front() == '^') {
+            m_text.remove_prefix(1);
+        }
+        if (!m_text.empty() && m_text.back() == '$' && (m_text.size() < 2 || m_text[m_text.size() - 2] != '\\')) {
+            m_text.remove_suffix(1);
+        }
+
+        auto root = parseAlternation();
+        if (root && m_pos != m_text.size()) {
+            return fail("unexpected `" + std::string(1, m_text[m_pos]) + "`");
+        }
+        return root;
+    }
+
+private:
+    std::unique_ptr<Node> fail(std::string message) {
+        m_error = std::move(message) + " at offset " + std::to_string(m_pos);
+        return nullptr;
+    }
+
+    bool atEnd() const {
+        return m_pos >= m_text.size();
+    }
+
+    std::unique_ptr<Node> parseAlternation() {
+        auto first = parseConcatenation();
+        if (!first || atEnd() || m_text[m_pos] != '|') {
+            return first;
+        }
+
+        auto node = makeNode(Node::Kind::Alternate);
+        node->children.push_back(std::move(first));
+        while (!atEnd() && m_text[m_pos] == '|') {
+            ++m_pos;
+            auto branch = parseConcatenation();
+            if (!branch) {
+                return nullptr;
+            }
+            node->children.push_back(std::move(branch));
+        }
+        return node;
+    }
+
+    std::unique_ptr<Node> parseConcatenation() {
+        auto node = makeNode(Node::Kind::Concat);
+        while (!atEnd() && m_text[m_pos] != '|' && m_text[m_pos] != ')') {
+            auto item = parseRepeat();
+            if (!item) {
+                return nullptr;
+            }
+            node->children.push_back(std::move(item));
+        }
+        return node;
+    }
+
+    std::unique_ptr<Node> parseRepeat() {
+        auto atom = parseAtom();
+        while (atom && !atEnd()) {
+            const char op = m_text[m_pos];
+            if (op == '*' || op == '+' || op == '?') {
+                ++m_pos;
+                atom = makeRepeat(std::move(atom), op == '+' ? 1 : 0, op == '?' ? 1 : -1);
+            } else if (op == '{') {
+                int minRepeat = 0;
+                int maxRepeat = 0;
+                if (!parseBounds(minRepeat, maxRepeat)) {
+                    return nullptr;
+                }
+                atom = makeRepeat(std::move(atom), minRepeat, maxRepeat);
+            } else {
+                break;
+            }
+        }
+        return atom;
+    }
+
+    bool parseNumber(int& value) {
+        const std::size_t start = m_pos;
+        value = 0;
+        while (!atEnd() && m_text[m_pos] >= '0' && m_text[m_pos] <= '9') {
+            value = value * 10 + (m_text[m_pos++] - '0');
+            if (value > kMaxRepeat) {
+                fail("repeat count above " + std::to_string(kMaxRepeat));
+                return false;
+            }
+        }
+        if (m_pos == start) {
+            fail("expected a number in `{}`");
+            return false;
+        }
+        return true;
+    }
+
+    bool parseBounds(int& minRepeat, int& maxRepeat) {
+        ++m_pos; // '{'
+        if (!parseNumber(minRepeat)) {
+            return false;
+        }
+        maxRepeat = minRepeat;
+        if (!atEnd() && m_text[m_pos] == ',') {
+            ++m_pos;
+            maxRepeat = -1;
+            if (!atEnd() && m_text[m_pos] != '}' && !parseNumber(maxRepeat)) {
+                return false;
+            }
+        }
+        if (atEnd() || m_text[m_pos] != '}') {
+            fail("unterminated `{}`");
+            return false;
+        }
+        ++m_pos;
+        if (maxRepeat != -1 && maxRepeat < minRepeat) {
+            fail("repeat bounds out of order");
+            return false;
+        }
+        return true;
+    }
+
+    std::unique_ptr<Node> parseAtom() {
+        const char ch = m_text[m_pos++];
+        switch (ch) {
+        case '(': {
+            if (m_text.substr(m_pos, 2) == "?:") {
+                m_pos += 2;
+            }
+            auto inner = parseAlternation();
+            if (!inner) {
+                return nullptr;
+            }
+            if (atEnd() || m_text[m_pos] != ')') {
+                return fail("missing `)`");
+            }
+            ++m_pos;
+            return inner;
+        }
+        case '[': {
+            ByteSet set;
+            ClassParser parser(m_text, m_pos, true);
+            if (!parser.parse(set, m_error)) {
+                return nullptr;
+            }
+            auto node = makeNode(Node::Kind::Bytes);
+            node->bytes = set;
+            return node;
+        }
+        case '.':
+            return makeAnyByte();
+        case '\\': {
+            if (atEnd()) {
+                return fail("dangling escape");
+            }
+            const char escaped = m_text[m_pos++];
+            ByteSet set;
+            if (ClassParser::shorthandClass(escaped, set)) {
+                return makeBytes(set);
+            }
+            return makeLiteral(static_cast<unsigned char>(escaped));
+        }
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            --m_pos;
+            return fail("nothing to repeat");
+        case '^':
+        case '$':
+            --m_pos;
+            return fail("anchors are only allowed at the ends");
+        default:
+            return makeLiteral(static_cast<unsigned char>(ch));
+        }
+    }
+
+    std::string_view m_text;
+    std::string& m_error;
+    std::size_t m_pos = 0;
+};
+} // namespace
+
+bool PatternMatcher::addGlob(std::string_view glob, std::uint16_t ruleId, std::string& error) {
+    auto root = parseGlob(glob, error);
+    if (!root) {
+        return false;
+    }
+    addPattern(std::move(root), ruleId);
+    return true;
+}
+
+void PatternMatcher::addSuffix(std::string_view suffix, std::uint16_t ruleId) {
+    auto root = makeNode(Node::Kind::Concat);
+    root->children.push_back(makeRepeat(makeAnyByte(), 0, -1));
+    for (char ch : suffix) {
+        root->children.push_back(makeLiteral(static_cast<unsigned char>(ch)));
+    }
+    addPattern(std::move(root), ruleId);
+}
+
+bool PatternMatcher::addRegex(std::string_view regex, std::uint16_t ruleId, std::string& error) {
+    auto root = RegexParser(regex, error).parse();
+    if (!root) {
+        return false;
+    }
+    addPattern(std::move(root), ruleId);
+    return true;
+}
+
+bool PatternMatcher::validateGlob(std::string_view glob, std::string& error) {
+    return parseGlob(glob, error) != nullptr;
+}
+
+bool PatternMatcher::validateRegex(std::string_view regex, std::string& error) {
+    return RegexParser(regex, error).parse() != nullptr;
+}
+
+void PatternMatcher::clear() {
+    m_nfa.clear();
+    m_byteSets.clear();
+    m_starts.clear();
+    m_transitions.clear();
+    m_accepting.clear();
+    m_classCount = 1;
+    m_classOf.fill(0);
+    m_dfaReady = false;
+}
+
+bool PatternMatcher::empty() const noexcept {
+    // A restored matcher has its DFA but no NFA.
+    return m_starts.empty() && !m_dfaReady;
+}
+
+void PatternMatcher::addPattern(std::unique_ptr<Node> root, std::uint16_t ruleId) {
+    const std::uint32_t accept = newState(NfaState::Kind::Match);
+    m_nfa[accept].ruleId = ruleId;
+    m_starts.push_back(emit(*root, accept));
+    m_dfaReady = false;
+}
+
+std::uint32_t PatternMatcher::newState(NfaState::Kind kind) {
+    m_nfa.emplace_back();
+    m_nfa.back().kind = kind;
+    return static_cast<std::uint32_t>(m_nfa.size() - 1);
+}
+
+// Thompson construction built back to front: each call returns the entry state of a fragment whose
+// exits all lead to `next`, so no patch lists are needed.
+std::uint32_t PatternMatcher::emit(const Node& node, std::uint32_t next) {
+    switch (node.kind) {
+    case Node::Kind::Empty:
+        return next;
+    case Node::Kind::Bytes: {
+        const std::uint32_t state = newState(NfaState::Kind::Byte);
+        m_nfa[state].byteSet = static_cast<std::uint32_t>(m_byteSets.size());
+        m_nfa[state].next = {next};
+        m_byteSets.push_back(node.bytes);
+        return state;
+    }
+    case Node::Kind::Concat:
+        for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) {
+            next = emit(**it, next);
+        }
+        return next;
+    case Node::Kind::Alternate: {
+        std::vector<std::uint32_t> branches;
+        for (const auto& child : node.children) {
+            branches.push_back(emit(*child, next));
+        }
+        const std::uint32_t split = newState(NfaState::Kind::Split);
+        m_nfa[split].next = std::move(branches);
+        return split;
+    }
+    case Node::Kind::Repeat: {
+        const Node& child = *node.children.front();
+        std::uint32_t tail = next;
+        if (node.maxRepeat < 0) {
+            // child* : a split that either enters the child (which loops back) or leaves.
+            const std::uint32_t loop = newState(NfaState::Kind::Split);
+            const std::uint32_t body = emit(child, loop);
+            m_nfa[loop].next = {body, next};
+            tail = loop;
+        } else {
+            // Optional copies nest: (child (child ...)?)?
+            for (int i = node.minRepeat; i < node.maxRepeat; ++i) {
+                const std::uint32_t body = emit(child, tail);
+                const std::uint32_t optional = newState(NfaState::Kind::Split);
+                m_nfa[optional].next = {body, next};
+                tail = optional;
+            }
+        }
+        for (int i = 0; i < node.minRepeat; ++i) {
+            tail = emit(child, tail);
+        }
+        return tail;
+    }
+    }
+    return next;
+}
+
+std::uint16_t PatternMatcher::closure(std::vector<std::uint32_t>& states) const {
+    std::vector<std::uint32_t> stack(states.begin(), states.end());
+    std::vector<bool> seen(m_nfa.size(), false);
+    states.clear();
+    std::uint16_t best = kNoMatch;
+
+    while (!stack.empty()) {
+        const std::uint32_t state = stack.back();
+        stack.pop_back();
+        if (seen[state]) {
+            continue;
+        }
+        seen[state] = true;
+
+        const NfaState& nfaState = m_nfa[state];
+        if (nfaState.kind == NfaState::Kind::Split) {
+            stack.insert(stack.end(), nfaState.next.begin(), nfaState.next.end());
+            continue;
+        }
+        if (nfaState.kind == NfaState::Kind::Match) {
+            best = std::min(best, nfaState.ruleId);
+        }
+        states.push_back(state);
+    }
+
+    std::sort(states.begin(), states.end());
+    return best;
+}
+
+void PatternMatcher::compile() {
+    m_transitions.clear();
+    m_accepting.clear();
+    m_dfaReady = !m_starts.empty() && buildDfa();
+    if (!m_dfaReady) {
+        // Too many states: keep the NFA and simulate it, which is still one pass per name.
+        m_transitions.clear();
+        m_accepting.clear();
+    }
+}
+
+bool PatternMatcher::buildDfa() {
+    // Split the 256 byte values into classes that no pattern can tell apart; most rule sets need a few dozen.
+    std::array<std::uint32_t, 256> classOfByte{};
+    std::size_t classCount = 1;
+    for (const ByteSet& set : m_byteSets) {
+        std::vector<std::int64_t> remap(classCount * 2, -1);
+        std::size_t nextCount = 0;
+        for (std::size_t byte = 0; byte < 256; ++byte) {
+            auto& slot = remap[classOfByte[byte] * 2 + (set[byte] ? 1 : 0)];
+            if (slot < 0) {
+                slot = static_cast<std::int64_t>(nextCount++);
+            }
+            classOfByte[byte] = static_cast<std::uint32_t>(slot);
+        }
+        classCount = nextCount;
+    }
+    if (classCount > 256) {
+        return false;
+    }
+
+    m_classCount = classCount;
+    std::vector<unsigned char> representative(classCount);
+    for (std::size_t byte = 256; byte-- > 0;) {
+        representative[classOfByte[byte]] = static_cast<unsigned char>(byte);
+    }
+    for (std::size_t byte = 0; byte < 256; ++byte) {
+        m_classOf[byte] = static_cast<std::uint8_t>(classOfByte[foldAscii(static_cast<unsigned char>(byte))]);
+    }
+
+    // Subset construction. State 0 is the dead state (no live NFA states); state 1 is the start.
+    std::map<std::vector<std::uint32_t>, std::uint32_t> ids;
+    std::vector<std::vector<std::uint32_t>> sets;
+    auto intern = [&](std::vector<std::uint32_t> set, std::uint16_t accept) -> std::uint32_t {
+        auto [it, inserted] = ids.emplace(std::move(set), static_cast<std::uint32_t>(sets.size()));
+        if (inserted) {
+            sets.push_back(it->first);
+            m_accepting.push_back(accept);
+            m_transitions.resize(sets.size() * m_classCount, kDeadState);
+        }
+        return it->second;
+    };
+
+    intern({}, kNoMatch);
+    std::vector<std::uint32_t> start(m_starts.begin(), m_starts.end());
+    const std::uint16_t startAccept = closure(start);
+    intern(std::move(start), startAccept);
+
+    for (std::uint32_t current = 1; current < sets.size(); ++current) {
+        if (sets.size() > kMaxDfaStates) {
+            return false;
+        }
+
+        for (std::size_t cls = 0; cls < m_classCount; ++cls) {
+            const unsigned char byte = representative[cls];
+            std::vector<std::uint32_t> next;
+            for (std::uint32_t state : sets[current]) {
+                const NfaState& nfaState = m_nfa[state];
+                if (nfaState.kind == NfaState::Kind::Byte && m_byteSets[nfaState.byteSet][byte]) {
+                    next.push_back(nfaState.next.front());
+                }
+            }
+
+            if (next.empty()) {
+                continue;
+            }
+            const std::uint16_t accept = closure(next);
+            const std::uint32_t target = intern(std::move(next), accept);
+            m_transitions[current * m_classCount + cls] = target;
+        }
+    }
+    return true;
+}
+
+bool PatternMatcher::serialize(RuleCache::Writer& out) const {
+    if (!m_dfaReady) {
+        if (!m_starts.empty()) {
+            return false;
+        }
+        out.value<std::uint8_t>(0);
+        return true;
+    }
+
+    out.value<std::uint8_t>(1);
+    out.value(m_classOf);
+    out.value<std::uint64_t>(m_classCount);
+    out.array(m_transitions);
+    out.array(m_accepting);
+    return true;
+}
+
+bool PatternMatcher::restore(RuleCache::Reader& in) {
+    clear();
+    std::uint8_t hasDfa = 0;
+    if (!in.value(hasDfa) || hasDfa > 1) {
+        return false;
+    }
+    if (hasDfa == 0) {
+        return true;
+    }
+
+    std::array<std::uint8_t, 256> classOf{};
+    std::uint64_t classCount = 0;
+    std::vector<std::uint32_t> transitions;
+    std::vector<std::uint16_t> accepting;
+    if (!in.value(classOf) || !in.value(classCount) || !in.array(transitions) || !in.array(accepting)) {
+        return false;
+    }
+
+    // Every lookup match() can make must land inside the tables.
+    if (classCount == 0 || classCount > 256 || accepting.size() < 2 || transitions.size() != accepting.size() * classCount) {
+        return false;
+    }
+    if (std::any_of(classOf.begin(), classOf.end(), [classCount](std::uint8_t cls) { return cls >= classCount; }) ||
+        std::any_of(transitions.begin(), transitions.end(), [&accepting](std::uint32_t state) { return state >= accepting.size(); })) {
+        return false;
+    }
+
+    m_classOf = classOf;
+    m_classCount = static_cast<std::size_t>(classCount);
+    m_transitions = std::move(transitions);
+    m_accepting = std::move(accepting);
+    m_dfaReady = true;
+    return true;
+}
+
+std::uint16_t PatternMatcher::match(std::string_view fileName) const noexcept {
+    if (!m_dfaReady) {
+        return m_starts.empty() ? kNoMatch : simulateNfa(fileName);
+    }
+
+    std::uint32_t state = 1;
+    for (char ch : fileName) {
+        state = m_transitions[state * m_classCount + m_classOf[static_cast<unsigned char>(ch)]];
+        if (state == kDeadState) {
+            return kNoMatch;
+        }
+    }
+    return m_accepting[state];
+}
+
+std::uint16_t PatternMatcher::simulateNfa(std::string_view fileName) const {
+    std::vector<std::uint32_t> current(m_starts.begin(), m_starts.end());
+    std::uint16_t best = closure(current);
+    for (char ch : fileName) {
+        const unsigned char byte = foldAscii(static_cast<unsigned char>(ch));
+        std::vector<std::uint32_t> next;
+        for (std::uint32_t state : current) {
+            const NfaState& nfaState = m_nfa[state];
+            if (nfaState.kind == NfaState::Kind::Byte && m_byteSets[nfaState.byteSet][byte]) {
+                next.push_back(nfaState.next.front());
+            }
+        }
+        if (next.empty()) {
+            return kNoMatch;
+        }
+        best = closure(next);
+        current = std::move(next);
+    }
+    return best;
+}
@@ -0,0 +1,80 @@
+#ifndef PATTERN_MATCHER_HPP
+#define PATTERN_MATCHER_HPP
+
+#include "RuleCache.hpp"
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Matches file names against every glob, multi-part suffix and name regex in the rule set at once.
+// Patterns are compiled into one Thompson NFA and then into a DFA over byte equivalence classes, so
+// matching is a single pass over the name no matter how many rules there are. Every pattern must
+// match the whole name, comparisons ignore ASCII case, and when several rules match the lowest
+// rule id wins, which preserves "first defined wins".
+class PatternMatcher {
+public:
+    static constexpr std::uint16_t kNoMatch = UINT16_MAX;
+
+    // Parse tree shared by the glob and regex front ends; defined in the .cpp file.
+    struct Node;
+
+    // Glob with `*`, `?` and `[...]` classes (`[!...]` or `[^...]` negates), e.g. `Screenshot*`.
+    bool addGlob(std::string_view glob, std::uint16_t ruleId, std::string& error);
+    // Literal name ending such as `.tar.gz`.
+    void addSuffix(std::string_view suffix, std::uint16_t ruleId);
+    // Anchored regex over the whole name: literals, `.`, classes, `\d \w \s`, groups, `|`, `* + ?` and `{m,n}`.
+    bool addRegex(std::string_view regex, std::uint16_t ruleId, std::string& error);
+    // Build the automaton; call after adding patterns and before match().
+    void compile();
+    void clear();
+    bool empty() const noexcept;
+
+    // Copy the compiled DFA to or from a rule cache. serialize() returns false when there is only an NFA
+    // (too many DFA states), which is cheaper to rebuild than to store; restore() rejects a malformed DFA.
+    bool serialize(RuleCache::Writer& out) const;
+    bool restore(RuleCache::Reader& in);
+
+    // Lowest rule id whose pattern matches the entire UTF-8 file name, or kNoMatch.
+    std::uint16_t match(std::string_view fileName) const noexcept;
+
+    // Syntax check used while loading the configuration.
+    static bool validateGlob(std::string_view glob, std::string& error);
+    static bool validateRegex(std::string_view regex, std::string& error);
+
+private:
+    using ByteSet = std::bitset<256>;
+
+    struct NfaState {
+        enum class Kind : std::uint8_t { Byte, Split, Match } kind = Kind::Split;
+        std::uint32_t byteSet = 0;         // index into m_byteSets for Kind::Byte
+        std::vector<std::uint32_t> next;   // one successor for Byte, any number for Split
+        std::uint16_t ruleId = kNoMatch;   // for Kind::Match
+    };
+
+    void addPattern(std::unique_ptr<Node> root, std::uint16_t ruleId);
+    std::uint32_t emit(const Node& node, std::uint32_t next);
+    std::uint32_t newState(NfaState::Kind kind);
+    // Expand Split states so the set only holds Byte and Match states; returns the best rule id inside.
+    std::uint16_t closure(std::vector<std::uint32_t>& states) const;
+    bool buildDfa();
+    std::uint16_t simulateNfa(std::string_view fileName) const;
+
+    std::vector<NfaState> m_nfa;
+    std::vector<ByteSet> m_byteSets;
+    std::vector<std::uint32_t> m_starts;
+
+    // Byte -> equivalence class (ASCII case already folded) and the DFA built over those classes.
+    std::array<std::uint8_t, 256> m_classOf{};
+    std::size_t m_classCount = 1;
+    std::vector<std::uint32_t> m_transitions;
+    std::vector<std::uint16_t> m_accepting;
+    bool m_dfaReady = false;
+};
+
+#endif
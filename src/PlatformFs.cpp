@@ -0,0 +1,171 @@
+#include "PlatformFs.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+
+#include <vector>
+#else
+#include <cerrno>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace platform {
+
+std::optional<std::uint64_t> volumeId(const std::filesystem::path& path) {
+#ifdef _WIN32
+    // GetVolumePathNameW resolves mount points without requiring the leaf to exist.
+    std::vector<wchar_t> volumeRoot(MAX_PATH + 1);
+    if (!GetVolumePathNameW(path.wstring().c_str(), volumeRoot.data(), static_cast<DWORD>(volumeRoot.size()))) {
+        return std::nullopt;
+    }
+
+    DWORD serialNumber = 0;
+    if (!GetVolumeInformationW(volumeRoot.data(), nullptr, 0, &serialNumber, nullptr, nullptr, nullptr, 0)) {
+        return std::nullopt;
+    }
+    return serialNumber;
+#else
+    // Destinations may not exist yet, so fall back to the closest ancestor that does.
+    std::filesystem::path probe = path;
+    while (true) {
+        struct stat info {};
+        if (::stat(probe.c_str(), &info) == 0) {
+            return static_cast<std::uint64_t>(info.st_dev);
+        }
+
+        if (!probe.has_relative_path()) {
+            return std::nullopt;
+        }
+        probe = probe.parent_path();
+    }
+#endif
+}
+
+std::optional<FileIdentity> fileIdentity(const std::filesystem::path& path) {
+    FileIdentity identity;
+#ifdef _WIN32
+    HANDLE handle = CreateFileW(path.wstring().c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return std::nullopt;
+    }
+    BY_HANDLE_FILE_INFORMATION info{};
+    const BOOL gotInfo = GetFileInformationByHandle(handle, &info);
+    CloseHandle(handle);
+    if (!gotInfo || (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+        return std::nullopt;
+    }
+    identity.device = info.dwVolumeSerialNumber;
+    identity.fileId = (static_cast<std::uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+    identity.size = (static_cast<std::uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+    identity.modified = static_cast<std::int64_t>((static_cast<std::uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) |
+                                                  info.ftLastWriteTime.dwLowDateTime);
+#else
+    struct stat info {};
+    if (::stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+        return std::nullopt;
+    }
+    identity.device = static_cast<std::uint64_t>(info.st_dev);
+    identity.fileId = static_cast<std::uint64_t>(info.st_ino);
+    identity.size = static_cast<std::uint64_t>(info.st_size);
+    identity.modified = static_cast<std::int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+    return identity;
+}
+
+bool renameNoReplace(const std::filesystem::path& from, const std::filesystem::path& to, std::error_code& ec) {
+#ifdef _WIN32
+    ec.clear();
+    if (MoveFileExW(from.wstring().c_str(), to.wstring().c_str(), 0)) {
+        return true;
+    }
+    ec = std::error_code(static_cast<int>(GetLastError()), std::system_category());
+    return false;
+#else
+    return renameNoReplaceAt(AT_FDCWD, from, AT_FDCWD, to, ec);
+#endif
+}
+
+#ifndef _WIN32
+bool renameNoReplaceAt(int fromDir, const std::filesystem::path& fromName, int toDir, const std::filesystem::path& toName,
+                       std::error_code& ec) {
+    ec.clear();
+    const char* from = fromName.c_str();
+    const char* to = toName.c_str();
+#if defined(__linux__) && defined(RENAME_NOREPLACE)
+    if (::renameat2(fromDir, from, toDir, to, RENAME_NOREPLACE) == 0) {
+        return true;
+    }
+    if (errno != EINVAL && errno != ENOSYS) {
+        ec = std::error_code(errno, std::generic_category());
+        return false;
+    }
+#endif
+    // Filesystems without RENAME_NOREPLACE still refuse to link over an existing name.
+    if (::linkat(fromDir, from, toDir, to, 0) == 0) {
+        if (::unlinkat(fromDir, from, 0) != 0) {
+            ec = std::error_code(errno, std::generic_category());
+            ::unlinkat(toDir, to, 0);
+            return false;
+        }
+        return true;
+    }
+    if (errno == EEXIST || errno == EXDEV || errno == ENOENT) {
+        ec = std::error_code(errno, std::generic_category());
+        return false;
+    }
+
+    // Last resort for filesystems without hard links: check, then rename. This window is unavoidable there.
+    struct stat info {};
+    if (::fstatat(toDir, to, &info, AT_SYMLINK_NOFOLLOW) == 0) {
+        ec = std::make_error_code(std::errc::file_exists);
+        return false;
+    }
+    if (::renameat(fromDir, from, toDir, to) != 0) {
+        ec = std::error_code(errno, std::generic_category());
+        return false;
+    }
+    return true;
+}
+#endif
+
+bool syncDirectory(const std::filesystem::path& directory, std::error_code& ec) {
+    ec.clear();
+#ifdef _WIN32
+    (void)directory;
+    return true;
+#else
+    const int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        ec = std::error_code(errno, std::generic_category());
+        return false;
+    }
+
+    const bool synced = ::fsync(fd) == 0;
+    if (!synced) {
+        ec = std::error_code(errno, std::generic_category());
+    }
+    ::close(fd);
+    return synced;
+#endif
+}
+
+bool isSameOrBelow(const std::filesystem::path& path, const std::filesystem::path& root) {
+    auto pathIt = path.begin();
+    for (auto rootIt = root.begin(); rootIt != root.end(); ++rootIt, ++pathIt) {
+        // A trailing separator shows up as an empty last component; everything before it has matched.
+        if (rootIt->empty()) {
+            break;
+        }
+        if (pathIt == path.end() || *pathIt != *rootIt) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace platform
@@ -0,0 +1,51 @@
+#ifndef PLATFORM_FS_HPP
+#define PLATFORM_FS_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <system_error>
+
+// Thin wrappers over OS filesystem calls that std::filesystem does not expose.
+namespace platform {
+
+// What tells a file's current contents apart without reading them: which file it is, its size and its
+// modification time (in the OS's native ticks).
+struct FileIdentity {
+    std::uint64_t device = 0;
+    std::uint64_t fileId = 0;
+    std::uint64_t size = 0;
+    std::int64_t modified = 0;
+
+    bool operator==(const FileIdentity& other) const noexcept {
+        return device == other.device && fileId == other.fileId && size == other.size && modified == other.modified;
+    }
+    bool operator!=(const FileIdentity& other) const noexcept { return !(*this == other); }
+};
+
+// Identity of the regular file at path, following symlinks; nullopt when it can't be read or isn't a regular file.
+std::optional<FileIdentity> fileIdentity(const std::filesystem::path& path);
+
+// Identifier of the volume holding path (or its nearest existing ancestor); nullopt when unknown.
+std::optional<std::uint64_t> volumeId(const std::filesystem::path& path);
+
+// Rename from -> to, failing with errc::file_exists instead of replacing an existing target.
+// Uses renameat2(RENAME_NOREPLACE) on Linux and MoveFileExW without REPLACE_EXISTING on Windows.
+bool renameNoReplace(const std::filesystem::path& from, const std::filesystem::path& to, std::error_code& ec);
+
+#ifndef _WIN32
+// renameNoReplace with each name resolved relative to an open directory (or AT_FDCWD), so neither directory's
+// path is walked again.
+bool renameNoReplaceAt(int fromDir, const std::filesystem::path& fromName, int toDir, const std::filesystem::path& toName,
+                       std::error_code& ec);
+#endif
+
+// Lexical check that path is root itself or lies below it; both should already be normalized.
+bool isSameOrBelow(const std::filesystem::path& path, const std::filesystem::path& root);
+
+// Flush a directory's entries to disk so a rename into it survives a crash (no-op on Windows).
+bool syncDirectory(const std::filesystem::path& directory, std::error_code& ec);
+
+} // namespace platform
+
+#endif
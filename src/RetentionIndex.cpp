@@ -0,0 +1,336 @@
+#include "RetentionIndex.hpp"
+
+#include "Logger.hpp"
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <system_error>
+
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace {
+// The sweeper looks again at least this often, so a wall clock set back or forward can't strand it.
+constexpr auto kMaxSweepInterval = std::chrono::hours(1);
+
+std::int64_t currentTime() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(RetentionIndex::SystemClock::now().time_since_epoch()).count();
+}
+
+std::int64_t toNanoseconds(std::chrono::seconds duration) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+} // namespace
+
+RetentionIndex::RetentionIndex(std::filesystem::path path) : m_path(std::move(path)) {}
+
+RetentionIndex::~RetentionIndex() {
+    stop();
+}
+
+std::filesystem::path RetentionIndex::pathFor(const std::filesystem::path& rulesPath) {
+    return rulesPath.parent_path() / "retention.index";
+}
+
+bool RetentionIndex::open() {
+    std::unordered_map<Key, Entry> stored;
+    {
+        std::ifstream in(m_path, std::ios::binary);
+        std::string line;
+        while (std::getline(in, line)) {
+            // A torn last line from a crash is simply skipped.
+            const json record = json::parse(line, nullptr, false);
+            if (!record.is_object() || !record.value("path", json()).is_string()) {
+                continue;
+            }
+            const auto file = std::filesystem::u8path(record["path"].get<std::string>()).native();
+            if (record.value("removed", false)) {
+                stored.erase(file);
+                continue;
+            }
+            Entry entry;
+            entry.identity.device = record.value("device", std::uint64_t{0});
+            entry.identity.fileId = record.value("file", std::uint64_t{0});
+            entry.identity.size = record.value("size", std::uint64_t{0});
+            entry.identity.modified = record.value("mtime", std::int64_t{0});
+            entry.placed = record.value("placed", std::int64_t{0});
+            stored[file] = entry;
+        }
+    }
+
+    // Keep only files that are still what was placed, and write them back without the superseded lines.
+    auto temporary = m_path;
+    temporary += ".tmp";
+    std::lock_guard<std::mutex> lock(m_mutex);
+    {
+        m_out.open(temporary, std::ios::binary | std::ios::trunc);
+        for (auto& [file, entry] : stored) {
+            if (platform::fileIdentity(std::filesystem::path(file)) == entry.identity) {
+                insert(file, entry);
+            }
+        }
+        m_out.close();
+        if (!m_out) {
+            Logger::warning() << "Unable to write retention index `" << temporary.string() << "`; placements will not be kept.";
+            std::error_code cleanupErr;
+            std::filesystem::remove(temporary, cleanupErr);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temporary, m_path, ec);
+    if (ec) {
+        Logger::warning() << "Unable to replace retention index `" << m_path.string() << "`: " << ec.message();
+        std::filesystem::remove(temporary, ec);
+        return false;
+    }
+
+    m_out.clear();
+    m_out.open(m_path, std::ios::binary | std::ios::app);
+    return m_out.is_open();
+}
+
+void RetentionIndex::configure(std::vector<RetentionPolicy> policies) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_groups.clear();
+        for (auto& policy : policies) {
+            policy.folder = normalized(policy.folder);
+            m_groups.push_back(Group{std::move(policy), {}, 0});
+        }
+        for (auto& [file, entry] : m_files) {
+            entry.policy = policyFor(file);
+            if (entry.policy != kNoPolicy) {
+                Group& group = m_groups[entry.policy];
+                group.byAge.emplace(entry.placed, file);
+                group.totalBytes += entry.identity.size;
+            }
+        }
+        m_sweepRequested = true;
+    }
+    m_wake.notify_one();
+}
+
+void RetentionIndex::start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_sweeper.joinable()) {
+        return;
+    }
+    m_stopping = false;
+    m_sweeper = std::thread([this]() { run(); });
+}
+
+void RetentionIndex::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_sweeper.joinable()) {
+            return;
+        }
+        m_stopping = true;
+    }
+    m_wake.notify_one();
+    m_sweeper.join();
+}
+
+void RetentionIndex::placed(const std::filesystem::path& file) {
+    const auto identity = platform::fileIdentity(file);
+    if (!identity) {
+        return;
+    }
+    bool overLimit = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        overLimit = insert(normalized(file).native(), Entry{*identity, currentTime(), kNoPolicy});
+        m_sweepRequested = m_sweepRequested || overLimit;
+    }
+    if (overLimit) {
+        m_wake.notify_one();
+    }
+}
+
+void RetentionIndex::removed(const std::filesystem::path& file) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (auto it = m_files.find(normalized(file).native()); it != m_files.end()) {
+        erase(it);
+    }
+}
+
+void RetentionIndex::removedBelow(const std::filesystem::path& directory) {
+    const auto root = normalized(directory);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto it = m_files.begin(); it != m_files.end();) {
+        auto next = std::next(it);
+        if (platform::isSameOrBelow(std::filesystem::path(it->first), root)) {
+            erase(it);
+        }
+        it = next;
+    }
+}
+
+std::optional<RetentionIndex::SystemClock::time_point> RetentionIndex::sweep() {
+    // Files that couldn't be removed go back in the index; bounding the attempts keeps them from being retried forever.
+    std::size_t attempts = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        attempts = m_files.size();
+    }
+    for (; attempts > 0; --attempts) {
+        const std::int64_t now = currentTime();
+        std::optional<std::pair<Key, Entry>> expired;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            expired = takeExpired(now);
+        }
+        if (!expired) {
+            break;
+        }
+
+        // Removing happens outside the lock, so moves recording placements don't wait on it.
+        auto& [key, entry] = *expired;
+        const std::filesystem::path file(key);
+        const auto current = platform::fileIdentity(file);
+        if (!current) {
+            continue;
+        }
+        if (*current != entry.identity) {
+            // Changed since it was placed: someone is still working on it, so it counts as placed just now.
+            std::lock_guard<std::mutex> lock(m_mutex);
+            insert(key, Entry{*current, now, kNoPolicy});
+            continue;
+        }
+
+        std::error_code ec;
+        std::filesystem::remove(file, ec);
+        if (ec) {
+            Logger::warning() << "Unable to remove `" << file.string() << "` for retention: " << ec.message();
+            // Back at the end of the line, so one stubborn file doesn't keep the sweep from the others.
+            std::lock_guard<std::mutex> lock(m_mutex);
+            insert(key, Entry{entry.identity, now, kNoPolicy});
+            continue;
+        }
+        const auto age = std::chrono::duration_cast<std::chrono::hours>(std::chrono::nanoseconds(now - entry.placed));
+        Logger::info() << "Removed `" << file.string() << "` for retention (placed " << age.count() / 24 << " day(s) ago).";
+        Metrics::add(Metrics::Counter::FilesEvicted);
+        Metrics::add(Metrics::Counter::BytesEvicted, entry.identity.size);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::optional<std::int64_t> next;
+    for (const auto& group : m_groups) {
+        if (group.policy.maxAge && !group.byAge.empty()) {
+            const std::int64_t due = group.byAge.begin()->first + toNanoseconds(*group.policy.maxAge);
+            next = std::min(next.value_or(due), due);
+        }
+    }
+    if (!next) {
+        return std::nullopt;
+    }
+    return SystemClock::time_point(std::chrono::duration_cast<SystemClock::duration>(std::chrono::nanoseconds(*next)));
+}
+
+std::filesystem::path RetentionIndex::normalized(const std::filesystem::path& path) {
+    std::error_code ec;
+    const auto absolute = std::filesystem::absolute(path, ec);
+    return (ec ? path : absolute).lexically_normal();
+}
+
+std::size_t RetentionIndex::policyFor(const Key& file) const {
+    const std::filesystem::path path(file);
+    std::size_t best = kNoPolicy;
+    std::size_t bestLength = 0;
+    for (std::size_t i = 0; i < m_groups.size(); ++i) {
+        const auto& folder = m_groups[i].policy.folder;
+        if (folder.native().size() >= bestLength && platform::isSameOrBelow(path, folder)) {
+            best = i;
+            bestLength = folder.native().size();
+        }
+    }
+    return best;
+}
+
+bool RetentionIndex::insert(const Key& file, Entry entry) {
+    if (auto existing = m_files.find(file); existing != m_files.end() && existing->second.policy != kNoPolicy) {
+        Group& group = m_groups[existing->second.policy];
+        group.byAge.erase({existing->second.placed, file});
+        group.totalBytes -= existing->second.identity.size;
+    }
+
+    entry.policy = policyFor(file);
+    m_files[file] = entry;
+    if (m_out.is_open()) {
+        json record;
+        record["path"] = std::filesystem::path(file).u8string();
+        record["device"] = entry.identity.device;
+        record["file"] = entry.identity.fileId;
+        record["size"] = entry.identity.size;
+        record["mtime"] = entry.identity.modified;
+        record["placed"] = entry.placed;
+        store(record.dump(-1, ' ', false, json::error_handler_t::replace));
+    }
+    if (entry.policy == kNoPolicy) {
+        return false;
+    }
+
+    Group& group = m_groups[entry.policy];
+    group.byAge.emplace(entry.placed, file);
+    group.totalBytes += entry.identity.size;
+    return group.policy.maxTotalBytes && group.totalBytes > *group.policy.maxTotalBytes;
+}
+
+void RetentionIndex::erase(std::unordered_map<Key, Entry>::iterator it) {
+    if (it->second.policy != kNoPolicy) {
+        Group& group = m_groups[it->second.policy];
+        group.byAge.erase({it->second.placed, it->first});
+        group.totalBytes -= it->second.identity.size;
+    }
+    if (m_out.is_open()) {
+        json record;
+        record["path"] = std::filesystem::path(it->first).u8string();
+        record["removed"] = true;
+        store(record.dump(-1, ' ', false, json::error_handler_t::replace));
+    }
+    m_files.erase(it);
+}
+
+std::optional<std::pair<RetentionIndex::Key, RetentionIndex::Entry>> RetentionIndex::takeExpired(std::int64_t now) {
+    for (const auto& group : m_groups) {
+        if (group.byAge.empty()) {
+            continue;
+        }
+        const auto& [placed, file] = *group.byAge.begin();
+        const bool overSize = group.policy.maxTotalBytes && group.totalBytes > *group.policy.maxTotalBytes;
+        const bool tooOld = group.policy.maxAge && now - placed >= toNanoseconds(*group.policy.maxAge);
+        if (overSize || tooOld) {
+            auto it = m_files.find(file);
+            std::pair<Key, Entry> taken(it->first, it->second);
+            erase(it);
+            return taken;
+        }
+    }
+    return std::nullopt;
+}
+
+void RetentionIndex::store(const std::string& line) {
+    m_out << line << '\n';
+    m_out.flush();
+}
+
+void RetentionIndex::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping) {
+        m_sweepRequested = false;
+        lock.unlock();
+        const auto next = sweep();
+        lock.lock();
+
+        auto until = SystemClock::now() + kMaxSweepInterval;
+        if (next && *next < until) {
+            until = *next;
+        }
+        m_wake.wait_until(lock, until, [this]() { return m_stopping || m_sweepRequested; });
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef RETENTION_INDEX_HPP
+#define RETENTION_INDEX_HPP
+
+#include "PlatformFs.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// RetentionPolicy bounds what one destination folder keeps of the files the janitor placed there (`retention`).
+struct RetentionPolicy {
+    std::filesystem::path folder;
+    // Files placed longer ago than this are removed (`max_age`).
+    std::optional<std::chrono::seconds> maxAge;
+    // Past this many bytes placed in the folder, the files placed longest ago are removed (`max_total_size`).
+    std::optional<std::uint64_t> maxTotalBytes;
+};
+
+// Remembers every file the janitor placed, and when, and removes those a retention policy no longer allows.
+// Files are kept per policy in order of placement with a running total of their sizes, so a sweep only ever
+// looks at the files it removes (plus entries found stale on the way) however large the folder is. The index
+// is fed by the move path, told by the watcher when files are deleted or moved out of a destination, and
+// persisted as JSON lines; each file's identity is checked again right before it is removed.
+class RetentionIndex {
+public:
+    using SystemClock = std::chrono::system_clock;
+
+    explicit RetentionIndex(std::filesystem::path path);
+    // Stops the sweeper.
+    ~RetentionIndex();
+
+    RetentionIndex(const RetentionIndex&) = delete;
+    RetentionIndex& operator=(const RetentionIndex&) = delete;
+
+    // retention.index, next to rules.json.
+    static std::filesystem::path pathFor(const std::filesystem::path& rulesPath);
+
+    // Load the files earlier runs placed, dropping those that changed or went away, then start appending.
+    // Returns false (after logging) when the index can't be written; placements then last one run.
+    bool open();
+    // Replace the policies; files already indexed are regrouped under the new ones.
+    void configure(std::vector<RetentionPolicy> policies);
+    // Start the sweeper thread, which removes files as soon as a policy calls for it.
+    void start();
+    // Stop the sweeper and wait for a sweep in progress to finish.
+    void stop();
+
+    // Record that the janitor just placed file.
+    void placed(const std::filesystem::path& file);
+    // Forget file, which was deleted or moved away by someone else.
+    void removed(const std::filesystem::path& file);
+    // Forget every file at or below directory, e.g. after the directory was removed.
+    void removedBelow(const std::filesystem::path& directory);
+
+    // Remove every file the policies no longer allow. Returns when the next file will outlive its folder's
+    // max_age, or nullopt when no policy has one.
+    std::optional<SystemClock::time_point> sweep();
+
+private:
+    using Key = std::filesystem::path::string_type;
+    static constexpr std::size_t kNoPolicy = SIZE_MAX;
+
+    struct Entry {
+        platform::FileIdentity identity;
+        // Nanoseconds since the Unix epoch.
+        std::int64_t placed = 0;
+        std::size_t policy = kNoPolicy;
+    };
+
+    // Files under one policy, oldest placement first.
+    struct Group {
+        RetentionPolicy policy;
+        std::set<std::pair<std::int64_t, Key>> byAge;
+        std::uint64_t totalBytes = 0;
+    };
+
+    // Absolute and lexically normal, as keys and policy folders are compared.
+    static std::filesystem::path normalized(const std::filesystem::path& path);
+    // The policy covering the file; the innermost when folders nest.
+    std::size_t policyFor(const Key& file) const;
+    // Add or replace an entry; the caller holds m_mutex. Returns whether its folder is now over max_total_size.
+    bool insert(const Key& file, Entry entry);
+    // Remove an entry; the caller holds m_mutex.
+    void erase(std::unordered_map<Key, Entry>::iterator it);
+    // Take the entry a policy most urgently wants gone out of the index, or nullopt if none does.
+    std::optional<std::pair<Key, Entry>> takeExpired(std::int64_t now);
+    // Append a line to the index file; the caller holds m_mutex.
+    void store(const std::string& line);
+    // Sweep whenever woken or a file is due, until stop() is called.
+    void run();
+
+    std::filesystem::path m_path;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::unordered_map<Key, Entry> m_files;
+    std::vector<Group> m_groups;
+    std::ofstream m_out;
+    bool m_sweepRequested = false;
+    bool m_stopping = false;
+    std::thread m_sweeper;
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include "RuleCache.hpp"
+
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+constexpr char kMagic[4] = {'D', 'J', 'R', 'C'};
+// Bump whenever the layout of either section, or of anything serialized into them, changes.
+constexpr std::uint32_t kFormatVersion = 7;
+
+struct Header {
+    char magic[4];
+    std::uint32_t version;
+    // Paths are stored as native code units, so a cache is only readable by builds with the same path type.
+    std::uint32_t pathCharSize;
+    std::uint32_t reserved;
+    std::uint64_t contentHash;
+    // Hash of both sections, so a torn or damaged cache is never trusted.
+    std::uint64_t payloadHash;
+    std::uint64_t configSize;
+    std::uint64_t compiledSize;
+};
+
+std::uint64_t fnv1a(std::uint64_t value, std::string_view bytes) noexcept {
+    for (unsigned char byte : bytes) {
+        value ^= byte;
+        value *= 1099511628211ull;
+    }
+    return value;
+}
+
+constexpr std::uint64_t kFnvOffset = 14695981039346656037ull;
+
+std::uint64_t payloadHash(std::string_view configSection, std::string_view compiledSection) noexcept {
+    return fnv1a(fnv1a(kFnvOffset, configSection), compiledSection);
+}
+} // namespace
+
+RuleCache::~RuleCache() {
+    unmap();
+}
+
+std::filesystem::path RuleCache::pathFor(const std::filesystem::path& rulesPath) {
+    auto path = rulesPath;
+    path.replace_extension(".cache");
+    return path;
+}
+
+std::uint64_t RuleCache::hashContents(std::string_view contents) noexcept {
+    return fnv1a(kFnvOffset, contents);
+}
+
+bool RuleCache::open(const std::filesystem::path& path, std::uint64_t contentHash) {
+    unmap();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(file, &size) || size.QuadPart < static_cast<LONGLONG>(sizeof(Header))) {
+        CloseHandle(file);
+        return false;
+    }
+
+    // The mapping keeps its own reference to the file.
+    m_mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (m_mapping == nullptr) {
+        return false;
+    }
+
+    m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_data == nullptr) {
+        unmap();
+        return false;
+    }
+    m_size = static_cast<std::size_t>(size.QuadPart);
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info {};
+    if (::fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(Header))) {
+        ::close(fd);
+        return false;
+    }
+
+    void* data = ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    m_data = static_cast<const char*>(data);
+    m_size = static_cast<std::size_t>(info.st_size);
+#endif
+
+    Header header;
+    std::memcpy(&header, m_data, sizeof(header));
+    const std::size_t payloadSize = m_size - sizeof(Header);
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kFormatVersion ||
+        header.pathCharSize != sizeof(std::filesystem::path::value_type) || header.contentHash != contentHash ||
+        header.configSize > payloadSize || header.compiledSize != payloadSize - header.configSize) {
+        unmap();
+        return false;
+    }
+
+    m_config = std::string_view(m_data + sizeof(Header), static_cast<std::size_t>(header.configSize));
+    m_compiled = std::string_view(m_config.data() + m_config.size(), static_cast<std::size_t>(header.compiledSize));
+    if (payloadHash(m_config, m_compiled) != header.payloadHash) {
+        unmap();
+        return false;
+    }
+    return true;
+}
+
+std::string_view RuleCache::configSection() const noexcept {
+    return m_config;
+}
+
+std::string_view RuleCache::compiledSection() const noexcept {
+    return m_compiled;
+}
+
+bool RuleCache::store(const std::filesystem::path& path, std::uint64_t contentHash, std::string_view configSection,
+                      std::string_view compiledSection, std::error_code& ec) {
+    Header header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kFormatVersion;
+    header.pathCharSize = sizeof(std::filesystem::path::value_type);
+    header.contentHash = contentHash;
+    header.payloadHash = payloadHash(configSection, compiledSection);
+    header.configSize = configSection.size();
+    header.compiledSize = compiledSection.size();
+
+    auto temporary = path;
+    temporary += ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(configSection.data(), static_cast<std::streamsize>(configSection.size()));
+        out.write(compiledSection.data(), static_cast<std::streamsize>(compiledSection.size()));
+        out.close();
+        if (!out) {
+            ec = std::make_error_code(std::errc::io_error);
+            std::error_code cleanupErr;
+            std::filesystem::remove(temporary, cleanupErr);
+            return false;
+        }
+    }
+
+    std::filesystem::rename(temporary, path, ec);
+    if (ec) {
+        std::error_code cleanupErr;
+        std::filesystem::remove(temporary, cleanupErr);
+        return false;
+    }
+    return true;
+}
+
+void RuleCache::unmap() {
+#ifdef _WIN32
+    if (m_data != nullptr) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping != nullptr) {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+#else
+    if (m_data != nullptr) {
+        ::munmap(const_cast<char*>(m_data), m_size);
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_config = {};
+    m_compiled = {};
+}
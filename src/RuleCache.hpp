@@ -0,0 +1,160 @@
+#ifndef RULE_CACHE_HPP
+#define RULE_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+// Versioned binary copy of a loaded rules.json and its compiled matchers, stored beside it as rules.cache and
+// memory-mapped on startup, so an unchanged configuration is restored without parsing JSON or compiling
+// matchers. The cache is keyed by a hash of the rules.json bytes; any edit (or a build with a different format)
+// simply makes it miss. It holds raw host-order data and is only meant for the machine that wrote it.
+class RuleCache {
+public:
+    // Appends fixed-size fields and length-prefixed blobs.
+    class Writer {
+    public:
+        template <typename T>
+        void value(T field) {
+            static_assert(std::is_trivially_copyable_v<T>, "only plain values can be written");
+            m_data.append(reinterpret_cast<const char*>(&field), sizeof(field));
+        }
+
+        template <typename Char>
+        void string(std::basic_string_view<Char> text) {
+            value<std::uint64_t>(text.size());
+            m_data.append(reinterpret_cast<const char*>(text.data()), text.size() * sizeof(Char));
+        }
+
+        template <typename Char>
+        void string(const std::basic_string<Char>& text) {
+            string(std::basic_string_view<Char>(text));
+        }
+
+        template <typename T>
+        void array(const std::vector<T>& items) {
+            static_assert(std::is_trivially_copyable_v<T>, "only plain values can be written");
+            value<std::uint64_t>(items.size());
+            m_data.append(reinterpret_cast<const char*>(items.data()), items.size() * sizeof(T));
+        }
+
+        const std::string& data() const noexcept { return m_data; }
+
+    private:
+        std::string m_data;
+    };
+
+    // Reads what Writer wrote. Every read is bounds-checked; after the first failure ok() stays false and
+    // every later read fails too, so callers can check once at the end.
+    class Reader {
+    public:
+        explicit Reader(std::string_view data) : m_cursor(data.data()), m_end(data.data() + data.size()) {}
+
+        template <typename T>
+        bool value(T& field) {
+            static_assert(std::is_trivially_copyable_v<T>, "only plain values can be read");
+            if (!take(sizeof(T))) {
+                return false;
+            }
+            std::memcpy(&field, m_cursor - sizeof(T), sizeof(T));
+            return true;
+        }
+
+        template <typename Char>
+        bool string(std::basic_string<Char>& text) {
+            std::uint64_t size = 0;
+            if (!value(size) || size > remaining() / sizeof(Char) || !take(size * sizeof(Char))) {
+                return fail();
+            }
+            text.resize(static_cast<std::size_t>(size));
+            std::memcpy(text.data(), m_cursor - size * sizeof(Char), size * sizeof(Char));
+            return true;
+        }
+
+        // A length-prefixed blob left in place, e.g. one nested section.
+        bool view(std::string_view& blob) {
+            std::uint64_t size = 0;
+            if (!value(size) || !take(size)) {
+                return fail();
+            }
+            blob = std::string_view(m_cursor - size, static_cast<std::size_t>(size));
+            return true;
+        }
+
+        template <typename T>
+        bool array(std::vector<T>& items) {
+            static_assert(std::is_trivially_copyable_v<T>, "only plain values can be read");
+            std::uint64_t size = 0;
+            if (!value(size) || size > remaining() / sizeof(T) || !take(size * sizeof(T))) {
+                return fail();
+            }
+            items.resize(static_cast<std::size_t>(size));
+            std::memcpy(items.data(), m_cursor - size * sizeof(T), size * sizeof(T));
+            return true;
+        }
+
+        bool ok() const noexcept { return m_ok; }
+        bool atEnd() const noexcept { return m_ok && m_cursor == m_end; }
+
+    private:
+        std::size_t remaining() const noexcept { return static_cast<std::size_t>(m_end - m_cursor); }
+
+        bool take(std::uint64_t size) {
+            if (!m_ok || size > remaining()) {
+                return fail();
+            }
+            m_cursor += size;
+            return true;
+        }
+
+        bool fail() {
+            m_ok = false;
+            m_cursor = m_end;
+            return false;
+        }
+
+        const char* m_cursor;
+        const char* m_end;
+        bool m_ok = true;
+    };
+
+    RuleCache() = default;
+    ~RuleCache();
+
+    RuleCache(const RuleCache&) = delete;
+    RuleCache& operator=(const RuleCache&) = delete;
+
+    // Where the cache for a rules.json lives.
+    static std::filesystem::path pathFor(const std::filesystem::path& rulesPath);
+    // 64-bit FNV-1a over the rules.json bytes.
+    static std::uint64_t hashContents(std::string_view contents) noexcept;
+
+    // Map the cache and check it belongs to contents with this hash; false when missing, stale or damaged.
+    bool open(const std::filesystem::path& path, std::uint64_t contentHash);
+    // Sections of an opened cache; they point into the mapping and stay valid until this object goes away.
+    std::string_view configSection() const noexcept;
+    std::string_view compiledSection() const noexcept;
+
+    // Write a cache through a temporary file and a rename, so readers never see a partial one.
+    static bool store(const std::filesystem::path& path, std::uint64_t contentHash, std::string_view configSection,
+                      std::string_view compiledSection, std::error_code& ec);
+
+private:
+    void unmap();
+
+    const char* m_data = nullptr;
+    std::size_t m_size = 0;
+#ifdef _WIN32
+    void* m_mapping = nullptr;
+#endif
+    std::string_view m_config;
+    std::string_view m_compiled;
+};
+
+#endif
@@ -0,0 +1,253 @@
+#include "StabilityTracker.hpp"
+
+#include "DirectoryScanner.hpp"
+#include "ExtensionClassifier.hpp"
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <array>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+namespace {
+// Slots per wheel turn; with the default 100 ms tick one turn covers 25.6 s, longer delays wait whole turns.
+constexpr std::size_t kWheelSlots = 256;
+
+// Suffixes browsers and download managers give files until the last byte has arrived.
+constexpr std::array<std::string_view, 7> kInProgressSuffixes{
+    ".part", ".crdownload", ".tmp", ".download", ".partial", ".!ut", ".!qb",
+};
+
+bool endsWithIgnoringCase(const std::filesystem::path::string_type& name, std::string_view suffix) {
+    if (name.size() <= suffix.size()) {
+        return false;
+    }
+
+    const std::size_t start = name.size() - suffix.size();
+    for (std::size_t i = 0; i < suffix.size(); ++i) {
+        if (ExtensionClassifier::foldAscii(name[start + i]) != ExtensionClassifier::foldAscii(suffix[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+} // namespace
+
+StabilityTracker::StabilityTracker(Clock::duration stablePeriod, Clock::duration tick)
+    : m_stablePeriod(stablePeriod), m_tick(tick > Clock::duration::zero() ? tick : std::chrono::milliseconds(100)),
+      m_origin(Clock::now()), m_wheel(kWheelSlots) {}
+
+bool StabilityTracker::isInProgressDownload(const std::filesystem::path& path) {
+    const auto& name = path.native();
+    for (const auto suffix : kInProgressSuffixes) {
+        if (endsWithIgnoringCase(name, suffix)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void StabilityTracker::track(const std::filesystem::path& path, Clock::time_point now, std::optional<Clock::time_point> arrivedAt) {
+    const Clock::time_point arrival = arrivedAt.value_or(now);
+    if (m_stablePeriod <= Clock::duration::zero()) {
+        m_immediate.push_back(path);
+        m_immediateArrivals.push_back(arrival);
+        return;
+    }
+
+    if (m_entries.empty()) {
+        // Nothing is scheduled, so the wheel can jump straight to the present.
+        m_currentTick = std::max(m_currentTick, tickOf(now));
+    }
+
+    auto it = m_entries.find(path);
+    if (it != m_entries.end()) {
+        // The pending timer re-checks against the new lastChange when it fires; no second timer needed.
+        it->second.lastChange = now;
+        it->second.arrivedAt = std::min(it->second.arrivedAt, arrival);
+        return;
+    }
+
+    auto stat = statOf(path);
+    if (!stat) {
+        return;
+    }
+
+    Entry entry;
+    entry.stat = *stat;
+    entry.lastChange = now;
+    entry.arrivedAt = arrival;
+    entry.generation = ++m_nextGeneration;
+    schedule(path, entry.generation, m_stablePeriod, now);
+    m_entries.emplace(path, entry);
+}
+
+std::size_t StabilityTracker::trackFolder(const std::filesystem::path& folder, Clock::time_point now, bool recursive,
+                                          const std::function<bool(const std::filesystem::path&)>& skipDirectory) {
+    StageTimer timer(Metrics::Stage::Enumerate);
+    std::size_t queued = 0;
+    auto visitFile = [&](const std::filesystem::path& file) {
+        if (!isInProgressDownload(file)) {
+            track(file, now);
+            ++queued;
+        }
+    };
+
+    DirectoryScanner scanner;
+    std::error_code ec;
+    if (!recursive) {
+        scanner.list(folder, [&](DirectoryScanner::NameView name, DirectoryScanner::EntryType type) {
+            if (type == DirectoryScanner::EntryType::File) {
+                visitFile(folder / name);
+            }
+        }, ec);
+        return queued;
+    }
+
+    scanner.walk(folder, [&skipDirectory](const std::filesystem::path& directory) {
+        return !skipDirectory || !skipDirectory(directory);
+    }, visitFile, ec);
+    return queued;
+}
+
+std::vector<std::filesystem::path> StabilityTracker::advance(Clock::time_point now, std::vector<Clock::time_point>* arrivals,
+                                                             std::vector<FileStat>* stats) {
+    std::vector<std::filesystem::path> stable;
+    stable.swap(m_immediate);
+    if (arrivals != nullptr) {
+        arrivals->insert(arrivals->end(), m_immediateArrivals.begin(), m_immediateArrivals.end());
+    }
+    if (stats != nullptr) {
+        stats->resize(stats->size() + stable.size());
+    }
+    m_immediateArrivals.clear();
+
+    const std::uint64_t target = tickOf(now);
+    if (m_entries.empty()) {
+        // Only timers orphaned by forget()/clear() can be left; drop them instead of walking the slots.
+        if (m_timerCount != 0) {
+            for (auto& slot : m_wheel) {
+                slot.clear();
+            }
+            m_timerCount = 0;
+        }
+        m_currentTick = std::max(m_currentTick, target);
+        return stable;
+    }
+
+    while (m_currentTick < target) {
+        ++m_currentTick;
+        auto& slot = m_wheel[m_currentTick % kWheelSlots];
+        if (slot.empty()) {
+            continue;
+        }
+
+        // Rescheduling may land a timer back in this very slot, so work from a separate buffer.
+        m_firing.clear();
+        m_firing.swap(slot);
+        for (auto& timer : m_firing) {
+            if (timer.rounds > 0) {
+                --timer.rounds;
+                slot.push_back(std::move(timer));
+                continue;
+            }
+
+            --m_timerCount;
+            auto it = m_entries.find(timer.path);
+            if (it == m_entries.end() || it->second.generation != timer.generation) {
+                continue;
+            }
+
+            Entry& entry = it->second;
+            auto stat = statOf(timer.path);
+            if (!stat) {
+                // Deleted or renamed away while we waited; whatever replaces it will raise its own event.
+                m_entries.erase(it);
+                continue;
+            }
+
+            if (!stat->sameSizeAndTime(entry.stat)) {
+                entry.lastChange = now;
+            }
+            entry.stat = *stat;
+
+            const auto quietFor = now - entry.lastChange;
+            if (quietFor >= m_stablePeriod) {
+                if (arrivals != nullptr) {
+                    arrivals->push_back(entry.arrivedAt);
+                }
+                if (stats != nullptr) {
+                    stats->push_back(entry.stat);
+                }
+                stable.push_back(std::move(timer.path));
+                m_entries.erase(it);
+            } else {
+                schedule(timer.path, entry.generation, m_stablePeriod - quietFor, now);
+            }
+        }
+    }
+
+    return stable;
+}
+
+std::optional<StabilityTracker::Clock::time_point> StabilityTracker::nextDeadline() const {
+    if (!m_immediate.empty()) {
+        return m_origin;
+    }
+    if (m_entries.empty()) {
+        return std::nullopt;
+    }
+    // One wake-up per tick while anything is pending; each only visits a single slot.
+    return m_origin + m_tick * static_cast<Clock::rep>(m_currentTick + 1);
+}
+
+void StabilityTracker::forget(const std::filesystem::path& path) {
+    m_entries.erase(path);
+}
+
+void StabilityTracker::clear() {
+    m_entries.clear();
+    m_immediate.clear();
+    m_immediateArrivals.clear();
+    for (auto& slot : m_wheel) {
+        slot.clear();
+    }
+    m_timerCount = 0;
+}
+
+bool StabilityTracker::empty() const {
+    return m_entries.empty() && m_immediate.empty();
+}
+
+std::size_t StabilityTracker::size() const {
+    return m_entries.size() + m_immediate.size();
+}
+
+std::optional<FileStat> StabilityTracker::statOf(const std::filesystem::path& path) {
+    FileStat stat;
+    if (!stat.fetch(path, FileStat::Size | FileStat::Modified)) {
+        return std::nullopt;
+    }
+    return stat;
+}
+
+void StabilityTracker::schedule(const std::filesystem::path& path, std::uint64_t generation, Clock::duration delay, Clock::time_point now) {
+    // Round up so a file is never re-checked before its stable period can have elapsed.
+    const std::uint64_t dueTick = tickOf(now) + static_cast<std::uint64_t>((delay + m_tick - Clock::duration(1)) / m_tick);
+    const std::uint64_t ticksAhead = dueTick > m_currentTick ? dueTick - m_currentTick : 1;
+
+    Timer timer;
+    timer.path = path;
+    timer.generation = generation;
+    timer.rounds = (ticksAhead - 1) / kWheelSlots;
+    m_wheel[(m_currentTick + ticksAhead) % kWheelSlots].push_back(std::move(timer));
+    ++m_timerCount;
+}
+
+std::uint64_t StabilityTracker::tickOf(Clock::time_point time) const {
+    if (time <= m_origin) {
+        return 0;
+    }
+    return static_cast<std::uint64_t>((time - m_origin) / m_tick);
+}
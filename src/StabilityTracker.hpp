@@ -0,0 +1,93 @@
+#ifndef STABILITY_TRACKER_HPP
+#define STABILITY_TRACKER_HPP
+
+#include "FileStat.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+// Holds files back until their size and modification time have stopped changing for a stable period, so
+// downloads are never moved (or copied across volumes over and over) while still being written. Re-checks
+// are scheduled on a hashed timer wheel: each tick only visits the timers that land in its slot, so
+// thousands of pending downloads cost O(1) per file per tick rather than a sleep or a sorted queue each.
+class StabilityTracker {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // stablePeriod == 0 releases every tracked file on the next advance() without checking it.
+    explicit StabilityTracker(Clock::duration stablePeriod, Clock::duration tick = std::chrono::milliseconds(100));
+
+    // Names browsers and download tools use while a file is incomplete (.part, .crdownload, .tmp, ...).
+    static bool isInProgressDownload(const std::filesystem::path& path);
+
+    // Start tracking the file, or note fresh activity on one already tracked. arrivedAt is when the file was
+    // first noticed (now when not given) and is handed back by advance() for latency metrics.
+    void track(const std::filesystem::path& path, Clock::time_point now, std::optional<Clock::time_point> arrivedAt = std::nullopt);
+    // Track every regular file in the folder, e.g. after the watcher lost events; returns how many were queued.
+    // With recursive, subfolders are included except those skipDirectory rejects (such as destinations).
+    std::size_t trackFolder(const std::filesystem::path& folder, Clock::time_point now, bool recursive = false,
+                            const std::function<bool(const std::filesystem::path&)>& skipDirectory = {});
+    // Run the wheel up to now, re-checking files as they fall due; returns those that have been stable long enough.
+    // When arrivals is given it receives the arrival time of each returned file, and stats what the last check
+    // learned of it (nothing for files released without a check).
+    std::vector<std::filesystem::path> advance(Clock::time_point now, std::vector<Clock::time_point>* arrivals = nullptr,
+                                               std::vector<FileStat>* stats = nullptr);
+    // When advance() next has work to do, or nullopt when nothing is tracked.
+    std::optional<Clock::time_point> nextDeadline() const;
+    void forget(const std::filesystem::path& path);
+    void clear();
+
+    bool empty() const;
+    std::size_t size() const;
+
+private:
+    struct Entry {
+        FileStat stat;
+        // Last time the file was seen to change, by a notification or a differing snapshot.
+        Clock::time_point lastChange;
+        // Earliest time the file was noticed while tracked.
+        Clock::time_point arrivedAt;
+        // Matches the one live timer for this entry; timers left behind by forget() carry an older value.
+        std::uint64_t generation = 0;
+    };
+
+    struct Timer {
+        std::filesystem::path path;
+        std::uint64_t generation = 0;
+        // Full turns of the wheel still to wait before the timer fires.
+        std::uint64_t rounds = 0;
+    };
+
+    struct PathHash {
+        std::size_t operator()(const std::filesystem::path& path) const {
+            return std::filesystem::hash_value(path);
+        }
+    };
+
+    // Size and modification time in one metadata call; nullopt when the file is gone or not a regular file.
+    static std::optional<FileStat> statOf(const std::filesystem::path& path);
+    void schedule(const std::filesystem::path& path, std::uint64_t generation, Clock::duration delay, Clock::time_point now);
+    std::uint64_t tickOf(Clock::time_point time) const;
+
+    Clock::duration m_stablePeriod;
+    Clock::duration m_tick;
+    Clock::time_point m_origin;
+    std::uint64_t m_currentTick = 0;
+    std::uint64_t m_nextGeneration = 0;
+    std::size_t m_timerCount = 0;
+    std::vector<std::vector<Timer>> m_wheel;
+    // Reused while a slot is processed, so steady-state ticks don't allocate.
+    std::vector<Timer> m_firing;
+    std::unordered_map<std::filesystem::path, Entry, PathHash> m_entries;
+    // Files waiting for the next advance() when the stable period is zero.
+    std::vector<std::filesystem::path> m_immediate;
+    std::vector<Clock::time_point> m_immediateArrivals;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include "SweepCheckpoint.hpp"
+
+#include "Logger.hpp"
+
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace {
+std::string entryLine(const std::filesystem::path& directory, std::int64_t modificationTime) {
+    json entry;
+    entry["dir"] = directory.u8string();
+    entry["mtime"] = modificationTime;
+    return entry.dump(-1, ' ', false, json::error_handler_t::replace) + '\n';
+}
+} // namespace
+
+SweepCheckpoint::SweepCheckpoint(std::filesystem::path path) : m_path(std::move(path)) {}
+
+std::filesystem::path SweepCheckpoint::pathFor(const std::filesystem::path& rulesPath) {
+    return rulesPath.parent_path() / "organize.checkpoint";
+}
+
+std::optional<std::int64_t> SweepCheckpoint::modificationTime(const std::filesystem::path& directory) {
+    std::error_code ec;
+    const auto time = std::filesystem::last_write_time(directory, ec);
+    if (ec) {
+        return std::nullopt;
+    }
+    return static_cast<std::int64_t>(time.time_since_epoch().count());
+}
+
+bool SweepCheckpoint::begin(std::uint64_t fingerprint) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_fingerprint == fingerprint && m_out.is_open()) {
+        return true;
+    }
+
+    if (!m_fingerprint) {
+        // First sweep of this run: pick up what the last run settled, if it had the same rules.
+        std::ifstream in(m_path, std::ios::binary);
+        std::string line;
+        bool sameRules = false;
+        if (std::getline(in, line)) {
+            const json header = json::parse(line, nullptr, false);
+            sameRules = header.is_object() && header.value("fingerprint", std::uint64_t{0}) == fingerprint;
+        }
+        while (sameRules && std::getline(in, line)) {
+            const json entry = json::parse(line, nullptr, false);
+            if (!entry.is_object()) {
+                continue;
+            }
+            const auto dir = entry.find("dir");
+            const auto mtime = entry.find("mtime");
+            if (dir == entry.end() || !dir->is_string() || mtime == entry.end() || !mtime->is_number_integer()) {
+                continue;
+            }
+            m_settled[std::filesystem::u8path(dir->get<std::string>()).native()] = mtime->get<std::int64_t>();
+        }
+
+        // Entries for directories that changed or went away since can never match again; don't carry them.
+        for (auto it = m_settled.begin(); it != m_settled.end();) {
+            it = modificationTime(std::filesystem::path(it->first)) == it->second ? std::next(it) : m_settled.erase(it);
+        }
+    } else {
+        m_settled.clear();
+    }
+
+    m_fingerprint = fingerprint;
+    return rewrite();
+}
+
+bool SweepCheckpoint::unchanged(const std::filesystem::path& directory, std::int64_t modificationTime) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto it = m_settled.find(directory.native());
+    return it != m_settled.end() && it->second == modificationTime;
+}
+
+void SweepCheckpoint::complete(const std::filesystem::path& directory, std::int64_t modificationTime) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_settled[directory.native()] = modificationTime;
+    if (m_out.is_open()) {
+        // Flushed line by line so a crash loses at most the directory being written.
+        m_out << entryLine(directory, modificationTime);
+        m_out.flush();
+    }
+}
+
+bool SweepCheckpoint::rewrite() {
+    if (m_out.is_open()) {
+        m_out.close();
+    }
+
+    auto temporary = m_path;
+    temporary += ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        json header;
+        header["fingerprint"] = *m_fingerprint;
+        out << header.dump() << '\n';
+        for (const auto& [directory, modificationTime] : m_settled) {
+            out << entryLine(std::filesystem::path(directory), modificationTime);
+        }
+        out.close();
+        if (!out) {
+            Logger::warning() << "Unable to write sweep checkpoint `" << temporary.string() << "`; startup sweeps will classify every file.";
+            std::error_code cleanupErr;
+            std::filesystem::remove(temporary, cleanupErr);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temporary, m_path, ec);
+    if (ec) {
+        Logger::warning() << "Unable to replace sweep checkpoint `" << m_path.string() << "`: " << ec.message();
+        std::filesystem::remove(temporary, ec);
+        return false;
+    }
+
+    m_out.open(m_path, std::ios::binary | std::ios::app);
+    return m_out.is_open();
+}
@@ -0,0 +1,49 @@
+#ifndef SWEEP_CHECKPOINT_HPP
+#define SWEEP_CHECKPOINT_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+// What earlier sweeps already settled, so a restart (mid-backlog or not) doesn't classify the same files again.
+// It holds the directories whose every file was classified without any needing a move. Each is stored with the
+// modification time it had while it was listed. A directory still showing that time has gained, lost and renamed
+// nothing since, so its files need no second look until it changes. Entries are appended as JSON lines while a
+// sweep runs; the file is only a hint, so it is never fsynced and a torn last line is ignored.
+class SweepCheckpoint {
+public:
+    explicit SweepCheckpoint(std::filesystem::path path);
+
+    SweepCheckpoint(const SweepCheckpoint&) = delete;
+    SweepCheckpoint& operator=(const SweepCheckpoint&) = delete;
+
+    // organize.checkpoint, next to rules.json.
+    static std::filesystem::path pathFor(const std::filesystem::path& rulesPath);
+    // The directory's modification time in the filesystem clock's ticks; nullopt when it can't be read.
+    static std::optional<std::int64_t> modificationTime(const std::filesystem::path& directory);
+
+    // Start a sweep under the rules identified by fingerprint. Entries recorded under other rules are dropped.
+    // Returns false (after logging) when the checkpoint can't be written; the sweep then simply goes without.
+    bool begin(std::uint64_t fingerprint);
+    // Whether directory was settled by an earlier sweep and its modification time is still modificationTime.
+    bool unchanged(const std::filesystem::path& directory, std::int64_t modificationTime);
+    // Record that directory, as of modificationTime, is settled.
+    void complete(const std::filesystem::path& directory, std::int64_t modificationTime);
+
+private:
+    using Key = std::filesystem::path::string_type;
+
+    // Write the header and every known entry to a fresh file and keep it open for appending.
+    bool rewrite();
+
+    std::filesystem::path m_path;
+    std::mutex m_mutex;
+    std::optional<std::uint64_t> m_fingerprint;
+    std::unordered_map<Key, std::int64_t> m_settled;
+    std::ofstream m_out;
+};
+
+#endif
@@ -1,24 +1,355 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <cstdlib>
+#include <ctime>
 #include <filesystem>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
 #include <string>
-#include <thread>
+#include <tuple>
+#include <vector>
 
 #include <nlohmann/json.hpp>
 
+#include "ChangeQueue.hpp"
 #include "ConfigParser.hpp"
+#include "ConfigReloader.hpp"
+#include "DuplicateIndex.hpp"
 #include "FileMover.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "MetricsExporter.hpp"
+#include "MoveJournal.hpp"
+#include "PlatformFs.hpp"
+#include "RetentionIndex.hpp"
+#include "StabilityTracker.hpp"
+#include "SweepCheckpoint.hpp"
+
+namespace {
+// How long a file must go without new notifications before it is organized.
+constexpr auto kQuietPeriod = std::chrono::milliseconds(250);
+
+// Exit code for a bad command line or configuration, to tell it apart from files failing to move.
+constexpr int kExitUsage = 2;
+// Paths read from stdin per batch; each batch is waited for, so it must be large enough to keep the pool busy.
+constexpr std::size_t kStdinBatchFiles = 4096;
+
+void printUsage() {
+    Logger::error() << "Usage: DownloadsJanitor [undo --since <when> [--dry-run]]\n"
+                       "       DownloadsJanitor --organize <dir> [--threads <n>] [--dry-run] [--from-stdin]\n"
+                       "  <when> is a duration back from now (`30m`, `2h`, `7d`) or a local time (`2024-05-01`, `2024-05-01T14:30`).\n"
+                       "  <n> is the number of move workers; files are listed and classified on one thread each.";
+}
+
+// Parse `--since`: a duration back from now, or a local date with an optional time.
+std::optional<MoveJournal::SystemClock::time_point> parseSince(const std::string& value) {
+    if (const auto ago = ConfigParser::parseDuration(value)) {
+        return MoveJournal::SystemClock::now() - *ago;
+    }
+
+    for (const char* format : {"%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M", "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d"}) {
+        std::tm local{};
+        std::istringstream in(value);
+        in >> std::get_time(&local, format);
+        if (!in.fail() && in.peek() == std::char_traits<char>::eof()) {
+            local.tm_isdst = -1;
+            const std::time_t time = std::mktime(&local);
+            if (time != static_cast<std::time_t>(-1)) {
+                return MoveJournal::SystemClock::from_time_t(time);
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+// `undo --since <when> [--dry-run]`: move files the janitor sorted since then back where they came from.
+int runUndo(const std::filesystem::path& configRoot, const std::vector<std::string>& args) {
+    std::optional<MoveJournal::SystemClock::time_point> since;
+    bool dryRun = false;
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--since" && i + 1 < args.size()) {
+            since = parseSince(args[++i]);
+            if (!since) {
+                Logger::error() << "Cannot parse `--since " << args[i] << "`.";
+                printUsage();
+                return kExitUsage;
+            }
+        } else if (args[i] == "--dry-run") {
+            dryRun = true;
+        } else {
+            printUsage();
+            return kExitUsage;
+        }
+    }
+    if (!since) {
+        printUsage();
+        return kExitUsage;
+    }
+
+    MoveJournal journal(MoveJournal::pathFor(ConfigParser::rulesPathFor(configRoot.string())));
+    if (!journal.open()) {
+        return EXIT_FAILURE;
+    }
+    return journal.undo(*since, dryRun) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// One move of a dry run's plan.
+struct PlannedMove {
+    std::optional<std::uint64_t> volume;
+    std::filesystem::path destinationDir;
+    std::filesystem::path file;
+};
+
+// Files placed by one rule in `--organize`.
+struct RuleTally {
+    std::uint64_t files = 0;
+    std::uint64_t bytes = 0;
+};
+
+// How the summary names a rule: its number in the configuration, what it matches and where it sends files.
+std::string ruleLabel(std::size_t index, const Rule& rule) {
+    std::ostringstream label;
+    label << "rule " << index + 1 << " (";
+    const char* separator = "";
+    for (const auto* values : {&rule.extensions, &rule.patterns, &rule.nameRegexes, &rule.mimeTypes}) {
+        for (const auto& value : *values) {
+            label << separator << value;
+            separator = " ";
+        }
+    }
+    if (!rule.conditions.empty()) {
+        label << separator << "with conditions";
+    }
+    label << " -> " << rule.destination << ")";
+    return label.str();
+}
+
+// Lines summing up an `--organize` run with rules that took elapsed.
+std::vector<std::string> organizeSummary(bool dryRun, std::chrono::duration<double> elapsed, const std::vector<Rule>& rules,
+                                         const std::map<std::size_t, RuleTally>& tallies) {
+    std::uint64_t files = 0;
+    std::uint64_t bytes = 0;
+    for (const auto& [rule, tally] : tallies) {
+        files += tally.files;
+        bytes += tally.bytes;
+    }
+    const double seconds = std::max(elapsed.count(), 1e-9);
+    constexpr double kMegabyte = 1000.0 * 1000.0;
+
+    std::vector<std::string> lines;
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1);
+    line << (dryRun ? "Planned " : "Placed ") << files << " of " << Metrics::total(Metrics::Counter::FilesClassified)
+         << " file(s) in " << seconds << " s: " << Metrics::total(Metrics::Counter::FilesUnmatched) << " unmatched";
+    if (!dryRun) {
+        line << ", " << Metrics::total(Metrics::Counter::FilesCopied) << " copied across volumes, "
+             << Metrics::total(Metrics::Counter::MoveFailures) << " failed";
+    }
+    line << '.';
+    lines.push_back(line.str());
+
+    line.str({});
+    line << "Throughput: " << static_cast<double>(files) / seconds << " files/s, " << static_cast<double>(bytes) / kMegabyte / seconds
+         << " MB/s.";
+    lines.push_back(line.str());
+
+    // Busiest rules first.
+    std::vector<std::pair<std::size_t, RuleTally>> sorted(tallies.begin(), tallies.end());
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second.files > b.second.files; });
+    for (const auto& [rule, tally] : sorted) {
+        line.str({});
+        line << "  " << (rule < rules.size() ? ruleLabel(rule, rules[rule]) : "rule " + std::to_string(rule + 1)) << ": " << tally.files
+             << " file(s), " << static_cast<double>(tally.bytes) / kMegabyte << " MB";
+        lines.push_back(line.str());
+    }
+    return lines;
+}
+
+// `--organize <dir> [--threads <n>] [--dry-run] [--from-stdin]`: sort everything in dir (and its subfolders), or the
+// files listed on stdin, once with the configured rules, then exit.
+int runOrganize(const std::filesystem::path& configRoot, const std::vector<std::string>& args) {
+    if (args.empty() || args.front().empty()) {
+        printUsage();
+        return kExitUsage;
+    }
+    const std::filesystem::path directory = std::filesystem::u8path(args.front());
+    std::size_t threads = 0;
+    bool dryRun = false;
+    bool fromStdin = false;
+    for (std::size_t i = 1; i < args.size(); ++i) {
+        if (args[i] == "--threads" && i + 1 < args.size()) {
+            const std::string& value = args[++i];
+            const bool digits = !value.empty() && value.size() <= 4 &&
+                                std::all_of(value.begin(), value.end(), [](unsigned char ch) { return std::isdigit(ch) != 0; });
+            threads = digits ? std::stoul(value) : 0;
+            if (threads == 0) {
+                Logger::error() << "`--threads` must be a positive number.";
+                return kExitUsage;
+            }
+        } else if (args[i] == "--dry-run") {
+            dryRun = true;
+        } else if (args[i] == "--from-stdin") {
+            fromStdin = true;
+        } else {
+            printUsage();
+            return kExitUsage;
+        }
+    }
+
+    // The plan owns stdout; only warnings and errors, which go to stderr, are still logged.
+    if (dryRun) {
+        Logger::setLevel(Logger::Level::Warning);
+    }
+    ConfigParser parser;
+    if (!parser.load(configRoot.string())) {
+        Logger::error() << "Failed to load configuration. Exiting.";
+        return kExitUsage;
+    }
+    const auto level = parser.getLogSettings().level;
+    Logger::setLevel(dryRun ? std::max(level, Logger::Level::Warning) : level);
+    Logger::setFormat(parser.getLogSettings().format);
+
+    std::error_code ec;
+    if (!std::filesystem::is_directory(directory, ec)) {
+        Logger::error() << "`" << directory.string() << "` is not a directory.";
+        return kExitUsage;
+    }
+
+    // The rules of the watch folder dir lies in (the innermost), or else of the first one.
+    const auto folders = parser.getWatchFolders();
+    if (folders.empty()) {
+        Logger::error() << "Watch folder is not configured; `--organize` takes its rules from one.";
+        return kExitUsage;
+    }
+    const auto absolute = std::filesystem::absolute(directory, ec);
+    auto target = (ec ? directory : absolute).lexically_normal();
+    if (!target.has_filename() && target.has_relative_path()) {
+        // `bulk/` normalizes with a trailing separator; drop it so the paths built below are clean.
+        target = target.parent_path();
+    }
+    const WatchFolder* source = &folders.front();
+    std::size_t sourceLength = 0;
+    for (const auto& folder : folders) {
+        const auto root = std::filesystem::absolute(folder.path, ec).lexically_normal();
+        if (root.native().size() >= sourceLength && platform::isSameOrBelow(target, root)) {
+            source = &folder;
+            sourceLength = root.native().size();
+        }
+    }
+    Logger::info() << "Organizing `" << target.string() << "` with the rules for `" << source->path.string() << "`.";
+
+    // Logging and moves run on their own threads, so this one only lists and classifies.
+    Logger::Scope logging;
+    const auto rulesPath = ConfigParser::rulesPathFor(configRoot.string());
+    MoveJournal journal(MoveJournal::pathFor(rulesPath));
+    DuplicateIndex duplicates(DuplicateIndex::pathFor(rulesPath));
+    RetentionIndex retention(RetentionIndex::pathFor(rulesPath));
+
+    // Absolute, so the journal records sources `undo` can find from any working directory.
+    FileMover mover({WatchFolder{target, true, source->rules}}, threads != 0 ? threads : parser.getWorkerThreads());
+    mover.setContentSniffing(parser.getSniffContent());
+
+    std::vector<PlannedMove> plan;
+    std::mutex talliesMutex;
+    std::map<std::size_t, RuleTally> tallies;
+    if (dryRun) {
+        mover.setDryRun([&](const std::filesystem::path& file, std::uint64_t size, const std::filesystem::path& destinationDir,
+                            std::optional<std::uint64_t> volume, std::size_t rule) {
+            plan.push_back(PlannedMove{volume, destinationDir, file});
+            RuleTally& tally = tallies[rule];
+            ++tally.files;
+            tally.bytes += size;
+        });
+    } else {
+        // Moves are journaled, so `undo` can reverse a migration, and recorded like any other placement.
+        if (journal.open()) {
+            mover.setJournal(&journal);
+        }
+        if (duplicates.open()) {
+            mover.setDuplicateIndex(&duplicates);
+        }
+        mover.setDedupAction(parser.getDedupAction());
+        mover.setIoSettings(parser.getIoSettings());
+        // Placements are recorded, but nothing is evicted until the janitor itself next runs.
+        if (retention.open()) {
+            mover.setRetentionIndex(&retention);
+        }
+        mover.setPlacedObserver([&](const std::filesystem::path&, std::uint64_t size, std::size_t rule) {
+            std::lock_guard<std::mutex> lock(talliesMutex);
+            RuleTally& tally = tallies[rule];
+            ++tally.files;
+            tally.bytes += size;
+        });
+    }
+
+    const auto started = std::chrono::steady_clock::now();
+    bool succeeded = true;
+    if (fromStdin) {
+        // One path per line, relative ones taken from dir; anything after a tab (say, a dry run's destination) is ignored.
+        std::vector<std::filesystem::path> batch;
+        std::string line;
+        auto flush = [&]() {
+            succeeded = mover.organizePaths(batch) && succeeded;
+            batch.clear();
+        };
+        while (std::getline(std::cin, line)) {
+            line = line.substr(0, line.find('\t'));
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty()) {
+                continue;
+            }
+            const auto path = std::filesystem::u8path(line);
+            batch.push_back(path.is_absolute() ? path : (target / path).lexically_normal());
+            if (batch.size() >= kStdinBatchFiles) {
+                flush();
+            }
+        }
+        flush();
+    } else {
+        succeeded = mover.organizeOnce();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+
+    if (dryRun) {
+        // Grouped by device and then directory, the order in which executing the plan keeps each disk's writes together.
+        std::sort(plan.begin(), plan.end(), [](const PlannedMove& a, const PlannedMove& b) {
+            return std::tie(a.volume, a.destinationDir, a.file) < std::tie(b.volume, b.destinationDir, b.file);
+        });
+        for (const auto& move : plan) {
+            std::cout << move.file.u8string() << '\t' << move.destinationDir.u8string() << '\n';
+        }
+        std::cout.flush();
+        for (const auto& line : organizeSummary(true, elapsed, source->rules, tallies)) {
+            std::cerr << line << '\n';
+        }
+    } else {
+        for (const auto& line : organizeSummary(false, elapsed, source->rules, tallies)) {
+            Logger::info() << line;
+        }
+    }
+    return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+} // namespace
 
 #ifdef _WIN32
 #include <windows.h>
 
-#include <chrono>
+#include <memory>
 #include <string_view>
 
 namespace {
 constexpr wchar_t kStartupValueName[] = L"DownloadsJanitor";
 constexpr wchar_t kRunKeyPath[] = L"Software\\Microsoft\\Windows\\CurrentVersion\\Run";
 constexpr DWORD kWatchFilters = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_CREATION;
+// Room for a burst of FILE_NOTIFY_INFORMATION records per read.
+constexpr std::size_t kNotifyBufferSize = 64 * 1024;
 
 // Convert a Win32 error code into a trimmed UTF-8 description for logging.
 std::string formatWindowsError(DWORD code) {
@@ -72,14 +403,14 @@ std::filesystem::path getExecutablePath() {
 // Register the janitor to run at logon by writing to the user's Run registry key.
 bool registerForStartup(const std::wstring& commandLine) {
     if (commandLine.empty()) {
-        std::cerr << "Unable to register startup entry: command line is empty." << std::endl;
+        Logger::error() << "Unable to register startup entry: command line is empty.";
         return false;
     }
 
     HKEY runKey = nullptr;
     LONG status = RegOpenKeyExW(HKEY_CURRENT_USER, kRunKeyPath, 0, KEY_SET_VALUE, &runKey);
     if (status != ERROR_SUCCESS) {
-        std::cerr << "Failed to open startup registry key: " << formatWindowsError(status) << std::endl;
+        Logger::error() << "Failed to open startup registry key: " << formatWindowsError(status);
         return false;
     }
 
@@ -92,7 +423,7 @@ bool registerForStartup(const std::wstring& commandLine) {
     RegCloseKey(runKey);
 
     if (status != ERROR_SUCCESS) {
-        std::cerr << "Failed to register startup entry: " << formatWindowsError(status) << std::endl;
+        Logger::error() << "Failed to register startup entry: " << formatWindowsError(status);
         return false;
     }
 
@@ -108,53 +439,240 @@ bool registerForStartup(const std::wstring& commandLine) {
         commandUtf8 = "<unavailable>";
     }
 
-    std::cout << "Startup entry registered successfully: " << commandUtf8 << std::endl;
+    Logger::info() << "Startup entry registered successfully: " << commandUtf8;
     return true;
 }
 
-// Monitor the watch folder for changes and trigger the mover each time a notification arrives.
-bool watchForChanges(const std::filesystem::path& watchFolder, FileMover& mover) {
-    std::wstring watchFolderWide = watchFolder.wstring();
-    HANDLE changeHandle = FindFirstChangeNotificationW(watchFolderWide.c_str(), FALSE, kWatchFilters);
-    if (changeHandle == INVALID_HANDLE_VALUE) {
-        std::cerr << "Failed to start change notification: " << formatWindowsError(GetLastError()) << std::endl;
-        return false;
+// One ReadDirectoryChangesW subscription per watch folder, all waited on by the same loop.
+struct FolderSubscription {
+    WatchFolder folder;
+    HANDLE directory = INVALID_HANDLE_VALUE;
+    OVERLAPPED overlapped{};
+    // FILE_NOTIFY_INFORMATION records must be DWORD-aligned.
+    std::vector<DWORD> buffer = std::vector<DWORD>(kNotifyBufferSize / sizeof(DWORD));
+};
+
+bool armNotification(FolderSubscription& subscription) {
+    ResetEvent(subscription.overlapped.hEvent);
+    return ReadDirectoryChangesW(subscription.directory, subscription.buffer.data(),
+                                 static_cast<DWORD>(subscription.buffer.size() * sizeof(DWORD)),
+                                 subscription.folder.recursive ? TRUE : FALSE, kWatchFilters, nullptr, &subscription.overlapped,
+                                 nullptr) != 0;
+}
+
+void closeSubscription(FolderSubscription& subscription) {
+    // Wait for the cancelled read to finish before the buffer goes away.
+    DWORD ignored = 0;
+    CancelIo(subscription.directory);
+    GetOverlappedResult(subscription.directory, &subscription.overlapped, &ignored, TRUE);
+    CloseHandle(subscription.overlapped.hEvent);
+    CloseHandle(subscription.directory);
+}
+
+// Open the folder and start the first read; returns nullptr (after logging) when the folder can't be watched.
+std::unique_ptr<FolderSubscription> subscribe(const WatchFolder& folder) {
+    auto subscription = std::make_unique<FolderSubscription>();
+    subscription->folder = folder;
+    subscription->directory = CreateFileW(folder.path.wstring().c_str(),
+                                          FILE_LIST_DIRECTORY,
+                                          FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                          nullptr,
+                                          OPEN_EXISTING,
+                                          FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+                                          nullptr);
+    if (subscription->directory == INVALID_HANDLE_VALUE) {
+        Logger::error() << "Failed to open watch folder `" << folder.path.string() << "` for notifications: " << formatWindowsError(GetLastError());
+        return nullptr;
     }
 
-    std::cout << "Monitoring `" << watchFolder.string() << "` for changes..." << std::endl;
+    subscription->overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (subscription->overlapped.hEvent == nullptr) {
+        Logger::error() << "Failed to create notification event: " << formatWindowsError(GetLastError());
+        CloseHandle(subscription->directory);
+        return nullptr;
+    }
+
+    if (!armNotification(*subscription)) {
+        Logger::error() << "Failed to start change notification for `" << folder.path.string() << "`: " << formatWindowsError(GetLastError());
+        CloseHandle(subscription->overlapped.hEvent);
+        CloseHandle(subscription->directory);
+        return nullptr;
+    }
+
+    Logger::info() << "Monitoring `" << folder.path.string() << (folder.recursive ? "` and its subfolders" : "`") << " for changes...";
+    return subscription;
+}
+
+// Monitor every watch folder (and, for recursive ones, every folder below it) from one loop and hand each changed
+// file to the mover once it has been quiet for a while and its size and modification time have held still for
+// stablePeriod.
+bool watchForChanges(const std::vector<WatchFolder>& watchFolders, FileMover& mover, std::chrono::milliseconds stablePeriod) {
+    std::vector<std::unique_ptr<FolderSubscription>> subscriptions;
+    for (const auto& folder : watchFolders) {
+        if (subscriptions.size() == MAXIMUM_WAIT_OBJECTS) {
+            Logger::error() << "At most " << MAXIMUM_WAIT_OBJECTS << " watch folders are supported; not watching `" << folder.path.string() << "`.";
+            continue;
+        }
+        if (auto subscription = subscribe(folder)) {
+            subscriptions.push_back(std::move(subscription));
+        }
+    }
+
+    ChangeQueue pending(kQuietPeriod);
+    StabilityTracker stability(stablePeriod);
+    const auto isDestination = [&mover](const std::filesystem::path& folder) { return mover.isInsideDestination(folder); };
+    bool keepWatching = !subscriptions.empty();
+    std::vector<HANDLE> events;
 
-    bool keepWatching = true;
     while (keepWatching) {
-        DWORD waitStatus = WaitForSingleObject(changeHandle, INFINITE);
-        if (waitStatus == WAIT_OBJECT_0) {
-            if (!mover.organizeOnce()) {
-                std::cerr << "One or more files failed to move during processing." << std::endl;
+        // Sleep until the next notification, the oldest pending file has been quiet long enough, or the tracker
+        // is due to re-check a file.
+        DWORD timeout = INFINITE;
+        auto deadline = pending.nextDeadline();
+        if (const auto recheck = stability.nextDeadline(); recheck && (!deadline || *recheck < *deadline)) {
+            deadline = recheck;
+        }
+        if (deadline) {
+            const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(*deadline - ChangeQueue::Clock::now());
+            timeout = remaining.count() > 0 ? static_cast<DWORD>(remaining.count()) : 0;
+        }
+
+        events.clear();
+        for (const auto& subscription : subscriptions) {
+            events.push_back(subscription->overlapped.hEvent);
+        }
+
+        const DWORD waitStatus = WaitForMultipleObjects(static_cast<DWORD>(events.size()), events.data(), FALSE, timeout);
+        if (waitStatus >= WAIT_OBJECT_0 && waitStatus < WAIT_OBJECT_0 + events.size()) {
+            const std::size_t index = waitStatus - WAIT_OBJECT_0;
+            FolderSubscription& subscription = *subscriptions[index];
+            const WatchFolder& folder = subscription.folder;
+
+            bool folderFailed = false;
+            DWORD bytesReturned = 0;
+            if (!GetOverlappedResult(subscription.directory, &subscription.overlapped, &bytesReturned, FALSE)) {
+                Logger::error() << "Failed to read change notifications for `" << folder.path.string() << "`: " << formatWindowsError(GetLastError());
+                folderFailed = true;
+            } else if (bytesReturned == 0) {
+                // The notification buffer overflowed, so rescan; the tracker still holds back files being written.
+                Logger::warning() << "Change notification buffer overflowed; rescanning `" << folder.path.string() << "`.";
+                pending.clear();
+                stability.trackFolder(folder.path, ChangeQueue::Clock::now(), folder.recursive, isDestination);
+            } else {
+                const auto now = ChangeQueue::Clock::now();
+                const auto* cursor = reinterpret_cast<const BYTE*>(subscription.buffer.data());
+                while (true) {
+                    const auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(cursor);
+                    if (info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_MODIFIED ||
+                        info->Action == FILE_ACTION_RENAMED_NEW_NAME) {
+                        // Names are relative to the watch folder and include subfolders when watching recursively.
+                        const std::filesystem::path path =
+                            folder.path / std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR));
+                        std::error_code typeErr;
+                        if (folder.recursive && mover.isInsideDestination(path)) {
+                            // Our own moves into destinations below the watch folder; nothing to do.
+                        } else if (folder.recursive && std::filesystem::is_directory(path, typeErr)) {
+                            // A folder moved in raises one notification, not one per file inside it.
+                            if (info->Action != FILE_ACTION_MODIFIED) {
+                                stability.trackFolder(path, now, true, isDestination);
+                            }
+                        } else if (!StabilityTracker::isInProgressDownload(path)) {
+                            // Partial downloads are renamed to their real name when complete, which raises its own event.
+                            pending.touch(path, now);
+                        }
+                    }
+
+                    if (info->NextEntryOffset == 0) {
+                        break;
+                    }
+                    cursor += info->NextEntryOffset;
+                }
             }
 
-            // A brief delay keeps duplicate notifications from spinning the loop too quickly.
-            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            if (!folderFailed && !armNotification(subscription)) {
+                Logger::error() << "Failed to re-arm change notification for `" << folder.path.string() << "`: " << formatWindowsError(GetLastError());
+                folderFailed = true;
+            }
 
-            if (!FindNextChangeNotification(changeHandle)) {
-                std::cerr << "Failed to re-arm change notification: " << formatWindowsError(GetLastError()) << std::endl;
-                keepWatching = false;
+            // Losing one folder (e.g. a removed drive) shouldn't stop the others.
+            if (folderFailed) {
+                closeSubscription(subscription);
+                subscriptions.erase(subscriptions.begin() + static_cast<std::ptrdiff_t>(index));
+                if (subscriptions.empty()) {
+                    Logger::error() << "No folders left to watch.";
+                    keepWatching = false;
+                }
             }
         } else if (waitStatus == WAIT_FAILED) {
-            std::cerr << "WaitForSingleObject failed: " << formatWindowsError(GetLastError()) << std::endl;
+            Logger::error() << "WaitForMultipleObjects failed: " << formatWindowsError(GetLastError());
             keepWatching = false;
-        } else {
+        } else if (waitStatus != WAIT_TIMEOUT) {
             keepWatching = false;
         }
+
+        const auto now = ChangeQueue::Clock::now();
+        std::vector<ChangeQueue::Clock::time_point> firstSeen;
+        const auto ready = pending.takeReady(now, &firstSeen);
+        for (std::size_t index = 0; index < ready.size(); ++index) {
+            stability.track(ready[index], now, firstSeen[index]);
+        }
+
+        // Hand off without waiting so new notifications keep flowing while the workers move files.
+        std::vector<ChangeQueue::Clock::time_point> arrivals;
+        std::vector<FileStat> stats;
+        const auto stable = stability.advance(now, &arrivals, &stats);
+        if (!stable.empty()) {
+            mover.submitPaths(stable, arrivals, stats);
+        }
+        Metrics::set(Metrics::Gauge::PendingEvents, static_cast<std::int64_t>(pending.size()));
+        Metrics::set(Metrics::Gauge::StabilityTracked, static_cast<std::int64_t>(stability.size()));
     }
 
-    FindCloseChangeNotification(changeHandle);
+    for (auto& subscription : subscriptions) {
+        closeSubscription(*subscription);
+    }
     return keepWatching;
 }
 } // namespace
-#endif // _WIN32
+#elif defined(__linux__)
+#include "InotifyWatcher.hpp"
 
-int main() {
-#ifndef _WIN32
-    std::cerr << "DownloadsJanitor currently supports Windows only." << std::endl;
+namespace {
+// Return the absolute path for the currently running executable, or empty on failure.
+std::filesystem::path getExecutablePath() {
+    std::error_code ec;
+    std::filesystem::path executable = std::filesystem::read_symlink("/proc/self/exe", ec);
+    return ec ? std::filesystem::path{} : executable;
+}
+
+// Monitor every watch folder through inotify/fanotify from one loop until the process is asked to stop.
+bool watchForChanges(const std::vector<WatchFolder>& watchFolders, FileMover& mover, std::chrono::milliseconds stablePeriod) {
+    InotifyWatcher watcher(mover, kQuietPeriod, stablePeriod);
+    if (!watcher.open()) {
+        return false;
+    }
+
+    // A folder that can't be watched is reported by addWatch(); keep going with the rest.
+    bool watchingAny = false;
+    for (const auto& folder : watchFolders) {
+        watchingAny = watcher.addWatch(folder.path, folder.recursive) || watchingAny;
+    }
+    if (!watchingAny) {
+        return false;
+    }
+
+    watcher.watchDestinations();
+
+    return watcher.run();
+}
+} // namespace
+#endif
+
+int main(int argc, char* argv[]) {
+#if !defined(_WIN32) && !defined(__linux__)
+    (void)argc;
+    (void)argv;
+    Logger::error() << "DownloadsJanitor currently supports Windows and Linux only.";
     return EXIT_FAILURE;
 #else
     // Use the executable location so the janitor can ship a bundled config folder.
@@ -162,29 +680,90 @@ int main() {
     const std::filesystem::path configRoot =
         executablePath.empty() ? std::filesystem::current_path() : executablePath.parent_path();
 
+    // One-off commands run in the foreground, logging synchronously, and leave Ctrl+C working.
+    const std::vector<std::string> args(argv + 1, argv + argc);
+    if (!args.empty()) {
+        if (args.front() == "undo") {
+            return runUndo(configRoot, std::vector<std::string>(args.begin() + 1, args.end()));
+        }
+        if (args.front() == "--organize") {
+            return runOrganize(configRoot, std::vector<std::string>(args.begin() + 1, args.end()));
+        }
+        printUsage();
+        return kExitUsage;
+    }
+
+#ifdef __linux__
+    // Must happen before any thread starts (the log flusher, the move workers) so they inherit the blocked mask.
+    InotifyWatcher::blockShutdownSignals();
+#endif
+    // Declared before everything that logs so it outlives, and flushes after, all of it.
+    Logger::Scope logging;
+
     ConfigParser parser;
     if (!parser.load(configRoot.string())) {
-        std::cerr << "Failed to load configuration. Exiting." << std::endl;
-        return EXIT_FAILURE;
+        Logger::error() << "Failed to load configuration. Exiting.";
+        return kExitUsage;
     }
+    Logger::setLevel(parser.getLogSettings().level);
+    Logger::setFormat(parser.getLogSettings().format);
 
-    const std::string watchFolderStr = parser.getWatchFolder();
-    if (watchFolderStr.empty()) {
-        std::cerr << "Watch folder is not configured. Exiting." << std::endl;
-        return EXIT_FAILURE;
+    std::vector<WatchFolder> watchFolders = parser.getWatchFolders();
+    if (watchFolders.empty()) {
+        Logger::error() << "Watch folder is not configured. Exiting.";
+        return kExitUsage;
+    }
+
+    const bool anyRules = std::any_of(watchFolders.begin(), watchFolders.end(), [](const WatchFolder& folder) { return !folder.rules.empty(); });
+    if (!anyRules) {
+        Logger::warning() << "No rules loaded; the janitor will not move files until rules are provided.";
     }
 
-    std::filesystem::path watchFolder(watchFolderStr);
-    std::vector<Rule> rules = parser.getRules();
-    if (rules.empty()) {
-        std::cerr << "No rules loaded; the janitor will not move files until rules are provided." << std::endl;
+    // Settle whatever a crash interrupted before anything new is moved. Declared before the mover, which writes to it.
+    MoveJournal journal(MoveJournal::pathFor(ConfigParser::rulesPathFor(configRoot.string())));
+    const bool journaling = journal.open();
+    // Lets the startup sweep skip directories an earlier one settled, e.g. when restarted halfway through a backlog.
+    SweepCheckpoint checkpoint(SweepCheckpoint::pathFor(ConfigParser::rulesPathFor(configRoot.string())));
+    // Content hashes of destination files, kept across runs; opened even with `dedup` off so a reload can turn it on.
+    DuplicateIndex duplicates(DuplicateIndex::pathFor(ConfigParser::rulesPathFor(configRoot.string())));
+    // Everything placed so far, for `retention`; kept even without policies so adding one later covers older files.
+    RetentionIndex retention(RetentionIndex::pathFor(ConfigParser::rulesPathFor(configRoot.string())));
+
+    FileMover mover(watchFolders, parser.getWorkerThreads(), parser.compiledRules());
+    mover.setContentSniffing(parser.getSniffContent());
+    mover.setIoSettings(parser.getIoSettings());
+    if (journaling) {
+        mover.setJournal(&journal);
+    }
+    mover.setCheckpoint(&checkpoint);
+    if (duplicates.open()) {
+        mover.setDuplicateIndex(&duplicates);
+    }
+    mover.setDedupAction(parser.getDedupAction());
+    if (retention.open()) {
+        mover.setRetentionIndex(&retention);
+    }
+    mover.setRetentionPolicies(parser.getRetentionPolicies());
+    retention.start();
+    // Save what this start had to parse and compile so the next one with the same rules.json can skip it.
+    if (!parser.loadedFromCache() && !parser.storeCache(mover.serializeRules())) {
+        Logger::warning() << "Startup will keep parsing rules.json until the rule cache can be written.";
     }
 
-    FileMover mover(watchFolder, std::move(rules));
+    // Apply rules.json edits without a restart. Declared after the mover so it stops before the mover goes away.
+    ConfigReloader reloader(configRoot, mover);
+    reloader.start();
 
+    // Settings are read once; changing `metrics` takes a restart.
+    MetricsExporter metricsExporter(parser.getMetricsSettings());
+    if (parser.getMetricsSettings().enabled()) {
+        metricsExporter.start();
+    }
+
+#ifdef _WIN32
     std::wstring startupCommand;
     if (executablePath.empty()) {
-        std::cerr << "Executable path is empty; cannot configure startup." << std::endl;
+        Logger::warning() << "Executable path is empty; cannot configure startup.";
     } else {
         // Prefer the companion VBScript so the janitor starts hidden, but fall back to the exe.
         std::error_code scriptExistsErr;
@@ -193,14 +772,13 @@ int main() {
 
         if (std::filesystem::exists(scriptPath, scriptExistsErr) && !scriptExistsErr) {
             startupCommand = L"wscript.exe \"" + scriptPath.wstring() + L"\"";
-            std::cout << "Configuring startup to run via script: " << scriptPath.string() << std::endl;
+            Logger::info() << "Configuring startup to run via script: " << scriptPath.string();
         } else {
             if (scriptExistsErr) {
-                std::cerr << "Unable to validate hidden launcher script: " << scriptExistsErr.message()
-                          << ". Falling back to launching the executable directly." << std::endl;
+                Logger::warning() << "Unable to validate hidden launcher script: " << scriptExistsErr.message()
+                                  << ". Falling back to launching the executable directly.";
             } else {
-                std::cout << "Hidden launcher script not found; falling back to launching the executable directly."
-                          << std::endl;
+                Logger::info() << "Hidden launcher script not found; falling back to launching the executable directly.";
             }
             startupCommand = L"\"" + executablePath.wstring() + L"\"";
         }
@@ -209,15 +787,18 @@ int main() {
     if (!startupCommand.empty()) {
         registerForStartup(startupCommand);
     } else {
-        std::cerr << "Startup registration skipped because the command line could not be determined." << std::endl;
+        Logger::warning() << "Startup registration skipped because the command line could not be determined.";
     }
+#endif
 
-    std::cout << "Running DownloadsJanitor once on startup..." << std::endl;
+    Logger::info() << "Running DownloadsJanitor once on startup...";
     // Process any new arrivals before entering the long-running watcher loop.
     mover.organizeOnce();
 
-    if (!watchForChanges(watchFolder, mover)) {
-        std::cerr << "File monitoring stopped unexpectedly." << std::endl;
+    const bool watchedCleanly = watchForChanges(watchFolders, mover, parser.getStabilityPeriod());
+    Logger::info() << "Destination directory cache skipped " << mover.directoryChecksSaved() << " directory check(s).";
+    if (!watchedCleanly) {
+        Logger::error() << "File monitoring stopped unexpectedly.";
         return EXIT_FAILURE;
     }
 